@@ -30,8 +30,14 @@
 int resolve_mac(struct sockaddr *, struct ifdata *, uchar *, int);
 int get_mask(struct sockaddr *);
 
+/* デフォルトGWの検索用(familyのみ)とGWのアドレス */
+static struct sockaddr_storage gw_dst_v4, gw_dst_v6;
+static struct sockaddr_storage gw_ip_v4, gw_ip_v6;
+
 /*
     @brief デフォルトGWのMACアドレスを取得
+    初回(メインスレッド)にMAC解決の要求先を登録し、以降はネイバーの変更が
+    gw_mac_v4, gw_mac_v6 へ反映される
     @param ifdata インターフェース情報
     @param v4 ipv4指定
     @param v6 ipv6指定
@@ -39,19 +45,23 @@ int get_mask(struct sockaddr *);
 void
 get_default_gw(struct ifdata *ifdata, int v4, int v6)
 {
-    struct sockaddr_storage ip;
-    
-    memset(&ip, 0, sizeof(ip));
-    
     if (v4) {
-        ip.ss_family = AF_INET; 
-        gw_mac_v4_valid = resolve_mac((struct sockaddr*)&ip, 
-            ifdata, gw_mac_v4, 1);
+        if (gw_nh_v4.addr == NULL) {
+            gw_dst_v4.ss_family = AF_INET; 
+            (void)nh_init(&gw_nh_v4, (struct sockaddr*)&gw_dst_v4,
+                (struct sockaddr*)&gw_ip_v4, gw_mac_v4, &gw_mac_v4_valid,
+                ifdata, 1);
+        }
+        gw_mac_v4_valid = nh_resolve(&gw_nh_v4);
     } 
     if (v6) {
-        ip.ss_family = AF_INET6;
-        gw_mac_v6_valid = resolve_mac((struct sockaddr*)&ip, 
-            ifdata, gw_mac_v6, 1);
+        if (gw_nh_v6.addr == NULL) {
+            gw_dst_v6.ss_family = AF_INET6;
+            (void)nh_init(&gw_nh_v6, (struct sockaddr*)&gw_dst_v6,
+                (struct sockaddr*)&gw_ip_v6, gw_mac_v6, &gw_mac_v6_valid,
+                ifdata, 1);
+        }
+        gw_mac_v6_valid = nh_resolve(&gw_nh_v6);
     }
 }
 
@@ -73,6 +83,9 @@ get_svr_info(void)
         svr_info.stat = resolve_mac(
                 (struct sockaddr*)&svr_info.svr_ip4,
                 if_egress, svr_info.svr_mac, 0); 
+        (void)nh_init(&svr_info.nh4, (struct sockaddr*)&svr_info.svr_ip4,
+                (struct sockaddr*)&svr_info.gw4, svr_info.svr_mac,
+                &svr_info.stat, if_egress, 0);
 
         svr_info.checksum_delta = calc_chksum_delta(&if_ingress->vip4, 
             &svr_info.svr_ip4.sin_addr);
@@ -91,6 +104,9 @@ get_svr_info(void)
                 (struct sockaddr*)&svr_info.svr_ip6,
                 if_egress, svr_info.svr_mac, 0);
         }
+        (void)nh_init(&svr_info.nh6, (struct sockaddr*)&svr_info.svr_ip6,
+                (struct sockaddr*)&svr_info.gw6, svr_info.svr_mac,
+                &svr_info.stat, if_egress, 0);
     } else {
         evtlog("gft1", 0, 0, NULL); 
     }
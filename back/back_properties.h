@@ -17,6 +17,7 @@
 #define KEY_EGRESS_IP6      "eg.ip6"
 #define KEY_SVR_IP4         "svr.ip4"
 #define KEY_SVR_IP6         "svr.ip6"
+#define KEY_PROXY_TTL       "proxy.ttl"
 
 #ifdef VAL_SUBS
 prop_db_t prop_db_backend[] = { 
@@ -30,6 +31,23 @@ prop_db_t prop_db_backend[] = {
     {"eg.ip6",    "::"},
     {"svr.ip4",   "0.0.0,0"},
     {"svr.ip6",   "::"},
+    {"rx_ring",   "0"},
+    {"tx_mode",   "1"},
+    {"io_mode",   "0"},
+    {"rx_filter", "1"},
+    {"sched.fifo", "0"},
+    {"hugepage", "1"},
+    {"mlock",    "1"},
+    {"rx.poll",  "0"},
+    {"rx.busy_poll", "50"},
+    {"rx.poll_idle", "200"},
+    {"vnet_hdr", "0"},
+    {"in.vlan",  ""},
+    {"shm_stat.interval", "1000"},
+    {"latency.sample", "0"},
+    {"prof",     "0"},
+    {"rx.stat_interval", "1000"},
+    {"proxy.ttl", "30"},
 
     /*==============================================================*
      *    table end.
@@ -29,8 +29,12 @@
 
 #include "checksum.h"
 #include "client_tbl.h"
+#include "pktio.h"
+#include "hugemem.h"
+#include "rxpoll.h"
+#include "latency.h"
+#include "prof.h"
 
-#define DATABUF_SIZE 1520
 #define MAX_RECV 128 
 
 /* 
@@ -40,6 +44,21 @@
 static struct ifdata if_in;
 static struct ifdata if_eg;
 
+/* 送信キュー(in:サーバ側への送信, eg:クライアント側への送信) */
+static struct tx_queue txq_in;
+static struct tx_queue txq_eg;
+
+/* 受信ソケット(インターフェース情報の再読み込み時に受信フィルタを再設定) */
+static int rx_fd_in;
+static int rx_fd_eg;
+
+/* 受信中フレームのクライアント側セグメント(VLAN、入力側スレッドのみ参照) */
+static struct ifdata *seg_in;
+
+/* 滞留時間の計測(in:入力側スレッド, eg:サーバ側スレッド) */
+static struct latency lat_in;
+static struct latency lat_eg;
+
 /* prototype */
 static void proc_ingress_data(unsigned char *buf, int);
 static void proc_egress_data(unsigned char *buf, int);
@@ -49,6 +68,16 @@ static void proc_v4_eg_vip(struct ethhdr *eth, struct ip *, int);
 static void proc_v6_eg_vip(struct ethhdr *eth, struct ip6_hdr *, int);
 static void proc_v4_eg_novip(struct ethhdr *eth, struct ip *, int);
 static void proc_v6_eg_novip(struct ethhdr *eth, struct ip6_hdr *, int);
+static inline void send_flush_in(void);
+static int recv_xsk(struct xsk *, void (*)(unsigned char *, int), int);
+static void open_xsk(void);
+static inline int xsk_timeout(struct xsk *);
+static unsigned char *init_rx_buffer(struct ifdata *, int, int *, int *);
+static inline void send_flush_eg(void);
+static inline void send_frame_in(struct ethhdr *, int);
+static inline void send_frame_eg(struct ethhdr *, int);
+static inline struct ethhdr *vlan_tag_eg(struct ethhdr *,
+    struct vlan_info *, int, int *);
 
 void *back_ingress(void *arg);
 void *back_egress(void *arg);
@@ -90,9 +119,6 @@ int main(int argc, char *argv[])
     mlog_init();
     evtlog_init();
 
-    /* クライアント情報テーブル初期化 */
-    init_client_table();
-
     memset(&if_in, 0, sizeof(if_in));
     memset(&if_eg, 0, sizeof(if_eg));
 
@@ -102,6 +128,18 @@ int main(int argc, char *argv[])
     /* 設定ファイル読み出し */
     anycast_prop_init();
 
+    /* クライアント情報テーブル初期化(hugepageの設定を参照する) */
+    init_client_table();
+
+    /* 振り分けスレッドが参照する静的領域を常駐させる */
+    huge_lock(&client_info, sizeof(client_info), "client info");
+    huge_lock(sstat_blk, sizeof(sstat_blk), "stat");
+    huge_lock(mlog_data, sizeof(mlog_data), "mlog");
+    huge_lock(evtlog_data, sizeof(evtlog_data), "evtlog");
+
+    /* ネイバー、経路テーブルのミラー(失敗時は都度検索する) */
+    (void)rt_mirror_start();
+
     /* インターフェース情報読み込み */
     get_interface_info(&if_in, &if_eg);
 
@@ -123,6 +161,15 @@ int main(int argc, char *argv[])
     get_default_gw(if_ingress, if_ingress->v4_enable,
         if_ingress->v6_enable);
 
+    /* MAC解決スレッド起動 */
+    if (resolver_start() < 0) {
+        return -1;
+    }
+    proxy_cache_init();
+
+    /* AF_XDPソケット(両スレッドの起動前にUMEMを共有して生成する) */
+    open_xsk();
+
     /* スレッド同期変数初期化 */
     sync_init((volatile int*)flag, THREAD_NUM);
 
@@ -141,6 +188,9 @@ int main(int argc, char *argv[])
     /* スレッド同期 */
     wait_thread((volatile int*)flag, THREAD_NUM);
 
+    /* コマンド処理(スレッド生成後に固定し、他のスレッドへ継承しない) */
+    (void)thread_placement("command", KEY_CPU_CMD, -1, 0);
+
     /* コマンド待ち受け処理へ */
     if (command_proc() < 0) {
         return -1;
@@ -155,19 +205,34 @@ int main(int argc, char *argv[])
 void * 
 back_ingress(void *arg)
 {
-    static unsigned char databuff[DATABUF_SIZE];
-    int fd;
+    unsigned char *buf;
+    struct rx_poll rp;
+    int fd, xfd, ret, size, hdr;
 
     pthread_detach(pthread_self());
 
+    /* CPU固定(以降の確保はスレッドのNUMAノード) */
+    numa_move(&sstat_blk[1], sizeof(sstat_blk[1]),
+        thread_placement("ingress", KEY_CPU_NET, 1, 1));
+
     /* ソケット初期化 */
-    if (init_socket_if(if_ingress, 0, &fd) != 0) {
+    if (init_socket_if(if_ingress, 0, &fd, NULL) != 0) {
         exit(1);
     }
+    rx_fd_in = fd;
 
     signal_block();
 
-    if_ingress->sockfd = fd;
+    buf = init_rx_buffer(if_ingress, fd, &size, &hdr);
+    xfd = (if_ingress->xsk) ? if_ingress->xsk->fd : -1;
+    SASAT_STAT_THREAD(1);
+    if (rx_poll_init(&rp, fd, xfd, rx_spin_in, rx_sleep_in,
+            rx_kernel_in) != 0) {
+        exit(1);
+    }
+    tx_queue_init(&txq_in, if_egress);
+    (void)lat_init(&lat_in, 1, lat_samples_in, fd);
+    prof_init(1);
 
     /* 起動をメインスレッドへ通知 */
     sync_thread((volatile int*)arg);
@@ -176,20 +241,50 @@ back_ingress(void *arg)
         書き換え処理
     */
     for ( ;; ) {
-        fd_set fds;
-        int ret, len, i;
+        int len, i, n;
+        uint16_t vid = 0;
+        struct timespec *ts;
 
-        FD_ZERO(&fds);
-        FD_SET(fd, &fds);
-
-        /* 待ち受け */
-        ret = select(fd + 1, &fds, NULL, NULL, NULL);
+        /* 待ち受け(busy poll中はすぐに戻る) */
+        ret = rx_poll_wait(&rp, xsk_timeout(if_egress->xsk));
  
-        if (likely(ret != 0)) {
+        if (unlikely(ret == 0)) {
+            /* 送信完了の回収(受信用フレームを戻す) */
+            send_flush_in();
+        } else {
+            n = 0;
+            if (xfd >= 0) {
+                /* XDPで転送するのはタグ無しのフレームのみ */
+                seg_in = if_ingress;
+                n = recv_xsk(if_ingress->xsk, proc_ingress_data,
+                    rx_drop_short_in);
+            }
             for (i = 0; i < MAX_RECV; i++) {
-                if ((len = recv(fd, databuff, DATABUF_SIZE, 0)) > 0) {
-                    if (likely(len > sizeof(struct ethhdr))) {
-                        proc_ingress_data(databuff, len);
+                PROF_START();
+                ts = lat_pick(&lat_in) ? &lat_in.rx : NULL;
+                if (VLAN_INFO()->num || ts) {
+                    len = recv_vlan(fd, buf, size, &vid, ts);
+                } else {
+                    len = recv(fd, buf, size, MSG_TRUNC);
+                }
+                if (len > 0) {
+                    PROF(PROF_RECV);
+                    if (unlikely(len > size)) {
+                        SASAT_STAT(rx_drop_oversize_in);
+                    } else if (likely(len > (int)(hdr + sizeof(struct ethhdr)))) {
+                        if (hdr && vnet_gso(buf)) {
+                            SASAT_STAT(rx_gro_in);
+                        }
+                        seg_in = if_ingress;
+                        if (unlikely(vid != 0)) {
+                            seg_in = vlan_lookup(VLAN_INFO(), vid, if_ingress);
+                            if (seg_in == NULL) {
+                                SASAT_STAT(rx_drop_vlan_in);
+                                continue;
+                            }
+                            SASAT_STAT(rx_packet_vlan_in);
+                        }
+                        proc_ingress_data(buf + hdr, len - hdr);
                     } else {
                         SASAT_STAT(rx_drop_short_in);
                     }
@@ -197,6 +292,9 @@ back_ingress(void *arg)
                     break;
                 }
             }
+            lat_end(&lat_in);
+            rx_poll_done(&rp, n + i);
+            send_flush_in();
         }
     }
     return NULL;
@@ -204,6 +302,7 @@ back_ingress(void *arg)
 
 /*
     @brief IPパケットのみ振り分け その他は破棄
+    VIPの判定とARP/ND応答は受信したセグメント(seg_in)で行う
     @param buf
     @param len
 */
@@ -217,10 +316,11 @@ proc_ingress_data(unsigned char *buf, int len)
         /* 送信元が自MACアドレスの場合処理しない（他プロセス送信）*/
         return;
     }
+    SASAT_STAT_ADD(rx_bytes_in, len);
     if (unlikely(is_multicast(eth->h_dest))) {
         /* multicast(bcast)の場合、arp要求/NS処理を行う */
         SASAT_STAT(rx_packet_mc_in);
-        mac_resolve(eth, prot, if_ingress, len);
+        mac_resolve(eth, prot, seg_in, len);
     } else if (prot == ETH_P_IP) {
         /* IPv4 */
         SASAT_STAT(rx_packet_v4_in);
@@ -239,7 +339,7 @@ proc_ingress_data(unsigned char *buf, int len)
                     ((icmp6h = get_icmp6_ns(ip6h, len)) != NULL))) {
                 if (vip_mode) {
                     /* unicastのNS処理 */
-                    mac_resolve_uc6(eth, ip6h, icmp6h, if_ingress, len);
+                    mac_resolve_uc6(eth, ip6h, icmp6h, seg_in, len);
                 }
             } else {
                 proc_v6_in(eth, ip6h, len);
@@ -249,8 +349,8 @@ proc_ingress_data(unsigned char *buf, int len)
         }
     } else if (prot == ETH_P_ARP) {
         /* unicast arp request応答 */
-        if (if_ingress->v4_enable) {
-            if (arp_reply(eth, if_ingress)) {
+        if (seg_in->v4_enable) {
+            if (arp_reply(eth, seg_in)) {
                 SASAT_STAT(tx_arp_reply_in);
             }
         }
@@ -268,30 +368,29 @@ proc_v4_in(struct ethhdr *eth, struct ip *ip, int len)
 {
     evtlog("pri4", len, 0, (uchar*)eth);
 
-    if (unlikely(cmp_ipv4(&ip->ip_dst, &if_ingress->vip4) != 0)) {
+    if (unlikely(cmp_ipv4(&ip->ip_dst, &seg_in->vip4) != 0)) {
         /* 宛先 */
         SASAT_STAT(rx_drop_addr_v4_in);
         return;
     }
+    PROF(PROF_CLASSIFY);
 
     get_ci_up4(&ip->ip_src);
+    PROF(PROF_LOOKUP);
  
-    if (unlikely(svr_info.stat == SVR_INIT)) {
-        /* serverのMACアドレスが不明の場合、解決する */
-        if (resolve_mac((struct sockaddr*)&svr_info.svr_ip4,
-                if_egress, svr_info.svr_mac, 0) == 0) {
-            SASAT_STAT(rx_drop_in);
-            return;
-        }
-        svr_info.stat = SVR_OK;
-    }
-
-    copy_mac(eth->h_dest, svr_info.svr_mac);
     ip->ip_dst = svr_info.svr_ip4.sin_addr;
-    ip->ip_sum = htons(add16forCheckSum(ntohs(ip->ip_sum),
+    ip->ip_sum = htons(rewrite_ip_sum(seg_in, ntohs(ip->ip_sum),
         svr_info.checksum_delta));
 
-    write(if_egress->sockfd , eth, len);
+    if (unlikely(svr_info.stat == SVR_INIT)) {
+        /* serverのMACアドレスが不明の場合、解決するまで保留する */
+        nh_hold(&svr_info.nh4, eth, len);
+        return;
+    }
+    load_mac(eth->h_dest, svr_info.svr_mac);
+    PROF(PROF_REWRITE);
+
+    send_frame_in(eth, len);
 
     SASAT_STAT(tx_packet_v4_in);
 }
@@ -302,28 +401,30 @@ proc_v4_in(struct ethhdr *eth, struct ip *ip, int len)
 static void
 proc_v6_in(struct ethhdr *eth, struct ip6_hdr *ip, int len)
 {
+    struct in6_addr vip6;
+
     evtlog("prc6", len, 0, (uchar*)eth);
 
-    if (unlikely(cmp_ipv6(&ip->ip6_dst, &if_ingress->vip6) != 0)) {
+    load_vip6(seg_in, &vip6);
+    if (unlikely(cmp_ipv6(&ip->ip6_dst, &vip6) != 0)) {
         SASAT_STAT(rx_drop_addr_v6_in);
         return;
     }
+    PROF(PROF_CLASSIFY);
 
     get_ci_up6(&ip->ip6_src);
+    PROF(PROF_LOOKUP);
  
+    ip->ip6_dst = svr_info.svr_ip6.sin6_addr;
+
     if (unlikely(svr_info.stat == SVR_INIT)) {
-        if (resolve_mac((struct sockaddr*)&svr_info.svr_ip6,
-                if_egress, svr_info.svr_mac, 0) == 0) {
-            SASAT_STAT(rx_drop_in);
-            return;
-        }
-        svr_info.stat = SVR_OK;
+        nh_hold(&svr_info.nh6, eth, len);
+        return;
     }
+    load_mac(eth->h_dest, svr_info.svr_mac);
+    PROF(PROF_REWRITE);
 
-    copy_mac(eth->h_dest, svr_info.svr_mac);
-    ip->ip6_dst = svr_info.svr_ip6.sin6_addr;
-
-    write(if_egress->sockfd, eth, len);
+    send_frame_in(eth, len);
 
     SASAT_STAT(tx_packet_v6_in);
 }
@@ -345,19 +446,33 @@ static void (*proc_v6_eg)(struct ethhdr*, struct ip6_hdr*, int);
 void *
 back_egress(void *arg)
 {
-    static unsigned char databuff[DATABUF_SIZE];
-    int fd;
+    unsigned char *buf;
+    struct rx_poll rp;
+    int fd, xfd, ret, size, hdr;
 
     pthread_detach(pthread_self());
 
+    numa_move(&sstat_blk[0], sizeof(sstat_blk[0]),
+        thread_placement("egress", KEY_CPU_NET, 0, 1));
+
     /* ソケット初期化 */
-    if (init_socket_if(if_egress, 1, &fd) != 0) {
+    if (init_socket_if(if_egress, 1, &fd, NULL) != 0) {
         exit(1);
     }
+    rx_fd_eg = fd;
 
     signal_block();
 
-    if_egress->sockfd = fd;
+    buf = init_rx_buffer(if_egress, fd, &size, &hdr);
+    xfd = (if_egress->xsk) ? if_egress->xsk->fd : -1;
+    SASAT_STAT_THREAD(0);
+    if (rx_poll_init(&rp, fd, xfd, rx_spin_eg, rx_sleep_eg,
+            rx_kernel_eg) != 0) {
+        exit(1);
+    }
+    tx_queue_init(&txq_eg, if_ingress);
+    (void)lat_init(&lat_eg, 0, lat_samples_eg, fd);
+    prof_init(0);
 
     proc_v4_eg = v4_eg_list[vip_mode];
     proc_v6_eg = v6_eg_list[vip_mode];
@@ -369,20 +484,37 @@ back_egress(void *arg)
         書き換え処理
     */
     for ( ;; ) {
-        fd_set fds;
-        int ret, len, i;
+        int len, i, n;
+        uint16_t vid;
+        struct timespec *ts;
 
-        FD_ZERO(&fds);
-        FD_SET(fd, &fds);
+        /* 待ち受け(busy poll中はすぐに戻る) */
+        ret = rx_poll_wait(&rp, xsk_timeout(if_ingress->xsk));
 
-        /* 待ち受け */
-        ret = select(fd + 1, &fds, NULL, NULL, NULL);
-
-        if (likely(ret != 0)) {
+        if (unlikely(ret == 0)) {
+            send_flush_eg();
+        } else {
+            n = 0;
+            if (xfd >= 0) {
+                n = recv_xsk(if_egress->xsk, proc_egress_data,
+                    rx_drop_short_eg);
+            }
             for (i = 0; i < MAX_RECV; i++) {
-                if ((len = recv(fd, databuff, DATABUF_SIZE, 0)) > 0) {
-                    if (likely(len > sizeof(struct ethhdr))) {
-                        proc_egress_data(databuff, len);
+                PROF_START();
+                if ((ts = lat_pick(&lat_eg) ? &lat_eg.rx : NULL) != NULL) {
+                    len = recv_vlan(fd, buf, size, &vid, ts);
+                } else {
+                    len = recv(fd, buf, size, MSG_TRUNC);
+                }
+                if (len > 0) {
+                    PROF(PROF_RECV);
+                    if (unlikely(len > size)) {
+                        SASAT_STAT(rx_drop_oversize_eg);
+                    } else if (likely(len > (int)(hdr + sizeof(struct ethhdr)))) {
+                        if (hdr && vnet_gso(buf)) {
+                            SASAT_STAT(rx_gro_eg);
+                        }
+                        proc_egress_data(buf + hdr, len - hdr);
                     } else {
                         SASAT_STAT(rx_drop_short_eg);
                     }
@@ -390,6 +522,9 @@ back_egress(void *arg)
                     break;
                 }
             }
+            lat_end(&lat_eg);
+            rx_poll_done(&rp, n + i);
+            send_flush_eg();
         }
     }
     return NULL;
@@ -398,6 +533,7 @@ back_egress(void *arg)
 /*
     @brief IPパケットのみ振り分け
     その他は破棄
+    送信元がVLANのVIPの場合はタグを付けてクライアント側へ送信する
 */
 static void
 proc_egress_data(unsigned char *buf, int len)
@@ -408,6 +544,7 @@ proc_egress_data(unsigned char *buf, int len)
     if (unlikely(cmp_mac(eth->h_source, if_egress->mac) == 0)) {
         return;
     } 
+    SASAT_STAT_ADD(rx_bytes_eg, len);
     if (unlikely(is_multicast(eth->h_dest))) {
         SASAT_STAT(rx_packet_mc_eg);
         mac_resolve_egress(eth, prot, len);
@@ -415,7 +552,13 @@ proc_egress_data(unsigned char *buf, int len)
         /* IPv4 */
         SASAT_STAT(rx_packet_v4_eg);
         if (likely(len >= (sizeof(struct ethhdr) + sizeof(struct ip)))) {
-            proc_v4_eg(eth, (struct ip*)(eth+1), len);
+            struct ip *ip = (struct ip*)(eth+1);
+            struct vlan_info *v = VLAN_INFO();
+            if (unlikely(v->num)) {
+                eth = vlan_tag_eg(eth, v, vlan_by_vip4(v, &ip->ip_src),
+                    &len);
+            }
+            proc_v4_eg(eth, ip, len);
         }else {
             SASAT_STAT(rx_drop_short_eg);
         }
@@ -429,6 +572,11 @@ proc_egress_data(unsigned char *buf, int len)
                     ((icmp6h = get_icmp6_ns(ip6h, len)) != NULL)) {
                 mac_resolve_uc6_egress(eth, ip6h, icmp6h, len);
             } else {
+                struct vlan_info *v = VLAN_INFO();
+                if (unlikely(v->num)) {
+                    eth = vlan_tag_eg(eth, v,
+                        vlan_by_vip6(v, &ip6h->ip6_src), &len);
+                }
                 proc_v6_eg(eth, ip6h, len);
             }
         } else {
@@ -452,10 +600,12 @@ static void
 proc_v4_eg_vip(struct ethhdr *eth, struct ip *ip, int len)
 {
     evtlog("pre4", len, 0, (uchar*)eth);
+    PROF(PROF_CLASSIFY);
 
     (void)get_ci_dwn4(&ip->ip_dst);
+    PROF(PROF_LOOKUP);
 
-    write(if_ingress->sockfd, eth, len);
+    send_frame_eg(eth, len);
 
     SASAT_STAT(tx_packet_v4_eg);
 }
@@ -467,21 +617,16 @@ static void
 proc_v6_eg_vip(struct ethhdr *eth, struct ip6_hdr *ip, int len)
 {
     evtlog("pre6", len, 0, (uchar*)eth);
+    PROF(PROF_CLASSIFY);
 
     (void)get_ci_dwn6(&ip->ip6_dst);
+    PROF(PROF_LOOKUP);
 
-    write(if_ingress->sockfd, eth, len);
+    send_frame_eg(eth, len);
 
     SASAT_STAT(tx_packet_v6_eg);
 }
 
-static inline int
-get_gw_mac4(void)
-{
-    get_default_gw(if_ingress, 1, 0);
-    return gw_mac_v4_valid;
-}
-
 /*
     @brief ipv4処理（非仮想IPモーﾄﾞ)
 */
@@ -489,29 +634,28 @@ static void
 proc_v4_eg_novip(struct ethhdr *eth, struct ip *ip, int len)
 {
     evtlog("prn4", len, 0, (uchar*)eth);
+    PROF(PROF_CLASSIFY);
 
     (void)get_ci_dwn4(&ip->ip_dst);
+    PROF(PROF_LOOKUP);
 
     if (cmp_mac(eth->h_dest, if_egress->mac) == 0) {
-        if (unlikely(!gw_mac_v4_valid && (get_gw_mac4() == 0))) {
-            SASAT_STAT(tx_drop_mac4);
+        if (unlikely(!gw_mac_v4_valid)) {
+            /* GWのMACが解決するまで保留する */
+            if (nh_hold(&gw_nh_v4, eth, len) != 0) {
+                SASAT_STAT(tx_drop_mac4);
+            }
             return;
         }
-        copy_mac(eth->h_dest, gw_mac_v4);
+        load_mac(eth->h_dest, gw_mac_v4);
     }
+    PROF(PROF_REWRITE);
 
-    write(if_ingress->sockfd, eth, len);
+    send_frame_eg(eth, len);
 
     SASAT_STAT(tx_packet_v4_eg);
 }
 
-static inline int
-get_gw_mac6(void)
-{
-    get_default_gw(if_ingress, 0, 1);
-    return gw_mac_v6_valid;
-}
-
 /*
     @brief ipv6処理（非仮想IPモード)
 */
@@ -519,20 +663,249 @@ static void
 proc_v6_eg_novip(struct ethhdr *eth, struct ip6_hdr *ip, int len)
 {
     evtlog("prn6", len, 0, (uchar*)eth);
+    PROF(PROF_CLASSIFY);
 
     (void)get_ci_dwn6(&ip->ip6_dst);
+    PROF(PROF_LOOKUP);
 
     if (cmp_mac(eth->h_dest, if_egress->mac) == 0) {
-        if (unlikely(!gw_mac_v6_valid && (get_gw_mac6() == 0))) {
-            SASAT_STAT(tx_drop_mac6);
+        if (unlikely(!gw_mac_v6_valid)) {
+            if (nh_hold(&gw_nh_v6, eth, len) != 0) {
+                SASAT_STAT(tx_drop_mac6);
+            }
             return;
         }
-        copy_mac(eth->h_dest, gw_mac_v6);
+        load_mac(eth->h_dest, gw_mac_v6);
     }
+    PROF(PROF_REWRITE);
 
-    write(if_ingress->sockfd, eth, len);
+    send_frame_eg(eth, len);
 
     SASAT_STAT(tx_packet_v6_eg);
 }
 
+/*
+    @brief 送信キューへ格納(サーバ側)
+*/
+static inline void
+send_frame_in(struct ethhdr *eth, int len)
+{
+    int ret;
+
+    SASAT_STAT_ADD(tx_bytes_in, len);
+    if (unlikely((ret = tx_put(&txq_in, eth, len)) != TX_QUEUED)) {
+        SASAT_STAT(tx_queue_full_in);
+        if (ret == TX_DROP) {
+            SASAT_STAT(tx_drop_full_in);
+            return;
+        }
+    }
+    lat_queued(&lat_in);
+    PROF(PROF_TX);
+}
+
+/*
+    @brief 送信キューのフレームを送信(サーバ側)
+*/
+static inline void
+send_flush_in(void)
+{
+    int cnt;
+
+    lat_sent(&lat_in);
+    PROF_START();
+    if ((cnt = tx_flush(&txq_in)) > 0) {
+        PROF(PROF_FLUSH);
+        SASAT_STAT(tx_flush_in);
+        SASAT_STAT_ADD(tx_flush_frames_in, cnt);
+    }
+}
+
+/*
+    @brief 送信キューへ格納(クライアント側)
+*/
+static inline void
+send_frame_eg(struct ethhdr *eth, int len)
+{
+    int ret;
+
+    SASAT_STAT_ADD(tx_bytes_eg, len);
+    if (unlikely((ret = tx_put(&txq_eg, eth, len)) != TX_QUEUED)) {
+        SASAT_STAT(tx_queue_full_eg);
+        if (ret == TX_DROP) {
+            SASAT_STAT(tx_drop_full_eg);
+            return;
+        }
+    }
+    lat_queued(&lat_eg);
+    PROF(PROF_TX);
+}
+
+/*
+    @brief クライアント側へ送信するフレームにVLANタグを付ける
+    受信bufferはタグ分の空きを確保している(AF_XDPはUMEMのheadroom)
+    @param v   VLAN情報(VLAN番号を求めたもの)
+    @param i   VLAN番号(-1:タグ無し)
+    @param len フレーム長(タグ分加算する)
+    @return フレームの先頭
+*/
+static inline struct ethhdr *
+vlan_tag_eg(struct ethhdr *eth, struct vlan_info *v, int i, int *len)
+{
+    if (i < 0) {
+        return eth;
+    }
+    SASAT_STAT(tx_packet_vlan_eg);
+    *len += VLAN_HLEN;
+    return vlan_push(eth, v->vid[i], txq_eg.hdr_len);
+}
+
+/*
+    @brief 送信キューのフレームを送信(クライアント側)
+*/
+static inline void
+send_flush_eg(void)
+{
+    int cnt;
+
+    lat_sent(&lat_eg);
+    PROF_START();
+    if ((cnt = tx_flush(&txq_eg)) > 0) {
+        PROF(PROF_FLUSH);
+        SASAT_STAT(tx_flush_eg);
+        SASAT_STAT_ADD(tx_flush_frames_eg, cnt);
+    }
+}
+
+/*
+    @brief AF_XDPソケット生成(io_mode=1の場合)
+    2つのインターフェースでUMEMを共有し、受信したフレームをコピーせずに
+    他方から送信する
+*/
+static void
+open_xsk(void)
+{
+    if (anycast_get_properties_int(KEY_IO_MODE) != IO_MODE_XDP) {
+        return;
+    }
+    if (xsk_open_pair(if_ingress, if_egress) != 0) {
+        mlog("xsk(%s,%s) not available, use AF_PACKET", if_ingress->ifname,
+            if_egress->ifname);
+    }
+}
+
+/*
+    @brief インターフェース情報の再読み込みを反映(コマンドスレッドから呼ぶ)
+    受信フィルタ、AF_XDPで受信するアドレスを再設定し、VIPから
+    サーバのIPへのチェックサム差分を計算し直す
+*/
+void
+update_interface(void)
+{
+    if (svr_info.v4_enable) {
+        __atomic_store_n(&svr_info.checksum_delta,
+            calc_chksum_delta(&if_ingress->vip4, &svr_info.svr_ip4.sin_addr),
+            __ATOMIC_RELAXED);
+    }
+    (void)xsk_set_addr(if_ingress->xsk, if_ingress);
+    (void)xsk_set_addr(if_egress->xsk, if_egress);
+
+    if (rx_fd_in > 0) {
+        (void)attach_sock_filter(rx_fd_in, if_ingress, 0);
+    }
+    if (rx_fd_eg > 0) {
+        (void)attach_sock_filter(rx_fd_eg, if_egress, 1);
+    }
+}
+
+/*
+    @brief 受信bufferと制御フレームの送信ソケットを設定
+    vnet_hdrを使用する場合、受信ソケットからの送信はvirtio_net_hdrが
+    必要なため、ARP応答等は送信専用ソケットから送信する
+    受信bufferはMTU長(jumbo frame)、vnet_hdrの場合は最大64KB
+    (スレッドのNUMAノードに置くため受信スレッドで確保する)
+    @param ifp      受信インターフェース
+    @param fd       受信ソケット
+    @param size     受信bufferサイズ(出力)
+    @param hdr      フレーム前のヘッダ長(出力)
+    @return 受信buffer(先頭にVLANタグを付けるための空きを確保する)
+*/
+static unsigned char *
+init_rx_buffer(struct ifdata *ifp, int fd, int *size, int *hdr)
+{
+    unsigned char *buf;
+
+    if (!ifp->vnet_hdr) {
+        ifp->sockfd = fd;
+        *size = RX_BUF_SIZE(ifp);
+        *hdr = 0;
+        if ((buf = huge_alloc(*size + VLAN_HLEN, "rx buffer")) == NULL) {
+            syslog(LOG_ERR, "rx buffer(%s) alloc error", ifp->ifname);
+            exit(1);
+        }
+        return buf + VLAN_HLEN;
+    }
+
+    /* GROで結合されたフレーム(最大64KB)を受信する */
+    if (((ifp->sockfd = tx_socket(ifp, 0)) < 0) ||
+            ((buf = huge_alloc(VNET_BUF_SIZE + VLAN_HLEN,
+                "vnet buffer")) == NULL)) {
+        syslog(LOG_ERR, "vnet hdr(%s) init error", ifp->ifname);
+        exit(1);
+    }
+    *size = VNET_BUF_SIZE;
+    *hdr = VNET_HDR_LEN;
+    return buf + VLAN_HLEN;
+}
+
+/*
+    @brief 受信待ちのタイムアウト
+    送信完了待ちのフレームがある場合、受信が無くても回収するため
+    (UMEMを共有する場合、回収するまで受信側のfill ringへ戻らない)
+    @return タイムアウト(ms、-1:無期限)
+*/
+static inline int
+xsk_timeout(struct xsk *x)
+{
+    if ((x == NULL) || (xsk_tx_pending(x) == 0)) {
+        return -1;
+    }
+    return 1;
+}
+
+/*
+    @brief AF_XDPソケットからの受信
+    UMEMを共有する場合、フレームはそのまま他方のtx ringへ入れ、送信完了後に
+    受信用へ戻す。共有しない場合は他方のUMEMへコピーするため、
+    処理後すぐに受信用に戻す
+    @return 受信したフレーム数
+*/
+static int
+recv_xsk(struct xsk *x, void (*proc)(unsigned char *, int), int short_stat)
+{
+    struct xsk *tx = (x->peer) ? x->peer : x;
+    struct xdp_desc *desc;
+    uint32_t i, n, idx;
+
+    n = xsk_rx_peek(x, MAX_RECV, &idx);
+    for (i = 0; i < n; i++) {
+        desc = xsk_rx_desc(x, idx + i);
+        tx->rx_used = 0;
+        PROF_START();
+        if (likely(desc->len > sizeof(struct ethhdr))) {
+            proc(xsk_frame(x, desc->addr), desc->len);
+        } else {
+            SASAT_STAT(short_stat);
+        }
+        if (!tx->rx_used) {
+            /* 送信しなかったフレームは受信用に戻す */
+            xsk_fill(x, desc->addr);
+        }
+    }
+    if (n) {
+        xsk_rx_release(x, n);
+    }
+    return n;
+}
+
 /* end */
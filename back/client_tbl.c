@@ -19,6 +19,7 @@
 #include "anycast.h"
 #include "client_tbl.h"
 #include "util_inline.h"
+#include "hugemem.h"
 
 /* prototype */
 static ci_v4_t *
@@ -326,9 +327,9 @@ init_client_table(void)
         SLIST_INIT(&client_info.ch_dwn6[i]);
     }
 
-    ci4 = calloc((sizeof(ci_v4_t) * CLI_CACHE), 1);
+    ci4 = huge_alloc(sizeof(ci_v4_t) * CLI_CACHE, "client v4");
     if (!ci4) {
-        syslog(LOG_ERR, "init client table malloc %d",
+        syslog(LOG_ERR, "init client table malloc %zu",
             (sizeof(ci_v4_t) * CLI_CACHE));
         exit(1);
     }
@@ -338,9 +339,9 @@ init_client_table(void)
         ci4++;
     }
 
-    ci4 = calloc((sizeof(ci_v4_t) * CLI_CACHE), 1);
+    ci4 = huge_alloc(sizeof(ci_v4_t) * CLI_CACHE, "client v4");
     if (!ci4) {
-        syslog(LOG_ERR, "init client table malloc %d",
+        syslog(LOG_ERR, "init client table malloc %zu",
             (sizeof(ci_v4_t) * CLI_CACHE));
         exit(1);
     }
@@ -350,9 +351,9 @@ init_client_table(void)
         ci4++;
     }
 
-    ci6 = calloc((sizeof(ci_v6_t) * CLI_CACHE), 1);
+    ci6 = huge_alloc(sizeof(ci_v6_t) * CLI_CACHE, "client v6");
     if (!ci6) {
-        syslog(LOG_ERR, "init client table malloc %d",
+        syslog(LOG_ERR, "init client table malloc %zu",
             (sizeof(ci_v6_t) * CLI_CACHE));
         exit(1);
     }
@@ -362,9 +363,9 @@ init_client_table(void)
         ci6++;
     }
 
-    ci6 = calloc((sizeof(ci_v6_t) * CLI_CACHE), 1);
+    ci6 = huge_alloc(sizeof(ci_v6_t) * CLI_CACHE, "client v6");
     if (!ci6) {
-        syslog(LOG_ERR, "init client table malloc %d",
+        syslog(LOG_ERR, "init client table malloc %zu",
             (sizeof(ci_v6_t) * CLI_CACHE));
         exit(1);
     }
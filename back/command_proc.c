@@ -22,9 +22,13 @@
 #include "util_inline.h"
 #include "val.h"
 #include "anycast.h"
+#include "hugemem.h"
+#include "latency.h"
+#include "rxpoll.h"
 
 static void timeout_init(struct timeval *tv);
 static void log_dump(unsigned char);
+static void update_if(void);
 
 /* static valiables */
 static volatile int sig_flg;
@@ -46,6 +50,21 @@ timeout_init(struct timeval *tv)
     timeout_set(tv, 10);
 }
 
+/*
+    @brief インターフェース情報の再読み込み(VIPの変更等)
+    VLANの変更は振り分けスレッドの参照を待ち合わせないため、再起動まで
+    反映しない
+*/
+static void
+update_if(void)
+{
+    mlog("update interface");
+
+    reload_interface_info(if_ingress, if_egress);
+    vlan_abort();
+    update_interface();
+}
+
 /*
     @brief logおよび統計情報をファイルに書き出す
     @param flag ビットマップ
@@ -77,6 +96,9 @@ log_dump(unsigned char flag)
         fwrite(buff, strlen(buff), 1, fp);
 
         if (flag & LOG_STAT) {
+            lat_stat();
+            rx_poll_stat();
+            huge_stat();
             write_log_stat(fp, buff);
         }
         if (flag & LOG_MLOG) {
@@ -88,6 +110,9 @@ log_dump(unsigned char flag)
         if (flag & LOG_CLI) {
             write_log_cli(fp, buff);
         }
+        if (flag & LOG_PROF) {
+            write_log_prof(fp, buff);
+        }
 
         free(buff);
         fclose(fp);
@@ -0,0 +1,29 @@
+/**
+ * file    hugemem.c
+ * brief   データパス用メモリ(hugepage、事前割り当て、mlock)
+ * note    COPYRIGHT FUJITSU LIMITED 2010
+ *
+ * 改版履歴(出荷後記入)
+ * 版数   日付    変更者    リリースノート
+ * ---- -------- --------- --------------------------------------------------
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "option.h"
+#include "log.h"
+#include "prop_common.h"
+#include "stat.h"
+#include "hugemem.h"
+
+/* 共通処理 */
+#include "hugemem_body.c"
+
+/* end */
@@ -15,10 +15,18 @@
 #include "anycast.h"
 
 int get_interface_info(struct ifdata *if_in, struct ifdata *if_eg);
+void reload_interface_info(struct ifdata *if_in, struct ifdata *if_eg);
+struct vlan_info *vlan_commit(void);
+void vlan_abort(void);
+void vlan_release(struct vlan_info *);
 int init_ud_socket(void);
 uint64_t tsc_cycle_init(void);
 void signal_block(void);
-int init_socket_if(struct ifdata *, int, int *);
+int thread_placement(const char *, const char *, int, int);
+void numa_move(void *, size_t, int);
+int init_socket_if(struct ifdata *, int, int *, struct rx_ring *);
+int attach_sock_filter(int, struct ifdata *, int);
+void free_rx_ring(struct rx_ring *);
 void get_svr_info(void);
 void marge_info(void);
 int create_back_thread(void*(*func)(void*), volatile int *wait);
@@ -28,5 +36,8 @@ void sync_init(volatile int *flag, int cnt);
 void get_default_gw(struct ifdata *, int, int);
 int get_connect_mode(void);
 int init_pid(void);
+int rt_mirror_start(void);
+void proxy_cache_init(void);
+void update_interface(void);
 
 #endif
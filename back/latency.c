@@ -0,0 +1,27 @@
+/**
+ * file    latency.c
+ * brief   滞留時間(受信から送信まで)の計測
+ * note    COPYRIGHT FUJITSU LIMITED 2010
+ *
+ * 改版履歴(出荷後記入)
+ * 版数   日付    変更者    リリースノート
+ * ---- -------- --------- --------------------------------------------------
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#include "option.h"
+#include "log.h"
+#include "prop_common.h"
+#include "stat.h"
+#include "latency.h"
+
+/* 共通処理 */
+#include "latency_body.c"
+
+/* end */
@@ -10,6 +10,7 @@
 
 #include <unistd.h>
 #include <string.h>
+#include <stdlib.h>
 #include <linux/types.h>
 #include <netinet/in.h>
 #include <netinet/ip6.h>
@@ -19,10 +20,35 @@
 #include "option.h"
 #include "val.h"
 #include "init.h"
+#include "back_properties.h"
 
 /* common以下の共通処理 */
 #include "arp_proc.c"
 
+#define PROXY_CACHE_NUM     256     /* 代理応答キャッシュのエントリ数(2のべき乗) */
+#define PROXY_CACHE_WAY     4       /* 1つのキーで検索するエントリ数 */
+
+/*
+    @brief 代理応答キャッシュ(ターゲットIP毎のMAC)
+    検索、登録はサーバ側のスレッドのみが行なう。解決はresolverスレッドが
+    行ない、解決したらstatusをSVR_OKにする
+    (解決要求はproxy_cache_initで全エントリ分を登録しておき、登録時に
+    確保、ロックを行なわない)
+*/
+struct proxy_ent {
+    struct nh_entry nh;             /* 解決要求 */
+    struct sockaddr_storage addr;   /* ターゲットIP(キー) */
+    struct sockaddr_storage gw;
+    uint8_t mac[MAC_STORE_LEN] __attribute__((aligned(8)));  /* load_mac */
+    volatile uint8_t status;        /* SVR_OK:解決済み */
+    uint8_t used;
+    uint8_t stale;                  /* 期限切れ(再解決中は古いMACで応答) */
+    uint64_t expire;                /* 有効期限(TSC値、0は未確認) */
+};
+
+static struct proxy_ent proxy_cache[PROXY_CACHE_NUM];
+static uint64_t proxy_ttl;          /* 有効期間(TSCサイクル) */
+
 int resolve_mac(struct sockaddr *, struct ifdata *, uchar *, int);
 static void arp_proxy_reply(struct ethhdr *, struct ether_arp *);
 static void arp_gw_reply(struct ethhdr *, struct ether_arp *);
@@ -34,6 +60,7 @@ static void send_gw_na(struct ethhdr *, struct ip6_hdr *,
 int get_target_mac(struct sockaddr *, char *, struct sockaddr*, uchar*, int);
 void send_ping(struct sockaddr *, struct ifdata*);
 void arp_egress_reply(struct ethhdr *eth);
+static int proxy_cache_lookup(struct sockaddr *, uchar *);
 
 /*
     @brief サーバからのMAC解決処理(multicast)
@@ -57,8 +84,10 @@ mac_resolve_egress(struct ethhdr *eth,
                 && ((icmp6h = get_icmp6_ns(ip6h, len)) != NULL)) {
             len -= NS_BASE_SIZE;
             if (vip_mode && (cmp_mac(eth->h_dest, if_egress->fmmac) == 0)) {
-                if (check_valid_ns(ip6h, icmp6h, 
-                    &if_egress->vip6, 0, len) != -1) {
+                struct in6_addr vip6;
+
+                load_vip6(if_egress, &vip6);
+                if (check_valid_ns(ip6h, icmp6h, &vip6, 0, len) != -1) {
                     /* 仮想IPに対する応答処理 */
                     send_gw_na(eth, ip6h, 
                         (struct nd_neighbor_solicit*)icmp6h, 1);
@@ -149,8 +178,11 @@ mac_resolve_uc6_egress(struct ethhdr *eth, struct ip6_hdr *ip6h,
     len -= NS_BASE_SIZE;
 
     if (cmp_mac(eth->h_dest, if_egress->mac) == 0) {
+        struct in6_addr vip6;
+
+        load_vip6(if_egress, &vip6);
         if (vip_mode && 
-            (check_valid_ns(ip6h, icmp6h, &if_egress->vip6, 0, len) != -1)) {
+            (check_valid_ns(ip6h, icmp6h, &vip6, 0, len) != -1)) {
             send_gw_na(eth, ip6h, (struct nd_neighbor_solicit*)icmp6h, 0);
         }
     } else {
@@ -201,6 +233,148 @@ resolve_mac(struct sockaddr *sa, struct ifdata *ifdata,
     return SVR_INIT;
 }
 
+/*
+    @brief 代理応答キャッシュ初期化(サーバ側スレッドの起動前に呼ぶ)
+*/
+void
+proxy_cache_init(void)
+{
+    struct proxy_ent *pe;
+    long ttl = anycast_get_properties_int(KEY_PROXY_TTL);
+
+    if (ttl <= 0) {
+        ttl = 1;
+    }
+    proxy_ttl = (uint64_t)ttl * get_clock() * 1000000;
+
+    for (pe = proxy_cache; pe < &proxy_cache[PROXY_CACHE_NUM]; pe++) {
+        (void)nh_init(&pe->nh, (struct sockaddr *)&pe->addr,
+            (struct sockaddr *)&pe->gw, pe->mac, &pe->status, if_ingress, 0);
+        /* 応答フレームは保留しない */
+        free(pe->nh.hold_buf);
+        pe->nh.hold_buf = NULL;
+    }
+}
+
+/*
+    @brief キャッシュエントリのキー比較
+*/
+static inline int
+proxy_cmp(struct proxy_ent *pe, struct sockaddr *sa)
+{
+    if (pe->addr.ss_family != sa->sa_family) {
+        return -1;
+    }
+    if (sa->sa_family == AF_INET) {
+        return cmp_ipv4(&((struct sockaddr_in *)&pe->addr)->sin_addr,
+            &((struct sockaddr_in *)sa)->sin_addr);
+    }
+    return memcmp(&((struct sockaddr_in6 *)&pe->addr)->sin6_addr,
+        &((struct sockaddr_in6 *)sa)->sin6_addr, sizeof(struct in6_addr));
+}
+
+/*
+    @brief エントリを登録し解決を要求する
+    (要求中でないエントリのみ再利用する。解決要求は登録済みのため
+    アドレスだけを入れ替える)
+*/
+static void
+proxy_cache_fill(struct proxy_ent *pe, struct sockaddr *sa)
+{
+    __atomic_store_n(&pe->status, SVR_INIT, __ATOMIC_RELEASE);
+    /* ゲートウェイを消してからアドレスを入れ替える(ネイバーの変更を
+       古いゲートウェイで反映しないため) */
+    memset(&pe->gw, 0, sizeof(pe->gw));
+    memset(&pe->addr, 0, sizeof(pe->addr));
+    memcpy(&pe->addr, sa, (sa->sa_family == AF_INET) ?
+        sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6));
+    pe->gw.ss_family = sa->sa_family;
+    pe->expire = 0;
+    pe->stale = 0;
+    pe->used = 1;
+
+    nh_request(&pe->nh);
+}
+
+/*
+    @brief 代理応答キャッシュ検索
+    未登録、未解決の場合は解決を要求して応答しない
+    (サーバは再要求するため、次の要求はキャッシュから応答する)
+    期限切れの場合は再解決を要求し、解決中は古いMACで応答する
+    @param sa ターゲットIP
+    @param mac 応答するMACの格納先
+    @return 0:ヒット -1:ミス
+*/
+static int
+proxy_cache_lookup(struct sockaddr *sa, uchar *mac)
+{
+    struct proxy_ent *pe, *victim = NULL;
+    uint64_t now = rdtsc();
+    uint32_t hash;
+    int i;
+
+    hash = (sa->sa_family == AF_INET) ?
+        flow_hash4(((struct sockaddr_in *)sa)->sin_addr.s_addr) :
+        flow_hash6(((struct sockaddr_in6 *)sa)->sin6_addr.s6_addr32);
+
+    for (i = 0; i < PROXY_CACHE_WAY; i++) {
+        pe = &proxy_cache[(hash + i) & (PROXY_CACHE_NUM - 1)];
+        if (!pe->used) {
+            if ((victim == NULL) || victim->used) {
+                victim = pe;
+            }
+            continue;
+        }
+        if (proxy_cmp(pe, sa) != 0) {
+            /* 要求中でなく、期限の最も早いものを置き換える */
+            if (!__atomic_load_n(&pe->nh.pending, __ATOMIC_ACQUIRE) &&
+                  ((victim == NULL) ||
+                   (victim->used && (pe->expire < victim->expire)))) {
+                victim = pe;
+            }
+            continue;
+        }
+
+        if (__atomic_load_n(&pe->status, __ATOMIC_ACQUIRE) != SVR_OK) {
+            if (pe->stale &&
+                    __atomic_load_n(&pe->nh.pending, __ATOMIC_ACQUIRE)) {
+                /* 再解決中は古いMACで応答する */
+                load_mac(mac, pe->mac);
+                SASAT_STAT(proxy_stale);
+                return 0;
+            }
+            /* 解決中(解決に失敗していれば再要求) */
+            pe->stale = 0;
+            nh_request(&pe->nh);
+            SASAT_STAT(proxy_pending);
+            return -1;
+        }
+        if (pe->expire == 0) {
+            /* 解決後、最初の参照から期限を数える */
+            pe->expire = now + proxy_ttl;
+            pe->stale = 0;
+        } else if (now >= pe->expire) {
+            /* 期限切れのため再解決(解決するまで古いMACで応答する) */
+            pe->expire = 0;
+            pe->stale = 1;
+            __atomic_store_n(&pe->status, SVR_INIT, __ATOMIC_RELEASE);
+            nh_request(&pe->nh);
+            load_mac(mac, pe->mac);
+            SASAT_STAT(proxy_stale);
+            return 0;
+        }
+        load_mac(mac, pe->mac);
+        SASAT_STAT(proxy_hit);
+        return 0;
+    }
+
+    SASAT_STAT(proxy_miss);
+    if (victim != NULL) {
+        proxy_cache_fill(victim, sa);
+    }
+    return -1;
+}
+
 /*
     @brief arp代理応答処理(本体)
 */
@@ -243,11 +417,13 @@ arp_proxy_body(struct ethhdr *eth, struct ether_arp *arp, uchar *mac)
 static void
 arp_gw_reply(struct ethhdr *eth, struct ether_arp *arp)
 {
+    uint8_t mac[ETH_ALEN];
     int i = 0;
 
     do {
         if (gw_mac_v4_valid) {
-            if (arp_proxy_body(eth, arp, gw_mac_v4) != -1) {
+            load_mac(mac, gw_mac_v4);
+            if (arp_proxy_body(eth, arp, mac) != -1) {
                 SASAT_STAT(tx_arp_reply_eg);
             }
             break;
@@ -269,8 +445,8 @@ arp_proxy_reply(struct ethhdr *eth, struct ether_arp *arp)
 
     sa.sin_family = AF_INET;
     sa.sin_addr = *(struct in_addr*)arp->arp_tpa;
-    if (resolve_mac((struct sockaddr*)&sa, if_ingress, mac, 0) == SVR_INIT) {
-        /* mac解決できなかった */
+    if (proxy_cache_lookup((struct sockaddr*)&sa, mac) < 0) {
+        /* mac未解決 */
         return;
     }
     if (arp_proxy_body(eth, arp, mac) != -1) {
@@ -358,8 +534,8 @@ send_proxy_na(struct ethhdr *s_eth, struct ip6_hdr *s_ip6h,
     sa.sin6_family = AF_INET6;
     memcpy(&sa.sin6_addr, &s_ns->nd_ns_target, sizeof(sa.sin6_addr));
 
-    if (resolve_mac((struct sockaddr*)&sa, if_ingress, mac, 0) == SVR_INIT) {
-        /* mac解決できなかった */
+    if (proxy_cache_lookup((struct sockaddr*)&sa, mac) < 0) {
+        /* mac未解決 */
         return;
     }
 
@@ -374,11 +550,13 @@ static void
 send_gw_na(struct ethhdr *s_eth, struct ip6_hdr *s_ip6h,
               struct nd_neighbor_solicit *s_ns, int mcast)
 {
+    uint8_t mac[ETH_ALEN];
     int i = 0;
 
     do {
         if (gw_mac_v6_valid) {
-            send_na_body(s_eth, s_ip6h, s_ns, mcast, gw_mac_v6);
+            load_mac(mac, gw_mac_v6);
+            send_na_body(s_eth, s_ip6h, s_ns, mcast, mac);
             SASAT_STAT(tx_na_eg);
             break;
         }
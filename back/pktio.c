@@ -0,0 +1,27 @@
+/**
+ * file    pktio.c
+ * brief   送信キュー
+ * note    COPYRIGHT FUJITSU LIMITED 2010
+ *
+ * 改版履歴(出荷後記入)
+ * 版数   日付    変更者    リリースノート
+ * ---- -------- --------- --------------------------------------------------
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include "option.h"
+#include "log.h"
+#include "prop_common.h"
+#include "pktio.h"
+#include "hugemem.h"
+
+/* 共通処理 */
+#include "pktio_body.c"
+
+/* end */
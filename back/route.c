@@ -19,6 +19,9 @@
 #include "option.h"
 #include "log.h"
 #include "val.h"
+#include "init.h"
+#include "stat.h"
+#include "prop_common.h"
 
 /* common以下の共通処理 */
 #include "rt_body.c"
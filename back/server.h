@@ -10,6 +10,8 @@
 #ifndef __BACK_SRV_H__
 #define __BACK_SRV_H__
 
+#include "resolver.h"
+
 /* サーバ情報テーブルの状態 */
 enum {
     SVR_INIT = 0,   /* MACが不明    */
@@ -31,11 +33,17 @@ typedef struct backend_svr_s
     struct sockaddr_in svr_ip4;
     struct sockaddr_in6 svr_ip6;
 
-    uint8_t svr_mac[ETH_ALEN];
+    uint8_t svr_mac[MAC_STORE_LEN] __attribute__((aligned(8)));  /* load_mac */
     uint16_t checksum_delta;
 
     uint32_t    hit4;
     uint32_t    hit6;
+
+    /* MAC解決要求、保留キュー(v4,v6とも解決結果は svr_mac, stat) */
+    struct nh_entry nh4;
+    struct nh_entry nh6;
+    struct sockaddr_storage gw4;
+    struct sockaddr_storage gw6;
 } backend_svr_t;
 
 #endif /*__BACK_SRV_H__*/
@@ -11,6 +11,7 @@
 #define __ANC_STAT__
 
 #include "stat_common.h"
+#include "anycast.h"
 
 /*
     @brief 統計種別 
@@ -20,6 +21,8 @@ enum {
     tx_packet_v6_in,
     rx_packet_v4_in,
     tx_packet_v4_in,
+    rx_bytes_in,
+    tx_bytes_in,
 
     rx_packet_mc_in,
 
@@ -30,12 +33,35 @@ enum {
 
     rx_drop_noip_in,
     rx_drop_short_in,
+    rx_drop_oversize_in,
     rx_drop_in,
 
+    tx_queue_full_in,
+    tx_drop_full_in,
+    tx_flush_in,
+    tx_flush_frames_in,
+    rx_spin_in,
+    rx_sleep_in,
+    rx_gro_in,
+    rx_packet_vlan_in,
+    rx_drop_vlan_in,
+    rx_kernel_in,
+    rx_kernel_drop_in,
+    rx_kernel_freeze_in,
+    rx_loss_int_in,
+    rx_loss_last_in,
+    rx_loss_max_in,
+    lat_samples_in,
+    lat_p50_in,
+    lat_p99_in,
+    lat_p999_in,
+
     rx_packet_v6_eg,
     tx_packet_v6_eg,
     rx_packet_v4_eg,
     tx_packet_v4_eg,
+    rx_bytes_eg,
+    tx_bytes_eg,
 
     rx_packet_mc_eg,
 
@@ -43,17 +69,58 @@ enum {
     tx_na_eg,
     tx_proxy_arp,
     tx_proxy_na,
+    proxy_hit,
+    proxy_miss,
+    proxy_pending,
+    proxy_stale,
 
     rx_drop_addr_v6_eg,
     rx_drop_addr_v4_eg,
     rx_drop_noip_eg,
     rx_drop_short_eg,
+    rx_drop_oversize_eg,
 
     rx_drop_eg,
 
+    tx_queue_full_eg,
+    tx_drop_full_eg,
+    tx_flush_eg,
+    tx_flush_frames_eg,
+    rx_spin_eg,
+    rx_sleep_eg,
+    rx_gro_eg,
+    tx_packet_vlan_eg,
+    rx_kernel_eg,
+    rx_kernel_drop_eg,
+    rx_kernel_freeze_eg,
+    rx_loss_int_eg,
+    rx_loss_last_eg,
+    rx_loss_max_eg,
+    lat_samples_eg,
+    lat_p50_eg,
+    lat_p99_eg,
+    lat_p999_eg,
+
     tx_drop_mac6,
     tx_drop_mac4,
 
+    nh_held,
+    nh_held_drop,
+    nh_held_tx,
+    nh_resolved,
+
+    nh_resolve_fail,
+    nh_updated,
+
+    mem_hugetlb,
+    mem_thp,
+    mem_normal,
+    mem_static,
+    mem_resident,
+    mem_locked,
+    mem_fallback,
+
+    cmd_upd_if,
     cmd_dump_req,
     cmd_trace,
     cmd_illegal,
@@ -68,6 +135,8 @@ struct stat_member sstat[STAT_MAX] = {
     {0, ":tx packets v6(in)\n"},
     {0, ":rx packets v4(in)\n"},
     {0, ":tx packets v4(in)\n"},
+    {0, ":rx bytes(in)\n"},
+    {0, ":tx bytes(in)\n"},
 
     {0, ":rx packets multicast(in)\n"},
     {0, ":tx arp reply(in)\n"},
@@ -77,13 +146,36 @@ struct stat_member sstat[STAT_MAX] = {
     {0, ":rx drop(v4 address/in)\n"},
     {0, ":rx drop(not ip/in)\n"},
     {0, ":rx drop(short/in)\n"},
+    {0, ":rx drop(oversize/in)\n"},
     {0, ":rx drop(other/in)\n"},
 
+    {0, ":tx queue full(in)\n"},
+    {0, ":tx drop(queue full/in)\n"},
+    {0, ":tx flush(in)\n"},
+    {0, ":tx flush frames(in)\n"},
+    {0, ":rx busy poll(empty/in)\n"},
+    {0, ":rx poll sleep(in)\n"},
+    {0, ":rx gro frames(in)\n"},
+    {0, ":rx packets vlan(in)\n"},
+    {0, ":rx drop(vlan/in)\n"},
+    {0, ":rx kernel packets(in)\n"},
+    {0, ":rx kernel drop(in)\n"},
+    {0, ":rx kernel ring freeze(in)\n"},
+    {0, ":rx loss intervals(in)\n"},
+    {0, ":rx loss rate last(ppm/in)\n"},
+    {0, ":rx loss rate max(ppm/in)\n"},
+    {0, ":latency samples(in)\n"},
+    {0, ":latency p50(ns/in)\n"},
+    {0, ":latency p99(ns/in)\n"},
+    {0, ":latency p99.9(ns/in)\n"},
+
 /* egress */
     {0, ":rx packets v6(out)\n"},
     {0, ":tx packets v6(out)\n"},
     {0, ":rx packets v4(out)\n"},
     {0, ":tx packets v4(out)\n"},
+    {0, ":rx bytes(out)\n"},
+    {0, ":tx bytes(out)\n"},
 
     {0, ":rx packets multicast(out)\n"},
     {0, ":tx arp reply(out)\n"},
@@ -91,26 +183,95 @@ struct stat_member sstat[STAT_MAX] = {
     {0, ":tx proxy arp(out)\n"},
 
     {0, ":tx proxy neighbor adv(out)\n"},
+    {0, ":proxy cache hit(out)\n"},
+    {0, ":proxy cache miss(out)\n"},
+    {0, ":proxy cache pending(out)\n"},
+    {0, ":proxy cache stale(out)\n"},
     {0, ":rx drop(v6 address/out)\n"},
     {0, ":rx drop(v4 address/out)\n"},
     {0, ":rx drop(not ip/out)\n"},
 
     {0, ":rx drop(short/out)\n"},
+    {0, ":rx drop(oversize/out)\n"},
     {0, ":rx drop(other/out)\n"},
 
+    {0, ":tx queue full(out)\n"},
+    {0, ":tx drop(queue full/out)\n"},
+    {0, ":tx flush(out)\n"},
+    {0, ":tx flush frames(out)\n"},
+    {0, ":rx busy poll(empty/out)\n"},
+    {0, ":rx poll sleep(out)\n"},
+    {0, ":rx gro frames(out)\n"},
+    {0, ":tx packets vlan(out)\n"},
+    {0, ":rx kernel packets(out)\n"},
+    {0, ":rx kernel drop(out)\n"},
+    {0, ":rx kernel ring freeze(out)\n"},
+    {0, ":rx loss intervals(out)\n"},
+    {0, ":rx loss rate last(ppm/out)\n"},
+    {0, ":rx loss rate max(ppm/out)\n"},
+    {0, ":latency samples(out)\n"},
+    {0, ":latency p50(ns/out)\n"},
+    {0, ":latency p99(ns/out)\n"},
+    {0, ":latency p99.9(ns/out)\n"},
+
     {0, ":tx drop(mac error v6/out)\n"},
     {0, ":tx drop(mac error v4/out)\n"},
 
+/* resolver */
+    {0, ":hold(mac unresolved)\n"},
+    {0, ":drop(hold queue full)\n"},
+    {0, ":tx held frames\n"},
+    {0, ":mac resolved\n"},
+
+    {0, ":mac resolve failed\n"},
+    {0, ":mac updated(neighbor)\n"},
+
+/* memory */
+    {0, ":memory hugetlb(bytes)\n"},
+    {0, ":memory thp(bytes)\n"},
+    {0, ":memory normal(bytes)\n"},
+    {0, ":memory static(bytes)\n"},
+    {0, ":memory resident(bytes)\n"},
+    {0, ":memory locked(bytes)\n"},
+    {0, ":memory fallback(hugepage/mlock)\n"},
+
 /* command */
+    {0, ":command update interface\n"},
     {0, ":command dump req\n"},
     {0, ":command event trace ctrl\n"},
     {0, ":command illegal request\n"}
 };
 
+#endif
+
+/*
+    @brief スレッド毎の統計
+    network処理スレッドはスレッド番号の領域、resolverスレッドとnetlink通知
+    受信スレッドはそれぞれ専用の領域、その他のスレッド(コマンドスレッド)は
+    最後の領域を更新する。sstatへは書き出し時に合算する
+    領域はページ単位とし、更新するスレッドのNUMAノードに置く
+*/
+#define STAT_BLOCK_RESOLVER (MAX_NET_THREAD)
+#define STAT_BLOCK_NETLINK  (MAX_NET_THREAD + 1)
+#define STAT_BLOCK_NUM  (MAX_NET_THREAD + 3)
+
+struct stat_block {
+    ssz_t stat[STAT_MAX];
+} __attribute__((aligned(4096)));
+
+#ifdef VAL_SUBS
+struct stat_block sstat_blk[STAT_BLOCK_NUM];
+__thread struct stat_block *sstat_self = &sstat_blk[STAT_BLOCK_NUM - 1];
 #else
 extern struct stat_member sstat[STAT_MAX];
+extern struct stat_block sstat_blk[STAT_BLOCK_NUM];
+extern __thread struct stat_block *sstat_self;
 #endif
 
-#define SASAT_STAT(member)  (sstat[member].stat++)
+#define SASAT_STAT(member)  (sstat_self->stat[member]++)
+#define SASAT_STAT_ADD(member, n)  (sstat_self->stat[member] += (n))
+
+/* 統計の領域をスレッド番号に切り替える */
+#define SASAT_STAT_THREAD(no)   (sstat_self = &sstat_blk[no])
 
 #endif
@@ -14,6 +14,7 @@
 
 #include "log.h"
 #include "anycast.h"
+#include "vlan.h"
 #include "server.h"
 #include "client_tbl.h"
 
@@ -28,6 +29,7 @@ SLOCAL backend_svr_t svr_info;
 
 SLOCAL struct ifdata *if_ingress;
 SLOCAL struct ifdata *if_egress;
+SLOCAL struct vlan_info *vlan_in;   /* クライアント側のVLAN(VLAN_INFO()で参照) */
 SLOCAL int vip_mode;
 #ifdef L_MODE
 SLOCAL int l_mode;
@@ -47,8 +49,10 @@ SLOCAL char ebuf2[ELOG_DATA_LEN];   /* 振り分けスレッド */
 
 SLOCAL uchar gw_mac_v4_valid;
 SLOCAL uchar gw_mac_v6_valid;
-SLOCAL uchar gw_mac_v4[ETH_ALEN] __attribute__((aligned(4)));
-SLOCAL uchar gw_mac_v6[ETH_ALEN] __attribute__((aligned(4)));
+SLOCAL uchar gw_mac_v4[MAC_STORE_LEN] __attribute__((aligned(8)));
+SLOCAL uchar gw_mac_v6[MAC_STORE_LEN] __attribute__((aligned(8)));
+SLOCAL struct nh_entry gw_nh_v4;    /* デフォルトGWのMAC解決要求、保留キュー */
+SLOCAL struct nh_entry gw_nh_v6;
 
 #undef EXTERM
 
@@ -9,8 +9,9 @@
 
     使用法：
     sasat -p (振分け設定更新)
-    sasat -l {all | stat | mlog | elog | cl | pol | svr} (ログ取得）
+    sasat -l {all | stat | mlog | elog | cl | pol | svr | prof} (ログ取得）
     sasat -t {0 | 1} (イベントトレース off/on)
+    sasat stat [--shm] (統計表示、--shmは共有メモリから読み出す)
 
     ※複数オプション同時指定可 
     例）sasat -p -l stat -l pol -l cl -t 0
@@ -28,14 +29,22 @@
 #include <sys/stat.h>
 #include <linux/un.h>
 #include <errno.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "shmstat.h"
 
 static unsigned char get_log_opt(char *arg);
 static int send_cmd(unsigned char cmd, unsigned char opt);
+static int stat_cmd(int argc, char *argv[]);
+static int stat_shm(const char *path);
 
 #define USAGE "Usage: sasat (OPTION)\n\
   -p (振分け設定ファイルの再読み込み)\n\
-  -l {all | stat | mlog | elog | cl | pol | svr} (ログ取得)\n\
-  -t {0 | 1} (イベントトレースの停止/開始)\n"
+  -l {all | stat | mlog | elog | cl | pol | svr | prof} (ログ取得)\n\
+  -t {0 | 1} (イベントトレースの停止/開始)\n\
+       sasat stat [--shm [FILE]]\n\
+  (統計表示、--shmは共有メモリから読み出し、コマンドスレッドを使用しない)\n"
 
 #define SASAT_FILE  "/dev/shm/.sasat"
 
@@ -61,6 +70,7 @@ enum {
     LOG_CLI     = (1 << 3),
     LOG_STAT2   = (1 << 4),
     LOG_SVR     = (1 << 5),
+    LOG_PROF    = (1 << 6),
     LOG_ALL     = 0xff,
 };
 
@@ -80,6 +90,7 @@ const struct log_option log_option[] = {
     {"cl",   LOG_CLI},
     {"pol",  LOG_STAT2},
     {"svr",  LOG_SVR},
+    {"prof", LOG_PROF},
     {NULL,   0}
 };
 
@@ -119,6 +130,11 @@ main(int argc, char *argv[])
 
     pol = log = evt = cmd = 0;
 
+    /* サブコマンド */
+    if ((argc > 1) && (strcmp(argv[1], "stat") == 0)) {
+        exit(stat_cmd(argc - 1, argv + 1) < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+    }
+
     while ((opt = getopt(argc, argv, "pl:t:")) != -1) {
         switch (opt) {
         case 'p':
@@ -172,6 +188,115 @@ main(int argc, char *argv[])
     exit(EXIT_SUCCESS);
 }
 
+/*
+    statサブコマンド
+    --shmなしは-l statと同じ(ログファイルへ出力)
+*/
+static int
+stat_cmd(int argc, char *argv[])
+{
+    if (argc == 1) {
+        fprintf(stderr, "Log command\n");
+        return send_cmd(UD_DUMP_REQ, LOG_STAT);
+    }
+    if ((argc <= 3) && (strcmp(argv[1], "--shm") == 0)) {
+        return stat_shm((argc == 3) ? argv[2] : SHMSTAT_FILE);
+    }
+    fprintf(stderr, USAGE);
+    return -1;
+}
+
+/*
+    共有メモリの統計を標準出力へ表示
+*/
+static int
+stat_shm(const char *path)
+{
+    static const char *status[] = {"init", "ok", "drop", "wait"};
+    struct shmstat s;
+    const struct shmstat_hdr *h;
+    const struct shmstat_pol *p;
+    const struct shmstat_svr *v;
+    const struct shmstat_cli *c;
+    const uint64_t *st;
+    const char *name;
+    char addr[INET6_ADDRSTRLEN], gw[INET6_ADDRSTRLEN], tbuf[32];
+    time_t t;
+    uint32_t i;
+    void *buf;
+
+    if (shmstat_open(&s, path) < 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if ((buf = malloc(s.size)) == NULL) {
+        perror("malloc");
+        shmstat_close(&s);
+        return -1;
+    }
+    if (shmstat_snapshot(&s, buf, s.size) < 0) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        free(buf);
+        shmstat_close(&s);
+        return -1;
+    }
+    h = buf;
+
+    t = h->update / 1000000000;
+    strftime(tbuf, sizeof(tbuf), "%Y/%m/%d %H:%M:%S", localtime(&t));
+    printf("%s pid %u (%s) update %s count %llu\n",
+        (h->type == SHMSTAT_FRONT) ? "front" : "backend", h->pid,
+        shmstat_alive(s.map) ? "running" : "stopped", tbuf,
+        (unsigned long long)h->count);
+
+    /* 統計 */
+    st = SHMSTAT_PTR(h, h->stat_off, const uint64_t);
+    name = SHMSTAT_PTR(h, h->name_off, const char);
+    for (i = 0; i < h->stat_num; i++) {
+        printf("%20llu %s\n", (unsigned long long)st[i],
+            name + i * SHMSTAT_NAME_LEN);
+    }
+
+    /* 振り分けテーブル */
+    if (h->type == SHMSTAT_FRONT) {
+        printf("\npolicy no %u\n", h->pol_no);
+        p = SHMSTAT_PTR(h, h->pol_off, const struct shmstat_pol);
+        for (i = 0; i < h->pol_num; i++, p++) {
+            printf("%20llu %8u %s\n", (unsigned long long)p->hit,
+                p->client, p->line);
+        }
+        if (h->pol_drop) {
+            printf("(%u policies not shown)\n", h->pol_drop);
+        }
+    }
+
+    /* サーバ */
+    printf("\nserver\n");
+    v = SHMSTAT_PTR(h, h->svr_off, const struct shmstat_svr);
+    for (i = 0; i < h->svr_num; i++, v++) {
+        inet_ntop(v->family, v->addr, addr, sizeof(addr));
+        inet_ntop(v->family, v->gw, gw, sizeof(gw));
+        printf("%20llu %-4s %s gw %s\n", (unsigned long long)v->hit,
+            (v->status < 4) ? status[v->status] : "-", addr, gw);
+    }
+    if (h->svr_drop) {
+        printf("(%u servers not shown)\n", h->svr_drop);
+    }
+
+    /* クライアントテーブル */
+    c = SHMSTAT_PTR(h, h->cli_off, const struct shmstat_cli);
+    printf("\nclient v4 %u/%u v6 %u/%u", c->up4, c->size4, c->up6, c->size6);
+    if (h->type == SHMSTAT_BACK) {
+        printf(" (down v4 %u/%u v6 %u/%u)", c->dwn4, c->size4, c->dwn6,
+            c->size6);
+    }
+    printf("\n");
+
+    free(buf);
+    shmstat_close(&s);
+    return 0;
+}
+
 /*
     コマンドオプション
 */
@@ -21,13 +21,20 @@
 
 typedef unsigned char	uchar;
 
+/*
+    振り分けスレッドの動作中に書き換えるMAC(ネクストホップの解決結果)の
+    格納領域。8byte境界の8byteとし、64bitで一度に読み書きする
+    (store_mac, load_mac)
+*/
+#define MAC_STORE_LEN   8
+
 /* 構成（一本腕、通過）*/
 enum {
     TYPE_ONE_ARM = 0,
     TYPE_TWO_ARM,
 
 #ifdef FRONT_T
-    MAX_NET_THREAD = 1,
+    MAX_NET_THREAD = 16,        /* 振り分けスレッド数の上限(thread_num) */
 #else
     MAX_NET_THREAD = 2,
 #endif
@@ -50,24 +57,54 @@ struct net_thread_info {
     } th[MAX_NET_THREAD];
 };
 
+/*
+    network処理スレッド起動時の引数
+*/
+struct net_thread_arg {
+    volatile int wait;              /* 起動結果(1:成功, -1:失敗) */
+    int no;                         /* スレッド番号 */
+};
+
+/*
+    mmap受信リング(PACKET_RX_RING, TPACKET_V3)
+*/
+struct rx_ring {
+    uint8_t *map;               /* mmap先頭 (NULLのときrecv()で受信) */
+    size_t map_size;            /* mmapサイズ */
+    uint32_t block_size;        /* ブロックサイズ */
+    uint32_t block_num;         /* ブロック数 */
+    uint32_t cur;               /* 次に処理するブロック */
+};
+
+struct xsk;
+
 /*
     translatorが使用するインターフェース情報
 */
 struct ifdata {
     int sockfd;                 /* socket */
+
+    uint32_t rx_block_size;     /* mmap受信リング ブロックサイズ */
+    uint32_t rx_block_num;      /* mmap受信リング ブロック数(0:使用しない) */
+    struct xsk *xsk;            /* AF_XDPソケット(NULL:使用しない) */
     
     uint8_t mac[ETH_ALEN];
     uint8_t v4_enable;
     uint8_t v6_enable;
 
     uint8_t fmmac[ETH_ALEN];    /* v6 multicast filter mac */
-    uint8_t _rsv[2];
+    uint8_t vnet_hdr;           /* 1:PACKET_VNET_HDR(GRO/GSO) */
+    uint8_t _rsv[1];
+    uint32_t mtu;               /* MTU(受信buffer長、リングのフレーム長の元) */
 
     struct in_addr  sip4;       /* 実IPv4 */
     struct in_addr  vip4;       /* 仮想IP */
+    uint16_t vip4_delta;        /* VLANのVIPをタグ無しのVIPへ置き換える
+                                   チェックサム差分(タグ無しは0) */
 
     struct in6_addr sip6;       /* 実IPv6 */
     struct in6_addr vip6;       /* 仮想IP */
+    uint32_t addr_seq;          /* sip,vipの更新中は奇数(seqlock) */
 
     int ping4_fd;
     int ping6_fd;
@@ -51,12 +51,14 @@ mac_resolve(struct ethhdr *eth, uint16_t prot, struct ifdata *ifdata, int len)
                (cmp_mac(ifdata->fmmac, eth->h_dest) == 0)) {
         struct ip6_hdr *ip6h = (struct ip6_hdr*)(eth+1);
         struct icmp6_hdr *icmp6h;
+        struct in6_addr vip6;
 
         if ((ip6h->ip6_nxt == IPPROTO_ICMPV6)
                 && ((icmp6h = get_icmp6_ns(ip6h, len)) != NULL)) {
             len -= NS_BASE_SIZE; 
 
-            if (check_valid_ns(ip6h, icmp6h, &ifdata->vip6, 0, len) != -1) {
+            load_vip6(ifdata, &vip6);
+            if (check_valid_ns(ip6h, icmp6h, &vip6, 0, len) != -1) {
                 send_icmp6_na(eth, ip6h, ifdata, 1);
                 return;
             }
@@ -143,8 +145,11 @@ void
 mac_resolve_uc6(struct ethhdr *eth, struct ip6_hdr *ip6h, 
                 struct icmp6_hdr *icmp6h, struct ifdata *ifdata, int len)
 {
+    struct in6_addr vip6;
+
     /* 宛先チェック */
-    if (!ifdata->v6_enable || (cmp_ipv6(&ip6h->ip6_dst, &ifdata->vip6) != 0)) {
+    load_vip6(ifdata, &vip6);
+    if (!ifdata->v6_enable || (cmp_ipv6(&ip6h->ip6_dst, &vip6) != 0)) {
 #ifdef FRONT_T
         SASAT_STAT(rx_drop);
 #else
@@ -156,7 +161,7 @@ mac_resolve_uc6(struct ethhdr *eth, struct ip6_hdr *ip6h,
     /* lengthチェック済み */
     len -= NS_BASE_SIZE;
 
-    if ( check_valid_ns(ip6h, icmp6h, &ifdata->vip6, 0, len) < 0) {
+    if ( check_valid_ns(ip6h, icmp6h, &vip6, 0, len) < 0) {
         /* invalid */
 #ifdef FRONT_T
         SASAT_STAT(rx_drop);
@@ -296,14 +301,14 @@ send_icmp6_na(struct ethhdr *s_eth, struct ip6_hdr *s_ip6h, struct ifdata *oif,
     ip6h->ip6_plen = htons(plen);
     ip6h->ip6_nxt = IPPROTO_ICMPV6;
     ip6h->ip6_hlim = 255;
-    ip6h->ip6_src = oif->vip6;
+    load_vip6(oif, &ip6h->ip6_src);
     ip6h->ip6_dst = s_ip6h->ip6_src;
     base = pseudo_sum_v6(ip6h);
 
     /* icmp header */
     na->nd_na_type = ND_NEIGHBOR_ADVERT;
     na->nd_na_flags_reserved = ND_NA_FLAG_SOLICITED;
-    na->nd_na_target = oif->vip6;
+    na->nd_na_target = ip6h->ip6_src;
 
     if (mcast) {
         na->nd_na_flags_reserved |= ND_NA_FLAG_OVERRIDE;
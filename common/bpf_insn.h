@@ -0,0 +1,202 @@
+/**
+ * file    bpf_insn.h
+ * brief   eBPF命令生成マクロ、bpf()システムコール
+ * note    COPYRIGHT FUJITSU LIMITED 2010
+ *
+ * 改版履歴(出荷後記入)
+ * 版数   日付    変更者    リリースノート
+ * ---- -------- --------- --------------------------------------------------
+ */
+#ifndef __BPF_INSN_H__
+#define __BPF_INSN_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/bpf.h>
+
+/* プログラムのライセンス */
+#define BPF_LICENSE "Apache-2.0"
+
+/*
+    命令生成(linux/samples/bpf/bpf_insn.hと同じ形式)
+*/
+#define BPF_ALU64_IMM(OP, DST, IMM) \
+    ((struct bpf_insn) { .code = BPF_ALU64 | BPF_OP(OP) | BPF_K, \
+        .dst_reg = DST, .src_reg = 0, .off = 0, .imm = IMM })
+
+#define BPF_ALU64_REG(OP, DST, SRC) \
+    ((struct bpf_insn) { .code = BPF_ALU64 | BPF_OP(OP) | BPF_X, \
+        .dst_reg = DST, .src_reg = SRC, .off = 0, .imm = 0 })
+
+#define BPF_MOV64_REG(DST, SRC) \
+    ((struct bpf_insn) { .code = BPF_ALU64 | BPF_MOV | BPF_X, \
+        .dst_reg = DST, .src_reg = SRC, .off = 0, .imm = 0 })
+
+#define BPF_MOV64_IMM(DST, IMM) \
+    ((struct bpf_insn) { .code = BPF_ALU64 | BPF_MOV | BPF_K, \
+        .dst_reg = DST, .src_reg = 0, .off = 0, .imm = IMM })
+
+#define BPF_LDX_MEM(SIZE, DST, SRC, OFF) \
+    ((struct bpf_insn) { .code = BPF_LDX | BPF_SIZE(SIZE) | BPF_MEM, \
+        .dst_reg = DST, .src_reg = SRC, .off = OFF, .imm = 0 })
+
+#define BPF_STX_MEM(SIZE, DST, SRC, OFF) \
+    ((struct bpf_insn) { .code = BPF_STX | BPF_SIZE(SIZE) | BPF_MEM, \
+        .dst_reg = DST, .src_reg = SRC, .off = OFF, .imm = 0 })
+
+#define BPF_ST_MEM(SIZE, DST, OFF, IMM) \
+    ((struct bpf_insn) { .code = BPF_ST | BPF_SIZE(SIZE) | BPF_MEM, \
+        .dst_reg = DST, .src_reg = 0, .off = OFF, .imm = IMM })
+
+#define BPF_JMP_IMM(OP, DST, IMM, OFF) \
+    ((struct bpf_insn) { .code = BPF_JMP | BPF_OP(OP) | BPF_K, \
+        .dst_reg = DST, .src_reg = 0, .off = OFF, .imm = IMM })
+
+#define BPF_JMP_REG(OP, DST, SRC, OFF) \
+    ((struct bpf_insn) { .code = BPF_JMP | BPF_OP(OP) | BPF_X, \
+        .dst_reg = DST, .src_reg = SRC, .off = OFF, .imm = 0 })
+
+#define BPF_JMP32_IMM(OP, DST, IMM, OFF) \
+    ((struct bpf_insn) { .code = BPF_JMP32 | BPF_OP(OP) | BPF_K, \
+        .dst_reg = DST, .src_reg = 0, .off = OFF, .imm = IMM })
+
+#define BPF_MOV32_IMM(DST, IMM) \
+    ((struct bpf_insn) { .code = BPF_ALU | BPF_MOV | BPF_K, \
+        .dst_reg = DST, .src_reg = 0, .off = 0, .imm = IMM })
+
+#define BPF_JMP_A(OFF) \
+    ((struct bpf_insn) { .code = BPF_JMP | BPF_JA, \
+        .dst_reg = 0, .src_reg = 0, .off = OFF, .imm = 0 })
+
+/* 2命令 */
+#define BPF_LD_MAP_FD(DST, MAP_FD) \
+    ((struct bpf_insn) { .code = BPF_LD | BPF_DW | BPF_IMM, \
+        .dst_reg = DST, .src_reg = BPF_PSEUDO_MAP_FD, .off = 0, \
+        .imm = MAP_FD }), \
+    ((struct bpf_insn) { .code = 0, .dst_reg = 0, .src_reg = 0, \
+        .off = 0, .imm = 0 })
+
+#define BPF_CALL_FUNC(FUNC) \
+    ((struct bpf_insn) { .code = BPF_JMP | BPF_CALL, \
+        .dst_reg = 0, .src_reg = 0, .off = 0, .imm = FUNC })
+
+#define BPF_EXIT_INSN() \
+    ((struct bpf_insn) { .code = BPF_JMP | BPF_EXIT, \
+        .dst_reg = 0, .src_reg = 0, .off = 0, .imm = 0 })
+
+/*
+    @brief bpf()システムコール
+*/
+static inline int
+sys_bpf(int cmd, union bpf_attr *attr)
+{
+    return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+/*
+    @brief map作成
+*/
+static inline int
+bpf_map_create(uint32_t type, uint32_t key_size, uint32_t value_size,
+    uint32_t max_entries, uint32_t flags)
+{
+    union bpf_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = type;
+    attr.key_size = key_size;
+    attr.value_size = value_size;
+    attr.max_entries = max_entries;
+    attr.map_flags = flags;
+    return sys_bpf(BPF_MAP_CREATE, &attr);
+}
+
+/*
+    @brief map更新
+*/
+static inline int
+bpf_map_update(int fd, const void *key, const void *value, uint64_t flags)
+{
+    union bpf_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = fd;
+    attr.key = (uint64_t)(unsigned long)key;
+    attr.value = (uint64_t)(unsigned long)value;
+    attr.flags = flags;
+    return sys_bpf(BPF_MAP_UPDATE_ELEM, &attr);
+}
+
+/*
+    @brief map参照
+*/
+static inline int
+bpf_map_lookup(int fd, const void *key, void *value)
+{
+    union bpf_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = fd;
+    attr.key = (uint64_t)(unsigned long)key;
+    attr.value = (uint64_t)(unsigned long)value;
+    return sys_bpf(BPF_MAP_LOOKUP_ELEM, &attr);
+}
+
+/*
+    @brief プログラムロード
+    @param log  verifierログ格納先(NULLの場合取得しない)
+*/
+static inline int
+bpf_prog_load(uint32_t type, const struct bpf_insn *insns, int cnt,
+    char *log, int log_size)
+{
+    union bpf_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = type;
+    attr.insns = (uint64_t)(unsigned long)insns;
+    attr.insn_cnt = cnt;
+    attr.license = (uint64_t)(unsigned long)BPF_LICENSE;
+    if (log) {
+        log[0] = '\0';
+        attr.log_buf = (uint64_t)(unsigned long)log;
+        attr.log_size = log_size;
+        attr.log_level = 1;
+    }
+    return sys_bpf(BPF_PROG_LOAD, &attr);
+}
+
+/*
+    @brief XDPプログラムをインターフェースへ接続
+    linkのfdをcloseすると外れる
+*/
+static inline int
+bpf_xdp_link(int prog_fd, int ifindex, uint32_t xdp_flags)
+{
+    union bpf_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.link_create.prog_fd = prog_fd;
+    attr.link_create.target_ifindex = ifindex;
+    attr.link_create.attach_type = BPF_XDP;
+    attr.link_create.flags = xdp_flags;
+    return sys_bpf(BPF_LINK_CREATE, &attr);
+}
+
+/*
+    @brief 接続中のプログラムを入れ替える(パケット処理は止まらない)
+*/
+static inline int
+bpf_link_update(int link_fd, int prog_fd)
+{
+    union bpf_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.link_update.link_fd = link_fd;
+    attr.link_update.new_prog_fd = prog_fd;
+    return sys_bpf(BPF_LINK_UPDATE, &attr);
+}
+
+#endif
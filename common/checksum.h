@@ -130,4 +130,28 @@ calc_chksum_delta(struct in_addr *old, struct in_addr *new)
     return ~sum;
 }
 
+/*
+    @brief VLANのVIPをタグ無しのVIPへ置き換えるチェックサム差分を設定
+    振り分けの差分(タグ無しのVIP -> サーバ)はセグメントによらず共通のため、
+    VLANのVIP宛てのフレームはこの差分を先に加える
+*/
+static inline void
+set_vip4_delta(struct ifdata *seg, struct ifdata *base)
+{
+    seg->vip4_delta = calc_chksum_delta(&seg->vip4, &base->vip4);
+}
+
+/*
+    @brief 宛先をVIPからサーバへ書き換えた後のIPチェックサム
+    @param seg   受信したセグメント
+    @param sum   書き換え前のチェックサム(ホストバイトオーダ)
+    @param delta タグ無しのVIPからサーバへの差分
+    @return 書き換え後のチェックサム(ホストバイトオーダ)
+*/
+static inline uint16_t
+rewrite_ip_sum(const struct ifdata *seg, uint16_t sum, uint16_t delta)
+{
+    return add16forCheckSum(add16forCheckSum(sum, seg->vip4_delta), delta);
+}
+
 #endif
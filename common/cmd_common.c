@@ -17,6 +17,7 @@
 #include <sys/un.h>
 
 #include "cmd_common.h"
+#include "shmstat.h"
 
 static void ssat_handler_hup(int sig);
 static void proc_ud_request(int soc);
@@ -48,7 +49,11 @@ command_proc(void)
 
     signal (SIGHUP, ssat_handler_hup);
 
+    /* 共有メモリの統計(作成できなくても処理は継続する) */
+    shmstat_init();
+
     timeout_init(&tv);
+    shmstat_update(&tv);
 
 #ifdef PROFILE
     start = rdtsc();
@@ -69,6 +74,7 @@ command_proc(void)
             proc_sig_check();
         }
         timeout_init(&tv);
+        shmstat_update(&tv);
 #ifdef PROFILE
         end = rdtsc();
         if ( get_sec(end - start) > PROFILE_SEC) {
@@ -136,6 +142,12 @@ proc_ud_request(int soc)
         SASAT_STAT(cmd_upd_policy);
         update_policy();
         break;
+#else
+    case UD_POLICY_UPD:
+        /* インターフェース情報の再読み込み */
+        SASAT_STAT(cmd_upd_if);
+        update_if();
+        break;
 #endif
     case UD_EVTR:
         /* イベントトレースの取得on/off */
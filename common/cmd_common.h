@@ -49,6 +49,7 @@ enum {
     LOG_CLI     = 1 << 3,
     LOG_STAT2   = 1 << 4,
     LOG_SVR     = 1 << 5,
+    LOG_PROF    = 1 << 6,
 };
 
 #endif
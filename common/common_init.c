@@ -18,6 +18,7 @@
 #include <fcntl.h>
 #include <ifaddrs.h>
 #include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <sys/socket.h>
 #include <sys/types.h>
@@ -25,21 +26,43 @@
 #include <sys/syscall.h>
 #include <sys/ioctl.h> 
 #include <sys/un.h>
+#include <sys/mman.h>
 #include <net/if.h>
-#include <netpacket/packet.h>
+#include <linux/if_packet.h>
+#include <linux/filter.h>
 #include <net/ethernet.h>
 #include <linux/sysctl.h>
+#include <linux/mempolicy.h>
+#include <linux/if_vlan.h>
+#include <linux/sockios.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
+#ifndef PACKET_IGNORE_OUTGOING
+#define PACKET_IGNORE_OUTGOING  23
+#endif
+
 #include "util_inline.h"
+#include "checksum.h"
+#include "xsk.h"
+#include "pktio.h"
 
 static struct ifaddrs *ifap0 = NULL;
+static struct vlan_info vlan_none;      /* VLAN無し(表を確保できない場合) */
+static struct vlan_info *vlan_pending;  /* 再読み込みで作成した表(未反映) */
 
 static void set_max_buffer(void);
 static int cre_ud_socket(const char *file_name);
 static int get_ifaddr_info(struct ifdata *ifdata);
 static void free_ifaddr_info(void);
+static void get_ring_info(struct ifdata *ifdata);
+static void set_fmmac(struct ifdata *ifdata);
+static void get_vlan_info(struct ifdata *parent);
+static void vlan_close_unused(struct vlan_info *v, struct vlan_info *cur);
+static const char *get_token(const char *str, int n, char *buf, int size);
+static int init_rx_ring(int soc, struct ifdata *ifdata, struct rx_ring *ring);
+static int parse_cpu_list(const char *, cpu_set_t *, int *, int);
+static void publish_ifdata(struct ifdata *ifd, const struct ifdata *tmp);
 
 /*
     @brief インターフェース情報をプロパティファイルから取得
@@ -58,6 +81,7 @@ get_interface_info(struct ifdata *if_in, struct ifdata *if_eg)
     strncpy(if_in->ifname, str, IFNAMSIZ);
 
     get_ifaddr_info(if_in);
+    get_ring_info(if_in);
 
 #ifdef BACKEND_T
     str = anycast_get_properties(KEY_IFNAME_EGRESS);
@@ -68,6 +92,7 @@ get_interface_info(struct ifdata *if_in, struct ifdata *if_eg)
 
     strncpy(if_eg->ifname, str, IFNAMSIZ);
     get_ifaddr_info(if_eg);
+    get_ring_info(if_eg);
 #endif
 
     free_ifaddr_info();
@@ -120,33 +145,316 @@ get_interface_info(struct ifdata *if_in, struct ifdata *if_eg)
     }
     mlog("vip mode = %d", vip_mode);
 
-    memset(if_in->fmmac, 0, ETH_ALEN);
-    if (if_in->v6_enable) {
-        if_in->fmmac[0] = 0x33;
-        if_in->fmmac[1] = 0x33;
-        if_in->fmmac[2] = 0xff;
-        if_in->fmmac[3] = if_in->vip6.s6_addr[13];
-        if_in->fmmac[4] = if_in->vip6.s6_addr[14];
-        if_in->fmmac[5] = if_in->vip6.s6_addr[15];
-    }
+    set_fmmac(if_in);
 #ifdef BACKEND_T
-    memset(if_eg->fmmac, 0, ETH_ALEN);
-    if (if_eg->v6_enable) {
-        if_eg->fmmac[0] = 0x33;
-        if_eg->fmmac[1] = 0x33;
-        if_eg->fmmac[2] = 0xff;
-        if_eg->fmmac[3] = if_eg->vip6.s6_addr[13];
-        if_eg->fmmac[4] = if_eg->vip6.s6_addr[14];
-        if_eg->fmmac[5] = if_eg->vip6.s6_addr[15];
-    }
+    set_fmmac(if_eg);
 #endif
 
+    /* クライアント側のVLAN */
+    get_vlan_info(if_in);
+
 #ifdef FRONT_T
     return TYPE_ONE_ARM;
 #else
     return TYPE_TWO_ARM;
 #endif
 }
+
+/*
+    @brief インターフェース情報の再読み込み(振り分けスレッド動作中に呼ぶ)
+    作業領域に取得し直してから変更のあった項目だけを反映する
+    (取得中にMAC等が一時的に0になるのを振り分けスレッドに見せない)
+*/
+void
+reload_interface_info(struct ifdata *if_in, struct ifdata *if_eg)
+{
+    struct ifdata tmp_in, tmp_eg;
+
+    tmp_in = *if_in;
+    tmp_eg = *if_eg;
+    (void)get_interface_info(&tmp_in, &tmp_eg);
+
+    publish_ifdata(if_in, &tmp_in);
+#ifdef BACKEND_T
+    publish_ifdata(if_eg, &tmp_eg);
+#endif
+}
+
+/*
+    @brief 作業領域のインターフェース情報のうち変更された項目を反映
+    ソケット、受信リング等の再作成が必要な項目(MTUを含む)は反映しない
+*/
+static void
+publish_ifdata(struct ifdata *ifd, const struct ifdata *tmp)
+{
+    static const uint8_t zero[ETH_ALEN];
+
+    if (strcmp(ifd->ifname, tmp->ifname) != 0) {
+        mlog("interface %s -> %s", ifd->ifname, tmp->ifname);
+        memcpy(ifd->ifname, tmp->ifname, sizeof(ifd->ifname));
+    }
+    /* 取得できなかった(0のままの)MACでは上書きしない */
+    if ((memcmp(ifd->mac, tmp->mac, ETH_ALEN) != 0) &&
+            (memcmp(tmp->mac, zero, ETH_ALEN) != 0)) {
+        copy_mac(ifd->mac, tmp->mac);
+    }
+    if ((ifd->sip4.s_addr != tmp->sip4.s_addr) ||
+            (ifd->vip4.s_addr != tmp->vip4.s_addr) ||
+            (memcmp(&ifd->sip6, &tmp->sip6, sizeof(ifd->sip6)) != 0) ||
+            (memcmp(&ifd->vip6, &tmp->vip6, sizeof(ifd->vip6)) != 0)) {
+        /* 更新中はaddr_seqを奇数にする(読み出し側はload_vip6) */
+        __atomic_store_n(&ifd->addr_seq, ifd->addr_seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        __atomic_store_n(&ifd->sip4.s_addr, tmp->sip4.s_addr,
+            __ATOMIC_RELAXED);
+        __atomic_store_n(&ifd->vip4.s_addr, tmp->vip4.s_addr,
+            __ATOMIC_RELAXED);
+        ifd->sip6 = tmp->sip6;
+        ifd->vip6 = tmp->vip6;
+        __atomic_store_n(&ifd->addr_seq, ifd->addr_seq + 1, __ATOMIC_RELEASE);
+    }
+    if (memcmp(ifd->fmmac, tmp->fmmac, ETH_ALEN) != 0) {
+        copy_mac(ifd->fmmac, tmp->fmmac);
+    }
+    if (ifd->mtu != tmp->mtu) {
+        /* 受信buffer等はMTUから作成済みのため再起動まで反映しない */
+        mlog("interface(%s) mtu %u -> %u needs restart", ifd->ifname,
+            ifd->mtu, tmp->mtu);
+    }
+    if (ifd->v4_enable != tmp->v4_enable) {
+        __atomic_store_n(&ifd->v4_enable, tmp->v4_enable, __ATOMIC_RELEASE);
+    }
+    if (ifd->v6_enable != tmp->v6_enable) {
+        __atomic_store_n(&ifd->v6_enable, tmp->v6_enable, __ATOMIC_RELEASE);
+    }
+}
+/*
+    @brief NSを受信するsolicited-node multicastのMAC
+*/
+static void
+set_fmmac(struct ifdata *ifdata)
+{
+    memset(ifdata->fmmac, 0, ETH_ALEN);
+    if (ifdata->v6_enable) {
+        ifdata->fmmac[0] = 0x33;
+        ifdata->fmmac[1] = 0x33;
+        ifdata->fmmac[2] = 0xff;
+        ifdata->fmmac[3] = ifdata->vip6.s6_addr[13];
+        ifdata->fmmac[4] = ifdata->vip6.s6_addr[14];
+        ifdata->fmmac[5] = ifdata->vip6.s6_addr[15];
+    }
+}
+
+/*
+    @brief カンマ区切りのn番目の要素を取り出す
+    @return buf(要素が無い場合は空文字列)
+*/
+static const char *
+get_token(const char *str, int n, char *buf, int size)
+{
+    const char *end;
+    int len;
+
+    buf[0] = '\0';
+    if (str == NULL) {
+        return buf;
+    }
+    for (; n > 0; n--) {
+        if ((str = strchr(str, ',')) == NULL) {
+            return buf;
+        }
+        str++;
+    }
+    if ((end = strchr(str, ',')) == NULL) {
+        end = str + strlen(str);
+    }
+    while ((str < end) && (*str == ' ')) {
+        str++;
+    }
+    len = ((end - str) < (size - 1)) ? (end - str) : (size - 1);
+    memcpy(buf, str, len);
+    buf[len] = '\0';
+    return buf;
+}
+
+/*
+    @brief VLANサブインターフェースの情報を取得(in.vlan)
+    VLAN毎のVIPはin.vlan.ip4, in.vlan.ip6にin.vlanと同じ順で指定する
+    (実IPモードではサブインターフェースのアドレスを使用する)
+    ARP/ND応答はサブインターフェースにbindしたソケットから送信し、
+    カーネルがタグを付ける。再読み込み時もソケットは引き継ぐ
+    初回は作成した表をそのまま使い、再読み込みでは作成した表を保留して
+    vlan_commit()で振り分けテーブルと同時に入れ替える
+    @param parent タグ無しのインターフェース
+*/
+static void
+get_vlan_info(struct ifdata *parent)
+{
+    struct vlan_info *cur = vlan_in, *v;
+    struct vlan_ioctl_args req;
+    struct ifdata *ifd;
+    const char *names, *ip4, *ip6;
+    char name[IFNAMSIZ], addr[INET6_ADDRSTRLEN];
+    int fd, i, j, num, sockfd[VLAN_MAX];
+
+    /* 前回の再読み込みで反映しなかった表は破棄 */
+    vlan_abort();
+
+    if ((v = calloc(1, sizeof(*v))) == NULL) {
+        mlog("vlan table alloc failed");
+        if (cur == NULL) {
+            vlan_in = &vlan_none;
+        }
+        return;
+    }
+
+    names = anycast_get_properties(KEY_VLAN);
+    ip4 = anycast_get_properties(KEY_VLAN_IP4);
+    ip6 = anycast_get_properties(KEY_VLAN_IP6);
+
+    /* 送信ソケットは同じサブインターフェースのものを引き継ぐ */
+    for (i = 0; cur && (i < cur->num); i++) {
+        sockfd[i] = cur->ifd[i].sockfd;
+    }
+
+    if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+        names = NULL;
+    }
+
+    num = 0;
+    for (i = 0; (num < VLAN_MAX) && names &&
+            (*get_token(names, i, name, sizeof(name)) != '\0'); i++) {
+        memset(&req, 0, sizeof(req));
+        req.cmd = GET_VLAN_VID_CMD;
+        snprintf(req.device1, sizeof(req.device1), "%s", name);
+        if ((ioctl(fd, SIOCGIFVLAN, &req) < 0) || (req.u.VID <= 0) ||
+                (req.u.VID >= VLAN_VID_NUM)) {
+            mlog("vlan(%s) not a vlan interface", name);
+            continue;
+        }
+
+        for (j = 0; cur && (j < cur->num); j++) {
+            if ((sockfd[j] > 0) && (strcmp(cur->ifd[j].ifname, name) == 0)) {
+                break;
+            }
+        }
+        ifd = &v->ifd[num];
+        snprintf(ifd->ifname, sizeof(ifd->ifname), "%s", name);
+        get_ifaddr_info(ifd);
+        if (cur && (j < cur->num)) {
+            ifd->sockfd = sockfd[j];
+            sockfd[j] = 0;
+        } else if ((ifd->sockfd = tx_socket(ifd, 0)) < 0) {
+            mlog("vlan(%s) socket error", name);
+            memset(ifd, 0, sizeof(*ifd));
+            continue;
+        }
+
+        if (vip_mode == 1) {
+            if (ifd->v4_enable && (inet_pton(AF_INET,
+                    get_token(ip4, i, addr, sizeof(addr)), &ifd->vip4) != 1)) {
+                ifd->v4_enable = 0;
+            }
+            if (ifd->v6_enable && (inet_pton(AF_INET6,
+                    get_token(ip6, i, addr, sizeof(addr)), &ifd->vip6) != 1)) {
+                ifd->v6_enable = 0;
+            }
+        } else {
+            ifd->vip4 = ifd->sip4;
+            ifd->vip6 = ifd->sip6;
+        }
+        set_vip4_delta(ifd, parent);
+        set_fmmac(ifd);
+
+        v->vid[num] = req.u.VID;
+        mlog("vlan(%s) id %d parent %s v4 %d v6 %d", name, req.u.VID,
+            parent->ifname, ifd->v4_enable, ifd->v6_enable);
+        num++;
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    free_ifaddr_info();
+
+    for (i = 0; i < num; i++) {
+        v->idx[v->vid[i]] = i + 1;
+    }
+    v->num = num;
+
+    if (cur == NULL) {
+        vlan_in = v;
+    } else {
+        /* 振り分けスレッドが参照中のため入れ替えは振り分けテーブルと同時 */
+        vlan_pending = v;
+    }
+}
+
+/*
+    @brief 再読み込みしたVLANの表を反映(コマンドスレッドから呼ぶ)
+    振り分けテーブルの入れ替えの直前に呼び、同じ猶予期間を待ってから
+    古い表をvlan_release()で解放する
+    @return 古い表(NULL:入れ替え無し)
+*/
+struct vlan_info *
+vlan_commit(void)
+{
+    struct vlan_info *old = vlan_in;
+
+    if (vlan_pending == NULL) {
+        return NULL;
+    }
+    __atomic_store_n(&vlan_in, vlan_pending, __ATOMIC_RELEASE);
+    vlan_pending = NULL;
+    return old;
+}
+
+/*
+    @brief 再読み込みしたVLANの表を破棄(反映しない場合)
+*/
+void
+vlan_abort(void)
+{
+    if (vlan_pending) {
+        vlan_close_unused(vlan_pending, vlan_in);
+        free(vlan_pending);
+        vlan_pending = NULL;
+    }
+}
+
+/*
+    @brief 入れ替えた古いVLANの表を解放(猶予期間後に呼ぶ)
+    指定されなくなったVLANのソケットはここで閉じる
+*/
+void
+vlan_release(struct vlan_info *old)
+{
+    if ((old == NULL) || (old == &vlan_none)) {
+        return;
+    }
+    vlan_close_unused(old, vlan_in);
+    free(old);
+}
+
+/*
+    @brief 表のソケットのうち現在の表で使用していないものを閉じる
+*/
+static void
+vlan_close_unused(struct vlan_info *v, struct vlan_info *cur)
+{
+    int i, j;
+
+    for (i = 0; i < v->num; i++) {
+        for (j = 0; cur && (j < cur->num); j++) {
+            if (cur->ifd[j].sockfd == v->ifd[i].sockfd) {
+                break;
+            }
+        }
+        if ((v->ifd[i].sockfd > 0) && !(cur && (j < cur->num))) {
+            close(v->ifd[i].sockfd);
+        }
+    }
+}
+
 /*
     @brief 指定インターフェースのIPアドレス情報を取得
 */
@@ -229,11 +537,19 @@ mymac:
 
         ioctl(fd, SIOCGIFHWADDR, &ifr);
         memcpy(ifdata->mac, &ifr.ifr_hwaddr.sa_data[0], ETH_ALEN);
+
+        /* 受信buffer等はMTUから求める(jumbo frame) */
+        if (ioctl(fd, SIOCGIFMTU, &ifr) == 0) {
+            ifdata->mtu = ifr.ifr_mtu;
+        }
         close(fd);
     }
+    if (ifdata->mtu < ETH_DATA_LEN) {
+        ifdata->mtu = ETH_DATA_LEN;
+    }
 
-    mlog("interface(%s) v4 %s, v6 %s", ifdata->ifname,
-            enbl[ifdata->v4_enable], enbl[ifdata->v6_enable]);
+    mlog("interface(%s) v4 %s, v6 %s, mtu %u", ifdata->ifname,
+            enbl[ifdata->v4_enable], enbl[ifdata->v6_enable], ifdata->mtu);
 
     return 0;
 }
@@ -246,17 +562,298 @@ static void free_ifaddr_info(void)
     }
 }
 
+/*
+    @brief mmap受信リングの設定をプロパティファイルから取得
+    vnet_hdrを使用する場合はGROで結合されたフレームをrecv()で受信する
+*/
+static void
+get_ring_info(struct ifdata *ifdata)
+{
+    long size, num;
+
+    ifdata->rx_block_size = ifdata->rx_block_num = 0;
+
+    ifdata->vnet_hdr = (anycast_get_properties_int(KEY_VNET_HDR) != 0) &&
+        (anycast_get_properties_int(KEY_IO_MODE) != IO_MODE_XDP);
+    if (ifdata->vnet_hdr) {
+        mlog("rx vnet hdr(%s)", ifdata->ifname);
+        return;
+    }
+
+    if (anycast_get_properties_int(KEY_RX_RING) == 0) {
+        /* recv()で受信 */
+        return;
+    }
+
+    if ((size = anycast_get_properties_int(KEY_RX_BLOCK_SIZE)) <= 0) {
+        size = RX_BLOCK_SIZE_DEFAULT;
+    }
+    if ((num = anycast_get_properties_int(KEY_RX_BLOCK_NUM)) <= 0) {
+        num = RX_BLOCK_NUM_DEFAULT;
+    }
+
+    /* ブロックサイズはページサイズの倍数(最大長のフレームが入ること) */
+    if (size < RX_RING_FRAME_SIZE(ifdata)) {
+        size = RX_RING_FRAME_SIZE(ifdata);
+    }
+    size = (size + getpagesize() - 1) & ~(getpagesize() - 1);
+
+    /* リング全体の長さはカーネルが32bitで扱う */
+    if ((size_t)num > (RX_RING_SIZE_MAX / (size_t)size)) {
+        mlog("rx ring(%s) block size %ld * num %ld too large, use recv()",
+            ifdata->ifname, size, num);
+        return;
+    }
+
+    ifdata->rx_block_size = size;
+    ifdata->rx_block_num = num;
+
+    mlog("rx ring(%s) block size %ld, block num %ld", ifdata->ifname,
+        size, num);
+}
+
+/*
+    @brief PACKET_FANOUTグループへ参加(bind後に行う)
+    同じグループのソケットへフローのハッシュ単位で受信を分散する
+    @param soc   ソケット
+    @param group グループID(下位16bit)
+*/
+int
+join_fanout(int soc, int group)
+{
+    int opt = (group & 0xffff) | (PACKET_FANOUT_HASH << 16);
+    char buf[32];
+
+    if (setsockopt(soc, SOL_PACKET, PACKET_FANOUT, &opt, sizeof(opt)) < 0) {
+        syslog(LOG_ERR, "socket error PACKET_FANOUT(%s)",
+            strerror_r(errno, buf, sizeof(buf)));
+        return -1;
+    }
+    return 0;
+}
+
+/*
+    受信フィルタ(classic BPF)の生成
+    ジャンプ先はラベルで指定し、生成後にオフセットへ変換する
+*/
+#define SF_INSN_MAX     64
+#define SF_ACCEPT_LEN   0x40000     /* 受信長(フレーム全体) */
+
+enum {
+    SF_NEXT = 0,        /* 次の命令 */
+    SF_PROTO,           /* ethertype判定 */
+    SF_ARP,
+    SF_IP4,
+    SF_IP6,
+    SF_IP6_ND,          /* v6アドレス不一致時(NSの判定) */
+    SF_ACCEPT,          /* 受信 */
+    SF_DROP,            /* 破棄 */
+    SF_LABEL_NUM
+};
+
+struct sf_prog {
+    struct sock_filter insn[SF_INSN_MAX];
+    uint8_t jt[SF_INSN_MAX];        /* ジャンプ先ラベル */
+    uint8_t jf[SF_INSN_MAX];
+    int label[SF_LABEL_NUM];        /* ラベルの命令位置 */
+    int num;
+};
+
+static void
+sf_emit(struct sf_prog *p, uint16_t code, uint32_t k, int jt, int jf)
+{
+    if (p->num < SF_INSN_MAX) {
+        p->insn[p->num] = (struct sock_filter)BPF_STMT(code, k);
+        p->jt[p->num] = jt;
+        p->jf[p->num] = jf;
+    }
+    p->num++;
+}
+
+static inline void
+sf_label(struct sf_prog *p, int l)
+{
+    p->label[l] = p->num;
+}
+
+/*
+    @brief 4byte単位でアドレスを比較(全て一致でjt、不一致でjf)
+*/
+static void
+sf_cmp(struct sf_prog *p, uint32_t off, const uint8_t *a, int len,
+    int jt, int jf)
+{
+    int i;
+
+    for (i = 0; i < len; i += 4) {
+        sf_emit(p, BPF_LD | BPF_W | BPF_ABS, off + i, SF_NEXT, SF_NEXT);
+        sf_emit(p, BPF_JMP | BPF_JEQ | BPF_K,
+            ((uint32_t)a[i] << 24) | (a[i+1] << 16) | (a[i+2] << 8) | a[i+3],
+            ((i + 4) < len) ? SF_NEXT : jt, jf);
+    }
+}
+
+/*
+    @brief MACアドレスを比較
+*/
+static void
+sf_cmp_mac(struct sf_prog *p, uint32_t off, const uint8_t *m, int jt, int jf)
+{
+    sf_cmp(p, off, m, 4, SF_NEXT, jf);
+    sf_emit(p, BPF_LD | BPF_H | BPF_ABS, off + 4, SF_NEXT, SF_NEXT);
+    sf_emit(p, BPF_JMP | BPF_JEQ | BPF_K, (m[4] << 8) | m[5], jt, jf);
+}
+
+/*
+    @brief ラベルをジャンプオフセットへ変換(前方へのジャンプのみ)
+    @return 0:正常 -1:生成できない
+*/
+static int
+sf_fixup(struct sf_prog *p)
+{
+    int i, jt, jf;
+
+    if (p->num > SF_INSN_MAX) {
+        return -1;
+    }
+    for (i = 0; i < p->num; i++) {
+        if (BPF_CLASS(p->insn[i].code) != BPF_JMP) {
+            continue;
+        }
+        jt = (p->jt[i] == SF_NEXT) ? 0 : (p->label[p->jt[i]] - i - 1);
+        jf = (p->jf[i] == SF_NEXT) ? 0 : (p->label[p->jf[i]] - i - 1);
+        if ((jt < 0) || (jt > 255) || (jf < 0) || (jf > 255)) {
+            return -1;
+        }
+        p->insn[i].jt = jt;
+        p->insn[i].jf = jf;
+    }
+    return 0;
+}
+
+/*
+    @brief 受信フィルタを設定
+    振り分け処理の対象となるフレームのみカーネルからコピーする
+      クライアント側: VIP宛てのIP、VIP宛てのARP、solicited-node multicast
+      サーバ側(backend): 自MAC宛て、またはmulticast以外のIP(サーバからの
+        送信は全て転送する)、ARP要求、NSのsolicited-node multicast
+      VLANタグ付き(in.vlan指定時): 全て(VLAN毎のVIPは振り分けスレッドで判定)
+    自インターフェースのMACから送信したフレーム、送信専用ソケット等から
+    送信したフレーム(PACKET_OUTGOING)は受信しない
+    (インターフェース情報を再読み込みした場合は再設定する)
+    @param soc 受信ソケット
+    @param egress 1:サーバ側インターフェース
+    @return 0:正常 -1:異常(フィルタ無しで受信する)
+*/
+int
+attach_sock_filter(int soc, struct ifdata *ifdata, int egress)
+{
+    struct sf_prog p;
+    struct sock_fprog fprog;
+    char buf[32];
+
+    if (anycast_get_properties_int(KEY_RX_FILTER) == 0) {
+        return 0;
+    }
+
+    memset(&p, 0, sizeof(p));
+
+    /* 送信したフレーム(PACKET_IGNORE_OUTGOINGが無いカーネル用) */
+    sf_emit(&p, BPF_LD | BPF_B | BPF_ABS, SKF_AD_OFF + SKF_AD_PKTTYPE,
+        SF_NEXT, SF_NEXT);
+    sf_emit(&p, BPF_JMP | BPF_JEQ | BPF_K, PACKET_OUTGOING, SF_DROP, SF_NEXT);
+
+    /* 自MACからの送信は破棄 */
+    sf_cmp_mac(&p, ETH_ALEN, ifdata->mac, SF_DROP, SF_PROTO);
+
+    sf_label(&p, SF_PROTO);
+    if (!egress && vlan_in->num) {
+        /* タグ付きは受信する */
+        sf_emit(&p, BPF_LD | BPF_B | BPF_ABS,
+            SKF_AD_OFF + SKF_AD_VLAN_TAG_PRESENT, SF_NEXT, SF_NEXT);
+        sf_emit(&p, BPF_JMP | BPF_JEQ | BPF_K, 1, SF_ACCEPT, SF_NEXT);
+    }
+    sf_emit(&p, BPF_LD | BPF_H | BPF_ABS, 12, SF_NEXT, SF_NEXT);
+    sf_emit(&p, BPF_JMP | BPF_JEQ | BPF_K, ETH_P_ARP, SF_ARP, SF_NEXT);
+    sf_emit(&p, BPF_JMP | BPF_JEQ | BPF_K, ETH_P_IP, SF_IP4, SF_NEXT);
+    sf_emit(&p, BPF_JMP | BPF_JEQ | BPF_K, ETH_P_IPV6, SF_IP6, SF_DROP);
+
+    /* ARP: ターゲットIP(オフセット38)、サーバ側は要求(代理応答する)のみ */
+    sf_label(&p, SF_ARP);
+    if (!ifdata->v4_enable) {
+        sf_emit(&p, BPF_RET | BPF_K, 0, SF_NEXT, SF_NEXT);
+    } else if (egress) {
+        sf_emit(&p, BPF_LD | BPF_H | BPF_ABS, 20, SF_NEXT, SF_NEXT);
+        sf_emit(&p, BPF_JMP | BPF_JEQ | BPF_K, ARPOP_REQUEST,
+            SF_ACCEPT, SF_DROP);
+    } else {
+        sf_cmp(&p, 38, (const uint8_t *)&ifdata->vip4, 4, SF_ACCEPT, SF_DROP);
+    }
+
+    /* IPv4: 宛先IP(オフセット30)、サーバ側はmulticast宛て以外 */
+    sf_label(&p, SF_IP4);
+    if (!ifdata->v4_enable) {
+        sf_emit(&p, BPF_RET | BPF_K, 0, SF_NEXT, SF_NEXT);
+    } else if (egress) {
+        sf_emit(&p, BPF_LD | BPF_B | BPF_ABS, 0, SF_NEXT, SF_NEXT);
+        sf_emit(&p, BPF_JMP | BPF_JSET | BPF_K, 0x01, SF_DROP, SF_ACCEPT);
+    } else {
+        sf_cmp(&p, 30, (const uint8_t *)&ifdata->vip4, 4, SF_ACCEPT, SF_DROP);
+    }
+
+    /* IPv6: 宛先IP(オフセット38)、NSのmulticast宛て
+       (サーバ側はmulticast宛て以外とsolicited-node multicast) */
+    sf_label(&p, SF_IP6);
+    if (!ifdata->v6_enable) {
+        sf_emit(&p, BPF_RET | BPF_K, 0, SF_NEXT, SF_NEXT);
+    } else if (egress) {
+        sf_emit(&p, BPF_LD | BPF_B | BPF_ABS, 0, SF_NEXT, SF_NEXT);
+        sf_emit(&p, BPF_JMP | BPF_JSET | BPF_K, 0x01, SF_IP6_ND, SF_ACCEPT);
+        sf_label(&p, SF_IP6_ND);
+        sf_emit(&p, BPF_LD | BPF_W | BPF_ABS, 0, SF_NEXT, SF_NEXT);
+        sf_emit(&p, BPF_ALU | BPF_AND | BPF_K, 0xffffff00, SF_NEXT, SF_NEXT);
+        sf_emit(&p, BPF_JMP | BPF_JEQ | BPF_K, 0x3333ff00, SF_ACCEPT, SF_DROP);
+    } else {
+        sf_cmp(&p, 38, ifdata->vip6.s6_addr, 16, SF_ACCEPT, SF_IP6_ND);
+        sf_label(&p, SF_IP6_ND);
+        sf_cmp_mac(&p, 0, ifdata->fmmac, SF_ACCEPT, SF_DROP);
+    }
+
+    sf_label(&p, SF_ACCEPT);
+    sf_emit(&p, BPF_RET | BPF_K, SF_ACCEPT_LEN, SF_NEXT, SF_NEXT);
+    sf_label(&p, SF_DROP);
+    sf_emit(&p, BPF_RET | BPF_K, 0, SF_NEXT, SF_NEXT);
+
+    if (sf_fixup(&p) != 0) {
+        mlog("rx filter(%s) too large %d", ifdata->ifname, p.num);
+        return -1;
+    }
+
+    fprog.len = p.num;
+    fprog.filter = p.insn;
+    if (setsockopt(soc, SOL_SOCKET, SO_ATTACH_FILTER,
+            &fprog, sizeof(fprog)) < 0) {
+        mlog("rx filter(%s) not available (%s)", ifdata->ifname,
+            strerror_r(errno, buf, sizeof(buf)));
+        return -1;
+    }
+    return 0;
+}
+
 /*
     @brief 受信ソケット初期化
 */
 #define MAX_BUFF_SZ 512
+#define RX_FRAME_SIZE   2048    /* TPACKET_V3では目安(可変長) */
+#define RX_RETIRE_TMO   1       /* ブロック引き渡しタイムアウト(ms) */
 #ifdef FRONT_T
 int
-init_socket_if(struct ifdata *ifdata, int * fd)
+init_socket_if(struct ifdata *ifdata, int * fd, struct rx_ring *ring)
 {
 #else
 int
-init_socket_if(struct ifdata *ifdata, int egress, int *fd)
+init_socket_if(struct ifdata *ifdata, int egress, int *fd,
+    struct rx_ring *ring)
 {
 #endif
     struct ifreq if_req;
@@ -275,6 +872,22 @@ init_socket_if(struct ifdata *ifdata, int egress, int *fd)
 
     set_max_buffer();
 
+    /* 受信フィルタ(bind前に設定し、対象外のフレームを受信しない) */
+#ifdef FRONT_T
+    (void)attach_sock_filter(soc, ifdata, 0);
+#else
+    (void)attach_sock_filter(soc, ifdata, egress);
+#endif
+
+    /* 送信したフレームを受信しない(送信専用ソケット、TX_RING、vnet_hdrの
+       ソケットから送信したフレームがPACKET_OUTGOINGとして戻るため) */
+    opt = 1;
+    if (setsockopt(soc, SOL_PACKET, PACKET_IGNORE_OUTGOING, &opt,
+            sizeof(opt)) < 0) {
+        mlog("rx ignore outgoing(%s) not available (%s)", device,
+            strerror_r(errno, buf, sizeof(buf)));
+    }
+
     /* 受信バッファサイズの設定 */
     opt = MAX_BUFF_SZ * 1024;
     setsockopt(soc, SOL_SOCKET, SO_RCVBUF,
@@ -284,6 +897,39 @@ init_socket_if(struct ifdata *ifdata, int egress, int *fd)
     setsockopt(soc, SOL_SOCKET, SO_SNDBUF,
             (char *) &opt, sizeof(opt));
 
+    /* クライアント側のVLANタグ(カーネルが外したタグを受け取る) */
+#ifdef FRONT_T
+    if (vlan_in->num) {
+#else
+    if (vlan_in->num && !egress) {
+#endif
+        opt = 1;
+        setsockopt(soc, SOL_PACKET, PACKET_AUXDATA, &opt, sizeof(opt));
+    }
+
+    /* GRO/GSO(受信フレームの前にvirtio_net_hdrが付く) */
+    if (ifdata->vnet_hdr) {
+        opt = 1;
+        if (setsockopt(soc, SOL_PACKET, PACKET_VNET_HDR, &opt,
+                sizeof(opt)) < 0) {
+            syslog(LOG_ERR, "socket error PACKET_VNET_HDR(%s)",
+                strerror_r(errno, buf, sizeof(buf)));
+            close(soc);
+            return (NET_REQ_SOCKET_ERR);
+        }
+    }
+
+    /* mmap受信リング(bind前に設定する) */
+    if (ring) {
+        memset(ring, 0, sizeof(*ring));
+        if (ifdata->rx_block_num &&
+                (init_rx_ring(soc, ifdata, ring) != 0)) {
+            /* 設定できない場合はrecv()で受信する */
+            mlog("rx ring(%s) not available (%s)", device,
+                strerror_r(errno, buf, sizeof(buf)));
+        }
+    }
+
     /* インターフェース情報の取得 */
     strncpy(if_req.ifr_name, device, sizeof(if_req.ifr_name)-1);
     if (ioctl(soc, SIOCGIFINDEX, &if_req) < 0) {
@@ -364,6 +1010,9 @@ init_socket_if(struct ifdata *ifdata, int egress, int *fd)
 init_sock_end:
 
     if (err) {
+        if (ring) {
+            free_rx_ring(ring);
+        }
         close(soc);
         return err;
     }
@@ -372,6 +1021,68 @@ init_sock_end:
     return (0);
 }
 
+/*
+    @brief mmap受信リング(TPACKET_V3)の作成
+    @return 0 正常, -1 異常(errno)
+*/
+static int
+init_rx_ring(int soc, struct ifdata *ifdata, struct rx_ring *ring)
+{
+    struct tpacket_req3 req;
+    int ver = TPACKET_V3;
+    void *map;
+
+    if (setsockopt(soc, SOL_PACKET, PACKET_VERSION, &ver, sizeof(ver)) < 0) {
+        return -1;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = ifdata->rx_block_size;
+    req.tp_block_nr = ifdata->rx_block_num;
+    req.tp_frame_size = RX_FRAME_SIZE;
+    if (req.tp_frame_size < RX_RING_FRAME_SIZE(ifdata)) {
+        req.tp_frame_size = RX_RING_FRAME_SIZE(ifdata);
+    }
+    req.tp_frame_nr = (req.tp_block_size / req.tp_frame_size) * req.tp_block_nr;
+    req.tp_retire_blk_tov = RX_RETIRE_TMO;
+    req.tp_feature_req_word = 0;
+
+    if (setsockopt(soc, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+        return -1;
+    }
+
+    map = mmap(NULL, (size_t)req.tp_block_size * req.tp_block_nr,
+            PROT_READ | PROT_WRITE, MAP_SHARED, soc, 0);
+    if (map == MAP_FAILED) {
+        int err = errno;
+        /* リングを解除してrecv()に戻す */
+        memset(&req, 0, sizeof(req));
+        setsockopt(soc, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req));
+        errno = err;
+        return -1;
+    }
+
+    ring->map = map;
+    ring->map_size = (size_t)ifdata->rx_block_size * ifdata->rx_block_num;
+    ring->block_size = ifdata->rx_block_size;
+    ring->block_num = ifdata->rx_block_num;
+    ring->cur = 0;
+
+    return 0;
+}
+
+/*
+    @brief mmap受信リングの解放
+*/
+void
+free_rx_ring(struct rx_ring *ring)
+{
+    if (ring->map) {
+        munmap(ring->map, ring->map_size);
+        ring->map = NULL;
+    }
+}
+
 /*
     送受信ﾊﾞｯﾌｧのシステム設定
 */
@@ -500,6 +1211,130 @@ uint64_t tsc_cycle_init(void)
     return (uint64_t)clk;
 }
 
+/*
+    @brief スレッドの配置(CPU固定、スケジューリング)
+    スレッドの先頭で呼ぶ。以降にスレッドが確保、初回に書き込む領域は
+    固定したCPUのNUMAノードに置かれる
+    @param name ログ表示名
+    @param key  CPUリストのプロパティ(例 "2,3" "4-7"、無しは固定しない)
+    @param no   0以上:リストのno番目(リストより多い場合は折り返す)の
+                CPUへ固定 -1:リスト全体へ固定
+    @param fifo 1:sched.fifo(優先度、0は使用しない)に従いSCHED_FIFOにする
+    @return 実行中のNUMAノード(不明の場合-1)
+*/
+int
+thread_placement(const char *name, const char *key, int no, int fifo)
+{
+    cpu_set_t set;
+    struct sched_param sp;
+    const char *str;
+    int list[CPU_SETSIZE];
+    int num, prio = 0, ret;
+    unsigned int cpu, node;
+    char buf[32], pin[32] = "any";
+
+    str = anycast_get_properties(key);
+    if ((str != NULL) &&
+            ((num = parse_cpu_list(str, &set, list, CPU_SETSIZE)) > 0)) {
+        if (no >= 0) {
+            CPU_ZERO(&set);
+            CPU_SET(list[no % num], &set);
+            snprintf(pin, sizeof(pin), "%d", list[no % num]);
+        } else {
+            snprintf(pin, sizeof(pin), "%s", str);
+        }
+        if ((ret = pthread_setaffinity_np(pthread_self(), sizeof(set),
+                &set)) != 0) {
+            mlog("%s thread affinity(%s) error (%s)", name, str,
+                strerror_r(ret, buf, sizeof(buf)));
+            strcpy(pin, "any");
+        }
+    }
+
+    if (fifo && ((prio = anycast_get_properties_int(KEY_SCHED_FIFO)) > 0)) {
+        memset(&sp, 0, sizeof(sp));
+        sp.sched_priority = prio;
+        if ((ret = pthread_setschedparam(pthread_self(), SCHED_FIFO,
+                &sp)) != 0) {
+            mlog("%s thread SCHED_FIFO %d error (%s)", name, prio,
+                strerror_r(ret, buf, sizeof(buf)));
+            prio = 0;
+        }
+    }
+
+    /* 実際の配置(固定した場合は移動後) */
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) < 0) {
+        cpu = node = -1;
+    }
+    mlog("%s thread cpu %d node %d (pinned %s) %s %d", name, (int)cpu,
+        (int)node, pin, prio ? "SCHED_FIFO" : "SCHED_OTHER", prio);
+    return (int)node;
+}
+
+/*
+    @brief 確保済みの領域をNUMAノードへ移動する
+    (領域に完全に含まれるページのみ、未割り当てのページは以降そのノードで
+    割り当てる)
+*/
+void
+numa_move(void *addr, size_t len, int node)
+{
+    unsigned long mask[2] = {0, 0};
+    uintptr_t pg = getpagesize();
+    uintptr_t start = ((uintptr_t)addr + pg - 1) & ~(pg - 1);
+    uintptr_t end = ((uintptr_t)addr + len) & ~(pg - 1);
+
+    if ((node < 0) || (node >= (int)(sizeof(mask) * 8)) || (end <= start)) {
+        return;
+    }
+    mask[node / (sizeof(long) * 8)] = 1UL << (node % (sizeof(long) * 8));
+
+    /* NUMA非対応のカーネル等では何もしない */
+    (void)syscall(SYS_mbind, start, end - start, MPOL_PREFERRED, mask,
+        sizeof(mask) * 8, MPOL_MF_MOVE);
+}
+
+/*
+    @brief CPUリスト("0,2,4-7")の解析
+    @param list 記述順のCPU番号
+    @return CPU数(書式エラーの場合0)
+*/
+static int
+parse_cpu_list(const char *str, cpu_set_t *set, int *list, int max)
+{
+    const char *p = str;
+    char *end;
+    long a, b;
+    int num = 0;
+
+    CPU_ZERO(set);
+    while (*p != '\0') {
+        a = b = strtol(p, &end, 10);
+        if ((end == p) || (a < 0)) {
+            return 0;
+        }
+        p = end;
+        if (*p == '-') {
+            p++;
+            b = strtol(p, &end, 10);
+            if ((end == p) || (b < a)) {
+                return 0;
+            }
+            p = end;
+        }
+        for (; (a <= b) && (a < CPU_SETSIZE) && (num < max); a++) {
+            CPU_SET(a, set);
+            list[num++] = a;
+        }
+        if (*p == ',') {
+            p++;
+        } else if (*p != '\0') {
+            return 0;
+        }
+    }
+    return num;
+}
+
 /*
     @brief 全シグナルをブロック
 */
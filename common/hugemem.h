@@ -0,0 +1,42 @@
+/**
+ * file    hugemem.h
+ * brief   データパス用メモリ(hugepage、事前割り当て、mlock)
+ * note    COPYRIGHT FUJITSU LIMITED 2010
+ *
+ * 改版履歴(出荷後記入)
+ * 版数   日付    変更者    リリースノート
+ * ---- -------- --------- --------------------------------------------------
+ */
+#ifndef __HUGEMEM_H__
+#define __HUGEMEM_H__
+
+#include <stddef.h>
+
+#include "anycast.h"
+
+/*
+    管理する領域数
+    振り分けスレッド毎に受信buffer、vnet buffer、送信キュー、フローテーブル
+    (v4/v6の初期領域とバケット)等を確保するためスレッド数の上限から求める。
+    共通分は静的領域、AF_XDPのUMEM、振り分けテーブル(再読み込み中は新旧2組)
+*/
+#define HUGEMEM_REGION_PER_THREAD   8
+#define HUGEMEM_REGION_COMMON       32
+#define HUGEMEM_REGION_MAX  \
+    (MAX_NET_THREAD * HUGEMEM_REGION_PER_THREAD + HUGEMEM_REGION_COMMON)
+
+/* 領域の種別 */
+enum {
+    HUGEMEM_HUGETLB = 0,    /* MAP_HUGETLB */
+    HUGEMEM_THP,            /* transparent huge page(madvise) */
+    HUGEMEM_NORMAL,         /* 通常ページ */
+    HUGEMEM_STATIC,         /* 静的領域(常駐のみ) */
+    HUGEMEM_TYPE_NUM
+};
+
+void *huge_alloc(size_t, const char *);
+void huge_free(void *);
+void huge_lock(void *, size_t, const char *);
+void huge_stat(void);
+
+#endif
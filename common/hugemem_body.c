@@ -0,0 +1,272 @@
+/**
+ * file    hugemem_body.c
+ * brief   データパス用メモリ(hugepage、事前割り当て、mlock)
+ * note    COPYRIGHT FUJITSU LIMITED 2010
+ *
+ * 改版履歴(出荷後記入)
+ * 版数   日付    変更者    リリースノート
+ * ---- -------- --------- --------------------------------------------------
+ */
+
+/*
+    振り分けスレッドが参照するテーブル、パケットバッファを確保する。
+    hugepage=1の場合、hugepageの大きさ以上の領域はMAP_HUGETLB、使用
+    できなければtransparent huge page、それも無効なら通常ページで確保する。
+    いずれも起動時に全ページを割り当て(ページフォールトを起こさない)、
+    mlock=1の場合はmlock()する。
+    確保した領域の種別、常駐サイズは統計の書き出し時に反映する
+*/
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+struct huge_region {
+    void *addr;
+    size_t len;
+    int type;
+    int locked;
+};
+
+static struct huge_region huge_reg[HUGEMEM_REGION_MAX];
+static pthread_mutex_t huge_mtx = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t huge_fallback;     /* hugepage, mlockを使用できなかった回数 */
+
+static const char *huge_type_name[HUGEMEM_TYPE_NUM] = {
+    "hugetlb", "thp", "normal", "static"
+};
+
+static size_t huge_page_size(void);
+static int huge_register(void *, size_t, int, int, const char *);
+
+/*
+    @brief データパス用メモリの確保(0クリア済み)
+    @param name ログ表示名
+    @return 領域(エラーの場合NULL、管理する領域数を超える場合もエラー)
+*/
+void *
+huge_alloc(size_t size, const char *name)
+{
+    size_t hsz = huge_page_size(), pg = getpagesize(), len;
+    uint8_t *p = MAP_FAILED, *a;
+    int type = HUGEMEM_NORMAL, locked = 0;
+    char buf[32];
+    size_t i;
+
+    if (anycast_get_properties_int(KEY_HUGEPAGE) && (size >= hsz)) {
+        len = (size + hsz - 1) & ~(hsz - 1);
+        p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+        if (p != MAP_FAILED) {
+            type = HUGEMEM_HUGETLB;
+        } else {
+            mlog("%s hugetlb %lu not available (%s)", name,
+                (unsigned long)len, strerror_r(errno, buf, sizeof(buf)));
+            __atomic_add_fetch(&huge_fallback, 1, __ATOMIC_RELAXED);
+
+            /* hugepage境界に合わせてTHPを使う */
+            a = mmap(NULL, len + hsz, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (a != MAP_FAILED) {
+                p = (uint8_t *)(((uintptr_t)a + hsz - 1) & ~(hsz - 1));
+                if (p > a) {
+                    munmap(a, p - a);
+                }
+                munmap(p + len, (a + hsz) - p);
+                if (madvise(p, len, MADV_HUGEPAGE) == 0) {
+                    type = HUGEMEM_THP;
+                }
+            }
+        }
+    }
+    if (p == MAP_FAILED) {
+        len = (size + pg - 1) & ~(pg - 1);
+        p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            return NULL;
+        }
+    }
+
+    if (type != HUGEMEM_HUGETLB) {
+        /* 事前割り当て */
+        if (madvise(p, len, MADV_POPULATE_WRITE) != 0) {
+            for (i = 0; i < len; i += pg) {
+                ((volatile uint8_t *)p)[i] = 0;
+            }
+        }
+    }
+    if (anycast_get_properties_int(KEY_MLOCK)) {
+        if (mlock(p, len) == 0) {
+            locked = 1;
+        } else {
+            mlog("%s mlock error (%s)", name,
+                strerror_r(errno, buf, sizeof(buf)));
+            __atomic_add_fetch(&huge_fallback, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    if (huge_register(p, len, type, locked, name) != 0) {
+        /* 登録できない領域は解放できず統計にも出ないため使用しない */
+        munmap(p, len);
+        return NULL;
+    }
+    return p;
+}
+
+/*
+    @brief データパス用メモリの解放
+*/
+void
+huge_free(void *p)
+{
+    int i;
+
+    if (p == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&huge_mtx);
+    for (i = 0; i < HUGEMEM_REGION_MAX; i++) {
+        if (huge_reg[i].addr == p) {
+            munmap(p, huge_reg[i].len);
+            huge_reg[i].addr = NULL;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&huge_mtx);
+}
+
+/*
+    @brief 静的領域(BSS等)を常駐させる
+    mlock()で全ページを割り当てる。mlock=0の場合は割り当てのみ
+*/
+void
+huge_lock(void *addr, size_t size, const char *name)
+{
+    size_t pg = getpagesize();
+    uintptr_t start = (uintptr_t)addr & ~(pg - 1);
+    size_t len = (((uintptr_t)addr + size + pg - 1) & ~(pg - 1)) - start;
+    int locked = 0;
+    char buf[32];
+
+    if (anycast_get_properties_int(KEY_MLOCK)) {
+        if (mlock((void *)start, len) == 0) {
+            locked = 1;
+        } else {
+            mlog("%s mlock error (%s)", name,
+                strerror_r(errno, buf, sizeof(buf)));
+            __atomic_add_fetch(&huge_fallback, 1, __ATOMIC_RELAXED);
+        }
+    }
+    if (!locked) {
+        (void)madvise((void *)start, len, MADV_POPULATE_WRITE);
+    }
+    (void)huge_register((void *)start, len, HUGEMEM_STATIC, locked, name);
+}
+
+/*
+    @brief 領域の種別毎のサイズ、常駐サイズを統計へ反映する
+    (書き出し前にコマンドスレッドから呼ぶ)
+*/
+void
+huge_stat(void)
+{
+    static const int member[HUGEMEM_TYPE_NUM] = {
+        mem_hugetlb, mem_thp, mem_normal, mem_static
+    };
+    ssz_t *st = sstat_blk[STAT_BLOCK_NUM - 1].stat;
+    size_t pg = getpagesize(), n, j;
+    unsigned char *vec;
+    int i;
+
+    for (i = 0; i < HUGEMEM_TYPE_NUM; i++) {
+        st[member[i]] = 0;
+    }
+    st[mem_resident] = st[mem_locked] = 0;
+
+    pthread_mutex_lock(&huge_mtx);
+    for (i = 0; i < HUGEMEM_REGION_MAX; i++) {
+        if (huge_reg[i].addr == NULL) {
+            continue;
+        }
+        st[member[huge_reg[i].type]] += huge_reg[i].len;
+        if (huge_reg[i].locked) {
+            st[mem_locked] += huge_reg[i].len;
+        }
+        n = huge_reg[i].len / pg;
+        if ((vec = malloc(n)) == NULL) {
+            continue;
+        }
+        if (mincore(huge_reg[i].addr, huge_reg[i].len, vec) == 0) {
+            for (j = 0; j < n; j++) {
+                if (vec[j] & 1) {
+                    st[mem_resident] += pg;
+                }
+            }
+        }
+        free(vec);
+    }
+    pthread_mutex_unlock(&huge_mtx);
+
+    st[mem_fallback] = __atomic_load_n(&huge_fallback, __ATOMIC_RELAXED);
+}
+
+/*
+    @brief hugepageの大きさ(/proc/meminfo Hugepagesize)
+*/
+static size_t
+huge_page_size(void)
+{
+    static size_t hsz;
+    char buf[128];
+    FILE *fp;
+
+    if (hsz) {
+        return hsz;
+    }
+    hsz = 2 * 1024 * 1024;
+    if ((fp = fopen("/proc/meminfo", "r")) != NULL) {
+        while (fgets(buf, sizeof(buf), fp)) {
+            if (strncmp(buf, "Hugepagesize:", 13) == 0) {
+                hsz = strtoul(buf + 13, NULL, 10) * 1024;
+                break;
+            }
+        }
+        fclose(fp);
+    }
+    return hsz;
+}
+
+/*
+    @brief 領域の登録
+    @return 0:成功 -1:管理する領域数を超えた
+*/
+static int
+huge_register(void *addr, size_t len, int type, int locked, const char *name)
+{
+    int i;
+
+    pthread_mutex_lock(&huge_mtx);
+    for (i = 0; i < HUGEMEM_REGION_MAX; i++) {
+        if (huge_reg[i].addr == NULL) {
+            huge_reg[i].addr = addr;
+            huge_reg[i].len = len;
+            huge_reg[i].type = type;
+            huge_reg[i].locked = locked;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&huge_mtx);
+
+    if (i == HUGEMEM_REGION_MAX) {
+        mlog("%s %lu bytes not registered (region max %d)", name,
+            (unsigned long)len, HUGEMEM_REGION_MAX);
+        syslog(LOG_ERR, "hugemem region table full (%s)", name);
+        return -1;
+    }
+    mlog("%s %lu bytes %s%s", name, (unsigned long)len,
+        huge_type_name[type], locked ? " locked" : "");
+    return 0;
+}
+
+/* end */
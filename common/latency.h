@@ -0,0 +1,100 @@
+/**
+ * file    latency.h
+ * brief   滞留時間(受信から送信まで)の計測
+ * note    COPYRIGHT FUJITSU LIMITED 2010
+ *
+ * 改版履歴(出荷後記入)
+ * 版数   日付    変更者    リリースノート
+ * ---- -------- --------- --------------------------------------------------
+ */
+#ifndef __LATENCY_H__
+#define __LATENCY_H__
+
+#include <stdint.h>
+#include <time.h>
+
+#include "util_inline.h"
+
+/*
+    latency.sampleのパケット毎に1つ、カーネルの受信時刻(SO_TIMESTAMPNS、
+    mmap受信リングはtpacket3_hdrの時刻)から送信直前までの時間を計る
+    結果は受信スレッド毎の対数線形ヒストグラム(2のべき乗毎に16区間、
+    誤差6%以内)に入れ、書き出し時に合算してp50,p99,p99.9を統計へ反映する
+    AF_XDP、XDP_TXで送信したフレームは計測しない
+*/
+#define LAT_SUB_BITS    4
+#define LAT_SUB         (1 << LAT_SUB_BITS)
+#define LAT_MAX_BITS    36      /* 約68秒(超える場合は最後の区間) */
+#define LAT_BUCKET_NUM  ((LAT_MAX_BITS - LAT_SUB_BITS + 2) << LAT_SUB_BITS)
+#define LAT_PEND_MAX    16      /* 送信待ちの計測数(超えた分は計測しない) */
+
+/*
+    @brief 受信スレッド毎の計測状態
+*/
+struct latency {
+    uint32_t rate;                      /* 1/rateを計測(0:計測しない) */
+    uint32_t cnt;                       /* 次の計測までのパケット数 */
+    int stat;                           /* 統計番号(計測数,p50,p99,p99.9の順) */
+    int pend;                           /* 送信待ちの計測数 */
+    struct timespec rx;                 /* 処理中フレームの受信時刻(0:対象外) */
+    struct timespec pend_rx[LAT_PEND_MAX];
+    uint64_t hist[LAT_BUCKET_NUM];      /* ヒストグラム(ns) */
+};
+
+int lat_init(struct latency *, int, int, int);
+void lat_flush(struct latency *);
+void lat_stat(void);
+
+/*
+    @brief 次のフレームを計測するか
+    @return 1:計測する(受信時刻をrxへ設定する)
+*/
+static inline int
+lat_pick(struct latency *l)
+{
+    if (likely(l->rate == 0)) {
+        return 0;
+    }
+    l->rx.tv_sec = 0;
+    if (likely(--l->cnt != 0)) {
+        return 0;
+    }
+    l->cnt = l->rate;
+    return 1;
+}
+
+/*
+    @brief 受信処理の終わり(送信しなかった計測対象を外す)
+*/
+static inline void
+lat_end(struct latency *l)
+{
+    l->rx.tv_sec = 0;
+}
+
+/*
+    @brief 送信キューへ格納したフレームが計測対象なら送信待ちにする
+*/
+static inline void
+lat_queued(struct latency *l)
+{
+    if (unlikely(l->rx.tv_sec != 0)) {
+        if (l->pend < LAT_PEND_MAX) {
+            l->pend_rx[l->pend++] = l->rx;
+        }
+        l->rx.tv_sec = 0;
+    }
+}
+
+/*
+    @brief 送信直前(送信待ちの計測対象があれば時間を記録する)
+*/
+static inline void
+lat_sent(struct latency *l)
+{
+    if (unlikely(l->pend)) {
+        lat_flush(l);
+    }
+}
+
+#endif
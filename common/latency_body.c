@@ -0,0 +1,165 @@
+/**
+ * file    latency_body.c
+ * brief   滞留時間(受信から送信まで)の計測
+ * note    COPYRIGHT FUJITSU LIMITED 2010
+ *
+ * 改版履歴(出荷後記入)
+ * 版数   日付    変更者    リリースノート
+ * ---- -------- --------- --------------------------------------------------
+ */
+
+/* 計測中のスレッド(統計の領域番号毎、コマンドスレッドが参照する) */
+static struct latency *lat_list[STAT_BLOCK_NUM];
+
+/*
+    @brief 計測の初期化(受信スレッドから呼ぶ)
+    @param l    計測状態
+    @param no   統計の領域番号
+    @param stat 統計番号(計測数、続けてp50,p99,p99.9)
+    @param fd   受信ソケット(mmap受信リングの場合-1)
+    @return 0:正常 -1:異常(計測しない)
+*/
+int
+lat_init(struct latency *l, int no, int stat, int fd)
+{
+    long rate;
+    int on = 1;
+
+    memset(l, 0, sizeof(*l));
+    l->stat = stat;
+    if ((rate = anycast_get_properties_int(KEY_LATENCY_SAMPLE)) <= 0) {
+        return 0;
+    }
+    if ((fd >= 0) && (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on,
+            sizeof(on)) < 0)) {
+        mlog("SO_TIMESTAMPNS(%d) %s", fd, strerror(errno));
+        return -1;
+    }
+    l->rate = l->cnt = rate;
+    __atomic_store_n(&lat_list[no], l, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/*
+    @brief 区間番号
+*/
+static inline uint32_t
+lat_bucket(uint64_t ns)
+{
+    uint32_t e;
+
+    if (ns < LAT_SUB) {
+        return ns;
+    }
+    e = 63 - __builtin_clzll(ns);
+    if (e > LAT_MAX_BITS) {
+        return LAT_BUCKET_NUM - 1;
+    }
+    e -= LAT_SUB_BITS - 1;
+    return (e << LAT_SUB_BITS) | ((ns >> (e - 1)) & (LAT_SUB - 1));
+}
+
+/*
+    @brief 区間の上限値
+*/
+static uint64_t
+lat_value(uint32_t i)
+{
+    uint32_t e = i >> LAT_SUB_BITS;
+
+    if (e == 0) {
+        return i;
+    }
+    return (((uint64_t)(LAT_SUB | (i & (LAT_SUB - 1))) + 1) << (e - 1)) - 1;
+}
+
+/*
+    @brief 送信待ちの計測対象の時間を記録(送信の直前に呼ぶ)
+    受信時刻はCLOCK_REALTIMEのため、時刻が戻った場合は記録しない
+*/
+void
+lat_flush(struct latency *l)
+{
+    struct timespec now;
+    int64_t ns;
+    int i;
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    for (i = 0; i < l->pend; i++) {
+        ns = (int64_t)(now.tv_sec - l->pend_rx[i].tv_sec) * 1000000000 +
+            (now.tv_nsec - l->pend_rx[i].tv_nsec);
+        if (ns >= 0) {
+            l->hist[lat_bucket(ns)]++;
+        }
+    }
+    l->pend = 0;
+}
+
+/*
+    @brief パーセンタイル
+    @param per 1000分率
+*/
+static uint64_t
+lat_percentile(const uint64_t *hist, uint64_t total, uint32_t per)
+{
+    uint64_t target, sum = 0;
+    uint32_t i;
+
+    if (total == 0) {
+        return 0;
+    }
+    target = (total * per + 999) / 1000;
+    for (i = 0; i < LAT_BUCKET_NUM; i++) {
+        if ((sum += hist[i]) >= target) {
+            break;
+        }
+    }
+    return lat_value(i);
+}
+
+/*
+    @brief ヒストグラムを統計番号毎に合算して統計へ反映する(書き出し前に呼ぶ)
+*/
+void
+lat_stat(void)
+{
+    static const uint32_t per[] = { 500, 990, 999 };
+    static uint64_t hist[LAT_BUCKET_NUM];
+    ssz_t *st = sstat_blk[STAT_BLOCK_NUM - 1].stat;
+    struct latency *l;
+    uint64_t total, v;
+    uint8_t done[STAT_BLOCK_NUM];
+    int i, n, k;
+
+    memset(done, 0, sizeof(done));
+    for (i = 0; i < STAT_BLOCK_NUM; i++) {
+        l = __atomic_load_n(&lat_list[i], __ATOMIC_ACQUIRE);
+        if ((l == NULL) || done[i]) {
+            continue;
+        }
+        memset(hist, 0, sizeof(hist));
+        total = 0;
+        for (n = i; n < STAT_BLOCK_NUM; n++) {
+            struct latency *ln = __atomic_load_n(&lat_list[n],
+                __ATOMIC_ACQUIRE);
+
+            if ((ln == NULL) || (ln->stat != l->stat)) {
+                continue;
+            }
+            done[n] = 1;
+            for (k = 0; k < LAT_BUCKET_NUM; k++) {
+                v = stat_read(&ln->hist[k]);
+                hist[k] += v;
+                total += v;
+            }
+        }
+
+        /* 統計の最後の領域はコマンドスレッドのみが更新する */
+        st[l->stat] = total;
+        for (k = 0; k < 3; k++) {
+            st[l->stat + 1 + k] = lat_percentile(hist, total, per[k]);
+        }
+    }
+}
+
+/* end */
@@ -28,6 +28,7 @@ void write_log_evtlog(FILE *, const char*);
 void write_log_cli(FILE *, const char*);
 void write_log_stat2(FILE *, const char*);
 void write_log_svr(FILE *, const char*);
+void write_log_prof(FILE *, const char*);
 FILE *open_log(time_t);
 
 /*
@@ -41,6 +42,7 @@ FILE *open_log(time_t);
 #define DUMP_CLIENT_NAME      "CLIENT INFO:"
 #define DUMP_STAT2_NAME       "POLICY STATUS:"
 #define DUMP_SERVER_NAME      "BACKEND TRANSLATOR INFO:"
+#define DUMP_PROF_NAME        "PROFILE:"
 
 #define MLOG_DATA_LEN   112
 #define MAX_MLOG        256
@@ -20,6 +20,7 @@
 #include "util_inline.h"
 #include "stat.h"
 #include "stat_common.h"
+#include "prof.h"
 #ifdef FRONT_T
 #include "policy.h"
 #endif
@@ -49,17 +50,18 @@ void mlog(const char *fmt, ...)
 {
     struct mlogdata *tr;   /* trace area    */
     va_list args;          /* value list    */
+    uint seqno;
+
+    /* 複数スレッドから呼ばれるため、書き込み位置は seqno から決める */
+    seqno = __sync_add_and_fetch(&mlog_ctl.seqno, 1);
 
     va_start(args, fmt);
-    tr = &mlog_data[mlog_ctl.pos];
+    tr = &mlog_data[(seqno - 1) % MAX_MLOG];
     vsnprintf(&tr->m_data[0], MLOG_DATA_LEN, fmt, args);
     tr->time = rdtsc();
-    tr->seqno = ++mlog_ctl.seqno;
+    tr->seqno = seqno;
     
-    mlog_ctl.pos++;
-    if (unlikely(mlog_ctl.pos >= MAX_MLOG)) {
-        mlog_ctl.pos = 0;
-    }
+    mlog_ctl.pos = seqno % MAX_MLOG;
     va_end(args);
 }
 
@@ -87,10 +89,12 @@ evtlog(char *traceid, ulong info1, ulong info2, uchar *data)
 #ifndef NO_EVTLOG
     if (evtlog_ctl.tr_on) {
         struct evtlog_data *tr;
+        uint seqno;
     
-        tr = &evtlog_data[evtlog_ctl.pos];
+        seqno = __sync_add_and_fetch(&evtlog_ctl.seqno, 1);
+        tr = &evtlog_data[(seqno - 1) % MAX_ELOG];
 
-        tr->seqno = ++evtlog_ctl.seqno;
+        tr->seqno = seqno;
         tr->trace_id = *(uint32_t*)traceid;
         tr->time = rdtsc();
         tr->info1 = info1;
@@ -100,10 +104,7 @@ evtlog(char *traceid, ulong info1, ulong info2, uchar *data)
         } else {
             *(uint*)tr->e_data = 0x20202020;
         }
-        evtlog_ctl.pos++;
-        if (unlikely(evtlog_ctl.pos >= MAX_ELOG)) {
-            evtlog_ctl.pos = 0;
-        }
+        evtlog_ctl.pos = seqno % MAX_ELOG;
     }
 #endif
 }
@@ -182,7 +183,7 @@ void
 write_log_stat(FILE *fp, const char *buff)
 {
     char *bufp;
-    int i, tlen;
+    int i, n, tlen;
 
     bufp = (char*)buff;
 
@@ -191,11 +192,75 @@ write_log_stat(FILE *fp, const char *buff)
     bufp += tlen; 
     
     for (i = 0; i < STAT_MAX; i++) {
+        /* スレッド毎の統計を合算 */
+        sstat[i].stat = 0;
+        for (n = 0; n < STAT_BLOCK_NUM; n++) {
+            sstat[i].stat += stat_read(&sstat_blk[n].stat[i]);
+        }
         convert_stat((struct stat_print*)bufp, &sstat[i]);
         int len = strlen(bufp);
         tlen += len;
         bufp += len; 
-        WRITE_LOG_MIDDLE(sizeof(struct stat_print));
+        WRITE_LOG_MIDDLE(128);
+    }
+
+    fwrite(buff, 1, tlen, fp);
+    anycast_sleep(10);
+}
+
+/*
+    @brief 段階毎のサイクル数の書き出し(prof=1の場合)
+    フレーム当たりの平均と最大(起動時からの値)
+    @param fp FILE*
+    @param buffer
+*/
+void
+write_log_prof(FILE *fp, const char *buff)
+{
+    static const char *const name[PROF_STAGE_NUM] = {
+        "recv", "classify", "lookup", "lookup(slow)", "rewrite",
+        "tx queue", "tx flush"
+    };
+    struct prof_block *p;
+    uint64_t count, avg, max;
+    char *bufp;
+    int i, n, num = 0, tlen;
+
+    bufp = (char*)buff;
+
+    sprintf(bufp, "\n"SEPARATOR"\n"DUMP_PROF_NAME"\n");
+    tlen = strlen(bufp);
+    bufp += tlen;
+
+    for (n = 0; n < STAT_BLOCK_NUM; n++) {
+        p = &prof_blk[n];
+        if (!__atomic_load_n(&p->on, __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+        num++;
+        sprintf(bufp, "thread %d\n%-14s%16s%12s%12s%10s\n", n, "stage",
+            "count", "avg(cycle)", "max(cycle)", "avg(ns)");
+        tlen += strlen(bufp);
+        bufp += strlen(bufp);
+
+        for (i = 0; i < PROF_STAGE_NUM; i++) {
+            if ((count = stat_read(&p->st[i].count)) == 0) {
+                continue;
+            }
+            avg = stat_read(&p->st[i].cycles) / count;
+            max = stat_read(&p->st[i].max);
+            sprintf(bufp, "%-14s%16"PRIu64"%12"PRIu64"%12"PRIu64"%10"PRIu64"\n",
+                name[i], count, avg, max,
+                get_clock() ? avg * 1000 / get_clock() : 0);
+            int len = strlen(bufp);
+            tlen += len;
+            bufp += len;
+        }
+        WRITE_LOG_MIDDLE(1024);
+    }
+    if (num == 0) {
+        sprintf(bufp, "disabled (prof=0)\n");
+        tlen += strlen(bufp);
     }
 
     fwrite(buff, 1, tlen, fp);
@@ -370,10 +435,13 @@ write_log_evtlog(FILE *fp, const char *buff)
 void
 write_log_cli(FILE *fp, const char *buff)
 {
+    struct lb_pol_cache *pc;
     lb_pol_cache_v4_t *pc4;
     lb_pol_cache_v6_t *pc6;
     void *top;
-    int num, i, tlen;
+    size_t size;
+    uint32_t i;
+    int num, n, tlen;
     char tmp[INET6_ADDRSTRLEN], tbuf[64];
     char *bufp = (char*)buff;
     time_t ssec = lb_policy_info.starttime;
@@ -383,54 +451,76 @@ write_log_cli(FILE *fp, const char *buff)
     tlen = strlen(bufp);
     bufp += tlen;
 
-    top = calloc(sizeof(lb_pol_cache_v6_t) * LB_MAX_CACHE, 1);
+    /* 他スレッドが更新中のため、コピーしてから書き出す */
+    size = 0;
+    for (n = 0; n < nt_info.count; n++) {
+        pc = lb_policy_info.cache[n];
+        if (size < pc->ft4.size * sizeof(lb_pol_cache_v4_t)) {
+            size = pc->ft4.size * sizeof(lb_pol_cache_v4_t);
+        }
+        if (size < pc->ft6.size * sizeof(lb_pol_cache_v6_t)) {
+            size = pc->ft6.size * sizeof(lb_pol_cache_v6_t);
+        }
+    }
+    top = malloc(size);
+    if (top == NULL) {
+        return;
+    }
 
     /* V6 */
-    pc6 = top;
-    memcpy(pc6, lb_policy_info.init6, sizeof(lb_pol_cache_v6_t) * LB_MAX_CACHE);
-
     sprintf(bufp, IPV6);
     tlen += strlen(IPV6);
     bufp += strlen(IPV6);
 
-    for (num = i = 0; i < LB_MAX_CACHE; i++) {
-        if (pc6->lb_stat) {
-            if (inet_ntop(AF_INET6, &pc6->lb_src_ip, tmp, INET6_ADDRSTRLEN) 
-                    != NULL) {
-                get_time(stime, pc6->timestamp, ssec, tbuf);
-                sprintf(bufp, "%4d) %s (%u packets) create: %s\n", 
-                    ++num, tmp, pc6->hit, tbuf);
-                int len = strlen(bufp);
-                tlen += len;
-                bufp += len;
-                WRITE_LOG_MIDDLE(128);
+    num = 0;
+    for (n = 0; n < nt_info.count; n++) {
+        pc = lb_policy_info.cache[n];
+        pc6 = top;
+        memcpy(pc6, pc->init6, sizeof(lb_pol_cache_v6_t) * pc->ft6.size);
+
+        for (i = 0; i < pc->ft6.size; i++) {
+            if (pc6->lb_stat) {
+                if (inet_ntop(AF_INET6, &pc6->lb_src_ip, tmp,
+                        INET6_ADDRSTRLEN) != NULL) {
+                    get_time(stime, pc6->timestamp, ssec, tbuf);
+                    sprintf(bufp, "%4d) %s (%u packets) create: %s\n", 
+                        ++num, tmp, pc6->hit, tbuf);
+                    int len = strlen(bufp);
+                    tlen += len;
+                    bufp += len;
+                    WRITE_LOG_MIDDLE(128);
+                }
             }
+            pc6++;
         }
-        pc6++;
     }
 
     /* V4 */
-    pc4 = top;
-    memcpy(pc4, lb_policy_info.init4, sizeof(lb_pol_cache_v4_t) * LB_MAX_CACHE);
-
     sprintf(bufp, IPV4);
     tlen += strlen(IPV4);
     bufp += strlen(IPV4);
 
-    for (num = i = 0; i < LB_MAX_CACHE; i++) {
-        if (pc4->lb_stat) {
-            if (inet_ntop(AF_INET, &pc4->lb_src_ip, tmp, INET_ADDRSTRLEN) 
-                    != NULL) {
-                get_time(stime, pc4->timestamp, ssec, tbuf);
-                sprintf(bufp,  "%4d) %s (%u packets) create: %s\n", 
-                    ++num, tmp, pc4->hit, tbuf);
-                int len = strlen(bufp);
-                tlen += len;
-                bufp += len;
-                WRITE_LOG_MIDDLE(128);
+    num = 0;
+    for (n = 0; n < nt_info.count; n++) {
+        pc = lb_policy_info.cache[n];
+        pc4 = top;
+        memcpy(pc4, pc->init4, sizeof(lb_pol_cache_v4_t) * pc->ft4.size);
+
+        for (i = 0; i < pc->ft4.size; i++) {
+            if (pc4->lb_stat) {
+                if (inet_ntop(AF_INET, &pc4->lb_src_ip, tmp,
+                        INET_ADDRSTRLEN) != NULL) {
+                    get_time(stime, pc4->timestamp, ssec, tbuf);
+                    sprintf(bufp,  "%4d) %s (%u packets) create: %s\n", 
+                        ++num, tmp, pc4->hit, tbuf);
+                    int len = strlen(bufp);
+                    tlen += len;
+                    bufp += len;
+                    WRITE_LOG_MIDDLE(128);
+                }
             }
+            pc4++;
         }
-        pc4++;
     }
 
     fwrite(buff, tlen, 1, fp);
@@ -574,6 +664,7 @@ write_log_cli(FILE *fp, const char *buff)
 void
 write_log_stat2(FILE *fp, const char *buff)
 {
+    struct lb_pol_set *set = lb_policy_info.set;
     lb_pol_v4_t *entry4;
     lb_pol_v6_t *entry6;
     int tlen, num;
@@ -588,11 +679,24 @@ write_log_stat2(FILE *fp, const char *buff)
     tlen += strlen(IPV6);
     bufp += strlen(IPV6);
 
+    if (set->lpm6.node) {
+        sprintf(bufp, "lookup: trie node %u leaf %u (%luKB)\n",
+            set->lpm6.node_num, set->lpm6.leaf_num,
+            (unsigned long)(set->lpm6.node_num *
+                sizeof(struct lpm6_node) +
+                set->lpm6.leaf_num * sizeof(uint32_t)) / 1024);
+    } else {
+        sprintf(bufp, "lookup: linear\n");
+    }
+    tlen += strlen(bufp);
+    bufp += strlen(bufp);
+
     num = 0;
 
-    TAILQ_FOREACH(entry6, &lb_policy_info.lb_pol_head6, lb_list) {
+    TAILQ_FOREACH(entry6, &set->lb_pol_head6, lb_list) {
         sprintf(bufp, "%4d) %s (hit:%u client:%u)\n", ++num, entry6->line,
-            entry6->hit_count, entry6->use_count);
+            entry6->hit_count + pol_cache_hit(&entry6->hit_count),
+            entry6->use_count);
         int len = strlen(bufp);
         tlen += len;
         bufp += len;
@@ -604,10 +708,23 @@ write_log_stat2(FILE *fp, const char *buff)
     tlen += strlen(IPV4);
     bufp += strlen(IPV4);
 
+    if (set->lpm4.tbl24) {
+        sprintf(bufp, "lookup: dir-24-8 tbl8 %u (%luKB)\n",
+            set->lpm4.tbl8_num,
+            (unsigned long)(LPM4_TBL24_NUM * sizeof(uint32_t) +
+                set->lpm4.tbl8_alloc * LPM4_TBL8_SIZE *
+                sizeof(uint32_t)) / 1024);
+    } else {
+        sprintf(bufp, "lookup: linear\n");
+    }
+    tlen += strlen(bufp);
+    bufp += strlen(bufp);
+
     num = 0;
-    TAILQ_FOREACH(entry4, &lb_policy_info.lb_pol_head4, lb_list) {
+    TAILQ_FOREACH(entry4, &set->lb_pol_head4, lb_list) {
         sprintf(bufp, "%4d) %s (hit:%u client:%u)\n", ++num, entry4->line,
-            entry4->hit_count, entry4->use_count);
+            entry4->hit_count + pol_cache_hit(&entry4->hit_count),
+            entry4->use_count);
         int len = strlen(bufp);
         tlen += len;
         bufp += len;
@@ -625,9 +742,16 @@ write_log_stat2(FILE *fp, const char *buff)
     @param buffer
 */
 #ifdef FRONT_T
+static inline uint32_t
+svr_hit(server_tbl_t *svr_tbl)
+{
+    return svr_tbl->srv_stat.hit + pol_cache_hit(&svr_tbl->srv_stat.hit);
+}
+
 void
 write_log_svr(FILE *fp, const char *buff)
 {
+    server_manage_t *mng = &lb_policy_info.set->svr;
     server_tbl_t *svr_tbl;
     char addr[INET6_ADDRSTRLEN];
     char gw[INET6_ADDRSTRLEN];
@@ -644,7 +768,7 @@ write_log_svr(FILE *fp, const char *buff)
     bufp += strlen(IPV6);
     num = 0;
 
-    SLIST_FOREACH(svr_tbl, &svr_mng_tbl.head6, list) {
+    SLIST_FOREACH(svr_tbl, &mng->head6, list) {
         if (likely(svr_tbl->status != SVR_DROP)) {
             struct sockaddr_in6 *sa1 = (struct sockaddr_in6*)&svr_tbl->svr_ip;
             struct sockaddr_in6 *sa2 = (struct sockaddr_in6*)&svr_tbl->gw_ip;
@@ -653,10 +777,10 @@ write_log_svr(FILE *fp, const char *buff)
                 /* GW経由の場合、GWアドレスを表示 */
                 inet_ntop(AF_INET6, &sa2->sin6_addr, gw, INET6_ADDRSTRLEN);
                 sprintf(bufp, "%4d) %s via %s (%u packets)\n",
-                    ++num, addr, gw, svr_tbl->srv_stat.hit);
+                    ++num, addr, gw, svr_hit(svr_tbl));
             } else {
                 sprintf(bufp, "%4d) %s (%u packets)\n",
-                    ++num, addr, svr_tbl->srv_stat.hit);
+                    ++num, addr, svr_hit(svr_tbl));
             }
             int len = strlen(bufp);
             tlen += len;
@@ -671,7 +795,7 @@ write_log_svr(FILE *fp, const char *buff)
     bufp += strlen(IPV4);
     num = 0;
 
-    SLIST_FOREACH(svr_tbl, &svr_mng_tbl.head4, list) {
+    SLIST_FOREACH(svr_tbl, &mng->head4, list) {
         if (likely(svr_tbl->status != SVR_DROP)) {
             struct sockaddr_in *sa1 = (struct sockaddr_in*)&svr_tbl->svr_ip;
             struct sockaddr_in *sa2 = (struct sockaddr_in*)&svr_tbl->gw_ip;
@@ -679,10 +803,10 @@ write_log_svr(FILE *fp, const char *buff)
             if (cmp_ipv4(&sa1->sin_addr, &sa2->sin_addr) != 0) {
                 inet_ntop(AF_INET, &sa2->sin_addr, gw, INET_ADDRSTRLEN);
                 sprintf(bufp, "%4d) %s via %s (%u packets)\n",
-                    ++num, addr, gw, svr_tbl->srv_stat.hit);
+                    ++num, addr, gw, svr_hit(svr_tbl));
             } else {
                 sprintf(bufp, "%4d) %s (%u packets)\n",
-                    ++num, addr, svr_tbl->srv_stat.hit);
+                    ++num, addr, svr_hit(svr_tbl));
             }
             int len = strlen(bufp);
             tlen += len;
@@ -0,0 +1,188 @@
+/**
+ * file    pktio.h
+ * brief   送信キュー(バースト単位の一括送信)
+ * note    COPYRIGHT FUJITSU LIMITED 2010
+ *
+ * 改版履歴(出荷後記入)
+ * 版数   日付    変更者    リリースノート
+ * ---- -------- --------- --------------------------------------------------
+ */
+#ifndef __PKTIO_H__
+#define __PKTIO_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/if_packet.h>
+#include <linux/virtio_net.h>
+
+#include "anycast.h"
+#include "util_inline.h"
+#include "xsk.h"
+#include "vlan.h"
+
+/* 送信方式(tx_mode) */
+#define TX_MODE_WRITE   0   /* フレーム毎にwrite() */
+#define TX_MODE_MMSG    1   /* sendmmsg()で一括送信 */
+#define TX_MODE_RING    2   /* PACKET_TX_RINGで一括送信 */
+#define TX_MODE_XSK     3   /* AF_XDPのtx ring(io_mode=1の場合) */
+
+#define TX_BATCH        64      /* sendmmsg()の最大キュー長 */
+#define TX_FRAME_SIZE   2048    /* キュー1段のサイズ(MTUが大きい場合は拡大) */
+
+/*
+    受信buffer長(インターフェースのMTUから求める、MTU1500の場合1520)
+    ハードウェアがタグを外さない場合に備えVLANタグ分を含める
+*/
+#define RX_BUF_SIZE(ifp)    (((ifp)->mtu + ETH_HLEN + VLAN_HLEN + 7) & ~7)
+
+/* MTU長のフレームを格納する受信リング(TPACKET_V3)のフレーム長 */
+#define RX_RING_FRAME_SIZE(ifp) \
+    TPACKET_ALIGN(TPACKET3_HDRLEN + RX_BUF_SIZE(ifp))
+
+/*
+    PACKET_VNET_HDR(vnet_hdr=1)
+    送受信するフレームの前にvirtio_net_hdrが付き、GROで結合された
+    フレーム(最大64KB)をそのまま受け取り、GSOで分割して送信させる
+*/
+#define VNET_HDR_LEN    ((int)sizeof(struct virtio_net_hdr))
+#define VNET_BUF_SIZE   (VNET_HDR_LEN + 65536 + 64)     /* 受信buffer */
+#define TX_SNDBUF_SIZE  (512 * 1024)    /* 送信専用ソケットの送信バッファ */
+
+/* PACKET_TX_RING(TPACKET_V2)のフレーム先頭からデータまでのオフセット */
+#define TX_RING_DATA_OFF    (TPACKET2_HDRLEN - sizeof(struct sockaddr_ll))
+
+/* キュー1段に格納できるフレーム長 */
+#define TX_FRAME_MAX(q) (((q)->mode == TX_MODE_RING) ? \
+    ((q)->frame_size - TX_RING_DATA_OFF) : ((q)->frame_size - (q)->hdr_len))
+
+/* tx_putの戻り値 */
+#define TX_QUEUED   0   /* キューに格納 */
+#define TX_FULL     1   /* キューが満杯のため一旦送信してから格納 */
+#define TX_DROP     (-1)/* 格納できないため破棄 */
+
+/*
+    @brief 送信キュー(書き込みスレッド毎)
+*/
+struct tx_queue {
+    struct ifdata *ifp;     /* 送信先インターフェース */
+    int mode;               /* 送信方式 */
+    uint32_t cnt;           /* 未送信フレーム数 */
+    uint32_t max;           /* キュー長 */
+    uint32_t frame_size;    /* キュー1段のサイズ(2のべき乗) */
+    int hdr_len;            /* フレーム前のヘッダ長(VNET_HDR_LEN or 0) */
+
+    /* TX_MODE_MMSG */
+    struct mmsghdr *msg;
+    struct iovec *iov;
+    uint8_t *buf;
+
+    /* TX_MODE_RING, vnet_hdr */
+    int fd;                 /* 送信専用ソケット */
+    uint8_t *map;
+    uint32_t map_size;
+    uint32_t cur;
+};
+
+int tx_queue_init(struct tx_queue *, struct ifdata *);
+void tx_queue_free(struct tx_queue *);
+int tx_flush(struct tx_queue *);
+int tx_socket(struct ifdata *, int);
+
+/*
+    @brief GROで結合されたフレームか(virtio_net_hdrのgso_type)
+*/
+static inline int
+vnet_gso(const void *hdr)
+{
+    return ((const struct virtio_net_hdr *)hdr)->gso_type !=
+        VIRTIO_NET_HDR_GSO_NONE;
+}
+
+/*
+    @brief 送信フレームをキューへ格納
+    vnet_hdrを使用する場合、フレームの直前に受信時のvirtio_net_hdrが
+    あること(受信bufferを書き換えたフレームのみ送信する)
+    @param q   送信キュー
+    @param eth フレーム先頭
+    @param len フレーム長
+    @return TX_QUEUED, TX_FULL, TX_DROP
+*/
+static inline int
+tx_put(struct tx_queue *q, const void *eth, int len)
+{
+    struct tpacket2_hdr *hdr;
+    int ret = TX_QUEUED;
+
+    if (q->mode == TX_MODE_XSK) {
+        struct xsk *x = q->ifp->xsk;
+
+        if (unlikely(x == NULL)) {
+            /* XSK未生成(起動中) */
+            write(q->ifp->sockfd, eth, len);
+            return TX_QUEUED;
+        }
+        if (unlikely(xsk_tx(x, eth, len) != 0)) {
+            tx_flush(q);
+            ret = TX_FULL;
+            if (xsk_tx(x, eth, len) != 0) {
+                return TX_DROP;
+            }
+        }
+        q->cnt++;
+        return ret;
+    }
+
+    if (q->hdr_len) {
+        /* virtio_net_hdrを含めて送信する */
+        eth = (const uint8_t *)eth - q->hdr_len;
+        len += q->hdr_len;
+        if (unlikely(len > q->frame_size) || (q->mode == TX_MODE_WRITE)) {
+            /* GROで結合されたフレームは順序を保って直接送信(GSOで分割) */
+            tx_flush(q);
+            write(q->fd, eth, len);
+            return TX_QUEUED;
+        }
+    } else if ((q->mode == TX_MODE_WRITE) || unlikely(len > TX_FRAME_MAX(q))) {
+        /* キューに入らないフレームは直接送信 */
+        write(q->ifp->sockfd, eth, len);
+        return TX_QUEUED;
+    }
+
+    if (q->mode == TX_MODE_MMSG) {
+        if (q->cnt >= q->max) {
+            tx_flush(q);
+            ret = TX_FULL;
+        }
+        memcpy(q->iov[q->cnt].iov_base, eth, len);
+        q->iov[q->cnt].iov_len = len;
+        q->cnt++;
+        return ret;
+    }
+
+    /* TX_MODE_RING */
+    hdr = (struct tpacket2_hdr *)(q->map + (q->cur * q->frame_size));
+    if (__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE) !=
+            TP_STATUS_AVAILABLE) {
+        /* 送信完了待ちのフレームを送り出す */
+        tx_flush(q);
+        ret = TX_FULL;
+        if (__atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE) !=
+                TP_STATUS_AVAILABLE) {
+            return TX_DROP;
+        }
+    }
+    memcpy((uint8_t *)hdr + TX_RING_DATA_OFF, eth, len);
+    hdr->tp_len = len;
+    __atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST,
+        __ATOMIC_RELEASE);
+
+    if (++q->cur >= q->max) {
+        q->cur = 0;
+    }
+    q->cnt++;
+    return ret;
+}
+
+#endif
@@ -0,0 +1,278 @@
+/**
+ * file    pktio_body.c
+ * brief   送信キュー(バースト単位の一括送信)
+ * note    COPYRIGHT FUJITSU LIMITED 2010
+ *
+ * 改版履歴(出荷後記入)
+ * 版数   日付    変更者    リリースノート
+ * ---- -------- --------- --------------------------------------------------
+ */
+
+static int init_tx_ring(struct tx_queue *q);
+
+/*
+    @brief 送信キュー初期化
+    受信バースト中に書き換えたフレームを溜め、バースト終了時に
+    tx_flush()でまとめて送信する
+    @param q   送信キュー
+    @param ifp 送信先インターフェース
+    @return 0(設定した送信方式を使用できない場合はフォールバック)
+*/
+int
+tx_queue_init(struct tx_queue *q, struct ifdata *ifp)
+{
+    long mode;
+    int i;
+    char buf[32];
+
+    memset(q, 0, sizeof(*q));
+    q->ifp = ifp;
+    q->fd = -1;
+
+    /* MTU長のフレームがキューに入る大きさ(jumbo frameもまとめて送信する) */
+    for (q->frame_size = TX_FRAME_SIZE; q->frame_size <
+            RX_BUF_SIZE(ifp) + TX_RING_DATA_OFF + VNET_HDR_LEN;
+            q->frame_size <<= 1)
+        ;
+
+    if (anycast_get_properties_int(KEY_IO_MODE) == IO_MODE_XDP) {
+        /* XSKは送信先インターフェースの受信スレッドが生成する */
+        q->mode = TX_MODE_XSK;
+        return 0;
+    }
+
+    mode = anycast_get_properties_int(KEY_TX_MODE);
+
+    if (anycast_get_properties_int(KEY_VNET_HDR)) {
+        /* GSOさせるため送信専用ソケットにPACKET_VNET_HDRを設定する */
+        if ((q->fd = tx_socket(ifp, 1)) >= 0) {
+            q->hdr_len = VNET_HDR_LEN;
+            mode = TX_MODE_MMSG;
+            mlog("tx vnet hdr(%s)", ifp->ifname);
+        } else {
+            mlog("tx vnet hdr(%s) not available (%s)", ifp->ifname,
+                strerror_r(errno, buf, sizeof(buf)));
+        }
+    }
+
+    if (mode == TX_MODE_RING) {
+        if (init_tx_ring(q) == 0) {
+            q->mode = TX_MODE_RING;
+            mlog("tx ring(%s) frame num %u", ifp->ifname, q->max);
+            return 0;
+        }
+        mlog("tx ring(%s) not available (%s)", ifp->ifname,
+            strerror_r(errno, buf, sizeof(buf)));
+        mode = TX_MODE_MMSG;
+    }
+
+    if (mode == TX_MODE_MMSG) {
+        q->msg = calloc(TX_BATCH, sizeof(struct mmsghdr));
+        q->iov = calloc(TX_BATCH, sizeof(struct iovec));
+        q->buf = huge_alloc(TX_BATCH * q->frame_size, "tx queue");
+        if (q->msg && q->iov && q->buf) {
+            for (i = 0; i < TX_BATCH; i++) {
+                q->iov[i].iov_base = q->buf + (i * q->frame_size);
+                q->msg[i].msg_hdr.msg_iov = &q->iov[i];
+                q->msg[i].msg_hdr.msg_iovlen = 1;
+            }
+            q->max = TX_BATCH;
+            q->mode = TX_MODE_MMSG;
+            return 0;
+        }
+        mlog("tx queue(%s) alloc error", ifp->ifname);
+        /* vnet_hdrの送信専用ソケットは残す */
+        free(q->msg);
+        free(q->iov);
+        huge_free(q->buf);
+        q->msg = NULL;
+        q->iov = NULL;
+        q->buf = NULL;
+    }
+
+    q->mode = TX_MODE_WRITE;
+    return 0;
+}
+
+/*
+    @brief 送信キュー解放
+*/
+void
+tx_queue_free(struct tx_queue *q)
+{
+    free(q->msg);
+    free(q->iov);
+    huge_free(q->buf);
+    if (q->map) {
+        munmap(q->map, q->map_size);
+    }
+    if (q->fd >= 0) {
+        close(q->fd);
+    }
+    memset(q, 0, sizeof(*q));
+    q->fd = -1;
+}
+
+/*
+    @brief キューに溜まったフレームを送信
+    @return 送信要求したフレーム数
+*/
+int
+tx_flush(struct tx_queue *q)
+{
+    uint32_t cnt = q->cnt;
+    int sent, ret;
+
+    if (q->mode == TX_MODE_XSK) {
+        if (q->ifp->xsk) {
+            if (cnt) {
+                xsk_tx_kick(q->ifp->xsk);
+            }
+            xsk_complete(q->ifp->xsk);
+        }
+        q->cnt = 0;
+        return cnt;
+    }
+
+    if (cnt == 0) {
+        return 0;
+    }
+
+    if (q->mode == TX_MODE_MMSG) {
+        int fd = (q->hdr_len) ? q->fd : q->ifp->sockfd;
+
+        for (sent = 0; sent < cnt; sent += ret) {
+            ret = sendmmsg(fd, &q->msg[sent], cnt - sent, 0);
+            if (ret <= 0) {
+                /* 送信できない残りは破棄(write()と同様) */
+                break;
+            }
+        }
+    } else if (q->mode == TX_MODE_RING) {
+        send(q->fd, NULL, 0, MSG_DONTWAIT);
+    }
+
+    q->cnt = 0;
+    return cnt;
+}
+
+/*
+    @brief 送信専用ソケットの作成
+    プロトコル0でbindし、受信はしない
+    @param ifp  送信先インターフェース
+    @param vnet 1:PACKET_VNET_HDRを設定する
+    @return ソケット, -1 異常(errno)
+*/
+int
+tx_socket(struct ifdata *ifp, int vnet)
+{
+    struct sockaddr_ll sa;
+    int fd, err, opt = TX_SNDBUF_SIZE;
+
+    if ((fd = socket(AF_PACKET, SOCK_RAW, 0)) < 0) {
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &opt, sizeof(opt));
+
+    opt = 1;
+    if (vnet && (setsockopt(fd, SOL_PACKET, PACKET_VNET_HDR, &opt,
+            sizeof(opt)) < 0)) {
+        goto tx_socket_err;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sll_family = AF_PACKET;
+    sa.sll_protocol = 0;
+    sa.sll_ifindex = if_nametoindex(ifp->ifname);
+    if ((sa.sll_ifindex == 0) ||
+            (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0)) {
+        goto tx_socket_err;
+    }
+    return fd;
+
+tx_socket_err:
+    err = errno;
+    close(fd);
+    errno = err;
+    return -1;
+}
+
+/*
+    @brief PACKET_TX_RING設定
+    TX_RINGを設定したソケットは全ての送信がリング経由になるため、
+    受信ソケットとは別に送信専用ソケットを作成する
+*/
+static int
+init_tx_ring(struct tx_queue *q)
+{
+    struct tpacket_req req;
+    struct sockaddr_ll sa;
+    long num;
+    int ver = TPACKET_V2, err;
+    uint32_t block_size = getpagesize() * 4;
+
+    if (block_size < q->frame_size) {
+        block_size = q->frame_size;
+    }
+
+    if ((num = anycast_get_properties_int(KEY_TX_FRAME_NUM)) <= 0) {
+        num = TX_FRAME_NUM_DEFAULT;
+    }
+    /* ブロック単位に切り上げ */
+    num = (num + (block_size / q->frame_size) - 1) &
+        ~((block_size / q->frame_size) - 1);
+
+    /* プロトコル0のソケットは受信しない */
+    if ((q->fd = socket(AF_PACKET, SOCK_RAW, 0)) < 0) {
+        return -1;
+    }
+
+    if (setsockopt(q->fd, SOL_PACKET, PACKET_VERSION, &ver,
+            sizeof(ver)) < 0) {
+        goto tx_ring_err;
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = block_size;
+    req.tp_frame_size = q->frame_size;
+    req.tp_frame_nr = num;
+    req.tp_block_nr = num / (block_size / q->frame_size);
+    if (setsockopt(q->fd, SOL_PACKET, PACKET_TX_RING, &req,
+            sizeof(req)) < 0) {
+        goto tx_ring_err;
+    }
+
+    q->map_size = req.tp_block_size * req.tp_block_nr;
+    q->map = mmap(NULL, q->map_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+        q->fd, 0);
+    if (q->map == MAP_FAILED) {
+        q->map = NULL;
+        goto tx_ring_err;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sll_family = AF_PACKET;
+    sa.sll_protocol = 0;
+    sa.sll_ifindex = if_nametoindex(q->ifp->ifname);
+    if ((sa.sll_ifindex == 0) ||
+            (bind(q->fd, (struct sockaddr *)&sa, sizeof(sa)) < 0)) {
+        goto tx_ring_err;
+    }
+
+    q->max = num;
+    q->cur = 0;
+    return 0;
+
+tx_ring_err:
+    err = errno;
+    if (q->map) {
+        munmap(q->map, q->map_size);
+        q->map = NULL;
+    }
+    close(q->fd);
+    q->fd = -1;
+    errno = err;
+    return -1;
+}
+
+/* end */
@@ -0,0 +1,73 @@
+/**
+ * file    prof.h
+ * brief   振り分け処理の段階毎のサイクル数計測(prof=1の場合)
+ * note    COPYRIGHT FUJITSU LIMITED 2010
+ *
+ * 改版履歴(出荷後記入)
+ * 版数   日付    変更者    リリースノート
+ * ---- -------- --------- --------------------------------------------------
+ */
+#ifndef __PROF_H__
+#define __PROF_H__
+
+#include <stdint.h>
+
+#include "util_inline.h"
+#include "stat.h"
+
+/*
+    フレーム毎にPROF_START()からPROF()までのtsc差分を段階毎に加算する
+    (PROF()は次の段階の開始を兼ねる)。途中で破棄したフレームは
+    そこまでの段階のみ加算する。無効の場合はprof_selfの確認のみ
+*/
+enum {
+    PROF_RECV = 0,      /* 受信(システムコール) */
+    PROF_CLASSIFY,      /* フレームの判定(宛先の確認まで) */
+    PROF_LOOKUP,        /* 振り分けキャッシュ、クライアント情報の検索 */
+    PROF_LOOKUP_SLOW,   /* 振り分けテーブルの検索(キャッシュ外) */
+    PROF_REWRITE,       /* ヘッダ書き換え */
+    PROF_TX,            /* 送信キューへ格納 */
+    PROF_FLUSH,         /* 送信(送信キュー単位) */
+    PROF_STAGE_NUM
+};
+
+struct prof_stage {
+    uint64_t count;
+    uint64_t cycles;
+    uint64_t max;
+};
+
+/*
+    @brief スレッド毎の計測値(統計と同じ領域番号)
+*/
+struct prof_block {
+    int on;
+    uint64_t tsc;                           /* 段階の開始 */
+    struct prof_stage st[PROF_STAGE_NUM];
+} __attribute__((aligned(64)));
+
+extern struct prof_block prof_blk[STAT_BLOCK_NUM];
+extern __thread struct prof_block *prof_self;
+
+void prof_init(int);
+
+static inline void
+prof_add(struct prof_block *p, int stage)
+{
+    struct prof_stage *st = &p->st[stage];
+    uint64_t now = rdtsc(), d = now - p->tsc;
+
+    p->tsc = now;
+    st->count++;
+    st->cycles += d;
+    if (d > st->max) {
+        st->max = d;
+    }
+}
+
+#define PROF_START() \
+    do { if (unlikely(prof_self != NULL)) prof_self->tsc = rdtsc(); } while (0)
+#define PROF(stage) \
+    do { if (unlikely(prof_self != NULL)) prof_add(prof_self, stage); } while (0)
+
+#endif
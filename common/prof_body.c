@@ -0,0 +1,29 @@
+/**
+ * file    prof_body.c
+ * brief   振り分け処理の段階毎のサイクル数計測(prof=1の場合)
+ * note    COPYRIGHT FUJITSU LIMITED 2010
+ *
+ * 改版履歴(出荷後記入)
+ * 版数   日付    変更者    リリースノート
+ * ---- -------- --------- --------------------------------------------------
+ */
+
+struct prof_block prof_blk[STAT_BLOCK_NUM];
+__thread struct prof_block *prof_self;
+
+/*
+    @brief 計測の開始(振り分けスレッドから呼ぶ)
+    @param no 統計の領域番号
+*/
+void
+prof_init(int no)
+{
+    if (anycast_get_properties_int(KEY_PROF) <= 0) {
+        return;
+    }
+    prof_self = &prof_blk[no];
+    __atomic_store_n(&prof_self->on, 1, __ATOMIC_RELEASE);
+    mlog("prof thread %d", no);
+}
+
+/* end */
@@ -41,8 +41,43 @@ typedef struct {
 #define KEY_VIP_MODE        "vip_mode"
 #define KEY_VIP4            "in.ip4"
 #define KEY_VIP6            "in.ip6"
+#define KEY_RX_RING         "rx_ring"
+#define KEY_RX_BLOCK_SIZE   "rx_ring.block_size"
+#define KEY_RX_BLOCK_NUM    "rx_ring.block_num"
+#define KEY_TX_MODE         "tx_mode"
+#define KEY_TX_FRAME_NUM    "tx_ring.frame_num"
+#define KEY_IO_MODE         "io_mode"
+#define KEY_XSK_FRAME_NUM   "xsk.frame_num"
+#define KEY_XSK_QUEUE       "xsk.queue"
+#define KEY_XSK_ZEROCOPY    "xsk.zerocopy"
+#define KEY_RX_FILTER       "rx_filter"
+#define KEY_CPU_NET         "cpu.net"
+#define KEY_CPU_CMD         "cpu.cmd"
+#define KEY_CPU_RESOLVER    "cpu.resolver"
+#define KEY_SCHED_FIFO      "sched.fifo"
+#define KEY_HUGEPAGE        "hugepage"
+#define KEY_MLOCK           "mlock"
+#define KEY_RX_POLL         "rx.poll"
+#define KEY_RX_BUSY_POLL    "rx.busy_poll"
+#define KEY_RX_POLL_IDLE    "rx.poll_idle"
+#define KEY_VNET_HDR        "vnet_hdr"
+#define KEY_VLAN            "in.vlan"
+#define KEY_VLAN_IP4        "in.vlan.ip4"
+#define KEY_VLAN_IP6        "in.vlan.ip6"
+#define KEY_SHM_STAT        "shm_stat.interval"
+#define KEY_LATENCY_SAMPLE  "latency.sample"
+#define KEY_PROF            "prof"
+#define KEY_RX_STAT_INTERVAL "rx.stat_interval"
 
 #define IFNAME_INGRESS_DEFAULT "eth0"
 #define IFNAME_EGRESS_DEFAULT  "eth1"
 #define UD_FILE_NAME "/dev/shm/.sasat"
+
+/* mmap受信リングの初期値 */
+#define RX_BLOCK_SIZE_DEFAULT   (1 << 20)
+#define RX_BLOCK_NUM_DEFAULT    32
+#define RX_RING_SIZE_MAX        0xffffffffUL    /* ブロックサイズ*ブロック数 */
+
+/* PACKET_TX_RINGのフレーム数の初期値 */
+#define TX_FRAME_NUM_DEFAULT    256
 #endif
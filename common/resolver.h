@@ -0,0 +1,61 @@
+/**
+ * file    resolver.h
+ * brief   MACアドレス解決スレッド(振り分けスレッドから非同期に解決する)
+ * note    COPYRIGHT FUJITSU LIMITED 2010
+ *
+ * 改版履歴(出荷後記入)
+ * 版数   日付    変更者    リリースノート
+ * ---- -------- --------- --------------------------------------------------
+ */
+#ifndef __RESOLVER_H__
+#define __RESOLVER_H__
+
+#include <stdint.h>
+#include <sys/queue.h>
+#include <sys/socket.h>
+
+#include "anycast.h"
+
+#define NH_QUEUE_SIZE   256     /* 解決要求キュー長(2のべき乗) */
+#define NH_HOLD_NUM     4       /* ネクストホップ毎の保留フレーム数 */
+#define NH_HOLD_SIZE    2048    /* 保留できるフレーム長 */
+#define NH_RETRY        3       /* 1回の要求での解決試行回数 */
+
+/*
+    @brief ネクストホップ(MAC解決の単位)
+    アドレス、解決結果の格納先はサーバテーブル側の領域を指す
+*/
+struct nh_entry {
+    LIST_ENTRY(nh_entry) link;  /* 登録リスト(ネイバー変更の反映用) */
+
+    struct sockaddr *addr;      /* 解決するアドレス */
+    struct sockaddr *gw;        /* ゲートウェイ(解決時に設定) */
+    uint8_t *mac;               /* 解決したMACの格納先(MAC_STORE_LEN) */
+    volatile uint8_t *status;   /* 状態(解決したらSVR_OKにする) */
+    struct ifdata *ifp;         /* 送信インターフェース */
+    int default_gw;
+
+    /* 解決、MACの変更を通知する(NULL可、nh_initの後に設定する) */
+    void (*notify)(struct nh_entry *);
+
+    volatile int pending;       /* 解決要求中(キュー投入済み) */
+
+    /* 保留キュー(振り分けスレッドが格納、resolverスレッドが送信) */
+    volatile int lock;
+    int hold_num;
+    uint16_t hold_len[NH_HOLD_NUM];
+    uint8_t *hold_buf;          /* NH_HOLD_NUM * NH_HOLD_SIZE */
+};
+
+int nh_init(struct nh_entry *, struct sockaddr *, struct sockaddr *,
+    uint8_t *, volatile uint8_t *, struct ifdata *, int);
+void nh_free(struct nh_entry *);
+int nh_resolve(struct nh_entry *);
+int nh_request(struct nh_entry *);
+int nh_hold(struct nh_entry *, const void *, int);
+void nh_neigh_update(int, const uint8_t *, const uint8_t *);
+
+int resolver_start(void);
+int resolver_sync(int);
+
+#endif
@@ -0,0 +1,416 @@
+/**
+ * file    resolver_body.c
+ * brief   MACアドレス解決スレッド(共通処理)
+ * note    COPYRIGHT FUJITSU LIMITED 2010
+ *
+ * 改版履歴(出荷後記入)
+ * 版数   日付    変更者    リリースノート
+ * ---- -------- --------- --------------------------------------------------
+ */
+
+/*
+    振り分けスレッドはMACアドレスが未解決の場合、解決要求をキューへ入れ、
+    フレームをネクストホップ毎の保留キューへ格納して処理を続ける。
+    resolverスレッドは要求を取り出して解決(ping送信、待ち合わせ)を行ない、
+    解決したら保留していたフレームを送信する。
+*/
+
+int get_target_mac(struct sockaddr *, char *, struct sockaddr *,
+    unsigned char *, int);
+void send_ping(struct sockaddr *, struct ifdata *);
+void signal_block(void);
+
+/*
+    解決要求キュー(複数の振り分けスレッドから格納、resolverスレッドが取り出す)
+    スロット毎の順序番号で格納完了を判定する
+*/
+struct nh_slot {
+    volatile uint32_t seq;
+    struct nh_entry *nh;
+};
+
+static struct nh_queue {
+    struct nh_slot slot[NH_QUEUE_SIZE];
+    volatile uint32_t head __attribute__((aligned(64)));  /* 格納位置 */
+    volatile uint32_t tail __attribute__((aligned(64)));  /* 取り出し位置 */
+    volatile uint32_t done;     /* 処理を終えた要求数 */
+    int efd;                    /* 起床通知(eventfd) */
+} nh_q;
+
+/* 保留フレームの送信用 */
+static uint8_t nh_txbuf[NH_HOLD_NUM * NH_HOLD_SIZE];
+
+/* 登録済みのネクストホップ */
+static LIST_HEAD(, nh_entry) nh_list = LIST_HEAD_INITIALIZER(nh_list);
+static pthread_mutex_t nh_list_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *resolver_thread(void *);
+static struct nh_entry *nh_dequeue(void);
+static void nh_flush(struct nh_entry *, int);
+
+/*
+    @brief ネクストホップ初期化
+    @param addr 解決するアドレス
+    @param gw ゲートウェイの格納先
+    @param mac MACの格納先
+    @param status 状態の格納先
+    @param ifp 送信インターフェース
+    @return 0:成功 -1:保留キュー確保失敗(保留せず破棄する)
+*/
+int
+nh_init(struct nh_entry *nh, struct sockaddr *addr, struct sockaddr *gw,
+    uint8_t *mac, volatile uint8_t *status, struct ifdata *ifp,
+    int default_gw)
+{
+    memset(nh, 0, sizeof(*nh));
+
+    nh->addr = addr;
+    nh->gw = gw;
+    nh->gw->sa_family = addr->sa_family;
+    nh->mac = mac;
+    nh->status = status;
+    nh->ifp = ifp;
+    nh->default_gw = default_gw;
+
+    pthread_mutex_lock(&nh_list_lock);
+    LIST_INSERT_HEAD(&nh_list, nh, link);
+    pthread_mutex_unlock(&nh_list_lock);
+
+    nh->hold_buf = malloc(NH_HOLD_NUM * NH_HOLD_SIZE);
+    if (nh->hold_buf == NULL) {
+        mlog("nh_init malloc error %d", NH_HOLD_NUM * NH_HOLD_SIZE);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+    @brief ネクストホップ解放
+    (resolverスレッドが参照しないことを resolver_sync で確認してから)
+*/
+void
+nh_free(struct nh_entry *nh)
+{
+    if (nh->addr == NULL) {
+        /* 初期化していない */
+        return;
+    }
+    pthread_mutex_lock(&nh_list_lock);
+    LIST_REMOVE(nh, link);
+    pthread_mutex_unlock(&nh_list_lock);
+
+    free(nh->hold_buf);
+    nh->hold_buf = NULL;
+}
+
+/*
+    @brief MACアドレスを解決する(待ち合わせを行なうため振り分けスレッド
+    からは呼ばない)
+    @return SVR_OK:解決 SVR_INIT:未解決
+*/
+int
+nh_resolve(struct nh_entry *nh)
+{
+    uint8_t mac[ETH_ALEN];
+    int i, ret;
+
+    for (i = 0; i < NH_RETRY; i++) {
+        /* routing socket検索 */
+        ret = get_target_mac(nh->addr, nh->ifp->ifname, nh->gw, mac,
+            nh->default_gw);
+        if (ret < 0) {
+            /* エラー */
+            continue;
+        }
+        if (cmp_mac(zerodata, mac) != 0) {
+            /* MACを格納してから状態を更新する */
+            store_mac(nh->mac, mac);
+            __atomic_store_n(nh->status, SVR_OK, __ATOMIC_RELEASE);
+            if (nh->notify) {
+                nh->notify(nh);
+            }
+            return SVR_OK;
+        }
+        /* MACが不明の場合、pingを打つ */
+        send_ping(nh->gw, nh->ifp);
+        anycast_sleep(10);
+    }
+    return SVR_INIT;
+}
+
+/*
+    @brief 解決要求をキューへ格納(振り分けスレッドから呼ぶ、待ち合わせない)
+    要求中のネクストホップは重複して格納しない
+    @return 0:格納(要求中) -1:キューが満杯
+*/
+int
+nh_request(struct nh_entry *nh)
+{
+    struct nh_slot *s;
+    uint32_t pos, seq;
+    uint64_t v = 1;
+
+    if (nh->pending || !__sync_bool_compare_and_swap(&nh->pending, 0, 1)) {
+        return 0;
+    }
+
+    pos = nh_q.head;
+    for ( ;; ) {
+        s = &nh_q.slot[pos & (NH_QUEUE_SIZE - 1)];
+        seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+        if (seq == pos) {
+            if (__atomic_compare_exchange_n(&nh_q.head, &pos, pos + 1, 0,
+                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+            /* 他スレッドが先に格納した(posは更新済み) */
+        } else if ((int32_t)(seq - pos) < 0) {
+            /* 満杯 */
+            nh->pending = 0;
+            return -1;
+        } else {
+            pos = nh_q.head;
+        }
+    }
+    s->nh = nh;
+    __atomic_store_n(&s->seq, pos + 1, __ATOMIC_RELEASE);
+
+    (void)write(nh_q.efd, &v, sizeof(v));
+    return 0;
+}
+
+/*
+    @brief フレームを保留キューへ格納し、解決を要求する
+    @param eth フレーム(宛先MAC以外は書き換え済み)
+    @return 0:保留 -1:破棄
+*/
+int
+nh_hold(struct nh_entry *nh, const void *eth, int len)
+{
+    int ret = -1;
+
+    if (likely((len <= NH_HOLD_SIZE) && (nh->hold_buf != NULL))) {
+        while (__sync_lock_test_and_set(&nh->lock, 1)) {
+            while (nh->lock) {
+                cpu_relax();
+            }
+        }
+        if (nh->hold_num < NH_HOLD_NUM) {
+            memcpy(nh->hold_buf + (nh->hold_num * NH_HOLD_SIZE), eth, len);
+            nh->hold_len[nh->hold_num++] = len;
+            ret = 0;
+        }
+        __sync_lock_release(&nh->lock);
+    }
+
+    if (ret == 0) {
+        SASAT_STAT(nh_held);
+    } else {
+        SASAT_STAT(nh_held_drop);
+    }
+    nh_request(nh);
+    return ret;
+}
+
+/*
+    @brief ネイバーのMACが変わった(追加、削除された)ことを反映する
+    (経路ミラーの通知受信スレッドから呼ぶ)
+    ゲートウェイが一致するネクストホップのMACを更新し、未解決だった
+    ものは解決済みにして保留フレームを送信させる。
+    ネイバーが削除された(解決できなくなった)場合は未解決(SVR_INIT)に
+    戻して再解決を要求する(再解決するまでフレームは保留する)
+    @param family
+    @param addr ネイバーのアドレス
+    @param mac 新しいMAC(NULL:削除された)
+*/
+void
+nh_neigh_update(int family, const uint8_t *addr, const uint8_t *mac)
+{
+    struct nh_entry *nh;
+    const void *gw;
+    int alen = (family == AF_INET) ? 4 : 16;
+
+    pthread_mutex_lock(&nh_list_lock);
+    LIST_FOREACH(nh, &nh_list, link) {
+        if (nh->gw->sa_family != family) {
+            continue;
+        }
+        gw = (family == AF_INET) ?
+            (const void *)&((struct sockaddr_in *)nh->gw)->sin_addr :
+            (const void *)&((struct sockaddr_in6 *)nh->gw)->sin6_addr;
+        if (memcmp(gw, addr, alen) != 0) {
+            continue;
+        }
+        if (mac == NULL) {
+            if (*nh->status != SVR_OK) {
+                continue;
+            }
+            __atomic_store_n(nh->status, SVR_INIT, __ATOMIC_RELEASE);
+            nh_request(nh);
+        } else if (*nh->status != SVR_OK) {
+            store_mac(nh->mac, mac);
+            __atomic_store_n(nh->status, SVR_OK, __ATOMIC_RELEASE);
+            /* 保留フレームの送信 */
+            nh_request(nh);
+        } else if (cmp_mac(nh->mac, mac) != 0) {
+            store_mac(nh->mac, mac);
+        } else {
+            continue;
+        }
+        if (nh->notify) {
+            nh->notify(nh);
+        }
+        SASAT_STAT(nh_updated);
+    }
+    pthread_mutex_unlock(&nh_list_lock);
+}
+
+/*
+    @brief resolverスレッド起動(振り分けスレッドの起動前に呼ぶ)
+    @return 0:成功 -1:失敗
+*/
+int
+resolver_start(void)
+{
+    pthread_t tid;
+    int i;
+
+    for (i = 0; i < NH_QUEUE_SIZE; i++) {
+        nh_q.slot[i].seq = i;
+    }
+    nh_q.head = nh_q.tail = nh_q.done = 0;
+
+    if ((nh_q.efd = eventfd(0, 0)) < 0) {
+        syslog(LOG_ERR, "resolver eventfd error %d", errno);
+        return -1;
+    }
+    if (pthread_create(&tid, NULL, resolver_thread, NULL)) {
+        syslog(LOG_ERR, "resolver thread create error %d", errno);
+        close(nh_q.efd);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+    @brief 格納済みの要求の処理が終わるまで待つ
+    (ネクストホップを解放する前に呼ぶ)
+    @param msec 最大待ち時間
+    @return 0:完了 -1:タイムアウト
+*/
+int
+resolver_sync(int msec)
+{
+    uint32_t target = nh_q.head;
+    int t;
+
+    for (t = 0; (int32_t)(__atomic_load_n(&nh_q.done, __ATOMIC_ACQUIRE)
+            - target) < 0; t += 10) {
+        if (t >= msec) {
+            return -1;
+        }
+        anycast_sleep(10);
+    }
+    return 0;
+}
+
+/*
+    @brief resolverスレッド
+*/
+static void *
+resolver_thread(void *arg)
+{
+    struct nh_entry *nh;
+    uint64_t v;
+    int ok;
+
+    pthread_detach(pthread_self());
+    signal_block();
+    SASAT_STAT_THREAD(STAT_BLOCK_RESOLVER);
+    numa_move(sstat_self, sizeof(*sstat_self),
+        thread_placement("resolver", KEY_CPU_RESOLVER, -1, 0));
+
+    for ( ;; ) {
+        while ((nh = nh_dequeue()) != NULL) {
+            if (*nh->status == SVR_OK) {
+                /* 解決済み(解決後に保留されたフレーム) */
+                ok = 1;
+            } else if ((ok = (nh_resolve(nh) == SVR_OK))) {
+                SASAT_STAT(nh_resolved);
+            } else {
+                SASAT_STAT(nh_resolve_fail);
+            }
+            /* 要求を受け付けてから保留キューを処理する */
+            __atomic_store_n(&nh->pending, 0, __ATOMIC_RELEASE);
+            nh_flush(nh, ok);
+
+            __atomic_store_n(&nh_q.done, nh_q.done + 1, __ATOMIC_RELEASE);
+        }
+        /* 要求が無ければ待つ */
+        if (read(nh_q.efd, &v, sizeof(v)) < 0 && errno != EINTR) {
+            anycast_sleep(10);
+        }
+    }
+    return NULL;
+}
+
+/*
+    @brief 解決要求の取り出し
+*/
+static struct nh_entry *
+nh_dequeue(void)
+{
+    struct nh_slot *s = &nh_q.slot[nh_q.tail & (NH_QUEUE_SIZE - 1)];
+    struct nh_entry *nh;
+
+    if (__atomic_load_n(&s->seq, __ATOMIC_ACQUIRE) != nh_q.tail + 1) {
+        return NULL;
+    }
+    nh = s->nh;
+    __atomic_store_n(&s->seq, nh_q.tail + NH_QUEUE_SIZE, __ATOMIC_RELEASE);
+    nh_q.tail++;
+    return nh;
+}
+
+/*
+    @brief 保留フレームを送信(解決できなかった場合は破棄)
+    ロック中は取り出すだけにして、送信はロック外で行なう
+*/
+static void
+nh_flush(struct nh_entry *nh, int ok)
+{
+    uint16_t len[NH_HOLD_NUM];
+    struct ethhdr *eth;
+    int i, num;
+
+    if (nh->hold_buf == NULL) {
+        return;
+    }
+    while (__sync_lock_test_and_set(&nh->lock, 1)) {
+        cpu_relax();
+    }
+    num = nh->hold_num;
+    for (i = 0; i < num; i++) {
+        len[i] = nh->hold_len[i];
+        memcpy(nh_txbuf + (i * NH_HOLD_SIZE),
+            nh->hold_buf + (i * NH_HOLD_SIZE), len[i]);
+    }
+    nh->hold_num = 0;
+    __sync_lock_release(&nh->lock);
+
+    for (i = 0; i < num; i++) {
+        if (!ok || (nh->ifp->sockfd <= 0)) {
+            SASAT_STAT(nh_held_drop);
+            continue;
+        }
+        eth = (struct ethhdr *)(nh_txbuf + (i * NH_HOLD_SIZE));
+        load_mac(eth->h_dest, nh->mac);
+        if (write(nh->ifp->sockfd, eth, len[i]) > 0) {
+            SASAT_STAT(nh_held_tx);
+        } else {
+            SASAT_STAT(nh_held_drop);
+        }
+    }
+}
+
+/* end */
@@ -0,0 +1,82 @@
+/**
+ * file    ring_inline.h
+ * brief   mmap受信リング(TPACKET_V3)の参照処理
+ * note    COPYRIGHT FUJITSU LIMITED 2010
+ *
+ * 改版履歴(出荷後記入)
+ * 版数   日付    変更者    リリースノート
+ * ---- -------- --------- --------------------------------------------------
+ */
+#ifndef __RING_INLINE_H__
+#define __RING_INLINE_H__
+
+#include <stdint.h>
+#include <linux/if_packet.h>
+
+#include "anycast.h"
+
+/*
+    @brief 処理対象のブロックを取得
+    @return ブロック(ユーザに引き渡されていない場合NULL)
+*/
+static inline struct tpacket_block_desc *
+rx_ring_block(struct rx_ring *ring)
+{
+    struct tpacket_block_desc *bd;
+
+    bd = (struct tpacket_block_desc *)(ring->map +
+        (ring->cur * ring->block_size));
+
+    if ((__atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE)
+            & TP_STATUS_USER) == 0) {
+        return NULL;
+    }
+    return bd;
+}
+
+/*
+    @brief ブロックの先頭フレーム
+*/
+static inline struct tpacket3_hdr *
+rx_ring_first(struct tpacket_block_desc *bd)
+{
+    return (struct tpacket3_hdr *)((uint8_t *)bd +
+        bd->hdr.bh1.offset_to_first_pkt);
+}
+
+/*
+    @brief 次のフレーム
+*/
+static inline struct tpacket3_hdr *
+rx_ring_next(struct tpacket3_hdr *ppd)
+{
+    return (struct tpacket3_hdr *)((uint8_t *)ppd + ppd->tp_next_offset);
+}
+
+/*
+    @brief フレームのVLAN ID(カーネルが外したタグ、タグ無しの場合0)
+*/
+static inline uint16_t
+rx_ring_vid(struct tpacket3_hdr *ppd)
+{
+    if (ppd->tp_status & TP_STATUS_VLAN_VALID) {
+        return ppd->hv1.tp_vlan_tci & 0x0fff;
+    }
+    return 0;
+}
+
+/*
+    @brief ブロックをカーネルへ返却し、次のブロックへ進む
+*/
+static inline void
+rx_ring_release(struct rx_ring *ring, struct tpacket_block_desc *bd)
+{
+    __atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL,
+        __ATOMIC_RELEASE);
+
+    if (++ring->cur >= ring->block_num) {
+        ring->cur = 0;
+    }
+}
+
+#endif
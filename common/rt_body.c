@@ -9,17 +9,21 @@
  * ---- -------- --------- --------------------------------------------------
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
 #include <time.h>
+#include <pthread.h>
 #include <net/if.h>
 #include <netinet/in.h>
 #include <linux/rtnetlink.h>
+#include <linux/neighbour.h>
 
 #include "log.h"
 #include "val.h"
 #include "util_inline.h"
+#include "resolver.h"
 
 /* struct */
 typedef struct
@@ -50,6 +54,10 @@ struct rtsock_handle
 };
 
 /* prototype */
+#ifndef NDA_RTA
+#define NDA_RTA(r) \
+    ((struct rtattr*)(((char*)(r)) + NLMSG_ALIGN(sizeof(struct ndmsg))))
+#endif
 #define NLMSG_TAIL(nmsg) \
     ((struct rtattr *) (((void *) (nmsg)) + NLMSG_ALIGN((nmsg)->nlmsg_len)))
 
@@ -62,10 +70,66 @@ static int get_neigh(struct nlmsghdr *n, void *, void*);
 #ifdef L_MODE
 static int get_masklen(struct nlmsghdr *n, void *, void*);
 #endif
-static int rtsock_open(struct rtsock_handle *rth);
+static int rtsock_open(struct rtsock_handle *rth, uint32_t groups);
 static void rtsock_close(struct rtsock_handle *rth);
 static int rtsock_talk(struct rtsock_handle *rtsock, struct nlmsghdr *n); 
 static int get_route(struct nlmsghdr *n, inet_prefix *dst, inet_prefix *via);
+int parse_rtattr(struct rtattr *tb[], int max, struct rtattr *rta, int len);
+void signal_block(void);
+
+/*
+    ネイバー、経路テーブルのミラー
+    起動時に一度だけダンプし、以降はRTNLGRP_NEIGH, RTNLGRP_IPV4_ROUTE,
+    RTNLGRP_IPV6_ROUTEの通知で更新する。get_target_mac はミラーから応答する
+*/
+#define RTM_NEIGH_HASH  1024        /* ネイバーハッシュのバケット数(2のべき乗) */
+#define RTM_RCVBUF      (1 << 20)   /* 通知受信用ソケットの受信バッファ */
+
+/* ミラーに載せるネイバーの状態 */
+#define RTM_NUD_VALID   (NUD_REACHABLE | NUD_STALE | NUD_DELAY | NUD_PROBE | \
+                         NUD_PERMANENT)
+
+struct rt_neigh {
+    struct rt_neigh *next;
+    int family;
+    int ifindex;
+    uint8_t addr[16];
+    uint8_t mac[ETH_ALEN];
+};
+
+struct rt_route {
+    int family;
+    int plen;                   /* prefix長 */
+    uint32_t prio;              /* metric */
+    uint8_t dst[16];
+    uint8_t gw[16];             /* 0:直接接続 */
+};
+
+static struct {
+    pthread_mutex_t lock;
+    volatile int ready;         /* 1:ミラーから応答する */
+    struct rtsock_handle rth;   /* 通知受信用(常時オープン) */
+
+    struct rt_neigh *neigh[RTM_NEIGH_HASH];
+    int neigh_num;
+
+    struct rt_route *route;     /* prefix長の長い順、同じ長さはmetric順 */
+    int route_num;
+    int route_max;
+
+    char ifname[IFNAMSIZ];      /* if_nametoindex の結果を保持 */
+    int ifindex;
+} rt_mirror = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static void *rt_mirror_thread(void *);
+static int rt_mirror_dump(int type);
+static int rt_mirror_recv(void);
+static void rt_mirror_msg(struct nlmsghdr *);
+static void rt_mirror_neigh(struct nlmsghdr *);
+static void rt_mirror_route(struct nlmsghdr *);
+static void rt_mirror_flush(void);
+static int rt_mirror_lookup(struct sockaddr *, char *, struct sockaddr *,
+    unsigned char *, int);
 
 /**
  * @brief 宛先アドレスからnext hopIPとそのMACアドレスを求める処理
@@ -97,7 +161,12 @@ int get_target_mac(struct sockaddr *target_addr,
 
     copy_mac(dstmac, zerodata);
 
-    if (rtsock_open(&rth) < 0) {
+    if (rt_mirror.ready) {
+        /* ミラーから応答 */
+        return rt_mirror_lookup(target_addr, ifname, nexthop, dstmac, gw);
+    }
+
+    if (rtsock_open(&rth, 0) < 0) {
         return -1;
     }
 
@@ -191,6 +260,495 @@ int get_target_mac(struct sockaddr *target_addr,
     return 0;
 }
 
+/*
+    @brief ネイバー、経路テーブルのミラーを作成し、通知の受信を開始する
+    (失敗した場合は get_target_mac の都度ルーティングソケットで検索する)
+    @return 0:成功 -1:失敗
+*/
+int
+rt_mirror_start(void)
+{
+    pthread_t tid;
+    int rcvbuf = RTM_RCVBUF;
+
+    if (rtsock_open(&rt_mirror.rth,
+            RTMGRP_NEIGH | RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_ROUTE) < 0) {
+        return -1;
+    }
+    /* 通知の取りこぼし(ENOBUFS)を減らす */
+    if (setsockopt(rt_mirror.rth.fd, SOL_SOCKET, SO_RCVBUF,
+            &rcvbuf, sizeof(rcvbuf)) < 0) {
+        mlog("rt mirror SO_RCVBUF (%s)",
+            strerror_r(errno, ebuf1, ELOG_DATA_LEN));
+    }
+
+    if ((rt_mirror_dump(RTM_GETNEIGH) < 0) ||
+            (rt_mirror_dump(RTM_GETROUTE) < 0)) {
+        mlog("rt mirror dump failed");
+        goto err;
+    }
+    if (pthread_create(&tid, NULL, rt_mirror_thread, NULL)) {
+        mlog("rt mirror thread create error");
+        goto err;
+    }
+    rt_mirror.ready = 1;
+
+    mlog("rt mirror neigh %d route %d", rt_mirror.neigh_num,
+        rt_mirror.route_num);
+    return 0;
+
+err:
+    rtsock_close(&rt_mirror.rth);
+    rt_mirror_flush();
+    return -1;
+}
+
+/*
+    @brief 通知受信スレッド
+*/
+static void *
+rt_mirror_thread(void *arg)
+{
+    pthread_detach(pthread_self());
+    signal_block();
+    SASAT_STAT_THREAD(STAT_BLOCK_NETLINK);
+    numa_move(sstat_self, sizeof(*sstat_self),
+        thread_placement("netlink", KEY_CPU_RESOLVER, -1, 0));
+
+    for ( ;; ) {
+        if ((rt_mirror_recv() >= 0) || (errno != ENOBUFS)) {
+            continue;
+        }
+        /* 通知を取りこぼしたため作り直す(作り直す間は都度検索) */
+        mlog("rt mirror overrun, reload");
+        rt_mirror.ready = 0;
+        for ( ;; ) {
+            rt_mirror_flush();
+            if ((rt_mirror_dump(RTM_GETNEIGH) == 0) &&
+                    (rt_mirror_dump(RTM_GETROUTE) == 0)) {
+                break;
+            }
+            anycast_sleep(1000);
+        }
+        rt_mirror.ready = 1;
+    }
+    return NULL;
+}
+
+/*
+    @brief テーブルをダンプしてミラーへ反映(途中の通知も反映する)
+*/
+static int
+rt_mirror_dump(int type)
+{
+    int ret;
+
+    if (wdump_request(&rt_mirror.rth, AF_UNSPEC, type) < 0) {
+        return -1;
+    }
+    while ((ret = rt_mirror_recv()) == 0) {
+        ;
+    }
+    return (ret > 0) ? 0 : -1;
+}
+
+/*
+    @brief 1回受信し、含まれるメッセージをミラーへ反映
+    @return 1:ダンプ完了 0:継続 -1:エラー(errno)
+*/
+static int
+rt_mirror_recv(void)
+{
+    struct rtsock_handle *rth = &rt_mirror.rth;
+    struct sockaddr_nl nladdr;
+    struct iovec iov;
+    struct msghdr msg = {
+        .msg_name = &nladdr,
+        .msg_namelen = sizeof(nladdr),
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+    };
+    char buf[16384];
+    struct nlmsghdr *h;
+    int status, ret = 0;
+
+    iov.iov_base = buf;
+    iov.iov_len = sizeof(buf);
+    status = recvmsg(rth->fd, &msg, 0);
+    if (status < 0) {
+        return (errno == EINTR) ? 0 : -1;
+    }
+    if (status == 0) {
+        errno = EPIPE;
+        return -1;
+    }
+    if (nladdr.nl_pid != 0) {
+        /* kernel以外 */
+        return 0;
+    }
+
+    for (h = (struct nlmsghdr*)buf; NLMSG_OK(h, status);
+            h = NLMSG_NEXT(h, status)) {
+        if (rth->dump && (h->nlmsg_seq == rth->dump)) {
+            if (h->nlmsg_type == NLMSG_DONE) {
+                rth->dump = 0;
+                ret = 1;
+                continue;
+            }
+            if (h->nlmsg_type == NLMSG_ERROR) {
+                struct nlmsgerr *err = (struct nlmsgerr*)NLMSG_DATA(h);
+                errno = (h->nlmsg_len < NLMSG_LENGTH(sizeof(*err))) ?
+                    EINVAL : -err->error;
+                evtlog("rtm0", errno, 0, (uchar*)"RTNETLINK answers");
+                return -1;
+            }
+        }
+        rt_mirror_msg(h);
+    }
+    return ret;
+}
+
+/*
+    @brief メッセージをミラーへ反映
+*/
+static void
+rt_mirror_msg(struct nlmsghdr *h)
+{
+    switch (h->nlmsg_type) {
+    case RTM_NEWNEIGH:
+    case RTM_DELNEIGH:
+        rt_mirror_neigh(h);
+        break;
+    case RTM_NEWROUTE:
+    case RTM_DELROUTE:
+        rt_mirror_route(h);
+        break;
+    default:
+        break;
+    }
+}
+
+/*
+    @brief ネイバーのハッシュ値
+*/
+static inline uint32_t
+rt_neigh_hash(const uint8_t *addr, int alen)
+{
+    uint32_t h = 2166136261u;
+    int i;
+
+    for (i = 0; i < alen; i++) {
+        h = (h ^ addr[i]) * 16777619u;
+    }
+    return h & (RTM_NEIGH_HASH - 1);
+}
+
+/*
+    @brief ネイバーの追加、更新、削除
+    MACが変わった場合、削除された(解決できなくなった)場合は
+    サーバテーブル等のネクストホップへ反映する
+*/
+static void
+rt_mirror_neigh(struct nlmsghdr *h)
+{
+    struct ndmsg *r = NLMSG_DATA(h);
+    struct rtattr *tb[NDA_MAX+1];
+    struct rt_neigh *ne, **pp;
+    uint8_t addr[16], mac[ETH_ALEN];
+    int len = h->nlmsg_len - NLMSG_LENGTH(sizeof(*r));
+    int alen, changed = 0, lost = 0;
+    uint32_t hash;
+
+    if (len < 0) {
+        return;
+    }
+    if (r->ndm_family == AF_INET) {
+        alen = 4;
+    } else if (r->ndm_family == AF_INET6) {
+        alen = 16;
+    } else {
+        return;
+    }
+    parse_rtattr(tb, NDA_MAX, NDA_RTA(r), len);
+    if ((tb[NDA_DST] == NULL) || (RTA_PAYLOAD(tb[NDA_DST]) != alen)) {
+        return;
+    }
+    memcpy(addr, RTA_DATA(tb[NDA_DST]), alen);
+    hash = rt_neigh_hash(addr, alen);
+
+    pthread_mutex_lock(&rt_mirror.lock);
+    for (pp = &rt_mirror.neigh[hash]; (ne = *pp) != NULL; pp = &ne->next) {
+        if ((ne->family == r->ndm_family) &&
+                (ne->ifindex == r->ndm_ifindex) &&
+                (memcmp(ne->addr, addr, alen) == 0)) {
+            break;
+        }
+    }
+
+    if ((h->nlmsg_type == RTM_NEWNEIGH) && (r->ndm_state & RTM_NUD_VALID) &&
+            tb[NDA_LLADDR] && (RTA_PAYLOAD(tb[NDA_LLADDR]) == ETH_ALEN)) {
+        copy_mac(mac, RTA_DATA(tb[NDA_LLADDR]));
+        if (ne == NULL) {
+            if ((ne = calloc(1, sizeof(*ne))) == NULL) {
+                pthread_mutex_unlock(&rt_mirror.lock);
+                mlog("rt mirror malloc error %zu", sizeof(*ne));
+                return;
+            }
+            ne->family = r->ndm_family;
+            ne->ifindex = r->ndm_ifindex;
+            memcpy(ne->addr, addr, alen);
+            ne->next = rt_mirror.neigh[hash];
+            rt_mirror.neigh[hash] = ne;
+            rt_mirror.neigh_num++;
+            changed = 1;
+        } else if (cmp_mac(ne->mac, mac) != 0) {
+            changed = 1;
+        }
+        copy_mac(ne->mac, mac);
+    } else if (ne != NULL) {
+        /* 削除、または解決できなくなった */
+        *pp = ne->next;
+        free(ne);
+        rt_mirror.neigh_num--;
+        lost = 1;
+    }
+    pthread_mutex_unlock(&rt_mirror.lock);
+
+    if (changed) {
+        nh_neigh_update(r->ndm_family, addr, mac);
+    } else if (lost) {
+        nh_neigh_update(r->ndm_family, addr, NULL);
+    }
+}
+
+/*
+    @brief 経路の追加、更新、削除(mainテーブルのunicast経路のみ)
+*/
+static void
+rt_mirror_route(struct nlmsghdr *h)
+{
+    struct rtmsg *r = NLMSG_DATA(h);
+    struct rtattr *tb[RTA_MAX+1];
+    struct rt_route rt, *p;
+    int len = h->nlmsg_len - NLMSG_LENGTH(sizeof(*r));
+    int i, alen;
+    uint32_t table;
+
+    if (len < 0) {
+        return;
+    }
+    if (r->rtm_family == AF_INET) {
+        alen = 4;
+    } else if (r->rtm_family == AF_INET6) {
+        alen = 16;
+    } else {
+        return;
+    }
+    parse_rtattr(tb, RTA_MAX, RTM_RTA(r), len);
+
+    table = tb[RTA_TABLE] ? *(uint32_t*)RTA_DATA(tb[RTA_TABLE]) : r->rtm_table;
+    if ((table != RT_TABLE_MAIN) || (r->rtm_type != RTN_UNICAST)) {
+        return;
+    }
+
+    memset(&rt, 0, sizeof(rt));
+    rt.family = r->rtm_family;
+    rt.plen = r->rtm_dst_len;
+    if (tb[RTA_DST]) {
+        memcpy(rt.dst, RTA_DATA(tb[RTA_DST]), (r->rtm_dst_len + 7) / 8);
+    }
+    if (tb[RTA_PRIORITY]) {
+        rt.prio = *(uint32_t*)RTA_DATA(tb[RTA_PRIORITY]);
+    }
+    if (tb[RTA_GATEWAY]) {
+        memcpy(rt.gw, RTA_DATA(tb[RTA_GATEWAY]), alen);
+    } else if (tb[RTA_MULTIPATH] &&
+            (RTA_PAYLOAD(tb[RTA_MULTIPATH]) >= sizeof(struct rtnexthop))) {
+        /* マルチパスは先頭のnext hopを使う */
+        struct rtnexthop *nh = RTA_DATA(tb[RTA_MULTIPATH]);
+        struct rtattr *ntb[RTA_MAX+1];
+
+        if (nh->rtnh_len > sizeof(*nh)) {
+            parse_rtattr(ntb, RTA_MAX, RTNH_DATA(nh),
+                nh->rtnh_len - sizeof(*nh));
+            if (ntb[RTA_GATEWAY]) {
+                memcpy(rt.gw, RTA_DATA(ntb[RTA_GATEWAY]), alen);
+            }
+        }
+    }
+
+    pthread_mutex_lock(&rt_mirror.lock);
+    for (i = 0; i < rt_mirror.route_num; i++) {
+        p = &rt_mirror.route[i];
+        if ((p->family == rt.family) && (p->plen == rt.plen) &&
+                (p->prio == rt.prio) &&
+                (memcmp(p->dst, rt.dst, sizeof(rt.dst)) == 0)) {
+            break;
+        }
+    }
+
+    if (h->nlmsg_type == RTM_NEWROUTE) {
+        if (i < rt_mirror.route_num) {
+            /* 更新 */
+            memcpy(rt_mirror.route[i].gw, rt.gw, sizeof(rt.gw));
+        } else {
+            if (rt_mirror.route_num == rt_mirror.route_max) {
+                int max = rt_mirror.route_max ? (rt_mirror.route_max * 2) : 64;
+                p = realloc(rt_mirror.route, sizeof(*p) * max);
+                if (p == NULL) {
+                    pthread_mutex_unlock(&rt_mirror.lock);
+                    mlog("rt mirror malloc error %zu", sizeof(*p) * max);
+                    return;
+                }
+                rt_mirror.route = p;
+                rt_mirror.route_max = max;
+            }
+            /* prefix長の長い順、同じ長さはmetricの小さい順 */
+            for (i = 0; i < rt_mirror.route_num; i++) {
+                p = &rt_mirror.route[i];
+                if ((p->plen < rt.plen) ||
+                        ((p->plen == rt.plen) && (p->prio > rt.prio))) {
+                    break;
+                }
+            }
+            memmove(&rt_mirror.route[i + 1], &rt_mirror.route[i],
+                sizeof(rt) * (rt_mirror.route_num - i));
+            rt_mirror.route[i] = rt;
+            rt_mirror.route_num++;
+        }
+    } else if (i < rt_mirror.route_num) {
+        /* 削除 */
+        memmove(&rt_mirror.route[i], &rt_mirror.route[i + 1],
+            sizeof(rt) * (rt_mirror.route_num - i - 1));
+        rt_mirror.route_num--;
+    }
+    pthread_mutex_unlock(&rt_mirror.lock);
+}
+
+/*
+    @brief ミラーを空にする
+*/
+static void
+rt_mirror_flush(void)
+{
+    struct rt_neigh *ne, *next;
+    int i;
+
+    pthread_mutex_lock(&rt_mirror.lock);
+    for (i = 0; i < RTM_NEIGH_HASH; i++) {
+        for (ne = rt_mirror.neigh[i]; ne != NULL; ne = next) {
+            next = ne->next;
+            free(ne);
+        }
+        rt_mirror.neigh[i] = NULL;
+    }
+    rt_mirror.neigh_num = 0;
+    rt_mirror.route_num = 0;
+    pthread_mutex_unlock(&rt_mirror.lock);
+}
+
+/*
+    @brief アドレスがprefixに含まれるか
+*/
+static inline int
+rt_prefix_match(const uint8_t *addr, const uint8_t *pfx, int plen)
+{
+    int n = plen >> 3;
+    int r = plen & 7;
+
+    if (memcmp(addr, pfx, n) != 0) {
+        return 0;
+    }
+    if (r && ((addr[n] ^ pfx[n]) & (0xff00 >> r) & 0xff)) {
+        return 0;
+    }
+    return 1;
+}
+
+/*
+    @brief ミラーから next hop IP とそのMACアドレスを求める
+    (引数、戻り値は get_target_mac と同じ)
+*/
+static int
+rt_mirror_lookup(struct sockaddr *target_addr, char *ifname,
+    struct sockaddr *nexthop, unsigned char *dstmac, int gw)
+{
+    struct rt_route *rt = NULL;
+    struct rt_neigh *ne;
+    unsigned char *taddr, *naddr;
+    uint8_t via[16];
+    int i, alen, family, ifindex = 0;
+
+    family = target_addr->sa_family;
+    if (family == AF_INET) {
+        alen = 4;
+        taddr = (unsigned char*)&((struct sockaddr_in *)target_addr)->sin_addr;
+        naddr = (unsigned char*)&((struct sockaddr_in *)nexthop)->sin_addr;
+    } else if (family == AF_INET6) {
+        alen = 16;
+        taddr = (unsigned char*)&((struct sockaddr_in6 *)target_addr)->sin6_addr;
+        naddr = (unsigned char*)&((struct sockaddr_in6 *)nexthop)->sin6_addr;
+    } else {
+        return -1;
+    }
+
+    pthread_mutex_lock(&rt_mirror.lock);
+
+    if (ifname) {
+        if (strncmp(rt_mirror.ifname, ifname, IFNAMSIZ) != 0) {
+            if ((rt_mirror.ifindex = if_nametoindex(ifname)) == 0) {
+                pthread_mutex_unlock(&rt_mirror.lock);
+                mlog("if_nametoindex error(%s)", ifname);
+                return -1;
+            }
+            snprintf(rt_mirror.ifname, sizeof(rt_mirror.ifname), "%s", ifname);
+        }
+        ifindex = rt_mirror.ifindex;
+    }
+
+    for (i = 0; i < rt_mirror.route_num; i++) {
+        rt = &rt_mirror.route[i];
+        if (rt->family != family) {
+            continue;
+        }
+        if (gw ? (rt->plen == 0) : rt_prefix_match(taddr, rt->dst, rt->plen)) {
+            break;
+        }
+    }
+    if (i == rt_mirror.route_num) {
+        /* 経路が無い */
+        pthread_mutex_unlock(&rt_mirror.lock);
+        return -1;
+    }
+
+    if (memcmp(rt->gw, zerodata, alen) == 0) {
+        if (gw) {
+            pthread_mutex_unlock(&rt_mirror.lock);
+            return -1;
+        }
+        /* 直接接続 */
+        memcpy(via, taddr, alen);
+    } else {
+        memcpy(via, rt->gw, alen);
+    }
+
+    /* next hopを設定 */
+    memcpy(naddr, via, alen);
+
+    /* MAC取得(見つからない場合は0のまま) */
+    for (ne = rt_mirror.neigh[rt_neigh_hash(via, alen)]; ne; ne = ne->next) {
+        if ((ne->family == family) &&
+                (!ifindex || (ne->ifindex == ifindex)) &&
+                (memcmp(ne->addr, via, alen) == 0)) {
+            copy_mac(dstmac, ne->mac);
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&rt_mirror.lock);
+    return 0;
+}
+
 #ifdef L_MODE 
 /*
     @brief mask長を取得する
@@ -201,7 +759,7 @@ int get_mask(struct sockaddr *target_addr)
     struct filter filter;
     int mask = 0;
 
-    if (rtsock_open(&rth) < 0) {
+    if (rtsock_open(&rth, 0) < 0) {
         return -1;
     }
 
@@ -239,8 +797,9 @@ int get_mask(struct sockaddr *target_addr)
 
 /**
  * @brief ルーティングソケットオープン
+ * @param groups 受信する通知(RTMGRP_*, 0:通知なし)
  */
-static int rtsock_open(struct rtsock_handle *rth)
+static int rtsock_open(struct rtsock_handle *rth, uint32_t groups)
 {
     socklen_t addr_len;
     int sndbuf = 32768;
@@ -266,7 +825,7 @@ static int rtsock_open(struct rtsock_handle *rth)
 
     memset(&rth->local, 0, sizeof(rth->local));
     rth->local.nl_family = AF_NETLINK;
-    rth->local.nl_groups = 0;
+    rth->local.nl_groups = groups;
 
     if (bind(rth->fd, (struct sockaddr*)&rth->local, sizeof(rth->local)) < 0) {
         mlog("Cannot bind netlink socket (%s)", strerror_r(errno, ebuf2, ELOG_DATA_LEN));
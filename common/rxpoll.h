@@ -0,0 +1,88 @@
+/**
+ * file    rxpoll.h
+ * brief   受信待ち受け(割り込み待ち、busy poll、適応型)
+ * note    COPYRIGHT FUJITSU LIMITED 2010
+ *
+ * 改版履歴(出荷後記入)
+ * 版数   日付    変更者    リリースノート
+ * ---- -------- --------- --------------------------------------------------
+ */
+#ifndef __RXPOLL_H__
+#define __RXPOLL_H__
+
+#include <stdint.h>
+
+#include "util_inline.h"
+
+/* 待ち受け方式(rx.poll) */
+#define RX_POLL_IRQ         0   /* epoll_wait()で待つ */
+#define RX_POLL_BUSY        1   /* 常にbusy poll */
+#define RX_POLL_ADAPTIVE    2   /* 受信が続く間busy poll、途切れたら待つ */
+
+/* busy pollの初期値 */
+#define RX_BUSY_POLL_DEFAULT    50  /* SO_BUSY_POLL(usec) */
+#define RX_POLL_IDLE_DEFAULT    200 /* 待ち受けへ戻るまでの空回り時間(usec) */
+
+/*
+    カーネルの受信統計(PACKET_STATISTICS)の統計番号の並び
+    受信スレッドがrx.stat_interval(ms)毎に読み出して加算する
+    (読み出すとカーネル側は0になる)。損失率は書き出し時に
+    rx_poll_stat()で全受信スレッドの値から求める
+*/
+enum {
+    RX_KSTAT_PACKETS = 0,   /* カーネルが受信したフレーム(破棄を含む) */
+    RX_KSTAT_DROPS,         /* ソケットバッファ、リングの不足で破棄 */
+    RX_KSTAT_FREEZE,        /* リングのキューが止まった回数(mmap受信リング) */
+    RX_KSTAT_LOSS_INT,      /* 破棄のあった区間数 */
+    RX_KSTAT_LOSS_LAST,     /* 最後の区間の損失率(ppm、スレッドの最大) */
+    RX_KSTAT_LOSS_MAX,      /* 最大の損失率(ppm) */
+    RX_KSTAT_NUM
+};
+
+/*
+    @brief 受信スレッド毎の待ち受け状態
+*/
+struct rx_poll {
+    int mode;
+    int fd;                 /* AF_PACKETソケット */
+    int epfd;
+    int xfd;                /* AF_XDPソケット(無い場合-1) */
+    uint64_t idle_tsc;      /* 待ち受けへ戻るまでの空回り時間(tsc) */
+    uint64_t last;          /* 最後に受信した時刻(tsc) */
+    int spin;               /* 1:空回り中 */
+    int spin_stat;          /* 空回り回数の統計番号 */
+    int sleep_stat;         /* 待ち受け回数の統計番号 */
+
+    /* カーネルの受信統計 */
+    int kstat_stat;         /* 統計番号(RX_KSTAT_PACKETSの位置) */
+    uint64_t kstat_tsc;     /* 読み出し間隔(tsc、無効の場合UINT64_MAX) */
+    uint64_t kstat_last;    /* 最後に読み出した時刻(tsc) */
+    uint32_t loss_last;     /* 最後の区間の損失率(ppm) */
+    uint32_t loss_max;
+};
+
+int rx_poll_init(struct rx_poll *, int, int, int, int, int);
+void rx_poll_free(struct rx_poll *);
+int rx_poll_wait(struct rx_poll *, int);
+void rx_poll_kstat(struct rx_poll *);
+void rx_poll_stat(void);
+
+/*
+    @brief 受信処理の結果を反映
+    @param p 待ち受け状態
+    @param n 受信したフレーム数
+*/
+static inline void
+rx_poll_done(struct rx_poll *p, int n)
+{
+    if (n) {
+        p->last = rdtsc();
+        if (unlikely(p->last - p->kstat_last >= p->kstat_tsc)) {
+            rx_poll_kstat(p);
+        }
+    } else if (p->spin) {
+        SASAT_STAT(p->spin_stat);
+    }
+}
+
+#endif
@@ -0,0 +1,260 @@
+/**
+ * file    rxpoll_body.c
+ * brief   受信待ち受け(割り込み待ち、busy poll、適応型)
+ * note    COPYRIGHT FUJITSU LIMITED 2010
+ *
+ * 改版履歴(出荷後記入)
+ * 版数   日付    変更者    リリースノート
+ * ---- -------- --------- --------------------------------------------------
+ */
+
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+#ifndef SO_BUSY_POLL_BUDGET
+#define SO_BUSY_POLL_BUDGET 70
+#endif
+
+#define RX_BUSY_POLL_BUDGET 64  /* 1回のbusy pollで処理するフレーム数 */
+
+/* カーネルの受信統計を読み出すスレッド(統計の領域番号毎) */
+static struct rx_poll *rx_poll_list[STAT_BLOCK_NUM];
+
+/*
+    @brief ソケットにbusy pollを設定
+    カーネルが対応していない場合は設定せずに空回りのみ行う
+*/
+static void
+rx_busy_poll_set(int fd, int usec)
+{
+    int on = 1, budget = RX_BUSY_POLL_BUDGET;
+
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) < 0) {
+        mlog("SO_BUSY_POLL(%d) %s", fd, strerror(errno));
+        return;
+    }
+    if (setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &on,
+            sizeof(on)) < 0) {
+        mlog("SO_PREFER_BUSY_POLL(%d) %s", fd, strerror(errno));
+        return;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL_BUDGET, &budget, sizeof(budget));
+}
+
+/*
+    @brief 待ち受けの初期化
+    @param p          待ち受け状態
+    @param fd         AF_PACKETソケット
+    @param xfd        AF_XDPソケット(無い場合-1)
+    @param spin_stat  空回り回数の統計番号
+    @param sleep_stat 待ち受け回数の統計番号
+    @param kstat_stat カーネルの受信統計の統計番号(RX_KSTAT_NUM個)
+    @return 0:正常 -1:異常
+*/
+int
+rx_poll_init(struct rx_poll *p, int fd, int xfd, int spin_stat,
+    int sleep_stat, int kstat_stat)
+{
+    struct epoll_event ev;
+    const char *str;
+    int usec, msec;
+
+    memset(p, 0, sizeof(*p));
+    p->fd = fd;
+    p->xfd = xfd;
+    p->spin_stat = spin_stat;
+    p->sleep_stat = sleep_stat;
+
+    /* カーネルの受信統計(受信スレッドの統計の領域に加算する) */
+    p->kstat_stat = kstat_stat;
+    p->kstat_tsc = UINT64_MAX;
+    if ((msec = anycast_get_properties_int(KEY_RX_STAT_INTERVAL)) > 0) {
+        p->kstat_tsc = (uint64_t)msec * 1000 * get_clock();
+        p->kstat_last = rdtsc();
+        __atomic_store_n(&rx_poll_list[sstat_self - sstat_blk], p,
+            __ATOMIC_RELEASE);
+    }
+
+    p->mode = anycast_get_properties_int(KEY_RX_POLL);
+    if ((p->mode < RX_POLL_IRQ) || (p->mode > RX_POLL_ADAPTIVE)) {
+        mlog("rx.poll=%d invalid, use %d", p->mode, RX_POLL_IRQ);
+        p->mode = RX_POLL_IRQ;
+    }
+
+    usec = RX_POLL_IDLE_DEFAULT;
+    if (((str = anycast_get_properties(KEY_RX_POLL_IDLE)) != NULL) &&
+            (*str != '\0')) {
+        usec = anycast_get_properties_int(KEY_RX_POLL_IDLE);
+    }
+    p->idle_tsc = (uint64_t)usec * get_clock();
+
+    if ((p->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        syslog(LOG_ERR, "epoll_create1 %s", strerror(errno));
+        return -1;
+    }
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(p->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        syslog(LOG_ERR, "epoll_ctl %s", strerror(errno));
+        close(p->epfd);
+        p->epfd = -1;
+        return -1;
+    }
+    if (xfd >= 0) {
+        ev.data.fd = xfd;
+        if (epoll_ctl(p->epfd, EPOLL_CTL_ADD, xfd, &ev) < 0) {
+            syslog(LOG_ERR, "epoll_ctl %s", strerror(errno));
+            close(p->epfd);
+            p->epfd = -1;
+            return -1;
+        }
+    }
+
+    if (p->mode == RX_POLL_IRQ) {
+        return 0;
+    }
+
+    usec = RX_BUSY_POLL_DEFAULT;
+    if (((str = anycast_get_properties(KEY_RX_BUSY_POLL)) != NULL) &&
+            (*str != '\0')) {
+        usec = anycast_get_properties_int(KEY_RX_BUSY_POLL);
+    }
+    if (usec > 0) {
+        rx_busy_poll_set(fd, usec);
+        if (xfd >= 0) {
+            rx_busy_poll_set(xfd, usec);
+        }
+    }
+    mlog("rx poll mode %d busy_poll %d usec idle %d usec", p->mode, usec,
+        (int)(p->idle_tsc / (get_clock() ? get_clock() : 1)));
+    return 0;
+}
+
+/*
+    @brief 待ち受けの解放
+*/
+void
+rx_poll_free(struct rx_poll *p)
+{
+    int i;
+
+    for (i = 0; i < STAT_BLOCK_NUM; i++) {
+        if (rx_poll_list[i] == p) {
+            __atomic_store_n(&rx_poll_list[i], NULL, __ATOMIC_RELEASE);
+        }
+    }
+    if (p->epfd >= 0) {
+        close(p->epfd);
+        p->epfd = -1;
+    }
+}
+
+/*
+    @brief 受信待ち
+    busy poll中はカーネルを待たずに戻る。AF_XDPソケットは空のrecvfrom()で
+    ドライバのNAPIを直接実行させる(SO_PREFER_BUSY_POLL)
+    @param p       待ち受け状態
+    @param timeout タイムアウト(ms、-1:無期限)
+    @return 1:受信処理を行う 0:タイムアウト
+*/
+int
+rx_poll_wait(struct rx_poll *p, int timeout)
+{
+    struct epoll_event ev[2];
+    int ret;
+
+    if (p->mode == RX_POLL_BUSY) {
+        p->spin = 1;
+    } else if (p->mode == RX_POLL_ADAPTIVE) {
+        p->spin = ((rdtsc() - p->last) < p->idle_tsc);
+    }
+
+    if (p->spin) {
+        if (p->xfd >= 0) {
+            recvfrom(p->xfd, NULL, 0, MSG_DONTWAIT, NULL, NULL);
+        }
+        return 1;
+    }
+
+    SASAT_STAT(p->sleep_stat);
+    ret = epoll_wait(p->epfd, ev, 2, timeout);
+    if (ret == 0) {
+        return 0;
+    }
+    if (ret > 0) {
+        /* 受信が始まったため再び空回りする */
+        p->last = rdtsc();
+    }
+    return 1;
+}
+
+/*
+    @brief カーネルの受信統計を読み出して統計へ加算(受信スレッドから呼ぶ)
+    AF_XDPソケットの破棄は含まない
+*/
+void
+rx_poll_kstat(struct rx_poll *p)
+{
+    struct tpacket_stats_v3 st;
+    socklen_t len = sizeof(st);
+    uint32_t ppm;
+
+    p->kstat_last = p->last;
+
+    /* TPACKET_V3以外はtp_freeze_q_cntを返さない */
+    memset(&st, 0, sizeof(st));
+    if (getsockopt(p->fd, SOL_PACKET, PACKET_STATISTICS, &st, &len) < 0) {
+        return;
+    }
+    SASAT_STAT_ADD(p->kstat_stat + RX_KSTAT_PACKETS, st.tp_packets);
+    SASAT_STAT_ADD(p->kstat_stat + RX_KSTAT_DROPS, st.tp_drops);
+    SASAT_STAT_ADD(p->kstat_stat + RX_KSTAT_FREEZE, st.tp_freeze_q_cnt);
+
+    ppm = 0;
+    if (st.tp_drops) {
+        SASAT_STAT(p->kstat_stat + RX_KSTAT_LOSS_INT);
+        ppm = (uint64_t)st.tp_drops * 1000000 /
+            (st.tp_packets ? st.tp_packets : st.tp_drops);
+    }
+    __atomic_store_n(&p->loss_last, ppm, __ATOMIC_RELAXED);
+    if (ppm > p->loss_max) {
+        __atomic_store_n(&p->loss_max, ppm, __ATOMIC_RELAXED);
+    }
+}
+
+/*
+    @brief 損失率を統計へ反映する(書き出し前に呼ぶ)
+    統計番号毎に受信スレッドの最大値とする
+*/
+void
+rx_poll_stat(void)
+{
+    ssz_t *st = sstat_blk[STAT_BLOCK_NUM - 1].stat;
+    struct rx_poll *p;
+    uint32_t v;
+    int i;
+
+    /* 統計の最後の領域はコマンドスレッドのみが更新する */
+    for (i = 0; i < STAT_BLOCK_NUM; i++) {
+        if ((p = __atomic_load_n(&rx_poll_list[i], __ATOMIC_ACQUIRE))) {
+            st[p->kstat_stat + RX_KSTAT_LOSS_LAST] = 0;
+            st[p->kstat_stat + RX_KSTAT_LOSS_MAX] = 0;
+        }
+    }
+    for (i = 0; i < STAT_BLOCK_NUM; i++) {
+        if ((p = __atomic_load_n(&rx_poll_list[i], __ATOMIC_ACQUIRE)) == NULL) {
+            continue;
+        }
+        v = __atomic_load_n(&p->loss_last, __ATOMIC_RELAXED);
+        if (v > st[p->kstat_stat + RX_KSTAT_LOSS_LAST]) {
+            st[p->kstat_stat + RX_KSTAT_LOSS_LAST] = v;
+        }
+        v = __atomic_load_n(&p->loss_max, __ATOMIC_RELAXED);
+        if (v > st[p->kstat_stat + RX_KSTAT_LOSS_MAX]) {
+            st[p->kstat_stat + RX_KSTAT_LOSS_MAX] = v;
+        }
+    }
+}
+
+/* end */
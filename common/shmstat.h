@@ -0,0 +1,124 @@
+/**
+ * file    shmstat.h
+ * brief   共有メモリの統計(コマンドソケットを使わずに参照する)
+ * note    COPYRIGHT FUJITSU LIMITED 2010
+ *
+ * 改版履歴(出荷後記入)
+ * 版数   日付    変更者    リリースノート
+ * ---- -------- --------- --------------------------------------------------
+ */
+#ifndef __SHMSTAT_H__
+#define __SHMSTAT_H__
+
+#include <stdint.h>
+
+/*
+    コマンドスレッドがshm_stat.interval(ms)毎に統計、振り分けテーブル毎の
+    hit数、サーバ毎のhit数、クライアントテーブルの使用数を書き込む。
+    振り分けスレッドは関与しない(スレッド毎の統計を合算して書き込む)
+    参照側はseqが奇数(更新中)または読み出し前後で変化した場合に読み直す
+    レイアウトを変更した場合はSHMSTAT_VERSIONを上げる
+*/
+#define SHMSTAT_FILE        "/dev/shm/.sasat_stat"
+#define SHMSTAT_MAGIC       0x53535441  /* "SSTA" */
+#define SHMSTAT_VERSION     1
+
+#define SHMSTAT_NAME_LEN    48      /* 統計名 */
+#define SHMSTAT_LINE_LEN    128     /* 振り分け設定行 */
+#define SHMSTAT_POL_MAX     4096    /* 書き込む振り分けテーブル数(v4+v6) */
+#define SHMSTAT_SVR_MAX     1024    /* 書き込むサーバ数(v4+v6) */
+
+/* 書き込み側 */
+enum {
+    SHMSTAT_FRONT = 1,
+    SHMSTAT_BACK,
+};
+
+/*
+    @brief 振り分けテーブル1行(front)
+*/
+struct shmstat_pol {
+    uint64_t hit;                   /* パケット数 */
+    uint32_t client;                /* 参照している振り分けキャッシュ数 */
+    uint8_t family;                 /* AF_INET, AF_INET6 */
+    uint8_t _rsv[3];
+    char line[SHMSTAT_LINE_LEN];    /* 設定行 */
+};
+
+/*
+    @brief サーバ(frontは振り分け先、backendは実サーバ)
+*/
+struct shmstat_svr {
+    uint64_t hit;                   /* パケット数 */
+    uint8_t family;
+    uint8_t status;                 /* SVR_INIT, SVR_OK, ... */
+    uint8_t _rsv[6];
+    uint8_t addr[16];               /* v4は先頭4byte */
+    uint8_t gw[16];                 /* ゲートウェイ(addrと同じ場合は直結) */
+};
+
+/*
+    @brief クライアントテーブルの使用数
+    front: 振り分けキャッシュ(全スレッド合計)
+    backend: クライアント情報テーブル(up:クライアント->サーバ, dwn:逆方向)
+*/
+struct shmstat_cli {
+    uint32_t size4;                 /* テーブルサイズ */
+    uint32_t size6;
+    uint32_t up4;
+    uint32_t up6;
+    uint32_t dwn4;                  /* backendのみ */
+    uint32_t dwn6;
+};
+
+/*
+    @brief セグメント先頭
+    各配列の位置はセグメント先頭からのオフセット
+*/
+struct shmstat_hdr {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t type;                  /* SHMSTAT_FRONT, SHMSTAT_BACK */
+    uint32_t size;                  /* セグメントサイズ */
+    uint32_t seq;                   /* seqlock(奇数:更新中) */
+    uint32_t pid;                   /* 書き込むプロセス */
+    uint64_t update;                /* 最終更新時刻(CLOCK_REALTIME, ns) */
+    uint64_t count;                 /* 更新回数 */
+
+    uint32_t stat_num;
+    uint32_t stat_off;              /* uint64_t[stat_num] */
+    uint32_t name_off;              /* char[stat_num][SHMSTAT_NAME_LEN] */
+    uint32_t pol_num;
+    uint32_t pol_off;               /* struct shmstat_pol[] */
+    uint32_t pol_drop;              /* 書き込めなかった振り分けテーブル数 */
+    uint32_t svr_num;
+    uint32_t svr_off;               /* struct shmstat_svr[] */
+    uint32_t svr_drop;
+    uint32_t cli_off;               /* struct shmstat_cli */
+    uint32_t pol_no;                /* 振り分けテーブルの世代(front) */
+    uint32_t _rsv;
+};
+
+#define SHMSTAT_PTR(h, off, type)   ((type *)((uint8_t *)(h) + (off)))
+
+/* 書き込み側(front, backend) */
+struct timeval;
+int shmstat_init(void);
+void shmstat_update(struct timeval *);
+
+/*
+    読み出し側(shmstat_read.c, sasat stat --shm)
+    shmstat_snapshot()は一貫した内容をbufへコピーする
+*/
+struct shmstat {
+    int fd;
+    uint32_t size;
+    const struct shmstat_hdr *map;
+};
+
+int shmstat_open(struct shmstat *, const char *);
+int shmstat_snapshot(struct shmstat *, void *, uint32_t);
+int shmstat_alive(const struct shmstat_hdr *);
+void shmstat_close(struct shmstat *);
+
+#endif
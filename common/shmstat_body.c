@@ -0,0 +1,330 @@
+/**
+ * file    shmstat_body.c
+ * brief   共有メモリの統計の書き込み(コマンドスレッドから呼ぶ)
+ * note    COPYRIGHT FUJITSU LIMITED 2010
+ *
+ * 改版履歴(出荷後記入)
+ * 版数   日付    変更者    リリースノート
+ * ---- -------- --------- --------------------------------------------------
+ */
+
+static void shmstat_write(struct shmstat_hdr *);
+static void shmstat_begin(struct shmstat_hdr *);
+static void shmstat_end(struct shmstat_hdr *);
+
+static struct shmstat_hdr *shm_hdr;     /* NULL:使用しない */
+static uint64_t shm_interval;           /* 更新間隔(ms) */
+static uint64_t shm_last;               /* 最終更新(CLOCK_MONOTONIC, ms) */
+
+static inline uint64_t
+shm_clock_ms(int clk)
+{
+    struct timespec ts;
+
+    clock_gettime(clk, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+    @brief セグメント作成
+    作業ファイルに作ってからrenameし、旧セグメントを参照中の読み出し側へ
+    作りかけの内容を見せない
+    @return 0:正常(shm_stat.interval=0の場合は作成しない) -1:異常
+*/
+int
+shmstat_init(void)
+{
+    struct shmstat_hdr *h;
+    char *name, tmp[] = SHMSTAT_FILE".XXXXXX";
+    uint32_t size, off;
+    long ms;
+    int fd, i, len;
+
+    if ((ms = anycast_get_properties_int(KEY_SHM_STAT)) <= 0) {
+        return 0;
+    }
+
+    off = sizeof(struct shmstat_hdr);
+    size = off + STAT_MAX * (sizeof(uint64_t) + SHMSTAT_NAME_LEN) +
+        SHMSTAT_POL_MAX * sizeof(struct shmstat_pol) +
+        SHMSTAT_SVR_MAX * sizeof(struct shmstat_svr) +
+        sizeof(struct shmstat_cli);
+
+    if ((fd = mkstemp(tmp)) < 0) {
+        mlog("shm stat create error (%s)", strerror(errno));
+        return -1;
+    }
+    if ((fchmod(fd, 0644) < 0) || (ftruncate(fd, size) < 0) ||
+            ((h = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                fd, 0)) == MAP_FAILED)) {
+        mlog("shm stat map error (%s)", strerror(errno));
+        close(fd);
+        unlink(tmp);
+        return -1;
+    }
+    close(fd);
+
+    h->version = SHMSTAT_VERSION;
+#ifdef FRONT_T
+    h->type = SHMSTAT_FRONT;
+#else
+    h->type = SHMSTAT_BACK;
+#endif
+    h->size = size;
+    h->pid = getpid();
+
+    h->stat_num = STAT_MAX;
+    h->stat_off = off;
+    off += STAT_MAX * sizeof(uint64_t);
+    h->name_off = off;
+    off += STAT_MAX * SHMSTAT_NAME_LEN;
+    h->pol_off = off;
+    off += SHMSTAT_POL_MAX * sizeof(struct shmstat_pol);
+    h->svr_off = off;
+    off += SHMSTAT_SVR_MAX * sizeof(struct shmstat_svr);
+    h->cli_off = off;
+
+    /* 統計名(先頭の':'と改行を除く) */
+    for (i = 0; i < STAT_MAX; i++) {
+        name = SHMSTAT_PTR(h, h->name_off, char) + i * SHMSTAT_NAME_LEN;
+        strncpy(name, sstat[i].name + 1, SHMSTAT_NAME_LEN - 1);
+        if (((len = strlen(name)) > 0) && (name[len - 1] == '\n')) {
+            name[len - 1] = '\0';
+        }
+    }
+
+    shmstat_write(h);
+    __atomic_store_n(&h->magic, SHMSTAT_MAGIC, __ATOMIC_RELEASE);
+
+    if (rename(tmp, SHMSTAT_FILE) < 0) {
+        mlog("shm stat rename error (%s)", strerror(errno));
+        munmap(h, size);
+        unlink(tmp);
+        return -1;
+    }
+
+    shm_hdr = h;
+    shm_interval = ms;
+    shm_last = shm_clock_ms(CLOCK_MONOTONIC);
+    mlog("shm stat %s interval %ldms", SHMSTAT_FILE, ms);
+    return 0;
+}
+
+/*
+    @brief 更新間隔が経過していれば書き込む
+    @param tv 待ち受け時間(次の更新までに短縮する)
+*/
+void
+shmstat_update(struct timeval *tv)
+{
+    uint64_t now, rest;
+
+    if (shm_hdr == NULL) {
+        return;
+    }
+
+    now = shm_clock_ms(CLOCK_MONOTONIC);
+    if (now - shm_last >= shm_interval) {
+        shm_last = now;
+        shmstat_write(shm_hdr);
+    }
+
+    rest = shm_interval - (now - shm_last);
+    if ((uint64_t)tv->tv_sec * 1000 + tv->tv_usec / 1000 > rest) {
+        tv->tv_sec = rest / 1000;
+        tv->tv_usec = (rest % 1000) * 1000;
+    }
+}
+
+/*
+    @brief seqlock 書き込み開始(読み出し側は奇数の間読み直す)
+*/
+static void
+shmstat_begin(struct shmstat_hdr *h)
+{
+    __atomic_store_n(&h->seq, h->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void
+shmstat_end(struct shmstat_hdr *h)
+{
+    h->update = shm_clock_ms(CLOCK_REALTIME) * 1000000;
+    h->count++;
+    __atomic_store_n(&h->seq, h->seq + 1, __ATOMIC_RELEASE);
+}
+
+#ifdef FRONT_T
+static void
+shm_add_svr(struct shmstat_hdr *h, server_tbl_t *svr_tbl, int family)
+{
+    struct shmstat_svr *s;
+
+    if (svr_tbl->status == SVR_DROP) {
+        return;
+    }
+    if (h->svr_num >= SHMSTAT_SVR_MAX) {
+        h->svr_drop++;
+        return;
+    }
+    s = SHMSTAT_PTR(h, h->svr_off, struct shmstat_svr) + h->svr_num++;
+    memset(s, 0, sizeof(*s));
+    s->family = family;
+    s->status = svr_tbl->status;
+    s->hit = svr_tbl->srv_stat.hit + pol_cache_hit(&svr_tbl->srv_stat.hit);
+    if (family == AF_INET6) {
+        memcpy(s->addr, &((struct sockaddr_in6 *)&svr_tbl->svr_ip)->sin6_addr,
+            16);
+        memcpy(s->gw, &((struct sockaddr_in6 *)&svr_tbl->gw_ip)->sin6_addr,
+            16);
+    } else {
+        memcpy(s->addr, &((struct sockaddr_in *)&svr_tbl->svr_ip)->sin_addr,
+            4);
+        memcpy(s->gw, &((struct sockaddr_in *)&svr_tbl->gw_ip)->sin_addr, 4);
+    }
+}
+
+static void
+shm_add_pol(struct shmstat_hdr *h, const char *line, uint32_t hit,
+    uint32_t client, int family)
+{
+    struct shmstat_pol *p;
+
+    if (h->pol_num >= SHMSTAT_POL_MAX) {
+        h->pol_drop++;
+        return;
+    }
+    p = SHMSTAT_PTR(h, h->pol_off, struct shmstat_pol) + h->pol_num++;
+    memset(p, 0, sizeof(*p));
+    p->family = family;
+    p->hit = hit;
+    p->client = client;
+    snprintf(p->line, sizeof(p->line), "%s", line);
+}
+
+/*
+    @brief 振り分けテーブル、サーバ、振り分けキャッシュ
+    振り分けテーブルの切り替えはコマンドスレッドが行うため、ここでは
+    lb_policy_info.setは変わらない
+    キャッシュ中で未加算のヒット数はキャッシュを1回走査して集計しておく
+*/
+static void
+shmstat_write_front(struct shmstat_hdr *h)
+{
+    struct lb_pol_set *set = lb_policy_info.set;
+    struct shmstat_cli *cli = SHMSTAT_PTR(h, h->cli_off, struct shmstat_cli);
+    struct pol_cache_count cnt;
+    lb_pol_v4_t *entry4;
+    lb_pol_v6_t *entry6;
+    server_tbl_t *svr_tbl;
+
+    h->pol_num = h->pol_drop = h->svr_num = h->svr_drop = 0;
+    memset(cli, 0, sizeof(*cli));
+    if (set == NULL) {
+        return;
+    }
+    h->pol_no = set->pol_no;
+
+    pol_cache_collect(set, &cnt);
+    cli->size4 = cnt.size4;
+    cli->size6 = cnt.size6;
+    cli->up4 = cnt.up4;
+    cli->up6 = cnt.up6;
+
+    SLIST_FOREACH(svr_tbl, &set->svr.head6, list) {
+        shm_add_svr(h, svr_tbl, AF_INET6);
+    }
+    SLIST_FOREACH(svr_tbl, &set->svr.head4, list) {
+        shm_add_svr(h, svr_tbl, AF_INET);
+    }
+    TAILQ_FOREACH(entry6, &set->lb_pol_head6, lb_list) {
+        shm_add_pol(h, entry6->line,
+            entry6->hit_count + pol_cache_hit(&entry6->hit_count),
+            entry6->use_count, AF_INET6);
+    }
+    TAILQ_FOREACH(entry4, &set->lb_pol_head4, lb_list) {
+        shm_add_pol(h, entry4->line,
+            entry4->hit_count + pol_cache_hit(&entry4->hit_count),
+            entry4->use_count, AF_INET);
+    }
+}
+#else
+/*
+    @brief 実サーバ、クライアント情報テーブル
+*/
+static void
+shmstat_write_back(struct shmstat_hdr *h)
+{
+    struct shmstat_cli *cli = SHMSTAT_PTR(h, h->cli_off, struct shmstat_cli);
+    struct shmstat_svr *s = SHMSTAT_PTR(h, h->svr_off, struct shmstat_svr);
+    uint64_t *st = SHMSTAT_PTR(h, h->stat_off, uint64_t);
+    int i;
+
+    h->svr_num = 0;
+    if (svr_info.v6_enable) {
+        memset(s, 0, sizeof(*s));
+        s->family = AF_INET6;
+        s->status = svr_info.stat;
+        s->hit = st[tx_packet_v6_in];
+        memcpy(s->addr, &svr_info.svr_ip6.sin6_addr, 16);
+        memcpy(s->gw, &((struct sockaddr_in6 *)&svr_info.gw6)->sin6_addr, 16);
+        s++;
+        h->svr_num++;
+    }
+    if (svr_info.v4_enable) {
+        memset(s, 0, sizeof(*s));
+        s->family = AF_INET;
+        s->status = svr_info.stat;
+        s->hit = st[tx_packet_v4_in];
+        memcpy(s->addr, &svr_info.svr_ip4.sin_addr, 4);
+        memcpy(s->gw, &((struct sockaddr_in *)&svr_info.gw4)->sin_addr, 4);
+        h->svr_num++;
+    }
+
+    memset(cli, 0, sizeof(*cli));
+    if (client_info.up_init4 == NULL) {
+        return;
+    }
+    cli->size4 = cli->size6 = CLI_CACHE;
+    for (i = 0; i < CLI_CACHE; i++) {
+        cli->up4 += (client_info.up_init4[i].timestamp != 0);
+        cli->dwn4 += (client_info.dwn_init4[i].timestamp != 0);
+        cli->up6 += (client_info.up_init6[i].timestamp != 0);
+        cli->dwn6 += (client_info.dwn_init6[i].timestamp != 0);
+    }
+}
+#endif
+
+/*
+    @brief 統計(スレッド毎の領域を合算)と各テーブルの情報を書き込む
+*/
+static void
+shmstat_write(struct shmstat_hdr *h)
+{
+    uint64_t *st = SHMSTAT_PTR(h, h->stat_off, uint64_t);
+    ssz_t sum;
+    int i, n;
+
+#ifdef FRONT_T
+    /* XDPで送信した数(統計の最後の領域へ反映) */
+    xdp_fwd_stat();
+#endif
+    lat_stat();
+    rx_poll_stat();
+
+    shmstat_begin(h);
+    for (i = 0; i < STAT_MAX; i++) {
+        for (sum = 0, n = 0; n < STAT_BLOCK_NUM; n++) {
+            sum += stat_read(&sstat_blk[n].stat[i]);
+        }
+        st[i] = sum;
+    }
+#ifdef FRONT_T
+    shmstat_write_front(h);
+#else
+    shmstat_write_back(h);
+#endif
+    shmstat_end(h);
+}
+
+/* end */
@@ -0,0 +1,129 @@
+/**
+ * file    shmstat_read.c
+ * brief   共有メモリの統計の読み出し(sasatコマンド、監視ツールから使用する)
+ * note    COPYRIGHT FUJITSU LIMITED 2010
+ *
+ * 改版履歴(出荷後記入)
+ * 版数   日付    変更者    リリースノート
+ * ---- -------- --------- --------------------------------------------------
+ */
+
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "shmstat.h"
+
+#define SHMSTAT_RETRY   1000    /* 更新中の場合の読み直し回数 */
+
+/*
+    @brief セグメントを読み出し専用でmapする
+    @param path NULLの場合SHMSTAT_FILE
+    @return 0:正常 -1:異常(errno、形式が異なる場合EPROTO)
+*/
+int
+shmstat_open(struct shmstat *s, const char *path)
+{
+    const struct shmstat_hdr *h;
+    struct stat st;
+    void *map;
+
+    memset(s, 0, sizeof(*s));
+    s->fd = -1;
+
+    if ((s->fd = open(path ? path : SHMSTAT_FILE, O_RDONLY)) < 0) {
+        return -1;
+    }
+    if ((fstat(s->fd, &st) < 0) ||
+            (st.st_size < (off_t)sizeof(struct shmstat_hdr))) {
+        goto open_err;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, s->fd, 0);
+    if (map == MAP_FAILED) {
+        goto open_err;
+    }
+    h = map;
+    if ((h->magic != SHMSTAT_MAGIC) || (h->version != SHMSTAT_VERSION) ||
+            (h->size > st.st_size)) {
+        munmap(map, st.st_size);
+        errno = EPROTO;
+        goto open_err;
+    }
+    s->map = h;
+    s->size = st.st_size;
+    return 0;
+
+open_err:
+    {
+        int err = errno;
+        close(s->fd);
+        s->fd = -1;
+        errno = err;
+    }
+    return -1;
+}
+
+/*
+    @brief 更新中でない内容をコピーする(seqlock)
+    書き込み側を待たせることはない
+    @param buf  コピー先(セグメントサイズ以上)
+    @return 0:正常 -1:異常(ENOSPC:bufが小さい, EAGAIN:更新が続いている)
+*/
+int
+shmstat_snapshot(struct shmstat *s, void *buf, uint32_t size)
+{
+    uint32_t seq1, seq2;
+    int i;
+
+    if (size < s->size) {
+        errno = ENOSPC;
+        return -1;
+    }
+    for (i = 0; i < SHMSTAT_RETRY; i++) {
+        seq1 = __atomic_load_n(&s->map->seq, __ATOMIC_ACQUIRE);
+        if (seq1 & 1) {
+            usleep(10);
+            continue;
+        }
+        memcpy(buf, s->map, s->size);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        seq2 = __atomic_load_n(&s->map->seq, __ATOMIC_RELAXED);
+        if (seq1 == seq2) {
+            return 0;
+        }
+    }
+    errno = EAGAIN;
+    return -1;
+}
+
+/*
+    @brief 書き込むプロセスが動作しているか
+    @return 1:動作中 0:停止(内容は停止時のもの)
+*/
+int
+shmstat_alive(const struct shmstat_hdr *h)
+{
+    return (kill(h->pid, 0) == 0) || (errno == EPERM);
+}
+
+/*
+    @brief unmap
+*/
+void
+shmstat_close(struct shmstat *s)
+{
+    if (s->map) {
+        munmap((void *)s->map, s->size);
+    }
+    if (s->fd >= 0) {
+        close(s->fd);
+    }
+    memset(s, 0, sizeof(*s));
+    s->fd = -1;
+}
+
+/* end */
@@ -13,15 +13,16 @@
 
 #include <stdio.h> 
 #include <stdint.h>
+#include <inttypes.h>
 #include <string.h>
 
-/* 統計情報のビット長 */
-#define STATLEN_32
+/* 統計情報のビット長(バイト数を数えるため64bit) */
+#define STATLEN_64
 
 #ifdef STATLEN_64   /* 64bit */
-typedef long long unsigned int ssz_t;
+typedef uint64_t ssz_t;
 #define STAT_DATALEN 20
-static const char conv_string[] = "%20llu";
+static const char conv_string[] = "%20" PRIu64;
 
 #else
 typedef long unsigned int ssz_t;
@@ -41,6 +42,17 @@ struct stat_print {
     char name[0];
 };
 
+/*
+    @brief 他スレッドが更新中の統計を読む
+    更新は各スレッドが自分の領域に対してのみ行うため、ロックせずに
+    1回の読み出しで値を取る(64bitが分断されないように)
+*/
+static inline ssz_t
+stat_read(const ssz_t *p)
+{
+    return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
 static inline void
 convert_stat(struct stat_print *s1, struct stat_member *s2)
 {
@@ -41,13 +41,16 @@ extern uint64_t cpu_mhz;
 
 #define mfence()  __asm__ __volatile__ ("lock; addl $0,0(%%esp)": : :"memory")
 
+/* spin wait */
+#define cpu_relax()  __asm__ __volatile__ ("pause": : :"memory")
+
 /*
    tscレジスタ読み込み（ia32)
 */
 #define rdtsc()\
-        ({uint64_t ret;\
-          __asm__ volatile ("rdtsc" : "=A" (ret));\
-          ret;})
+        ({uint32_t lo, hi;\
+          __asm__ volatile ("rdtsc" : "=a" (lo), "=d" (hi));\
+          ((uint64_t)hi << 32) | lo;})
 
 /*
     @brief sleep (usec order)
@@ -80,6 +83,24 @@ cmp_ipv6(const struct in6_addr *ip1, const struct in6_addr *ip2)
     return memcmp(ip1, ip2, sizeof(struct in6_addr));
 }
 
+/*
+    @brief インターフェースのVIP(IPv6)を読み出す
+    再読み込みで更新中の値を読まないよう、addr_seqが変わらない間に読む
+*/
+static inline void
+load_vip6(const struct ifdata *ifd, struct in6_addr *vip6)
+{
+    uint32_t seq;
+
+    do {
+        while ((seq = __atomic_load_n(&ifd->addr_seq, __ATOMIC_ACQUIRE)) & 1) {
+            __builtin_ia32_pause();
+        }
+        memcpy(vip6, &ifd->vip6, sizeof(*vip6));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&ifd->addr_seq, __ATOMIC_RELAXED) != seq);
+}
+
 /*
     @brief ipv4比較
 */
@@ -110,6 +131,30 @@ copy_mac(unsigned char *mac1, const unsigned char *mac2)
 #endif
 }
 
+/*
+    @brief 振り分けスレッドが参照中のMACを更新(MAC_STORE_LENの領域)
+    書き換え途中のMACを読ませないため64bitで一度に書き込む
+*/
+static inline void
+store_mac(unsigned char *store, const unsigned char *mac)
+{
+    uint64_t v = 0;
+
+    memcpy(&v, mac, ETH_ALEN);
+    __atomic_store_n((uint64_t *)store, v, __ATOMIC_RELAXED);
+}
+
+/*
+    @brief store_macで更新されるMACを参照
+*/
+static inline void
+load_mac(unsigned char *mac, const unsigned char *store)
+{
+    uint64_t v = __atomic_load_n((const uint64_t *)store, __ATOMIC_RELAXED);
+
+    memcpy(mac, &v, ETH_ALEN);
+}
+
 /*
     @brief IPが0かどうか
     @param struct sockaddr*
@@ -235,4 +280,25 @@ static inline uint ip_hash_code6(uint32_t *addr, uint32_t mask)
     return (hash + (hash>>16) + (hash>>24)) & mask;
 }
 
+/*
+    @brief 32bitハッシュ(フローテーブル用、全ビットを混ぜる)
+*/
+static inline uint32_t flow_hash4(uint32_t addr)
+{
+    uint32_t h = addr;
+
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+static inline uint32_t flow_hash6(const uint32_t *addr)
+{
+    return flow_hash4(addr[0] ^ flow_hash4(addr[1] ^
+        flow_hash4(addr[2] ^ flow_hash4(addr[3]))));
+}
+
 #endif /* */
@@ -0,0 +1,180 @@
+/**
+ * file    vlan.h
+ * brief   802.1Q VLAN(VLAN毎のVIP、タグの取得と付加)
+ * note    COPYRIGHT FUJITSU LIMITED 2010
+ *
+ * 改版履歴(出荷後記入)
+ * 版数   日付    変更者    リリースノート
+ * ---- -------- --------- --------------------------------------------------
+ */
+#ifndef __VLAN_H__
+#define __VLAN_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <linux/if_packet.h>
+#include <linux/virtio_net.h>
+
+#include "anycast.h"
+
+#define VLAN_MAX        16      /* 1プロセスで扱うVLAN数 */
+#define VLAN_HLEN       4       /* タグ長 */
+#define VLAN_VID_NUM    4096
+#ifndef VLAN_VID_MASK
+#define VLAN_VID_MASK   0x0fff
+#endif
+
+/*
+    @brief クライアント側のVLAN(in.vlanで指定したサブインターフェース)
+    受信したフレームのVLAN IDから番号を引き、VIPとARP/ND応答の送信先
+    (サブインターフェースにbindしたソケット)を選ぶ。
+    振り分けテーブルは全VLANで共有する
+    再読み込みでは新しい表を作成してポインタを入れ替え、古い表(と指定され
+    なくなったVLANのソケット)は振り分けテーブルの猶予期間後に解放する
+*/
+struct vlan_info {
+    int num;                            /* 0:VLANを使用しない */
+    uint8_t idx[VLAN_VID_NUM];          /* VLAN ID -> 番号+1(0:対象外) */
+    uint16_t vid[VLAN_MAX];
+    struct ifdata ifd[VLAN_MAX];        /* VLAN毎のインターフェース情報 */
+};
+
+/* 振り分けスレッドはフレーム毎に取得し、フレームの処理中は同じ表を使う */
+#define VLAN_INFO()     __atomic_load_n(&vlan_in, __ATOMIC_ACQUIRE)
+
+/*
+    @brief VLAN IDからインターフェース情報を取得
+    @param v    VLAN情報
+    @param vid  VLAN ID(0:タグ無し)
+    @param base タグ無しのインターフェース
+    @return インターフェース情報(NULL:対象外のVLAN)
+*/
+static inline struct ifdata *
+vlan_lookup(struct vlan_info *v, uint16_t vid, struct ifdata *base)
+{
+    uint8_t i;
+
+    if (vid == 0) {
+        return base;
+    }
+    if ((i = v->idx[vid & VLAN_VID_MASK]) == 0) {
+        return NULL;
+    }
+    return &v->ifd[i - 1];
+}
+
+/*
+    @brief VIP(送信元)からVLAN番号を取得
+    @return 番号(-1:VLANのVIPではない)
+*/
+static inline int
+vlan_by_vip4(struct vlan_info *v, const struct in_addr *ip)
+{
+    int i;
+
+    for (i = 0; i < v->num; i++) {
+        if (v->ifd[i].v4_enable && (v->ifd[i].vip4.s_addr == ip->s_addr)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static inline int
+vlan_by_vip6(struct vlan_info *v, const struct in6_addr *ip)
+{
+    int i;
+
+    for (i = 0; i < v->num; i++) {
+        if (v->ifd[i].v6_enable &&
+                (memcmp(&v->ifd[i].vip6, ip, sizeof(*ip)) == 0)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+    @brief 受信(PACKET_AUXDATAのVLANタグを取得)
+    カーネルはタグを外してから渡すため、recv()ではVLANを区別できない
+    @param vid VLAN ID(タグ無しの場合0)
+    @param ts  受信時刻(SO_TIMESTAMPNS、NULL:不要、取得できない場合0)
+    @return recv(MSG_TRUNC)と同じ(sizeを超える場合はフレーム長)
+*/
+static inline int
+recv_vlan(int fd, void *buf, int size, uint16_t *vid, struct timespec *ts)
+{
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(struct tpacket_auxdata)) +
+            CMSG_SPACE(sizeof(struct timespec))];
+    } cm;
+    struct iovec iov;
+    struct msghdr msg;
+    struct cmsghdr *c;
+    struct tpacket_auxdata *aux;
+    int len;
+
+    iov.iov_base = buf;
+    iov.iov_len = size;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = &cm;
+    msg.msg_controllen = sizeof(cm);
+
+    *vid = 0;
+    if (ts) {
+        ts->tv_sec = 0;
+    }
+    if ((len = recvmsg(fd, &msg, MSG_TRUNC)) <= 0) {
+        return len;
+    }
+    for (c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+        if ((c->cmsg_level == SOL_PACKET) &&
+                (c->cmsg_type == PACKET_AUXDATA)) {
+            aux = (struct tpacket_auxdata *)CMSG_DATA(c);
+            if (aux->tp_status & TP_STATUS_VLAN_VALID) {
+                *vid = aux->tp_vlan_tci & VLAN_VID_MASK;
+            }
+        } else if (ts && (c->cmsg_level == SOL_SOCKET) &&
+                (c->cmsg_type == SCM_TIMESTAMPNS)) {
+            memcpy(ts, CMSG_DATA(c), sizeof(*ts));
+        }
+    }
+    return len;
+}
+
+/*
+    @brief フレームにVLANタグを付ける(フレームの前にVLAN_HLENの空きが必要)
+    @param eth     フレーム先頭
+    @param vid     VLAN ID
+    @param hdr_len フレーム前のvirtio_net_hdr長(0:無し、一緒に移動する)
+    @return タグを付けたフレームの先頭
+*/
+static inline struct ethhdr *
+vlan_push(struct ethhdr *eth, uint16_t vid, int hdr_len)
+{
+    uint8_t *p = (uint8_t *)eth - VLAN_HLEN;
+    uint16_t tag[2];
+
+    memmove(p - hdr_len, (uint8_t *)eth - hdr_len, hdr_len + (ETH_ALEN * 2));
+    if (hdr_len) {
+        struct virtio_net_hdr *vh = (struct virtio_net_hdr *)(p - hdr_len);
+
+        if (vh->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) {
+            vh->csum_start += VLAN_HLEN;
+        }
+        if (vh->hdr_len) {
+            vh->hdr_len += VLAN_HLEN;
+        }
+    }
+    tag[0] = htons(ETH_P_8021Q);
+    tag[1] = htons(vid);
+    memcpy(p + (ETH_ALEN * 2), tag, VLAN_HLEN);
+    return (struct ethhdr *)p;
+}
+
+#endif
@@ -0,0 +1,220 @@
+/**
+ * file    xsk.h
+ * brief   AF_XDPソケット(XSK)による送受信
+ * note    COPYRIGHT FUJITSU LIMITED 2010
+ *
+ * 改版履歴(出荷後記入)
+ * 版数   日付    変更者    リリースノート
+ * ---- -------- --------- --------------------------------------------------
+ */
+#ifndef __XSK_H__
+#define __XSK_H__
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <linux/if_xdp.h>
+
+#ifndef AF_XDP
+#define AF_XDP  44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+/* 動作方式(io_mode) */
+#define IO_MODE_PACKET  0   /* AF_PACKETのみ */
+#define IO_MODE_XDP     1   /* IPパケットをAF_XDPで送受信 */
+#define IO_MODE_XDP_FWD 2   /* XDPで書き換えて送信(front、ミスはAF_PACKET) */
+
+#define XSK_FRAME_SIZE      2048
+#define XSK_FRAME_MAX       (XSK_FRAME_SIZE - 256)  /* XDP_PACKET_HEADROOM分 */
+#define XSK_FRAME_NUM_DEFAULT   4096
+
+/*
+    @brief XSKのリング(fill/completion/rx/tx共通)
+*/
+struct xsk_ring {
+    uint32_t *producer;
+    uint32_t *consumer;
+    void *desc;
+    uint32_t mask;
+    uint32_t size;
+    uint32_t cached_prod;
+    uint32_t cached_cons;
+    void *map;
+    uint32_t map_size;
+};
+
+/*
+    @brief XSK
+    UMEMの前半を受信用(fill ring)、後半を送信用(free)に使う。
+    fill ring/rx ringは受信スレッド、tx ring/completion ringと送信用
+    フレームは送信するスレッドのみが操作する
+
+    xsk_open_pair()で生成した2つのXSKは1つのUMEMを共有し、
+    それぞれの領域(rx_baseから)を使う。一方で受信したフレームは
+    コピーせずに他方のtx ringへ入れ、送信完了後に受信側のfill ringへ
+    戻す(受信スレッドが他方の送信スレッドのため、所有者は変わらない)
+*/
+struct xsk {
+    int fd;
+    uint8_t *umem;          /* 共有する場合はUMEM全体 */
+    uint64_t umem_size;
+    uint32_t frame_num;
+    uint32_t rx_frames;     /* 受信用フレーム数 */
+    uint64_t rx_base;       /* 受信用フレームの先頭 */
+
+    struct xsk *peer;       /* UMEMを共有するXSK(NULL:共有しない) */
+    int shared;             /* 1:UMEMはpeerのもの */
+
+    struct xsk_ring fill;
+    struct xsk_ring comp;
+    struct xsk_ring rx;
+    struct xsk_ring tx;
+
+    uint64_t *free;         /* 送信用の空きフレーム */
+    uint32_t free_cnt;
+
+    int rx_used;            /* 受信フレームを送信に使用した */
+
+    int map_fd;             /* XSKMAP */
+    int addr_fd;            /* 振り分け対象のアドレス(ARRAY、struct xsk_addr) */
+    int prog_fd;
+    int link_fd;
+    int egress;             /* 1:サーバ側(自アドレス宛て以外をXSKへ) */
+};
+
+/*
+    @brief XDPプログラムが参照するアドレス(xsk_set_addr()で更新する)
+    クライアント側はVIP宛て、サーバ側は自アドレス(実IP)宛て以外のIPを
+    XSKへリダイレクトし、他はカーネルへ渡す
+*/
+struct xsk_addr {
+    uint32_t ip4;           /* ネットワークバイトオーダ */
+    uint8_t ip6[16];
+    uint8_t v4_enable;
+    uint8_t v6_enable;
+    uint8_t pass_match;     /* 1:一致したものをカーネルへ(サーバ側) */
+    uint8_t _rsv;
+};
+
+struct ifdata;
+struct xsk *xsk_open(struct ifdata *);
+int xsk_open_pair(struct ifdata *, struct ifdata *);
+void xsk_close(struct xsk *);
+int xsk_set_addr(struct xsk *, struct ifdata *);
+void xsk_complete(struct xsk *);
+
+/*
+    @brief フレームのアドレス
+*/
+static inline uint8_t *
+xsk_frame(struct xsk *x, uint64_t addr)
+{
+    return x->umem + addr;
+}
+
+/*
+    @brief 受信フレーム取得
+    @param idx 先頭のインデックス
+    @return 受信フレーム数
+*/
+static inline uint32_t
+xsk_rx_peek(struct xsk *x, uint32_t max, uint32_t *idx)
+{
+    uint32_t n;
+
+    n = __atomic_load_n(x->rx.producer, __ATOMIC_ACQUIRE) - x->rx.cached_cons;
+    if (n > max) {
+        n = max;
+    }
+    *idx = x->rx.cached_cons;
+    return n;
+}
+
+static inline struct xdp_desc *
+xsk_rx_desc(struct xsk *x, uint32_t idx)
+{
+    return &((struct xdp_desc *)x->rx.desc)[idx & x->rx.mask];
+}
+
+/*
+    @brief 受信用フレームをfill ringへ返却
+    (xsk_rx_releaseで通知)
+*/
+static inline void
+xsk_fill(struct xsk *x, uint64_t addr)
+{
+    ((uint64_t *)x->fill.desc)[x->fill.cached_prod++ & x->fill.mask] =
+        addr & ~((uint64_t)XSK_FRAME_SIZE - 1);
+}
+
+/*
+    @brief 受信フレームの処理完了
+*/
+static inline void
+xsk_rx_release(struct xsk *x, uint32_t n)
+{
+    __atomic_store_n(x->fill.producer, x->fill.cached_prod,
+        __ATOMIC_RELEASE);
+    x->rx.cached_cons += n;
+    __atomic_store_n(x->rx.consumer, x->rx.cached_cons, __ATOMIC_RELEASE);
+}
+
+/*
+    @brief 送信(tx ringへ格納)
+    UMEM内のフレームはそのまま、それ以外は送信用フレームへコピーする
+    @return 0:格納 -1:空きなし
+*/
+static inline int
+xsk_tx(struct xsk *x, const void *eth, uint32_t len)
+{
+    struct xdp_desc *desc;
+    uint64_t addr;
+
+    if (x->tx.size - (x->tx.cached_prod -
+            __atomic_load_n(x->tx.consumer, __ATOMIC_ACQUIRE)) == 0) {
+        return -1;
+    }
+
+    if (((uint8_t *)eth >= x->umem) &&
+            ((uint8_t *)eth < x->umem + x->umem_size)) {
+        /* 受信したフレームをそのまま送信 */
+        addr = (uint8_t *)eth - x->umem;
+        x->rx_used = 1;
+    } else {
+        if ((x->free_cnt == 0) || (len > XSK_FRAME_SIZE)) {
+            return -1;
+        }
+        addr = x->free[--x->free_cnt];
+        memcpy(x->umem + addr, eth, len);
+    }
+
+    desc = &((struct xdp_desc *)x->tx.desc)[x->tx.cached_prod++ &
+        x->tx.mask];
+    desc->addr = addr;
+    desc->len = len;
+    desc->options = 0;
+    return 0;
+}
+
+/*
+    @brief 送信完了を回収していないフレーム数
+*/
+static inline uint32_t
+xsk_tx_pending(struct xsk *x)
+{
+    return x->tx.cached_prod - x->comp.cached_cons;
+}
+
+/*
+    @brief tx ringの送信要求
+*/
+static inline void
+xsk_tx_kick(struct xsk *x)
+{
+    __atomic_store_n(x->tx.producer, x->tx.cached_prod, __ATOMIC_RELEASE);
+    sendto(x->fd, NULL, 0, MSG_DONTWAIT, NULL, 0);
+}
+
+#endif
@@ -0,0 +1,487 @@
+/**
+ * file    xsk_body.c
+ * brief   AF_XDPソケット(XSK)による送受信
+ * note    COPYRIGHT FUJITSU LIMITED 2010
+ *
+ * 改版履歴(出荷後記入)
+ * 版数   日付    変更者    リリースノート
+ * ---- -------- --------- --------------------------------------------------
+ */
+
+static struct xsk *xsk_create(struct ifdata *, struct xsk *, int, int);
+static int xsk_map_ring(struct xsk *, struct xsk_ring *, int, uint32_t,
+    struct xdp_ring_offset *, uint64_t, uint32_t);
+static int xsk_load_prog(struct xsk *, struct ifdata *, int);
+
+/*
+    @brief XSK生成
+    UMEM登録、各リングのmmap、bind、XDPプログラムの接続を行う。
+    XDPプログラムはVIP宛てのIPv4とIPv6(ICMPv6以外)をXSKへリダイレクトし、
+    ARP,ND、ホスト宛て等はカーネルおよびAF_PACKETソケットへ渡す
+    @return XSK(エラーの場合NULL)
+*/
+struct xsk *
+xsk_open(struct ifdata *ifp)
+{
+    return xsk_create(ifp, NULL, 1, 0);
+}
+
+/*
+    @brief UMEMを共有するXSKを2つ生成(backend)
+    a,bで受信したフレームをコピーせずに他方から送信する。
+    共有できない場合(カーネルが異なるインターフェース間の共有に
+    対応していない等)は、それぞれのUMEMを持つXSKを生成する
+    @param a クライアント側
+    @param b サーバ側
+    @return 0:生成(ifp->xskに設定) -1:エラー
+*/
+int
+xsk_open_pair(struct ifdata *a, struct ifdata *b)
+{
+    if ((a->xsk = xsk_create(a, NULL, 2, 0)) == NULL) {
+        return -1;
+    }
+    if ((b->xsk = xsk_create(b, a->xsk, 2, 1)) != NULL) {
+        a->xsk->peer = b->xsk;
+        b->xsk->peer = a->xsk;
+        return 0;
+    }
+
+    mlog("xsk(%s,%s) shared umem not available, copy between umem",
+        a->ifname, b->ifname);
+    if ((b->xsk = xsk_create(b, NULL, 1, 1)) == NULL) {
+        xsk_close(a->xsk);
+        a->xsk = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+    @brief XSK生成
+    @param owner UMEMを共有する場合、UMEMを登録したXSK
+    @param share UMEMを共有するXSKの数(ownerがNULLの場合、UMEMを
+                 share倍の大きさで確保する)
+    @param egress 1:サーバ側
+*/
+static struct xsk *
+xsk_create(struct ifdata *ifp, struct xsk *owner, int share, int egress)
+{
+    struct xsk *x;
+    struct xdp_umem_reg reg;
+    struct xdp_mmap_offsets off;
+    struct sockaddr_xdp sxdp;
+    socklen_t optlen;
+    long num;
+    int copy, queue, i, ifindex;
+    char buf[32];
+
+    if ((num = anycast_get_properties_int(KEY_XSK_FRAME_NUM)) <= 0) {
+        num = XSK_FRAME_NUM_DEFAULT;
+    }
+    /* リングサイズは2のべき乗 */
+    for (i = 1; i < num; i <<= 1)
+        ;
+    num = i;
+    copy = anycast_get_properties_int(KEY_XSK_ZEROCOPY) ? 0 : 1;
+    queue = anycast_get_properties_int(KEY_XSK_QUEUE);
+
+    if ((ifindex = if_nametoindex(ifp->ifname)) == 0) {
+        mlog("xsk(%s) interface not found", ifp->ifname);
+        return NULL;
+    }
+    if (ifp->mtu + ETH_HLEN > XSK_FRAME_MAX) {
+        /* フレームが分割されるMTU(jumbo frame)はAF_PACKETで受信する */
+        mlog("xsk(%s) mtu %u too large", ifp->ifname, ifp->mtu);
+        return NULL;
+    }
+
+    if ((x = calloc(1, sizeof(*x))) == NULL) {
+        return NULL;
+    }
+    x->fd = x->map_fd = x->addr_fd = x->prog_fd = x->link_fd = -1;
+    x->egress = egress;
+    x->frame_num = num;
+    x->rx_frames = num / 2;
+
+    if (owner == NULL) {
+        x->umem_size = (uint64_t)num * XSK_FRAME_SIZE * share;
+        if ((x->umem = huge_alloc(x->umem_size, "xsk umem")) == NULL) {
+            goto xsk_err;
+        }
+        x->rx_base = 0;
+    } else {
+        /* ownerの次の領域を使う(フレーム数は同じ設定値) */
+        x->umem = owner->umem;
+        x->umem_size = owner->umem_size;
+        x->rx_base = owner->rx_base +
+            (uint64_t)owner->frame_num * XSK_FRAME_SIZE;
+        x->shared = 1;
+        if (x->rx_base + (uint64_t)num * XSK_FRAME_SIZE > x->umem_size) {
+            errno = ENOSPC;
+            goto xsk_err;
+        }
+    }
+    if ((x->free = calloc(num - x->rx_frames, sizeof(uint64_t))) == NULL) {
+        goto xsk_err;
+    }
+    for (i = x->rx_frames; i < num; i++) {
+        x->free[x->free_cnt++] = x->rx_base + (uint64_t)i * XSK_FRAME_SIZE;
+    }
+
+    if ((x->fd = socket(AF_XDP, SOCK_RAW, 0)) < 0) {
+        goto xsk_err;
+    }
+
+    if (owner == NULL) {
+        memset(&reg, 0, sizeof(reg));
+        reg.addr = (uint64_t)(unsigned long)x->umem;
+        reg.len = x->umem_size;
+        reg.chunk_size = XSK_FRAME_SIZE;
+        reg.headroom = 0;
+        if (setsockopt(x->fd, SOL_XDP, XDP_UMEM_REG, &reg,
+                sizeof(reg)) < 0) {
+            goto xsk_err;
+        }
+    }
+
+    /* 共有する場合もインターフェースが異なるためfill/completion ringを持つ */
+
+    if ((setsockopt(x->fd, SOL_XDP, XDP_UMEM_FILL_RING, &num,
+                sizeof(int)) < 0) ||
+            (setsockopt(x->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &num,
+                sizeof(int)) < 0) ||
+            (setsockopt(x->fd, SOL_XDP, XDP_RX_RING, &num,
+                sizeof(int)) < 0) ||
+            (setsockopt(x->fd, SOL_XDP, XDP_TX_RING, &num,
+                sizeof(int)) < 0)) {
+        goto xsk_err;
+    }
+
+    optlen = sizeof(off);
+    if (getsockopt(x->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) < 0) {
+        goto xsk_err;
+    }
+
+    if (xsk_map_ring(x, &x->fill, x->fd, num, &off.fr,
+                XDP_UMEM_PGOFF_FILL_RING, sizeof(uint64_t)) ||
+            xsk_map_ring(x, &x->comp, x->fd, num, &off.cr,
+                XDP_UMEM_PGOFF_COMPLETION_RING, sizeof(uint64_t)) ||
+            xsk_map_ring(x, &x->rx, x->fd, num, &off.rx,
+                XDP_PGOFF_RX_RING, sizeof(struct xdp_desc)) ||
+            xsk_map_ring(x, &x->tx, x->fd, num, &off.tx,
+                XDP_PGOFF_TX_RING, sizeof(struct xdp_desc))) {
+        goto xsk_err;
+    }
+
+    /* 受信用フレームをfill ringへ */
+    for (i = 0; i < x->rx_frames; i++) {
+        xsk_fill(x, x->rx_base + (uint64_t)i * XSK_FRAME_SIZE);
+    }
+    __atomic_store_n(x->fill.producer, x->fill.cached_prod,
+        __ATOMIC_RELEASE);
+
+    memset(&sxdp, 0, sizeof(sxdp));
+    sxdp.sxdp_family = AF_XDP;
+    sxdp.sxdp_ifindex = ifindex;
+    sxdp.sxdp_queue_id = queue;
+    if (owner == NULL) {
+        sxdp.sxdp_flags = copy ? XDP_COPY : XDP_ZEROCOPY;
+    } else {
+        /* 動作モードはownerに従う */
+        sxdp.sxdp_flags = XDP_SHARED_UMEM;
+        sxdp.sxdp_shared_umem_fd = owner->fd;
+    }
+    if (bind(x->fd, (struct sockaddr *)&sxdp, sizeof(sxdp)) < 0) {
+        goto xsk_err;
+    }
+
+    if (xsk_load_prog(x, ifp, queue) != 0) {
+        goto xsk_err;
+    }
+
+    /* XDPプログラム接続(copyモードはveth等でも動作する) */
+    x->link_fd = bpf_xdp_link(x->prog_fd, ifindex,
+        copy ? XDP_FLAGS_SKB_MODE : XDP_FLAGS_DRV_MODE);
+    if (x->link_fd < 0) {
+        goto xsk_err;
+    }
+
+    mlog("xsk(%s) queue %d frame num %u %s mode%s", ifp->ifname, queue,
+        x->frame_num, copy ? "copy" : "zero copy",
+        x->shared ? " shared umem" : "");
+    return x;
+
+xsk_err:
+    mlog("xsk(%s) open error (%s)", ifp->ifname,
+        strerror_r(errno, buf, sizeof(buf)));
+    xsk_close(x);
+    return NULL;
+}
+
+/*
+    @brief XSK解放
+    (UMEMを共有する場合、UMEMを登録したXSKを後に解放する)
+*/
+void
+xsk_close(struct xsk *x)
+{
+    struct xsk_ring *r[] = {&x->fill, &x->comp, &x->rx, &x->tx};
+    int i;
+
+    if (x == NULL) {
+        return;
+    }
+    if (x->peer) {
+        x->peer->peer = NULL;
+    }
+    /* XDPプログラムを先に外す */
+    if (x->link_fd >= 0) {
+        close(x->link_fd);
+    }
+    if (x->prog_fd >= 0) {
+        close(x->prog_fd);
+    }
+    if (x->map_fd >= 0) {
+        close(x->map_fd);
+    }
+    if (x->addr_fd >= 0) {
+        close(x->addr_fd);
+    }
+    for (i = 0; i < 4; i++) {
+        if (r[i]->map) {
+            munmap(r[i]->map, r[i]->map_size);
+        }
+    }
+    if (x->fd >= 0) {
+        close(x->fd);
+    }
+    if (!x->shared) {
+        huge_free(x->umem);
+    }
+    free(x->free);
+    free(x);
+}
+
+/*
+    @brief completion ringの回収
+    受信フレームは受信したXSKのfill ringへ、送信用フレームは空きへ戻す
+*/
+void
+xsk_complete(struct xsk *x)
+{
+    struct xsk *p = x->peer;
+    uint32_t n, i;
+    uint64_t addr, rx_size = (uint64_t)x->rx_frames * XSK_FRAME_SIZE;
+    int fill = 0, pfill = 0;
+
+    n = __atomic_load_n(x->comp.producer, __ATOMIC_ACQUIRE) -
+        x->comp.cached_cons;
+    for (i = 0; i < n; i++) {
+        addr = ((uint64_t *)x->comp.desc)[x->comp.cached_cons++ &
+            x->comp.mask];
+        if (addr - x->rx_base < rx_size) {
+            xsk_fill(x, addr);
+            fill = 1;
+        } else if (p && (addr - p->rx_base <
+                (uint64_t)p->rx_frames * XSK_FRAME_SIZE)) {
+            /* 他方で受信したフレーム(送信スレッドが他方の受信スレッド) */
+            xsk_fill(p, addr);
+            pfill = 1;
+        } else {
+            x->free[x->free_cnt++] = addr & ~((uint64_t)XSK_FRAME_SIZE - 1);
+        }
+    }
+    if (n) {
+        __atomic_store_n(x->comp.consumer, x->comp.cached_cons,
+            __ATOMIC_RELEASE);
+    }
+    if (fill) {
+        __atomic_store_n(x->fill.producer, x->fill.cached_prod,
+            __ATOMIC_RELEASE);
+    }
+    if (pfill) {
+        __atomic_store_n(p->fill.producer, p->fill.cached_prod,
+            __ATOMIC_RELEASE);
+    }
+}
+
+/*
+    @brief リングのmmap
+*/
+static int
+xsk_map_ring(struct xsk *x, struct xsk_ring *r, int fd, uint32_t num,
+    struct xdp_ring_offset *off, uint64_t pgoff, uint32_t esize)
+{
+    uint8_t *map;
+
+    r->map_size = off->desc + num * esize;
+    map = mmap(NULL, r->map_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, fd, pgoff);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    r->map = map;
+    r->producer = (uint32_t *)(map + off->producer);
+    r->consumer = (uint32_t *)(map + off->consumer);
+    r->desc = map + off->desc;
+    r->size = num;
+    r->mask = num - 1;
+    r->cached_prod = *r->producer;
+    r->cached_cons = *r->consumer;
+    return 0;
+}
+
+/*
+    @brief XDPプログラムが参照するアドレスを設定
+    (生成時、インターフェース情報の再読み込み時に呼ぶ)
+    @return 0:正常 -1:異常
+*/
+int
+xsk_set_addr(struct xsk *x, struct ifdata *ifp)
+{
+    struct xsk_addr a;
+    uint32_t key = 0;
+
+    if ((x == NULL) || (x->addr_fd < 0)) {
+        return 0;
+    }
+    memset(&a, 0, sizeof(a));
+    if (x->egress) {
+        /* サーバ側はホスト宛て(実IP)のみカーネルへ */
+        a.ip4 = ifp->sip4.s_addr;
+        memcpy(a.ip6, &ifp->sip6, sizeof(a.ip6));
+        a.pass_match = 1;
+    } else {
+        a.ip4 = ifp->vip4.s_addr;
+        memcpy(a.ip6, &ifp->vip6, sizeof(a.ip6));
+    }
+    a.v4_enable = ifp->v4_enable;
+    a.v6_enable = ifp->v6_enable;
+    return bpf_map_update(x->addr_fd, &key, &a, BPF_ANY);
+}
+
+/*
+    @brief XDPプログラム生成
+    宛先がアドレスmapと一致するか判定し(クライアント側:VIP宛て、
+    サーバ側:自アドレス宛て以外)、IPv4, IPv6(ICMPv6以外)を
+    XSKMAPのrx_queue_index番目へリダイレクト、他はXDP_PASS
+    r6:ctx r9:アドレスmapの値
+*/
+#define XSK_PROG_ADDR_MAP   2       /* アドレスmapのBPF_LD_MAP_FDの位置 */
+#define XSK_PROG_XSK_MAP    48      /* XSKMAPのBPF_LD_MAP_FDの位置 */
+
+static int
+xsk_load_prog(struct xsk *x, struct ifdata *ifp, int queue)
+{
+    uint32_t key = queue;
+    char log[1024];
+
+    struct bpf_insn prog[] = {
+        /* 0: r9 = アドレスmap[0] */
+        BPF_MOV64_REG(BPF_REG_6, BPF_REG_1),
+        BPF_ST_MEM(BPF_W, BPF_REG_10, -4, 0),
+        BPF_LD_MAP_FD(BPF_REG_1, 0),
+        BPF_MOV64_REG(BPF_REG_2, BPF_REG_10),
+        BPF_ALU64_IMM(BPF_ADD, BPF_REG_2, -4),
+        BPF_CALL_FUNC(BPF_FUNC_map_lookup_elem),
+        BPF_JMP_IMM(BPF_JEQ, BPF_REG_0, 0, 45),         /* pass */
+        BPF_MOV64_REG(BPF_REG_9, BPF_REG_0),
+        /* 9: r2 = data, r3 = data_end、ethernet + IPv4ヘッダまで */
+        BPF_LDX_MEM(BPF_W, BPF_REG_2, BPF_REG_6,
+            offsetof(struct xdp_md, data)),
+        BPF_LDX_MEM(BPF_W, BPF_REG_3, BPF_REG_6,
+            offsetof(struct xdp_md, data_end)),
+        BPF_MOV64_REG(BPF_REG_4, BPF_REG_2),
+        BPF_ALU64_IMM(BPF_ADD, BPF_REG_4, ETH_HLEN + 20),
+        BPF_JMP_REG(BPF_JGT, BPF_REG_4, BPF_REG_3, 39),  /* pass */
+        BPF_LDX_MEM(BPF_H, BPF_REG_4, BPF_REG_2,
+            offsetof(struct ethhdr, h_proto)),
+        BPF_JMP_IMM(BPF_JEQ, BPF_REG_4, htons(ETH_P_IP), 21),     /* v4 */
+        BPF_JMP_IMM(BPF_JNE, BPF_REG_4, htons(ETH_P_IPV6), 36),   /* pass */
+        /* 17: IPv6(ICMPv6はカーネル、AF_PACKETソケットで処理する) */
+        BPF_MOV64_REG(BPF_REG_4, BPF_REG_2),
+        BPF_ALU64_IMM(BPF_ADD, BPF_REG_4, ETH_HLEN + sizeof(struct ip6_hdr)),
+        BPF_JMP_REG(BPF_JGT, BPF_REG_4, BPF_REG_3, 33),  /* pass */
+        BPF_LDX_MEM(BPF_B, BPF_REG_4, BPF_REG_2,
+            ETH_HLEN + offsetof(struct ip6_hdr, ip6_nxt)),
+        BPF_JMP_IMM(BPF_JEQ, BPF_REG_4, IPPROTO_ICMPV6, 31),      /* pass */
+        BPF_LDX_MEM(BPF_B, BPF_REG_4, BPF_REG_9,
+            offsetof(struct xsk_addr, v6_enable)),
+        BPF_JMP_IMM(BPF_JEQ, BPF_REG_4, 0, 21),                   /* miss */
+        BPF_LDX_MEM(BPF_W, BPF_REG_4, BPF_REG_2, ETH_HLEN + 24),
+        BPF_LDX_MEM(BPF_W, BPF_REG_5, BPF_REG_9,
+            offsetof(struct xsk_addr, ip6)),
+        BPF_JMP_REG(BPF_JNE, BPF_REG_4, BPF_REG_5, 18),           /* miss */
+        BPF_LDX_MEM(BPF_W, BPF_REG_4, BPF_REG_2, ETH_HLEN + 28),
+        BPF_LDX_MEM(BPF_W, BPF_REG_5, BPF_REG_9,
+            offsetof(struct xsk_addr, ip6) + 4),
+        BPF_JMP_REG(BPF_JNE, BPF_REG_4, BPF_REG_5, 15),           /* miss */
+        BPF_LDX_MEM(BPF_W, BPF_REG_4, BPF_REG_2, ETH_HLEN + 32),
+        BPF_LDX_MEM(BPF_W, BPF_REG_5, BPF_REG_9,
+            offsetof(struct xsk_addr, ip6) + 8),
+        BPF_JMP_REG(BPF_JNE, BPF_REG_4, BPF_REG_5, 12),           /* miss */
+        BPF_LDX_MEM(BPF_W, BPF_REG_4, BPF_REG_2, ETH_HLEN + 36),
+        BPF_LDX_MEM(BPF_W, BPF_REG_5, BPF_REG_9,
+            offsetof(struct xsk_addr, ip6) + 12),
+        BPF_JMP_REG(BPF_JNE, BPF_REG_4, BPF_REG_5, 9),            /* miss */
+        BPF_JMP_A(5),                                             /* match */
+        /* 37: IPv4 */
+        BPF_LDX_MEM(BPF_B, BPF_REG_4, BPF_REG_9,
+            offsetof(struct xsk_addr, v4_enable)),
+        BPF_JMP_IMM(BPF_JEQ, BPF_REG_4, 0, 6),                    /* miss */
+        BPF_LDX_MEM(BPF_W, BPF_REG_4, BPF_REG_2, ETH_HLEN + 16),
+        BPF_LDX_MEM(BPF_W, BPF_REG_5, BPF_REG_9,
+            offsetof(struct xsk_addr, ip4)),
+        BPF_JMP_REG(BPF_JNE, BPF_REG_4, BPF_REG_5, 3),            /* miss */
+        /* 42: 一致 */
+        BPF_LDX_MEM(BPF_B, BPF_REG_4, BPF_REG_9,
+            offsetof(struct xsk_addr, pass_match)),
+        BPF_JMP_IMM(BPF_JNE, BPF_REG_4, 0, 9),                    /* pass */
+        BPF_JMP_A(2),                                             /* redirect */
+        /* 45: 不一致 */
+        BPF_LDX_MEM(BPF_B, BPF_REG_4, BPF_REG_9,
+            offsetof(struct xsk_addr, pass_match)),
+        BPF_JMP_IMM(BPF_JEQ, BPF_REG_4, 0, 6),                    /* pass */
+        /* 47: redirect */
+        BPF_LDX_MEM(BPF_W, BPF_REG_2, BPF_REG_6,
+            offsetof(struct xdp_md, rx_queue_index)),
+        BPF_LD_MAP_FD(BPF_REG_1, 0),
+        BPF_MOV64_IMM(BPF_REG_3, XDP_PASS),
+        BPF_CALL_FUNC(BPF_FUNC_redirect_map),
+        BPF_EXIT_INSN(),
+        /* 53: pass */
+        BPF_MOV64_IMM(BPF_REG_0, XDP_PASS),
+        BPF_EXIT_INSN(),
+    };
+
+    x->map_fd = bpf_map_create(BPF_MAP_TYPE_XSKMAP, sizeof(uint32_t),
+        sizeof(int), queue + 1, 0);
+    if (x->map_fd < 0) {
+        return -1;
+    }
+    if (bpf_map_update(x->map_fd, &key, &x->fd, BPF_ANY) < 0) {
+        return -1;
+    }
+    x->addr_fd = bpf_map_create(BPF_MAP_TYPE_ARRAY, sizeof(uint32_t),
+        sizeof(struct xsk_addr), 1, 0);
+    if ((x->addr_fd < 0) || (xsk_set_addr(x, ifp) < 0)) {
+        return -1;
+    }
+
+    prog[XSK_PROG_ADDR_MAP].imm = x->addr_fd;
+    prog[XSK_PROG_XSK_MAP].imm = x->map_fd;
+
+    x->prog_fd = bpf_prog_load(BPF_PROG_TYPE_XDP, prog,
+        sizeof(prog) / sizeof(prog[0]), NULL, 0);
+    if (x->prog_fd < 0) {
+        /* verifierのログを取得するため再ロード */
+        bpf_prog_load(BPF_PROG_TYPE_XDP, prog,
+            sizeof(prog) / sizeof(prog[0]), log, sizeof(log));
+        mlog("xsk(%s) prog load error %s", ifp->ifname, log);
+        return -1;
+    }
+    return 0;
+}
+
+/* end */
@@ -19,11 +19,16 @@
 #include "util_inline.h"
 #include "policy.h"
 #include "val.h"
+#include "xdp_fwd.h"
+#include "hugemem.h"
+#include "latency.h"
+#include "rxpoll.h"
 #include "stat.h"
 
 static void timeout_init(struct timeval *tv);
 static void log_dump(unsigned char);
 static void update_policy(void);
+static void policy_reclaim(void);
 
 /* static valiables */
 static volatile int sig_flg;
@@ -42,6 +47,7 @@ timeout_init(struct timeval *tv)
     static uint64_t start_time;
 
     send_garp(if_ingress, &start_time, 40);
+    policy_reclaim();
     timeout_set(tv, 10);
 }
 
@@ -75,7 +81,16 @@ log_dump(unsigned char flag)
         sprintf(buff, DUMP_MESSAGE_F" : %s", ctime_r(&time.tv_sec, bt));
         fwrite(buff, strlen(buff), 1, fp);
 
+        /* キャッシュ中のヒット数はキャッシュを1回走査して集計しておく */
+        if (flag & (LOG_STAT2 | LOG_SVR)) {
+            pol_cache_collect(lb_policy_info.set, NULL);
+        }
+
         if (flag & LOG_STAT) {
+            xdp_fwd_stat();
+            lat_stat();
+            rx_poll_stat();
+            huge_stat();
             write_log_stat(fp, buff);
         }
         if (flag & LOG_MLOG) {
@@ -93,6 +108,9 @@ log_dump(unsigned char flag)
         if (flag & LOG_SVR)  {
             write_log_svr(fp, buff);
         }
+        if (flag & LOG_PROF) {
+            write_log_prof(fp, buff);
+        }
         free(buff);
         fclose(fp);
     }
@@ -100,46 +118,132 @@ log_dump(unsigned char flag)
 
 /*
     @brief 振分け設定ファイル再読み込み
+    振り分けスレッドは止めず、新しいテーブルを作成してポインタを入れ替える。
+    古いテーブルは全振り分けスレッドの切り替えを待ってから解放する
+*/
+#define POL_GRACE_MSEC  10000
+
+/*
+    猶予期間内に解放できなかった振り分けテーブル(とVLANの表)
+    コマンド処理の合間にpolicy_reclaim()で解放する
+*/
+struct pol_retired {
+    struct pol_retired *next;
+    struct lb_pol_set *set;
+    struct vlan_info *vlan;
+};
+static struct pol_retired *pol_retired;
+
+/*
+    @brief 全振り分けスレッドが振り分けテーブルを参照しなくなったか
+    (番号はテーブルの作成毎に増えるため、より新しいテーブルへ
+    切り替えていれば参照していない)
+*/
+static int
+policy_unused(struct lb_pol_set *old)
+{
+    int i;
+
+    for (i = 0; i < nt_info.count; i++) {
+        if ((int)(__atomic_load_n(&lb_policy_info.cache[i]->pol_no,
+                __ATOMIC_ACQUIRE) - old->pol_no) <= 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+    @brief 解放待ちの振り分けテーブルを解放できるものから解放する
 */
+static void
+policy_reclaim(void)
+{
+    struct pol_retired **pp, *r;
+
+    for (pp = &pol_retired; (r = *pp) != NULL;) {
+        if (!policy_unused(r->set) || (resolver_sync(0) != 0)) {
+            pp = &r->next;
+            continue;
+        }
+        *pp = r->next;
+        vlan_release(r->vlan);
+        mlog("policy %u released", r->set->pol_no);
+        destroy_policy_table(r->set);
+        free(r);
+    }
+}
+
+/*
+    @brief 古い振り分けテーブルを解放待ちにする
+*/
+static void
+policy_retire(struct lb_pol_set *old, struct vlan_info *old_vlan)
+{
+    struct pol_retired *r;
+
+    if ((r = malloc(sizeof(*r))) == NULL) {
+        mlog("policy %u not released (no memory)", old->pol_no);
+        return;
+    }
+    r->set = old;
+    r->vlan = old_vlan;
+    r->next = pol_retired;
+    pol_retired = r;
+}
+
 static void
 update_policy(void)
 {
-    int i, count;
-    pthread_t ret;
+    struct lb_pol_set *old, *set;
+    struct vlan_info *old_vlan;
+    int i, msec;
 
     mlog("update policy table");
 
-    count = nt_info.count;
-    /* ネットワーク処理スレッドの停止 */
-    for (i = 0; i < count; i++) {
-        nt_info.th[i].cancel_end = 0;
-        pthread_cancel(nt_info.th[i].tid);
+    policy_reclaim();
+    reload_interface_info(if_ingress, if_egress);
+
+    if ((set = get_policy()) == NULL) {
+        vlan_abort();
+        update_interface();
+        mlog("update policy failed, keep policy %u",
+            lb_policy_info.set->pol_no);
+        return;
     }
 
-    /* 停止待ち */
-    anycast_sleep(10);
-    for (i = 0; i < count;) {
-        if (nt_info.th[i].cancel_end == 1) {
-            i++;            
+    /* VLANの表は振り分けテーブルと同じ猶予期間で入れ替える */
+    old = lb_policy_info.set;
+    old_vlan = vlan_commit();
+    __atomic_store_n(&lb_policy_info.set, set, __ATOMIC_RELEASE);
+    update_interface();
+    xdp_fwd_attach(set);
+
+    /* 猶予期間(全振り分けスレッドが新しいテーブルへ切り替えるまで) */
+    for (i = 0, msec = 0; i < nt_info.count;) {
+        if (__atomic_load_n(&lb_policy_info.cache[i]->pol_no,
+                __ATOMIC_ACQUIRE) == set->pol_no) {
+            i++;
+        } else if (msec < POL_GRACE_MSEC) {
+            anycast_sleep(10);
+            msec += 10;
         } else {
-            anycast_sleep(0);
+            /* 応答の無いスレッドがある場合、切り替え後に解放する */
+            mlog("policy %u release deferred (thread %d)", old->pol_no, i);
+            policy_retire(old, old_vlan);
+            return;
         }
     }
-
-    destroy_policy_table();
-    destroy_svr_tbl();
-
-    init_svr_mng_table();
-    init_policy_table(1);
-
-    (void)get_interface_info(if_ingress, if_egress);
-
-    get_policy();
-    ret = create_net_thread(front_ingress1);
-    if (!ret) {
+    /* resolverスレッドが古いサーバテーブルの要求を処理し終えるまで */
+    if (resolver_sync(POL_GRACE_MSEC) != 0) {
+        mlog("policy %u release deferred (resolver)", old->pol_no);
+        policy_retire(old, old_vlan);
         return;
     }
-    nt_info.th[0].tid = ret;
+
+    vlan_release(old_vlan);
+    destroy_policy_table(old);
+    mlog("policy %u -> %u", old->pol_no, set->pol_no);
 }
 
 /* end */
@@ -30,9 +30,15 @@
 #include "front_properties.h"
 #include "stat.h"
 #include "checksum.h"
+#include "ring_inline.h"
+#include "pktio.h"
+#include "xdp_fwd.h"
+#include "hugemem.h"
+#include "rxpoll.h"
+#include "latency.h"
+#include "prof.h"
 #undef  VAL_SUBS
 
-#define DATABUF_SIZE 1520
 #define MAX_RECV 128 
 
 /* 
@@ -43,27 +49,38 @@ static struct ifdata if_in;
 static struct ifdata if_eg;
 
 /* 代表IP */
-static struct in_addr   vip4;
-static struct in6_addr  vip6;
-
-/* 受信buffer */
-static unsigned char databuff[DATABUF_SIZE];
-
-/* VLAN header */
-#if 0
-struct ethvlan {
-    unsigned char   h_dest[ETH_ALEN];   /* destination eth addr */
-    unsigned char   h_source[ETH_ALEN]; /* source ether addr    */
-    uint32_t        h_tag;
-    uint32_t        h_proto;            /* packet type ID field */
-} __attribute__((packed));
-#endif
+
+/*
+    振り分けスレッド毎の情報(スレッド間で共有しない)
+*/
+struct worker {
+    int no;                         /* スレッド番号 */
+    int fd;                         /* 受信ソケット */
+    struct rx_ring rx_ring;         /* mmap受信リング */
+    struct tx_queue txq;            /* 送信キュー */
+    struct rx_poll rp;              /* 受信待ち受け */
+    struct lb_pol_cache *pc;        /* 振り分けキャッシュ */
+    struct ifdata *seg;             /* 受信中フレームのセグメント(VLAN) */
+    unsigned char *vnetbuff;        /* vnet_hdr使用時の受信buffer */
+    unsigned char *databuff;        /* 受信buffer(MTUから求める) */
+    int bufsize;
+    struct latency lat;             /* 滞留時間の計測 */
+} __attribute__((aligned(4096)));   /* スレッドのNUMAノードに置くためページ単位 */
+
+static struct worker workers[MAX_NET_THREAD];
 
 /* prototype */
-static void proc_recv_data(unsigned char *buf, int len);
-static void proc_v4(struct ethhdr *eth, struct ip *ip, int len);
-static void proc_v6(struct ethhdr *eth, struct ip6_hdr *ip, int len);
-static inline void proc_patrol(struct timeval *);
+static int get_thread_num(void);
+static int recv_sock(struct worker *w);
+static int recv_ring(struct worker *w);
+static int recv_xsk(struct worker *w, struct xsk *x);
+static void proc_recv_data(struct worker *w, unsigned char *buf, int len,
+    uint16_t vid);
+static inline void send_frame(struct worker *w, struct ethhdr *eth, int len);
+static inline void send_flush(struct worker *w);
+static inline void check_policy(struct worker *w);
+static void proc_v4(struct worker *w, struct ethhdr *eth, struct ip *ip, int len);
+static void proc_v6(struct worker *w, struct ethhdr *eth, struct ip6_hdr *ip, int len);
 static void front_cleanup(void *arg);
 void *front_ingress1(void *);
 
@@ -78,7 +95,7 @@ int arp_reply(struct ethhdr *, struct ifdata *);
 */
 int main(int argc, char *argv[])
 {
-    int type, ret;
+    int type;
 
     if (argc >=2 && strcmp(argv[1], "-d") == 0) {
         /* デーモン */
@@ -103,15 +120,24 @@ int main(int argc, char *argv[])
     /* 設定ファイル読み出し */
     anycast_prop_init();
 
-    /* サーバ管理テーブル初期化 */
-    init_svr_mng_table();
+    /* ネイバー、経路テーブルのミラー(失敗時は都度検索する) */
+    (void)rt_mirror_start();
+
+    /* 振り分けスレッド数 */
+    nt_info.count = get_thread_num();
+
     /* 振り分けテーブル初期化 */
-    init_policy_table(0);
+    init_policy_table();
+
+    /* 振り分けスレッドが参照する静的領域を常駐させる */
+    huge_lock(&lb_policy_info, sizeof(lb_policy_info), "policy info");
+    huge_lock(workers, sizeof(workers), "worker");
+    huge_lock(sstat_blk, sizeof(sstat_blk), "stat");
+    huge_lock(mlog_data, sizeof(mlog_data), "mlog");
+    huge_lock(evtlog_data, sizeof(evtlog_data), "evtlog");
 
     /* 動作モード読み出し */
     type = get_interface_info(&if_in, &if_eg);
-    
-    nt_info.count = MAX_NET_THREAD;
 
 /*
     if (type == TYPE_TWO_ARM) {
@@ -134,15 +160,21 @@ int main(int argc, char *argv[])
 */
     {
         if_egress = if_ingress = &if_in;
-        get_policy();
-        ret = create_net_thread(front_ingress1);
-        if (!ret) {
+        if ((lb_policy_info.set = get_policy()) == NULL) {
             return -1;
         }
-        nt_info.th[0].tid = ret;
+        /* MAC解決スレッド(振り分けスレッドより先に起動) */
+        if (resolver_start() < 0) {
+            return -1;
+        }
+        if (create_net_threads(front_ingress1) < 0) {
+            return -1;
+        }
+        xdp_fwd_attach(lb_policy_info.set);
     }
 
-    /* コマンド処理 */
+    /* コマンド処理(スレッド生成後に固定し、他のスレッドへ継承しない) */
+    (void)thread_placement("command", KEY_CPU_CMD, -1, 0);
     if (command_proc() < 0) {
         return -1;
     }
@@ -150,6 +182,34 @@ int main(int argc, char *argv[])
     return 0;
 }
 
+/*
+    @brief 振り分けスレッド数
+    thread_numが2以上の場合、各スレッドのソケットをPACKET_FANOUTで
+    束ねて受信を分散する
+*/
+static int
+get_thread_num(void)
+{
+    long num;
+
+    num = anycast_get_properties_int(KEY_THREAD_NUM);
+    if (num <= 0) {
+        num = 1;
+    } else if (num > MAX_NET_THREAD) {
+        mlog("thread_num %ld too large (max %d)", num, MAX_NET_THREAD);
+        num = MAX_NET_THREAD;
+    }
+    if ((num > 1) &&
+            (anycast_get_properties_int(KEY_IO_MODE) == IO_MODE_XDP)) {
+        /* XDPプログラムはインターフェースに1つのため */
+        mlog("thread_num %ld not supported with io_mode=%d", num,
+            IO_MODE_XDP);
+        num = 1;
+    }
+    mlog("forwarding thread %ld", num);
+    return num;
+}
+
 /*
     @brief 振り分け処理
     一本腕専用
@@ -157,72 +217,274 @@ int main(int argc, char *argv[])
 void * 
 front_ingress1 (void *arg)
 {
-    struct timeval timeout;
-    int fd, tno;
+    struct net_thread_arg *targ = arg;
+    struct worker *w;
+    int fd, xfd, node;
 
     pthread_detach(pthread_self());
 
     signal_block();
 
+    w = &workers[targ->no];
+    w->no = targ->no;
+    w->pc = lb_policy_info.cache[w->no];
+    SASAT_STAT_THREAD(w->no);
+
+    /* CPU固定、振り分けキャッシュと統計をスレッドのNUMAノードへ */
+    node = thread_placement("forward", KEY_CPU_NET, w->no, 1);
+    move_policy_cache(w->pc, node);
+    numa_move(sstat_self, sizeof(*sstat_self), node);
+    numa_move(w, sizeof(*w), node);
+
     /* ソケット初期化 */
-    if (init_socket_if(if_ingress, &fd) != 0) {
-        *(int*)arg = -1;
+    if (init_socket_if(if_ingress, &fd, &w->rx_ring) != 0) {
+        targ->wait = -1;
         return NULL;
     }
+    w->fd = fd;
+
+    if ((nt_info.count > 1) && (join_fanout(fd, getpid()) != 0)) {
+        goto ingress_err_ring;
+    }
 
-    if_ingress->sockfd = fd;
-    vip4 = if_ingress->vip4;
-    vip6 = if_ingress->vip6;
+    /* 受信buffer(jumbo frameを受信できるようMTUから求める)
+       vnet_hdrの場合はGROで結合されたフレーム(最大64KB)を受信する */
+    w->vnetbuff = NULL;
+    w->bufsize = RX_BUF_SIZE(if_ingress);
+    if (((w->databuff = huge_alloc(w->bufsize, "rx buffer")) == NULL) ||
+            (if_ingress->vnet_hdr && ((w->vnetbuff =
+                huge_alloc(VNET_BUF_SIZE, "vnet buffer")) == NULL))) {
+        goto ingress_err_buf;
+    }
+
+    xfd = -1;
+    if (w->no == 0) {
+        /* ARP応答等の送信はスレッド0のソケットを使用する
+           (vnet_hdrの受信ソケットはvirtio_net_hdrが必要なため送信専用) */
+        if (if_ingress->vnet_hdr) {
+            if ((if_ingress->sockfd = tx_socket(if_ingress, 0)) < 0) {
+                syslog(LOG_ERR, "tx socket(%s) error", if_ingress->ifname);
+                if_ingress->sockfd = 0;
+                goto ingress_err_buf;
+            }
+        } else {
+            if_ingress->sockfd = fd;
+        }
+
+        /* AF_XDP(IPパケットのみ、ARP,ND等はAF_PACKETソケットで受信) */
+        if (anycast_get_properties_int(KEY_IO_MODE) == IO_MODE_XDP) {
+            if ((if_ingress->xsk = xsk_open(if_ingress)) != NULL) {
+                xfd = if_ingress->xsk->fd;
+            } else {
+                mlog("xsk not available, use AF_PACKET");
+            }
+        }
+    }
+    w->rp.epfd = -1;
+    if (rx_poll_init(&w->rp, fd, xfd, rx_spin, rx_sleep, rx_kernel) != 0) {
+        rx_poll_free(&w->rp);
+        goto ingress_err_sock;
+    }
+    tx_queue_init(&w->txq, if_egress);
+    (void)lat_init(&w->lat, w->no, lat_samples, w->rx_ring.map ? -1 : fd);
+    prof_init(w->no);
     
-    tno = 0;
-    pthread_cleanup_push((void*)front_cleanup, &tno);
+    pthread_cleanup_push((void*)front_cleanup, w);
 
     /* 初期化完了 */
-    *(int*)arg = 1;
+    targ->wait = 1;
 
-    timeout_set(&timeout, 5);
+    check_policy(w);
     /*
         書き換え処理
     */
     for ( ;; ) {
-        fd_set fds;
-        int ret, len, i;
-
-        FD_ZERO(&fds);
-        FD_SET(fd, &fds);
-
-        /* 待ち受け */ 
-        ret = select(fd + 1, &fds, NULL, NULL, &timeout);
-        
-        if (likely(ret != 0)) {
-            for (i = 0; i < MAX_RECV; i++) { 
-                if ((len = recv(fd, databuff, DATABUF_SIZE, 0)) > 0) {
-                    if (likely(len > sizeof(struct ethhdr))) {
-                        proc_recv_data(databuff, len);
-                    } else {
-                        SASAT_STAT(rx_drop_short);
-                    }
-                } else {
-                    break;
-                }
+        int n;
+
+        /* 待ち受け(busy poll中はすぐに戻る) */ 
+        if (likely(rx_poll_wait(&w->rp, 1000) != 0)) {
+            n = 0;
+            if (xfd >= 0) {
+                n += recv_xsk(w, if_ingress->xsk);
+            }
+            if (w->rx_ring.map) {
+                n += recv_ring(w);
+            } else {
+                n += recv_sock(w);
             }
+            rx_poll_done(&w->rp, n);
+            /* 受信バースト分をまとめて送信 */
+            send_flush(w);
         } else {
             /* timeout */
             SASAT_STAT(select_to);
         }
-        proc_patrol(&timeout);
+        /* 振り分けテーブルの切り替え(タイムアウト時も確認する) */
+        check_policy(w);
     }
 
     pthread_cleanup_pop(0);
     return NULL;
+
+    /* 初期化失敗(確保済みのものを逆順に解放) */
+ingress_err_sock:
+    if (w->no == 0) {
+        if (if_ingress->vnet_hdr && (if_ingress->sockfd > 0)) {
+            close(if_ingress->sockfd);
+        }
+        xsk_close(if_ingress->xsk);
+        if_ingress->xsk = NULL;
+        if_ingress->sockfd = 0;
+    }
+ingress_err_buf:
+    huge_free(w->vnetbuff);
+    w->vnetbuff = NULL;
+    huge_free(w->databuff);
+    w->databuff = NULL;
+ingress_err_ring:
+    free_rx_ring(&w->rx_ring);
+    close(fd);
+    w->fd = 0;
+    targ->wait = -1;
+    return NULL;
+}
+
+/*
+    @brief recv()による受信
+    vnet_hdrを使用する場合はvirtio_net_hdrを残したままフレームを処理する
+    (送信時にそのままGSOの指定として使う)
+    bufferを超えるフレームは切り詰められるため破棄する
+    @return 受信したフレーム数
+*/
+static int
+recv_sock(struct worker *w)
+{
+    unsigned char *buf = w->databuff;
+    int size = w->bufsize, hdr = 0;
+    int len, i;
+    uint16_t vid = 0;
+    struct timespec *ts;
+
+    if (w->vnetbuff) {
+        buf = w->vnetbuff;
+        size = VNET_BUF_SIZE;
+        hdr = VNET_HDR_LEN;
+    }
+
+    for (i = 0; i < MAX_RECV; i++) { 
+        PROF_START();
+        ts = lat_pick(&w->lat) ? &w->lat.rx : NULL;
+        if (VLAN_INFO()->num || ts) {
+            len = recv_vlan(w->fd, buf, size, &vid, ts);
+        } else {
+            len = recv(w->fd, buf, size, MSG_TRUNC);
+        }
+        if (len > 0) {
+            PROF(PROF_RECV);
+            if (unlikely(len > size)) {
+                SASAT_STAT(rx_drop_oversize);
+            } else if (likely(len > (int)(hdr + sizeof(struct ethhdr)))) {
+                if (hdr && vnet_gso(buf)) {
+                    SASAT_STAT(rx_gro);
+                }
+                proc_recv_data(w, buf + hdr, len - hdr, vid);
+            } else {
+                SASAT_STAT(rx_drop_short);
+            }
+        } else {
+            break;
+        }
+    }
+    lat_end(&w->lat);
+    return i;
+}
+
+/*
+    @brief mmap受信リングからの受信
+    引き渡されたブロックをリング上でそのまま処理する
+    @return 受信したフレーム数
+*/
+static int
+recv_ring(struct worker *w)
+{
+    struct rx_ring *ring = &w->rx_ring;
+    struct tpacket_block_desc *bd;
+    struct tpacket3_hdr *ppd;
+    int i, num, blk, total = 0;
+
+    for (blk = 0; blk < ring->block_num; blk++) {
+        if ((bd = rx_ring_block(ring)) == NULL) {
+            break;
+        }
+
+        num = bd->hdr.bh1.num_pkts;
+        ppd = rx_ring_first(bd);
+        for (i = 0; i < num; i++) {
+            PROF_START();
+            if (unlikely(lat_pick(&w->lat))) {
+                w->lat.rx.tv_sec = ppd->tp_sec;
+                w->lat.rx.tv_nsec = ppd->tp_nsec;
+            }
+            if (unlikely(ppd->tp_snaplen < ppd->tp_len)) {
+                /* リングのフレーム長を超える(MTUが変更された等) */
+                SASAT_STAT(rx_drop_oversize);
+            } else if (likely(ppd->tp_snaplen > sizeof(struct ethhdr))) {
+                proc_recv_data(w, (unsigned char *)ppd + ppd->tp_mac,
+                    ppd->tp_snaplen, VLAN_INFO()->num ? rx_ring_vid(ppd) : 0);
+            } else {
+                SASAT_STAT(rx_drop_short);
+            }
+            ppd = rx_ring_next(ppd);
+        }
+        total += num;
+
+        rx_ring_release(ring, bd);
+    }
+    lat_end(&w->lat);
+    return total;
+}
+
+/*
+    @brief AF_XDPソケットからの受信
+    振り分け対象のフレームはUMEM上で書き換え、そのままtx ringへ入れる
+    @return 受信したフレーム数
+*/
+static int
+recv_xsk(struct worker *w, struct xsk *x)
+{
+    struct xdp_desc *desc;
+    uint32_t i, n, idx;
+
+    n = xsk_rx_peek(x, MAX_RECV, &idx);
+    for (i = 0; i < n; i++) {
+        desc = xsk_rx_desc(x, idx + i);
+        x->rx_used = 0;
+        PROF_START();
+        if (likely(desc->len > sizeof(struct ethhdr))) {
+            proc_recv_data(w, xsk_frame(x, desc->addr), desc->len, 0);
+        } else {
+            SASAT_STAT(rx_drop_short);
+        }
+        if (!x->rx_used) {
+            /* 送信しなかったフレームは受信用に戻す */
+            xsk_fill(x, desc->addr);
+        }
+    }
+    if (n) {
+        xsk_rx_release(x, n);
+    }
+    return n;
 }
 
 /*
     IPパケットのみ振り分け
     その他は破棄
+    VLAN(in.vlan)のフレームはVLAN毎のVIPで判定し、ARP/ND応答は
+    サブインターフェースから送信する(振り分け先へはタグ無しで送信)
+    @param vid VLAN ID(カーネルが外したタグ、0:タグ無し)
 */
 static void
-proc_recv_data(unsigned char *buf, int len)
+proc_recv_data(struct worker *w, unsigned char *buf, int len, uint16_t vid)
 {
     struct ethhdr *eth = (struct ethhdr *)buf;
     uint16_t prot = ntohs(eth->h_proto);
@@ -230,16 +492,25 @@ proc_recv_data(unsigned char *buf, int len)
     if (unlikely(cmp_mac(eth->h_source, if_ingress->mac) == 0)) {
         return;
     }
+    SASAT_STAT_ADD(rx_bytes, len);
+    w->seg = if_ingress;
+    if (unlikely(vid != 0)) {
+        if ((w->seg = vlan_lookup(VLAN_INFO(), vid, if_ingress)) == NULL) {
+            SASAT_STAT(rx_drop_vlan);
+            return;
+        }
+        SASAT_STAT(rx_packet_vlan);
+    }
     if (is_multicast(eth->h_dest)) {
         SASAT_STAT(rx_packet_mc);
         if (vip_mode) {
-            mac_resolve(eth, prot, if_ingress, len);
+            mac_resolve(eth, prot, w->seg, len);
         }
     } else if (prot == ETH_P_IP) {
         /* IPv4 */
         SASAT_STAT(rx_packet_v4);
         if (likely(len > (sizeof(struct ethhdr) + sizeof(struct ip)))) {
-            proc_v4(eth, (struct ip*)(eth+1), len);        
+            proc_v4(w, eth, (struct ip*)(eth+1), len);        
         }else {
             SASAT_STAT(rx_drop_short);
         }
@@ -252,41 +523,18 @@ proc_recv_data(unsigned char *buf, int len)
             if ((ip6h->ip6_nxt == IPPROTO_ICMPV6) && 
                     ((icmp6h = get_icmp6_ns(ip6h, len)) != NULL) ) {
                 if (vip_mode) {
-                    mac_resolve_uc6(eth, ip6h, icmp6h, if_ingress, len);     
+                    mac_resolve_uc6(eth, ip6h, icmp6h, w->seg, len);
                 }
             } else {
-               proc_v6(eth, ip6h, len);
+               proc_v6(w, eth, ip6h, len);
             }
         } else {
             SASAT_STAT(rx_drop_short);
         }
-#if 0   /* VLAN */
-    } else if (prot == ETH_P_8021Q) {
-        struct ethvlan *vlanhdr = (struct ethvlan*)buf;
-        prot = ntohs(vlanhdr->h_proto);
-        
-        if (prot == ETH_P_IP) {
-            if (likely(len >= (sizeof(struct ethhdr)+4+sizeof(struct ip)))) {
-                proc_v4(eth,(struct ip*)(buf+sizeof(struct ethhdr)+4), len);
-            } else {
-                SASAT_STAT(rx_drop_short);
-            }
-        } else if (prot == ETH_P_IPV6)  {
-            if (likely(len >= 
-                    (sizeof(struct ethhdr)+4+sizeof(struct ip6_hdr)))) {
-                proc_v6(eth,(struct ip6_hdr*)(buf+sizeof(struct ethhdr)+4),len);
-            } else {
-                SASAT_STAT(rx_drop_short);
-            }
-        } else {
-            /* 破棄 */
-            SASAT_STAT(rx_drop_vlan);
-        }
-#endif
     } else if (prot == ETH_P_ARP) {
         /* unicast arp request応答 */
-        if (if_ingress->v4_enable) {
-            arp_reply(eth, if_ingress);
+        if (w->seg->v4_enable) {
+            arp_reply(eth, w->seg);
         }
     } else  {
         /* 破棄 */        
@@ -298,97 +546,155 @@ proc_recv_data(unsigned char *buf, int len)
     @brief ipv4処理
 */
 static void
-proc_v4(struct ethhdr *eth, struct ip *ip, int len)
+proc_v4(struct worker *w, struct ethhdr *eth, struct ip *ip, int len)
 {
     lb_pol_cache_v4_t *lb;
+    uint32_t miss;
 
     evtlog("prc4", len, 0, (uchar*)eth);
 
-    if (unlikely(cmp_ipv4(&ip->ip_dst, &vip4) != 0)) {
+    if (unlikely(cmp_ipv4(&ip->ip_dst,
+            (w->seg == if_ingress) ? &w->pc->set->vip4 : &w->seg->vip4) != 0)) {
         SASAT_STAT(rx_drop_addr_v4);
         return;
     }  
-    if ((lb = get_pol_v4(ip->ip_src)) == NULL) {
+    PROF(PROF_CLASSIFY);
+    miss = w->pc->miss;
+    lb = get_pol_v4(w->pc, ip->ip_src);
+    PROF((w->pc->miss == miss) ? PROF_LOOKUP : PROF_LOOKUP_SLOW);
+    if (lb == NULL) {
         SASAT_STAT(rx_drop_policy);
         return;
     }
-    copy_mac(eth->h_dest, lb->lb_dst_mac); 
     copy_mac(eth->h_source, if_egress->mac);
 
     ip->ip_dst = lb->lb_dst_ip;
-    ip->ip_sum = htons(add16forCheckSum(ntohs(ip->ip_sum), lb->chksum_delta));
+    ip->ip_sum = htons(rewrite_ip_sum(w->seg, ntohs(ip->ip_sum),
+        lb->chksum_delta));
+
+    if (unlikely(svr_unresolved(lb->lb_stat, lb->svr)) &&
+            (check_wait_v4(lb) != 0)) {
+        /* MAC未解決のため保留(解決後にresolverスレッドが送信) */
+        nh_hold(&lb->svr->nh, eth, len);
+        return;
+    }
+    /* 宛先MACはサーバテーブルを参照する(ネイバーの変更を反映するため) */
+    load_mac(eth->h_dest, lb->svr->dst_mac);
+    PROF(PROF_REWRITE);
 
     SASAT_STAT(tx_packet_v4);
-    write(if_egress->sockfd , eth, len);
+    send_frame(w, eth, len);
 }
 
 /*
     @brief ipv6処理
 */
 static void
-proc_v6(struct ethhdr *eth, struct ip6_hdr *ip, int len)
+proc_v6(struct worker *w, struct ethhdr *eth, struct ip6_hdr *ip, int len)
 {
     lb_pol_cache_v6_t *lb;
+    uint32_t miss;
 
     evtlog("prc6", len, 0, (uchar*)eth);
 
-    if (unlikely(cmp_ipv6(&ip->ip6_dst, &vip6) != 0)) {
+    if (unlikely(cmp_ipv6(&ip->ip6_dst,
+            (w->seg == if_ingress) ? &w->pc->set->vip6 : &w->seg->vip6) != 0)) {
         SASAT_STAT(rx_drop_addr_v6);
         return;
     }  
-    if ((lb = get_pol_v6(&ip->ip6_src)) == NULL) {
+    PROF(PROF_CLASSIFY);
+    miss = w->pc->miss;
+    lb = get_pol_v6(w->pc, &ip->ip6_src);
+    PROF((w->pc->miss == miss) ? PROF_LOOKUP : PROF_LOOKUP_SLOW);
+    if (lb == NULL) {
         SASAT_STAT(rx_drop_policy);
         return;
     }
     
-    copy_mac(eth->h_dest, lb->lb_dst_mac); 
     copy_mac(eth->h_source, if_egress->mac);
 
     ip->ip6_dst = lb->lb_dst_ip;
 
+    if (unlikely(svr_unresolved(lb->lb_stat, lb->svr)) &&
+            (check_wait_v6(lb) != 0)) {
+        nh_hold(&lb->svr->nh, eth, len);
+        return;
+    }
+    load_mac(eth->h_dest, lb->svr->dst_mac);
+    PROF(PROF_REWRITE);
+
     SASAT_STAT(tx_packet_v6);
-    write(if_egress->sockfd, eth, len);
+    send_frame(w, eth, len);
 }
 
 /*
-    @brief 振り分けテーブル関連の処理　排他の関係で振り分けスレッドで動作   
+    @brief 送信キューへ格納
 */
 static inline void
-proc_patrol(struct timeval *to)
+send_frame(struct worker *w, struct ethhdr *eth, int len)
 {
-    int tv = 5;
+    int ret;
+
+    SASAT_STAT_ADD(tx_bytes, len);
+    if (unlikely((ret = tx_put(&w->txq, eth, len)) != TX_QUEUED)) {
+        SASAT_STAT(tx_queue_full);
+        if (ret == TX_DROP) {
+            SASAT_STAT(tx_drop_full);
+            return;
+        }
+    }
+    lat_queued(&w->lat);
+    PROF(PROF_TX);
+}
 
-    if (unlikely(patrol_flag != 0)) {
-    
-        SASAT_STAT(clr_policy_cache);
+/*
+    @brief 送信キューのフレームを送信
+*/
+static inline void
+send_flush(struct worker *w)
+{
+    int cnt;
+
+    lat_sent(&w->lat);
+    PROF_START();
+    if ((cnt = tx_flush(&w->txq)) > 0) {
+        PROF(PROF_FLUSH);
+        SASAT_STAT(tx_flush_num);
+        SASAT_STAT_ADD(tx_flush_frames, cnt);
+    }
+}
 
-        if (patrol_flag & DEL_CACHE4) {
-            static int ptr4;
+/*
+    @brief 振り分けテーブルが切り替わっていれば新しいテーブルを使う
+*/
+static inline void
+check_policy(struct worker *w)
+{
+    struct lb_pol_set *set;
 
-            ptr4 = clear_v4_cache(ptr4);
+    set = __atomic_load_n(&lb_policy_info.set, __ATOMIC_ACQUIRE);
+    if (unlikely(set != w->pc->set)) {
+        switch_policy(w->pc, set);
+    }
+}
 
-            if (ptr4 == LB_POL_DIVISOR) {
-                ptr4 = 0;
-                patrol_flag &= ~DEL_CACHE4;
-            }
-        }
-        if (patrol_flag & DEL_CACHE6) {
-            static int ptr6;
-
-            ptr6 = clear_v6_cache(ptr6);
-            
-            if (ptr6 == LB_POL_DIVISOR) {
-                ptr6 = 0;
-                patrol_flag &= ~DEL_CACHE6;
-            }
-        }    
+/*
+    @brief インターフェース情報の再読み込みを反映(コマンドスレッドから呼ぶ)
+    AF_XDPで受信するアドレスと受信フィルタを再設定する
+    (振り分けで参照するVIPは振り分けテーブルと共に切り替える)
+*/
+void
+update_interface(void)
+{
+    int i;
 
-        if (patrol_flag) {
-            tv = 1;
+    (void)xsk_set_addr(if_ingress->xsk, if_ingress);
+
+    for (i = 0; i < nt_info.count; i++) {
+        if (workers[i].fd > 0) {
+            (void)attach_sock_filter(workers[i].fd, if_ingress, 0);
         }
     }
-
-    timeout_set(to, tv);
 }
 
 /*
@@ -397,14 +703,28 @@ proc_patrol(struct timeval *to)
 static void
 front_cleanup(void *arg)
 {
-    int tno = *(int*)arg;
-
-    if (likely(if_ingress->sockfd != 0)) {
-        close(if_ingress->sockfd);
+    struct worker *w = arg;
+
+    free_rx_ring(&w->rx_ring);
+    tx_queue_free(&w->txq);
+    rx_poll_free(&w->rp);
+    huge_free(w->vnetbuff);
+    w->vnetbuff = NULL;
+    huge_free(w->databuff);
+    w->databuff = NULL;
+    close(w->fd);
+    w->fd = 0;
+
+    if (w->no == 0) {
+        if (if_ingress->vnet_hdr && (if_ingress->sockfd > 0)) {
+            close(if_ingress->sockfd);
+        }
+        xsk_close(if_ingress->xsk);
+        if_ingress->xsk = NULL;
         if_ingress->sockfd = 0;
     }
 
-    nt_info.th[tno].cancel_end = 1;
+    nt_info.th[w->no].cancel_end = 1;
 }
 
 /* end */
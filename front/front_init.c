@@ -18,7 +18,7 @@
 #include <errno.h>
 #include <pthread.h>
 #include <net/if.h>
-#include <netpacket/packet.h>
+#include <linux/if_packet.h>
 #include <linux/sysctl.h>
 #include <sys/un.h>
 #include <arpa/inet.h>
@@ -35,16 +35,21 @@
 
 /*
     @brief 振り分けスレッド起動
+    @param func スレッド関数
+    @param no   スレッド番号
 */
 pthread_t
-create_net_thread(void*(*func)(void*))
+create_net_thread(void*(*func)(void*), int no)
 {
     pthread_t tid;
-    volatile int wait = 0;
+    struct net_thread_arg arg;
+
+    arg.wait = 0;
+    arg.no = no;
 
     /* 一本腕専用 */
     /* 通過型の場合は通過型(ルータ/ブリッジ）の処理を起動する */
-    if (pthread_create(&tid, NULL, func, (void*)&wait)) {
+    if (pthread_create(&tid, NULL, func, (void*)&arg)) {
         strerror_r(errno, ebuf1, ELOG_DATA_LEN);
         syslog(LOG_ERR,
             "thread(ing) create error %s",ebuf1);
@@ -52,17 +57,37 @@ create_net_thread(void*(*func)(void*))
     }
 
     for ( ;; ) {
-        if (wait) {
+        if (arg.wait) {
             break;
         }
         anycast_sleep(10);
     }
 
-    if (wait == -1) {
+    if (arg.wait == -1) {
         return 0;
     }
 
     return tid;
 }
 
+/*
+    @brief 振り分けスレッドをnt_info.count数起動
+    @return 0:成功 -1:失敗
+*/
+int
+create_net_threads(void*(*func)(void*))
+{
+    pthread_t ret;
+    int i;
+
+    for (i = 0; i < nt_info.count; i++) {
+        ret = create_net_thread(func, i);
+        if (!ret) {
+            return -1;
+        }
+        nt_info.th[i].tid = ret;
+    }
+    return 0;
+}
+
 /* end */
@@ -12,11 +12,34 @@
 
 #include "prop_common.h"
 
+#define KEY_THREAD_NUM      "thread_num"
+#define KEY_FLOW_SIZE4      "flow.size4"
+#define KEY_FLOW_SIZE6      "flow.size6"
+
 #ifdef VAL_SUBS
 prop_db_t prop_db_front[] = { 
     {"in.ifname", "eth0"},
     {"ud_file",   "/dev/shm/.sasat"}, 
     {"vip_mode",  "1"},
+    {"rx_ring",   "0"},
+    {"tx_mode",   "1"},
+    {"io_mode",   "0"},
+    {"rx_filter", "1"},
+    {"sched.fifo", "0"},
+    {"hugepage", "1"},
+    {"mlock",    "1"},
+    {"rx.poll",  "0"},
+    {"rx.busy_poll", "50"},
+    {"rx.poll_idle", "200"},
+    {"vnet_hdr", "0"},
+    {"in.vlan",  ""},
+    {"shm_stat.interval", "1000"},
+    {"latency.sample", "0"},
+    {"prof",     "0"},
+    {"rx.stat_interval", "1000"},
+    {"thread_num", "1"},
+    {"flow.size4", "61440"},
+    {"flow.size6", "61440"},
 
     /*==============================================================*
      *    table end.
@@ -17,11 +17,23 @@
 void *front_ingress1 (void *arg);
 
 int get_interface_info(struct ifdata *if_in, struct ifdata *if_eg);
-pthread_t create_net_thread(void *(*func)(void *));
+void reload_interface_info(struct ifdata *if_in, struct ifdata *if_eg);
+struct vlan_info *vlan_commit(void);
+void vlan_abort(void);
+void vlan_release(struct vlan_info *);
+pthread_t create_net_thread(void *(*func)(void *), int);
+int create_net_threads(void *(*func)(void *));
+int join_fanout(int, int);
+int attach_sock_filter(int, struct ifdata *, int);
+void update_interface(void);
 int init_ud_socket(void);
 uint64_t tsc_cycle_init(void);
 void signal_block(void);
-int init_socket_if(struct ifdata *, int * fd);
+int thread_placement(const char *, const char *, int, int);
+void numa_move(void *, size_t, int);
+int init_socket_if(struct ifdata *, int * fd, struct rx_ring *);
+void free_rx_ring(struct rx_ring *);
 int init_pid(void);
+int rt_mirror_start(void);
 
 #endif
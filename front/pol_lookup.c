@@ -9,95 +9,152 @@
  * ---- -------- --------- --------------------------------------------------
  */
 
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
 #include <netinet/in.h>
 
 #include "option.h"
 #include "policy.h"
 #include "val.h"
+#include "stat.h"
 #include "util_inline.h"
 #include "checksum.h"
-
-static lb_pol_cache_v4_t *get_pol_slow_v4(struct in_addr, struct lb_hash_head4 *);
-static lb_pol_cache_v4_t *get_free_pol_cache4(void);
-static lb_pol_v4_t*policy_lookup4(struct in_addr saddr);
-static inline void free_pol_cache4(lb_pol_cache_v4_t *entry);
-
-static lb_pol_cache_v6_t *get_free_pol_cache6(void);
-static lb_pol_cache_v6_t *get_pol_slow_v6(struct in6_addr *, struct lb_hash_head6 *);
-static lb_pol_v6_t *policy_lookup6(struct in6_addr *saddr);
-static inline void free_pol_cache6(lb_pol_cache_v6_t *entry);
+#include "xdp_fwd.h"
+
+static lb_pol_cache_v4_t *get_pol_slow_v4(struct lb_pol_cache *, struct in_addr, uint32_t);
+static lb_pol_cache_v4_t *refresh_pol_v4(struct lb_pol_cache *, struct flow_bucket *, uint32_t, lb_pol_cache_v4_t *);
+static lb_pol_cache_v4_t *set_pol_v4(struct lb_pol_cache *, lb_pol_cache_v4_t *, lb_pol_v4_t *);
+static lb_pol_v4_t*policy_lookup4(struct lb_pol_set *, struct in_addr saddr);
+
+static lb_pol_cache_v6_t *get_pol_slow_v6(struct lb_pol_cache *, struct in6_addr *, uint32_t);
+static lb_pol_cache_v6_t *refresh_pol_v6(struct lb_pol_cache *, struct flow_bucket *, uint32_t, lb_pol_cache_v6_t *);
+static lb_pol_cache_v6_t *set_pol_v6(struct lb_pol_cache *, lb_pol_cache_v6_t *, lb_pol_v6_t *);
+static lb_pol_v6_t *policy_lookup6(struct lb_pol_set *, struct in6_addr *saddr);
+static inline void add_pol_hit(uint32_t *, server_tbl_t *, uint32_t);
+static inline void pol_unref(uint32_t **);
+
+static inline uint32_t flow_alt(uint32_t, uint32_t);
+static inline uint32_t flow_match(const struct flow_bucket *, uint32_t);
+static inline void flow_ref(struct flow_bucket *, uint32_t);
+static inline void flow_del(struct flow_bucket *, uint32_t);
+static uint32_t flow_slot(struct flow_table *, uint32_t, uint32_t,
+    const uint8_t *, size_t, size_t);
 
 /*
     @brief IPv4 振り分けキャッシュテーブル取得
+    @param pc 振り分けスレッドのキャッシュ
     @param saddr
     @return policyキャッシュ(NULLのとき破棄する)
 */
-lb_pol_cache_v4_t *get_pol_v4(struct in_addr saddr)
+lb_pol_cache_v4_t *get_pol_v4(struct lb_pol_cache *pc, struct in_addr saddr)
 {
+    struct flow_table *ft = &pc->ft4;
     lb_pol_cache_v4_t *entry;
-    uint hash = ip_hash_code4(saddr.s_addr, LB_POL_MASK);
-    struct lb_hash_head4 *head;
-
-    head = &lb_policy_info.lb_pol_hash_v4[hash];
+    uint32_t hash = flow_hash4(saddr.s_addr);
+    uint32_t b, m;
+
+    /* v4はアドレスそのものをキーとする */
+    b = hash & ft->mask;
+    if ((m = flow_match(&ft->bucket[b], saddr.s_addr)) == 0) {
+        b = flow_alt(hash, ft->mask);
+        m = flow_match(&ft->bucket[b], saddr.s_addr);
+    }
+    if (likely(m != 0)) {
+        entry = &pc->init4[(b * FLOW_WAYS) + __builtin_ctz(m)];
+        if (unlikely(entry->pol_no != pc->pol_no)) {
+            /* 振り分けテーブルが切り替わった場合 */
+            return refresh_pol_v4(pc, &ft->bucket[b], __builtin_ctz(m), entry);
+        }
+        flow_ref(&ft->bucket[b], __builtin_ctz(m));
 
-    TAILQ_FOREACH (entry, head, lb_list) {
-        if (cmp_ipv4(&entry->lb_src_ip, &saddr) == 0) {
-#if 0
-            if (unlikely(entry->pol_no != lb_policy_info.pol_no)) {
-                /* 振り分けテーブルが古い場合 */
-                free_pol_cache4(entry);
-                break;
-            }
-#endif
-            entry->hit++;
-            (*entry->pol_hit)++;
-            (*entry->svr_hit)++;
+        /* 振り分け、サーバのヒット数はキャッシュ解放時に加算 */
+        entry->hit++;
 
-            return entry->op;
-        }
+        return entry->op;
     }
-    return get_pol_slow_v4(saddr, head);
+    return get_pol_slow_v4(pc, saddr, hash);
 }
 
 /*
     @brief  振り分けテーブルを検索して、キャッシュテーブルを作成
  */
-static lb_pol_cache_v4_t *get_pol_slow_v4(struct in_addr saddr,
-    struct lb_hash_head4 *head)
+static lb_pol_cache_v4_t *get_pol_slow_v4(struct lb_pol_cache *pc,
+    struct in_addr saddr, uint32_t hash)
 {
     lb_pol_cache_v4_t *entry;
     lb_pol_v4_t *f;
 
+    pc->miss++;
+
     /* ソースアドレスから振り分けテーブルを検索 */
-    f = policy_lookup4(saddr);
+    f = policy_lookup4(pc->set, saddr);
     if (f == NULL) {
         /* 振り分けテーブルが存在しないため破棄する */
         return NULL;
     }
 
-    f->use_count++;
+    entry = &pc->init4[flow_slot(&pc->ft4, hash, saddr.s_addr,
+        (const uint8_t *)pc->init4, sizeof(lb_pol_cache_v4_t),
+        offsetof(lb_pol_cache_v4_t, timestamp))];
 
-    entry = get_free_pol_cache4();
+    if (entry->lb_stat) {
+        /* 追い出したエントリのヒット数を加算 */
+        add_pol_hit(entry->pol_hit, entry->svr, entry->hit);
+        pol_unref(&entry->pol_use);
+        SASAT_STAT(flow_evict_v4);
+    }
 
     entry->lb_src_ip = saddr;
+    entry->timestamp = rdtsc();
+
+    return set_pol_v4(pc, entry, f);
+}
+
+/*
+    @brief 切り替え前に作成したキャッシュを新しい振り分けテーブルで再検索
+    (ヒット数は切り替え時に加算済み)
+*/
+static lb_pol_cache_v4_t *refresh_pol_v4(struct lb_pol_cache *pc,
+    struct flow_bucket *bk, uint32_t way, lb_pol_cache_v4_t *entry)
+{
+    lb_pol_v4_t *f;
+
+    pc->miss++;
+    f = policy_lookup4(pc->set, entry->lb_src_ip);
+    if (f == NULL) {
+        /* 振り分け対象外になったためキャッシュから外す */
+        flow_del(bk, way);
+        entry->lb_stat = 0;
+        return NULL;
+    }
+    flow_ref(bk, way);
+
+    return set_pol_v4(pc, entry, f);
+}
+
+/*
+    @brief 振り分けテーブルの内容をキャッシュに設定
+    (キャッシュが振り分けテーブルを参照するのはここだけで、参照を外すのは
+    追い出しとテーブルの切り替え時)
+*/
+static lb_pol_cache_v4_t *set_pol_v4(struct lb_pol_cache *pc,
+    lb_pol_cache_v4_t *entry, lb_pol_v4_t *f)
+{
+    __sync_fetch_and_add(&f->use_count, 1);
+    entry->pol_use = &f->use_count;
+
+    entry->pol_no = pc->pol_no;
     entry->lb_dst_ip = ((struct sockaddr_in*)&f->svr->svr_ip)->sin_addr;
-    copy_mac(entry->lb_dst_mac, f->svr->dst_mac);
-#if 0
-    entry->pol_no = lb_policy_info.pol_no;
-#endif
     entry->lb_stat = f->svr->status;    /* OK or DROP */ 
+    if (entry->lb_stat == SVR_INIT) {
+        /* MAC未解決(解決するまでフレームは保留する) */
+        entry->lb_stat = SVR_WAIT;
+    }
 
     entry->pol_hit = &f->hit_count;
-    entry->svr_hit = &f->svr->srv_stat.hit;
-    entry->hit++;
-    (*entry->pol_hit)++;
-    (*entry->svr_hit)++;
-
-    if (likely(entry->lb_cache_type == 0)) {
-        /* 一時的なキャッシュではない場合 */
-        entry->timestamp = rdtsc();
-        TAILQ_INSERT_HEAD(head, entry, lb_list);
-    }
+    entry->svr = f->svr;
+    entry->hit = 1;
 
     if (entry->lb_stat == SVR_DROP) {
         /* 破棄設定 */ 
@@ -115,128 +172,156 @@ static lb_pol_cache_v4_t *get_pol_slow_v4(struct in_addr saddr,
 /*
     @brief 振り分けテーブル検索（IPv4)
 */
-static lb_pol_v4_t*policy_lookup4(struct in_addr saddr)
+static lb_pol_v4_t*policy_lookup4(struct lb_pol_set *set, struct in_addr saddr)
 {
     lb_pol_v4_t *entry;
 
-    TAILQ_FOREACH(entry, &lb_policy_info.lb_pol_head4, lb_list) {
-        if ((saddr.s_addr & entry->mask_v4.s_addr) == entry->addr_v4.s_addr) {
-            server_tbl_t *svr = entry->svr;
-            int i = 0;
-            do {
-                if (likely(svr->status != SVR_INIT)) {
-                    return entry;
-                }
-                resolve_target_mac(svr);
-            } while ( i++ < 3 );
-            break;
+    if (likely(set->lpm4.tbl24 != NULL)) {
+        entry = lpm4_lookup(&set->lpm4, saddr);
+    } else {
+        /* 検索用テーブルが作成できなかった場合 */
+        TAILQ_FOREACH(entry, &set->lb_pol_head4, lb_list) {
+            if ((saddr.s_addr & entry->mask_v4.s_addr) ==
+                    entry->addr_v4.s_addr) {
+                break;
+            }
         }
     }
-    return NULL;
+    return entry;
 }
 
 /*
-    @brief 振り分けキャッシュをフリーキューから取り出す
+    @brief MAC解決待ちのキャッシュを確認(IPv4)
+    @return 0:解決済み -1:未解決
 */
-static lb_pol_cache_v4_t *get_free_pol_cache4(void)
+int check_wait_v4(lb_pol_cache_v4_t *entry)
 {
-    lb_pol_cache_v4_t *entry;
+    server_tbl_t *svr = entry->svr;
 
-    entry = TAILQ_FIRST(&lb_policy_info.lb_pol_free4);
-
-    if (unlikely(entry == NULL)) {
-        start_patrol(DEL_CACHE4);
-        entry = &lb_policy_info.fix4;
-    } else {
-        TAILQ_REMOVE(&lb_policy_info.lb_pol_free4, entry, lb_list);
-        entry->hit = 0;
+    if (__atomic_load_n(&svr->status, __ATOMIC_ACQUIRE) != SVR_OK) {
+        return -1;
     }
-    return entry;
-}
-
-/*
-    @brief 振り分けキャッシュテーブルをフリーキューへ戻す
-*/
-static inline void free_pol_cache4(lb_pol_cache_v4_t *entry)
-{
-    entry->lb_stat = 0;
-    TAILQ_INSERT_TAIL(&lb_policy_info.lb_pol_free4, entry, lb_list);
+    entry->lb_stat = SVR_OK;
+    return 0;
 }
 
 /*
     @brief IPv6 振り分けキャッシュテーブル取得
+    @param pc 振り分けスレッドのキャッシュ
     @param saddr
     @return policyキャッシュ NULLのとき、破棄する
 */
-lb_pol_cache_v6_t *get_pol_v6(struct in6_addr *saddr)
+lb_pol_cache_v6_t *get_pol_v6(struct lb_pol_cache *pc, struct in6_addr *saddr)
 {
+    struct flow_table *ft = &pc->ft6;
     lb_pol_cache_v6_t *entry;
-    uint hash = ip_hash_code6(saddr->s6_addr32, LB_POL_MASK);
-    struct lb_hash_head6 *head;
-
-    head = &lb_policy_info.lb_pol_hash_v6[hash];
-
-    TAILQ_FOREACH (entry, head, lb_list) {
-        //宛先が一致したらヒット
-        if (cmp_ipv6(saddr, &entry->lb_src_ip) == 0) {
-#if 0
-            if (unlikely(entry->pol_no != lb_policy_info.pol_no)) {
-                /* 振り分けテーブルが古い場合 */
-                free_pol_cache6(entry);
-                break;
-            }
-#endif
-            /* 統計 */
-            entry->hit++;
-            (*entry->pol_hit)++;
-            (*entry->svr_hit)++;
+    uint32_t hash = flow_hash6(saddr->s6_addr32);
+    uint32_t b, m;
+    int k;
+
+    /* v6はハッシュ値をキーとし、一致したらアドレスを比較する */
+    b = hash & ft->mask;
+    for (k = 0; k < 2; k++) {
+        for (m = flow_match(&ft->bucket[b], hash); m; m &= m - 1) {
+            entry = &pc->init6[(b * FLOW_WAYS) + __builtin_ctz(m)];
+            if (cmp_ipv6(saddr, &entry->lb_src_ip) == 0) {
+                if (unlikely(entry->pol_no != pc->pol_no)) {
+                    /* 振り分けテーブルが切り替わった場合 */
+                    return refresh_pol_v6(pc, &ft->bucket[b],
+                        __builtin_ctz(m), entry);
+                }
+                flow_ref(&ft->bucket[b], __builtin_ctz(m));
 
-            return entry->op;
+                /* 統計(振り分け、サーバのヒット数はキャッシュ解放時に加算) */
+                entry->hit++;
+
+                return entry->op;
+            }
         }
+        b = flow_alt(hash, ft->mask);
     }
 
-    return get_pol_slow_v6(saddr, head);
+    return get_pol_slow_v6(pc, saddr, hash);
 }
 
 /*
     @brief 振り分けテーブルを検索して、キャッシュテーブルを作成
 */
-static lb_pol_cache_v6_t *get_pol_slow_v6(struct in6_addr *saddr,
-    struct lb_hash_head6 *head)
+static lb_pol_cache_v6_t *get_pol_slow_v6(struct lb_pol_cache *pc,
+    struct in6_addr *saddr, uint32_t hash)
 {
     lb_pol_cache_v6_t *entry;
     lb_pol_v6_t *f;
 
+    pc->miss++;
+
     /* ソースアドレスから振り分けテーブルを検索 */
-    f = policy_lookup6(saddr);
+    f = policy_lookup6(pc->set, saddr);
     if (f == NULL) {
         /* 破棄する場合 */
         return NULL;
     }
 
-    f->use_count++;
+    entry = &pc->init6[flow_slot(&pc->ft6, hash, hash,
+        (const uint8_t *)pc->init6, sizeof(lb_pol_cache_v6_t),
+        offsetof(lb_pol_cache_v6_t, timestamp))];
 
-    entry = get_free_pol_cache6();
+    if (entry->lb_stat) {
+        /* 追い出したエントリのヒット数を加算 */
+        add_pol_hit(entry->pol_hit, entry->svr, entry->hit);
+        pol_unref(&entry->pol_use);
+        SASAT_STAT(flow_evict_v6);
+    }
 
     entry->lb_src_ip = *saddr;
+    entry->timestamp = rdtsc();
+
+    return set_pol_v6(pc, entry, f);
+}
+
+/*
+    @brief 切り替え前に作成したキャッシュを新しい振り分けテーブルで再検索
+    (ヒット数は切り替え時に加算済み)
+*/
+static lb_pol_cache_v6_t *refresh_pol_v6(struct lb_pol_cache *pc,
+    struct flow_bucket *bk, uint32_t way, lb_pol_cache_v6_t *entry)
+{
+    lb_pol_v6_t *f;
+
+    pc->miss++;
+    f = policy_lookup6(pc->set, &entry->lb_src_ip);
+    if (f == NULL) {
+        /* 振り分け対象外になったためキャッシュから外す */
+        flow_del(bk, way);
+        entry->lb_stat = 0;
+        return NULL;
+    }
+    flow_ref(bk, way);
+
+    return set_pol_v6(pc, entry, f);
+}
+
+/*
+    @brief 振り分けテーブルの内容をキャッシュに設定
+    (キャッシュが振り分けテーブルを参照するのはここだけで、参照を外すのは
+    追い出しとテーブルの切り替え時)
+*/
+static lb_pol_cache_v6_t *set_pol_v6(struct lb_pol_cache *pc,
+    lb_pol_cache_v6_t *entry, lb_pol_v6_t *f)
+{
+    __sync_fetch_and_add(&f->use_count, 1);
+    entry->pol_use = &f->use_count;
+
+    entry->pol_no = pc->pol_no;
     entry->lb_dst_ip = ((struct sockaddr_in6*)&f->svr->svr_ip)->sin6_addr;
-    copy_mac(entry->lb_dst_mac, f->svr->dst_mac);
-#if 0
-    entry->pol_no = lb_policy_info.pol_no;
-#endif
     entry->lb_stat = f->svr->status;
+    if (entry->lb_stat == SVR_INIT) {
+        entry->lb_stat = SVR_WAIT;
+    }
 
     entry->pol_hit = &f->hit_count;
-    entry->svr_hit = &f->svr->srv_stat.hit;
-    entry->hit++;
-    (*entry->pol_hit)++;
-    (*entry->svr_hit)++;
-
-    if (likely(entry->lb_cache_type == 0)) {
-        /* 一時的キャッシュではない場合 */
-        entry->timestamp = rdtsc();
-        TAILQ_INSERT_HEAD(head, entry, lb_list);
-    }
+    entry->svr = f->svr;
+    entry->hit = 1;
 
     if (entry->lb_stat == SVR_DROP) {
         /* 破棄設定の場合 */
@@ -251,109 +336,394 @@ static lb_pol_cache_v6_t *get_pol_slow_v6(struct in6_addr *saddr,
 /*
     @brief 振り分けテーブル検索（IPv6)
 */
-static lb_pol_v6_t *policy_lookup6(struct in6_addr *saddr)
+static lb_pol_v6_t *policy_lookup6(struct lb_pol_set *set,
+    struct in6_addr *saddr)
 {
     lb_pol_v6_t *entry;
     struct in6_addr addr;
 
-    TAILQ_FOREACH(entry, &lb_policy_info.lb_pol_head6, lb_list) {
-        addr = *saddr;
-        mask_ipv6(&addr, &entry->mask_v6);
-        if (cmp_ipv6(&addr, &entry->addr_v6) == 0) {
-            server_tbl_t *svr = entry->svr;
-            int i = 0;
-            do {
-                if (likely(svr->status != SVR_INIT)) {
-                    return entry;
-                }
-                resolve_target_mac(svr);
-            } while ( i++ < 3 );
-            break;
+    if (likely(set->lpm6.node != NULL)) {
+        entry = lpm6_lookup(&set->lpm6, saddr);
+    } else {
+        /* 検索用テーブルが作成できなかった場合 */
+        TAILQ_FOREACH(entry, &set->lb_pol_head6, lb_list) {
+            addr = *saddr;
+            mask_ipv6(&addr, &entry->mask_v6);
+            if (cmp_ipv6(&addr, &entry->addr_v6) == 0) {
+                break;
+            }
         }
     }
-    return NULL;
+    return entry;
 }
 
 /*
-    @brief 振り分けキャッシュテーブルをフリーキューから取得
+    @brief MAC解決待ちのキャッシュを確認(IPv6)
+    @return 0:解決済み -1:未解決
 */
-static lb_pol_cache_v6_t *get_free_pol_cache6(void)
+int check_wait_v6(lb_pol_cache_v6_t *entry)
 {
-    lb_pol_cache_v6_t *entry;
+    server_tbl_t *svr = entry->svr;
 
-    entry = TAILQ_FIRST(&lb_policy_info.lb_pol_free6);
+    if (__atomic_load_n(&svr->status, __ATOMIC_ACQUIRE) != SVR_OK) {
+        return -1;
+    }
+    entry->lb_stat = SVR_OK;
+    return 0;
+}
 
-    if (unlikely(entry == NULL)) {
-        /* パトロール機能を開始 */
-        start_patrol(DEL_CACHE6);
-        entry = &lb_policy_info.fix6;
-    } else {
-        TAILQ_REMOVE(&lb_policy_info.lb_pol_free6, entry, lb_list);
-        entry->hit = 0;
+/*
+    @brief もう一方の候補バケット
+*/
+static inline uint32_t
+flow_alt(uint32_t hash, uint32_t mask)
+{
+    return ((hash >> 16) | (hash << 16)) & mask;
+}
+
+/*
+    @brief バケット内でキーが一致する way (ビットマップ)
+*/
+static inline uint32_t
+flow_match(const struct flow_bucket *bk, uint32_t sig)
+{
+    uint32_t m = 0;
+    int i;
+
+    for (i = 0; i < FLOW_WAYS; i++) {
+        m |= (uint32_t)(bk->sig[i] == sig) << i;
     }
-    return entry;
+    return m & bk->used;
+}
+
+/*
+    @brief 参照ビットを立てる(立っている場合は書き込まない)
+*/
+static inline void
+flow_ref(struct flow_bucket *bk, uint32_t way)
+{
+    if (unlikely(!(bk->ref & (1 << way)))) {
+        bk->ref |= (1 << way);
+    }
+}
+
+/*
+    @brief エントリを外す
+*/
+static inline void
+flow_del(struct flow_bucket *bk, uint32_t way)
+{
+    bk->used &= ~(1 << way);
+    bk->ref &= ~(1 << way);
+}
+
+/*
+    @brief 新しいエントリの格納位置を決める
+    空きの多い候補バケットに格納し、どちらも一杯のときは参照ビットの
+    立っていないエントリのうち最も古い(timestamp)ものを1つ追い出す。
+    追い出したバケットの参照ビットは落とす(CLOCK)
+    @param ent エントリ配列の先頭
+    @param esize エントリのサイズ
+    @param toff エントリ中の timestamp の位置
+    @return エントリ番号(追い出した場合は古い内容が残っている)
+*/
+static uint32_t
+flow_slot(struct flow_table *ft, uint32_t hash, uint32_t sig,
+    const uint8_t *ent, size_t esize, size_t toff)
+{
+    const uint32_t full = (1 << FLOW_WAYS) - 1;
+    struct flow_bucket *bk[2];
+    uint32_t b[2], i, idx, way, best = 0;
+    uint64_t ts, oldest;
+    int k, pass;
+
+    b[0] = hash & ft->mask;
+    b[1] = flow_alt(hash, ft->mask);
+    bk[0] = &ft->bucket[b[0]];
+    bk[1] = &ft->bucket[b[1]];
+
+    k = (__builtin_popcount(bk[1]->used) < __builtin_popcount(bk[0]->used));
+    if (bk[k]->used != full) {
+        way = __builtin_ctz(~bk[k]->used & full);
+        goto set;
+    }
+
+    oldest = UINT64_MAX;
+    for (pass = 0; pass < 2; pass++) {
+        for (k = 0; k < 2; k++) {
+            for (i = 0; i < FLOW_WAYS; i++) {
+                if (bk[k]->ref & (1 << i)) {
+                    continue;
+                }
+                idx = (b[k] * FLOW_WAYS) + i;
+                ts = *(const uint64_t *)(ent + (idx * esize) + toff);
+                if (ts < oldest) {
+                    oldest = ts;
+                    best = idx;
+                }
+            }
+        }
+        /* 全て参照されていた場合は参照ビットを落として再検索 */
+        bk[0]->ref = bk[1]->ref = 0;
+        if (oldest != UINT64_MAX) {
+            break;
+        }
+    }
+    k = ((best / FLOW_WAYS) != b[0]);
+    way = best % FLOW_WAYS;
+
+set:
+    bk[k]->sig[way] = sig;
+    bk[k]->used |= (1 << way);
+    bk[k]->ref |= (1 << way);
+    return (b[k] * FLOW_WAYS) + way;
 }
 
+/*
+    @brief 振り分け、サーバのヒット数を加算
+    (他の振り分けスレッドと共有するため、キャッシュ解放時にまとめて加算)
+*/
+static inline void
+add_pol_hit(uint32_t *pol_hit, server_tbl_t *svr, uint32_t hit)
+{
+    if (pol_hit == NULL) {
+        /* 切り替え時に加算済み */
+        return;
+    }
+    __sync_fetch_and_add(pol_hit, hit);
+    __sync_fetch_and_add(&svr->srv_stat.hit, hit);
+}
 
 /*
-    @brief 振り分けキャッシュテーブルをフリーキューへ戻す
+    @brief キャッシュから振り分けテーブルへの参照を外す(use_countを減らす)
 */
-static inline void free_pol_cache6(lb_pol_cache_v6_t *entry)
+static inline void
+pol_unref(uint32_t **pol_use)
 {
-    entry->lb_stat = 0;
-    TAILQ_INSERT_TAIL(&lb_policy_info.lb_pol_free6, entry, lb_list);
+    if (*pol_use == NULL) {
+        /* 切り替え時に外し済み */
+        return;
+    }
+    __sync_fetch_and_sub(*pol_use, 1);
+    *pol_use = NULL;
 }
 
 /*
-    処理要求フラグを設定
+    @brief 振り分けテーブルの切り替え(振り分けスレッドで動作)
+    キャッシュのヒット数を古い振り分けテーブルへ加算して参照を外す。
+    キャッシュ自体は残し、次にヒットした時に新しいテーブルで再検索する。
+    pol_no の更新で古いテーブルを参照しなくなったことを通知する
+    @param pc 振り分けスレッドのキャッシュ
+    @param set 新しい振り分けテーブル
 */
-void start_patrol(int flag)
+void
+switch_policy(struct lb_pol_cache *pc, struct lb_pol_set *set)
 {
-    patrol_flag |= flag;
+    lb_pol_cache_v4_t *pc4;
+    lb_pol_cache_v6_t *pc6;
+    uint32_t i;
+
+    for (i = 0, pc4 = pc->init4; i < pc->ft4.size; i++, pc4++) {
+        if (pc4->lb_stat) {
+            add_pol_hit(pc4->pol_hit, pc4->svr, pc4->hit);
+            pol_unref(&pc4->pol_use);
+            pc4->pol_hit = NULL;
+            pc4->svr = NULL;
+            pc4->hit = 0;
+        }
+    }
+    for (i = 0, pc6 = pc->init6; i < pc->ft6.size; i++, pc6++) {
+        if (pc6->lb_stat) {
+            add_pol_hit(pc6->pol_hit, pc6->svr, pc6->hit);
+            pol_unref(&pc6->pol_use);
+            pc6->pol_hit = NULL;
+            pc6->svr = NULL;
+            pc6->hit = 0;
+        }
+    }
+
+    pc->set = set;
+    __atomic_store_n(&pc->pol_no, set->pol_no, __ATOMIC_RELEASE);
 }
 
-int
-clear_v4_cache(int ptr)
+/*
+    キャッシュ中で未加算のヒット数(ダンプ用、コマンドスレッドのみ使用)
+    pol_cache_collect()でキャッシュを1回走査し、振り分けテーブル、サーバの
+    ヒット数のアドレス毎に合算しておく。XDPで送信した数も加える。
+    pol_cache_hit()はそこから引く
+*/
+struct pol_hit_ent {
+    const uint32_t *key;        /* hit_count, srv_stat.hitのアドレス */
+    uint32_t hit;
+};
+
+static struct pol_hit_ent *pol_hit_tbl;
+static uint32_t pol_hit_size;       /* 2のべき乗(0:未作成) */
+
+static inline struct pol_hit_ent *
+pol_hit_find(const uint32_t *key)
 {
-    int i = 0;
-    struct lb_hash_head4 *head;
-    lb_pol_cache_v4_t *entry, *entry_next;
-
-    while (!i && (ptr != LB_POL_DIVISOR)) {
-        head = &lb_policy_info.lb_pol_hash_v4[ptr];
-        for (entry = TAILQ_FIRST(head);
-             entry != NULL;
-             entry = entry_next) {
-            entry_next = TAILQ_NEXT(entry, lb_list);
-            TAILQ_REMOVE(head, entry, lb_list);
-            free_pol_cache4(entry);
-            i++;
+    uint32_t i = (uint32_t)(((uintptr_t)key >> 2) * 2654435761u) &
+        (pol_hit_size - 1);
+
+    for (; pol_hit_tbl[i].key; i = (i + 1) & (pol_hit_size - 1)) {
+        if (pol_hit_tbl[i].key == key) {
+            return &pol_hit_tbl[i];
         }
-        ptr++;
     }
-    return ptr;
+    return &pol_hit_tbl[i];
+}
+
+static void
+pol_hit_add(const uint32_t *key)
+{
+    pol_hit_find(key)->key = key;
+}
+
+static inline void
+pol_hit_count(const uint32_t *key, uint32_t hit)
+{
+    struct pol_hit_ent *e = pol_hit_find(key);
+
+    /* 登録していない(古いテーブルの)ヒット数は数えない */
+    if (e->key) {
+        e->hit += hit;
+    }
 }
-    
-int 
-clear_v6_cache(int ptr)
+
+/*
+    @brief キャッシュ中で未加算のヒット数を集計(ダンプの前に呼ぶ)
+    @param set 振り分けテーブル(このテーブルのヒット数のみ集計する)
+    @param cnt キャッシュの使用状況の格納先(NULL:不要)
+*/
+void
+pol_cache_collect(struct lb_pol_set *set, struct pol_cache_count *cnt)
 {
-    int i = 0;
-    struct lb_hash_head6 *head;
-    lb_pol_cache_v6_t *entry, *entry_next;
-
-    while (!i && (ptr != LB_POL_DIVISOR)) {
-        head = &lb_policy_info.lb_pol_hash_v6[ptr];
-        for (entry = TAILQ_FIRST(head);
-             entry != NULL;
-             entry = entry_next) {
-            entry_next = TAILQ_NEXT(entry, lb_list);
-            TAILQ_REMOVE(head, entry, lb_list);
-            free_pol_cache6(entry);
-            i++;
+    struct lb_pol_cache *pc;
+    lb_pol_cache_v4_t *pc4;
+    lb_pol_cache_v6_t *pc6;
+    lb_pol_v4_t *entry4;
+    lb_pol_v6_t *entry6;
+    server_tbl_t *svr_tbl;
+    struct pol_hit_ent *tbl;
+    uint32_t *xhit, i, num = 0, size = 1024;
+    int n;
+
+    if (cnt) {
+        memset(cnt, 0, sizeof(*cnt));
+    }
+    if (set == NULL) {
+        pol_hit_size = 0;
+        return;
+    }
+
+    TAILQ_FOREACH(entry6, &set->lb_pol_head6, lb_list) {
+        num++;
+    }
+    TAILQ_FOREACH(entry4, &set->lb_pol_head4, lb_list) {
+        num++;
+    }
+    SLIST_FOREACH(svr_tbl, &set->svr.head6, list) {
+        num++;
+    }
+    SLIST_FOREACH(svr_tbl, &set->svr.head4, list) {
+        num++;
+    }
+
+    /* 使用率50%以下 */
+    while (size < (num * 2)) {
+        size <<= 1;
+    }
+    if (size > pol_hit_size) {
+        if ((tbl = realloc(pol_hit_tbl, size * sizeof(*tbl))) == NULL) {
+            mlog("pol cache hit table alloc error %u", size);
+            pol_hit_size = 0;
+            return;
+        }
+        pol_hit_tbl = tbl;
+    }
+    pol_hit_size = size;
+    memset(pol_hit_tbl, 0, size * sizeof(*pol_hit_tbl));
+
+    TAILQ_FOREACH(entry6, &set->lb_pol_head6, lb_list) {
+        pol_hit_add(&entry6->hit_count);
+    }
+    TAILQ_FOREACH(entry4, &set->lb_pol_head4, lb_list) {
+        pol_hit_add(&entry4->hit_count);
+    }
+    SLIST_FOREACH(svr_tbl, &set->svr.head6, list) {
+        pol_hit_add(&svr_tbl->srv_stat.hit);
+    }
+    SLIST_FOREACH(svr_tbl, &set->svr.head4, list) {
+        pol_hit_add(&svr_tbl->srv_stat.hit);
+    }
+
+    /* 振り分けスレッドが更新中のキャッシュを読む(ポインタは比較のみ) */
+    for (n = 0; n < nt_info.count; n++) {
+        if ((pc = lb_policy_info.cache[n]) == NULL) {
+            continue;
+        }
+        if (cnt) {
+            cnt->size4 += pc->ft4.size;
+            cnt->size6 += pc->ft6.size;
+        }
+        for (i = 0, pc4 = pc->init4; i < pc->ft4.size; i++, pc4++) {
+            if (pc4->lb_stat) {
+                if (cnt) {
+                    cnt->up4++;
+                }
+                pol_hit_count(pc4->pol_hit, pc4->hit);
+                if ((svr_tbl = pc4->svr) != NULL) {
+                    pol_hit_count(&svr_tbl->srv_stat.hit, pc4->hit);
+                }
+            }
+        }
+        for (i = 0, pc6 = pc->init6; i < pc->ft6.size; i++, pc6++) {
+            if (pc6->lb_stat) {
+                if (cnt) {
+                    cnt->up6++;
+                }
+                pol_hit_count(pc6->pol_hit, pc6->hit);
+                if ((svr_tbl = pc6->svr) != NULL) {
+                    pol_hit_count(&svr_tbl->srv_stat.hit, pc6->hit);
+                }
+            }
         }
-        ptr++;
     }
-    return ptr;
+
+    /* XDPで送信した数(v4、v6の順の振り分けの位置毎) */
+    if ((xhit = xdp_fwd_hit(set, &num)) == NULL) {
+        return;
+    }
+    i = 0;
+    TAILQ_FOREACH(entry4, &set->lb_pol_head4, lb_list) {
+        if ((i < num) && (entry4->svr != NULL)) {
+            pol_hit_count(&entry4->hit_count, xhit[i]);
+            pol_hit_count(&entry4->svr->srv_stat.hit, xhit[i]);
+        }
+        i++;
+    }
+    TAILQ_FOREACH(entry6, &set->lb_pol_head6, lb_list) {
+        if ((i < num) && (entry6->svr != NULL)) {
+            pol_hit_count(&entry6->hit_count, xhit[i]);
+            pol_hit_count(&entry6->svr->srv_stat.hit, xhit[i]);
+        }
+        i++;
+    }
+    free(xhit);
+}
+
+/*
+    @brief キャッシュ中で未加算のヒット数(pol_cache_collect()の集計結果)
+    @param counter 振り分けまたはサーバのヒット数
+*/
+uint32_t
+pol_cache_hit(const uint32_t *counter)
+{
+    if (pol_hit_size == 0) {
+        return 0;
+    }
+    return pol_hit_find(counter)->hit;
 }
 
 /* end */
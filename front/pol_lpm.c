@@ -0,0 +1,482 @@
+/**
+ * file    pol_lpm.c
+ * brief   振り分けテーブル検索用テーブル作成処理
+ *         IPv4 は DIR-24-8、IPv6 は multibit trie (poptrie 方式)
+ * note    COPYRIGHT FUJITSU LIMITED 2010
+ *
+ * 改版履歴(出荷後記入)
+ * 版数   日付    変更者    リリースノート
+ * ---- -------- --------- --------------------------------------------------
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "option.h"
+#include "policy.h"
+#include "log.h"
+#include "hugemem.h"
+
+static int paint_policy(struct lb_pol_lpm4 *, lb_pol_v4_t *, uint32_t);
+static int alloc_tbl8(struct lb_pol_lpm4 *, uint32_t);
+static int move_tbl8(struct lb_pol_lpm4 *);
+
+/*
+    IPv6 作成用の展開したノード
+    子ノードは LPM6_CHILD を立てたノード番号、葉は振り分けテーブルの番号
+*/
+#define LPM6_CHILD      0x80000000
+struct lpm6_bnode {
+    uint32_t slot[LPM6_FANOUT];
+};
+
+struct lpm6_build {
+    struct lpm6_bnode *node;
+    uint32_t num;
+    uint32_t alloc;
+};
+
+static int paint_policy6(struct lpm6_build *, uint32_t, int,
+    const uint64_t *, const uint64_t *, uint32_t);
+static int alloc_bnode(struct lpm6_build *, uint32_t);
+static void count_bnode(struct lpm6_build *, uint32_t, uint32_t *, uint32_t *);
+static void compile_bnode(struct lb_pol_lpm6 *, struct lpm6_build *,
+    uint32_t, uint32_t);
+static void get_addr6(const struct in6_addr *, uint64_t *);
+
+/*
+    @brief 振り分けテーブル(IPv4)から DIR-24-8 テーブルを作成
+    振り分けテーブルは先に書かれたものが優先されるため、後ろから順に
+    上書きしていく。マスクが連続していなくてもよいが、tbl8 グループが
+    LPM4_TBL8_MAX を超える場合は作成せず線形検索とする。
+    tbl24 と tbl8 はデータパス用メモリ(hugepage)に置く。tbl8 は作成中は
+    reallocで伸ばし、作成後に使用するグループ数分を確保して移す。
+*/
+void
+build_lpm4(struct lb_pol_set *set)
+{
+    struct lb_pol_lpm4 *t = &set->lpm4;
+    lb_pol_v4_t *entry;
+    struct timespec start, end;
+    uint32_t n;
+    long usec;
+
+    free_lpm4(t);
+
+    TAILQ_FOREACH(entry, &set->lb_pol_head4, lb_list) {
+        t->pol_num++;
+    }
+    if (t->pol_num == 0) {
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    /* 番号0は該当なし */
+    t->pol = calloc(t->pol_num + 1, sizeof(lb_pol_v4_t *));
+    t->tbl24 = huge_alloc(LPM4_TBL24_NUM * sizeof(uint32_t), "lpm4 tbl24");
+    if (!t->pol || !t->tbl24) {
+        mlog("lpm4 malloc error %d", t->pol_num);
+        free_lpm4(t);
+        return;
+    }
+
+    n = 1;
+    TAILQ_FOREACH(entry, &set->lb_pol_head4, lb_list) {
+        t->pol[n++] = entry;
+    }
+
+    for (n = t->pol_num; n > 0; n--) {
+        if (paint_policy(t, t->pol[n], n) < 0) {
+            mlog("lpm4 disabled, tbl8 group over (%s)", t->pol[n]->line);
+            free(t->tbl8);
+            t->tbl8 = NULL;
+            free_lpm4(t);
+            return;
+        }
+    }
+    if (move_tbl8(t) < 0) {
+        mlog("lpm4 malloc error tbl8 %u", t->tbl8_num);
+        free_lpm4(t);
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    usec = (end.tv_sec - start.tv_sec) * 1000000 +
+        (end.tv_nsec - start.tv_nsec) / 1000;
+
+    mlog("lpm4 built: policy %u tbl8 %u/%u mem %luKB time %ldus",
+        t->pol_num, t->tbl8_num, t->tbl8_alloc,
+        (unsigned long)((LPM4_TBL24_NUM * sizeof(uint32_t)) +
+            (t->tbl8_alloc * LPM4_TBL8_SIZE * sizeof(uint32_t)) +
+            ((t->pol_num + 1) * sizeof(lb_pol_v4_t *))) / 1024,
+        usec);
+}
+
+/*
+    @brief DIR-24-8 テーブルを解放(以降は線形検索)
+*/
+void
+free_lpm4(struct lb_pol_lpm4 *t)
+{
+    huge_free(t->tbl24);
+    huge_free(t->tbl8);
+    free(t->pol);
+    memset(t, 0, sizeof(*t));
+}
+
+/*
+    @brief 振り分けテーブル1件分のアドレス範囲に番号を書き込む
+    マスクの0のビットの組み合わせ(部分集合)を順に列挙する
+    @return 0 正常 -1 tbl8 グループ不足
+*/
+static int
+paint_policy(struct lb_pol_lpm4 *t, lb_pol_v4_t *pol, uint32_t no)
+{
+    uint32_t addr = ntohl(pol->addr_v4.s_addr);
+    uint32_t mask = ntohl(pol->mask_v4.s_addr);
+    uint32_t addr24 = addr >> 8, free24 = ~mask >> 8;
+    uint32_t addr8 = addr & 0xff, free8 = ~mask & 0xff;
+    uint32_t s24, s8, *e, *grp;
+
+    s24 = 0;
+    do {
+        e = &t->tbl24[addr24 | s24];
+
+        if ((mask & 0xff) == 0) {
+            /* 下位8bitを問わない場合は tbl24 のみ(tbl8 は使われなくなる) */
+            *e = no;
+        } else {
+            if (!(*e & LPM4_EXT)) {
+                if (alloc_tbl8(t, *e) < 0) {
+                    return -1;
+                }
+                *e = LPM4_EXT | (t->tbl8_num - 1);
+            }
+            grp = &t->tbl8[(*e & ~LPM4_EXT) * LPM4_TBL8_SIZE];
+
+            s8 = 0;
+            do {
+                grp[addr8 | s8] = no;
+                s8 = (s8 - free8) & free8;
+            } while (s8);
+        }
+        s24 = (s24 - free24) & free24;
+    } while (s24);
+
+    return 0;
+}
+
+/*
+    @brief tbl8 グループを1つ割り当てる
+    @param init グループの初期値(それまでの tbl24 の値)
+*/
+static int
+alloc_tbl8(struct lb_pol_lpm4 *t, uint32_t init)
+{
+    uint32_t *grp;
+    int i;
+
+    if (t->tbl8_num >= t->tbl8_alloc) {
+        uint32_t num = t->tbl8_alloc ? (t->tbl8_alloc * 2) : 64;
+
+        if (num > LPM4_TBL8_MAX) {
+            num = LPM4_TBL8_MAX;
+        }
+        if (t->tbl8_num >= num) {
+            return -1;
+        }
+        grp = realloc(t->tbl8, num * LPM4_TBL8_SIZE * sizeof(uint32_t));
+        if (!grp) {
+            return -1;
+        }
+        t->tbl8 = grp;
+        t->tbl8_alloc = num;
+    }
+
+    grp = &t->tbl8[t->tbl8_num * LPM4_TBL8_SIZE];
+    for (i = 0; i < LPM4_TBL8_SIZE; i++) {
+        grp[i] = init;
+    }
+    t->tbl8_num++;
+    return 0;
+}
+
+/*
+    @brief 作成した tbl8 をデータパス用メモリへ移す
+    @return 0 正常 -1 確保できない(作成用の領域は解放済み)
+*/
+static int
+move_tbl8(struct lb_pol_lpm4 *t)
+{
+    uint32_t *tbl8;
+    size_t size = t->tbl8_num * LPM4_TBL8_SIZE * sizeof(uint32_t);
+
+    if (t->tbl8_num == 0) {
+        free(t->tbl8);
+        t->tbl8 = NULL;
+        t->tbl8_alloc = 0;
+        return 0;
+    }
+    tbl8 = huge_alloc(size, "lpm4 tbl8");
+    if (tbl8) {
+        memcpy(tbl8, t->tbl8, size);
+    }
+    free(t->tbl8);
+    t->tbl8 = tbl8;
+    t->tbl8_alloc = tbl8 ? t->tbl8_num : 0;
+    return tbl8 ? 0 : -1;
+}
+
+/*
+    @brief 振り分けテーブル(IPv6)から multibit trie を作成
+    IPv4 と同様に後ろから順に上書きして展開したノードを作り、
+    最後に poptrie 形式へ圧縮する。圧縮後のノードと葉はデータパス用メモリ
+    (hugepage)に置く。
+*/
+void
+build_lpm6(struct lb_pol_set *set)
+{
+    struct lb_pol_lpm6 *t = &set->lpm6;
+    lb_pol_v6_t *entry;
+    struct lpm6_build b;
+    struct timespec start, end;
+    uint64_t addr[2], mask[2];
+    uint32_t n, nodes, leaves;
+    long usec;
+
+    free_lpm6(t);
+
+    TAILQ_FOREACH(entry, &set->lb_pol_head6, lb_list) {
+        t->pol_num++;
+    }
+    if (t->pol_num == 0) {
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    memset(&b, 0, sizeof(b));
+    t->pol = calloc(t->pol_num + 1, sizeof(lb_pol_v6_t *));
+    if (!t->pol || (alloc_bnode(&b, 0) < 0)) {
+        mlog("lpm6 malloc error %d", t->pol_num);
+        goto error;
+    }
+
+    n = 1;
+    TAILQ_FOREACH(entry, &set->lb_pol_head6, lb_list) {
+        t->pol[n++] = entry;
+    }
+
+    for (n = t->pol_num; n > 0; n--) {
+        get_addr6(&t->pol[n]->addr_v6, addr);
+        get_addr6(&t->pol[n]->mask_v6, mask);
+        if (paint_policy6(&b, 0, 0, addr, mask, n) < 0) {
+            mlog("lpm6 disabled, node over (%s)", t->pol[n]->line);
+            goto error;
+        }
+    }
+
+    /* 圧縮 */
+    nodes = 1;
+    leaves = 0;
+    count_bnode(&b, 0, &nodes, &leaves);
+
+    t->node = huge_alloc(nodes * sizeof(struct lpm6_node), "lpm6 node");
+    t->leaf = huge_alloc(leaves * sizeof(uint32_t), "lpm6 leaf");
+    if (!t->node || (leaves && !t->leaf)) {
+        mlog("lpm6 malloc error %d/%d", nodes, leaves);
+        goto error;
+    }
+    t->node_num = 1;
+    compile_bnode(t, &b, 0, 0);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    usec = (end.tv_sec - start.tv_sec) * 1000000 +
+        (end.tv_nsec - start.tv_nsec) / 1000;
+
+    mlog("lpm6 built: policy %u node %u(%u) leaf %u mem %luKB time %ldus",
+        t->pol_num, t->node_num, b.num, t->leaf_num,
+        (unsigned long)(t->node_num * sizeof(struct lpm6_node) +
+            t->leaf_num * sizeof(uint32_t) +
+            (t->pol_num + 1) * sizeof(lb_pol_v6_t *)) / 1024,
+        usec);
+
+    free(b.node);
+    return;
+
+error:
+    free(b.node);
+    free_lpm6(t);
+}
+
+/*
+    @brief multibit trie を解放(以降は線形検索)
+*/
+void
+free_lpm6(struct lb_pol_lpm6 *t)
+{
+    huge_free(t->node);
+    huge_free(t->leaf);
+    free(t->pol);
+    memset(t, 0, sizeof(*t));
+}
+
+/*
+    @brief 振り分けテーブル1件分を off ビット目以降のノードに書き込む
+    off 以降にマスクのビットが残っていれば子ノードをたどる
+    @return 0 正常 -1 ノード数の上限
+*/
+static int
+paint_policy6(struct lpm6_build *b, uint32_t bi, int off,
+    const uint64_t *addr, const uint64_t *mask, uint32_t no)
+{
+    uint32_t a = lpm6_index(addr, off);
+    uint32_t free6 = ~lpm6_index(mask, off) & (LPM6_FANOUT - 1);
+    uint32_t s, slot;
+    int next = off + LPM6_STRIDE;
+    int rest;
+
+    /* 次の区切り以降にマスクのビットがあるか */
+    if (next >= 128) {
+        rest = 0;
+    } else if (next < 64) {
+        rest = ((mask[0] << next) != 0) || (mask[1] != 0);
+    } else {
+        rest = ((mask[1] << (next - 64)) != 0);
+    }
+
+    s = 0;
+    do {
+        slot = b->node[bi].slot[a | s];
+
+        if (!rest) {
+            /* 範囲全体が優先されるため子ノードは不要になる */
+            b->node[bi].slot[a | s] = no;
+        } else {
+            if (!(slot & LPM6_CHILD)) {
+                if (alloc_bnode(b, slot) < 0) {
+                    return -1;
+                }
+                slot = LPM6_CHILD | (b->num - 1);
+                b->node[bi].slot[a | s] = slot;
+            }
+            if (paint_policy6(b, slot & ~LPM6_CHILD, next,
+                    addr, mask, no) < 0) {
+                return -1;
+            }
+        }
+        s = (s - free6) & free6;
+    } while (s);
+
+    return 0;
+}
+
+/*
+    @brief 作成用ノードを1つ割り当てる
+    @param init 全スロットの初期値(親スロットの値)
+*/
+static int
+alloc_bnode(struct lpm6_build *b, uint32_t init)
+{
+    struct lpm6_bnode *node;
+    int i;
+
+    if (b->num >= b->alloc) {
+        uint32_t num = b->alloc ? (b->alloc * 2) : 256;
+
+        if (num > LPM6_NODE_MAX) {
+            num = LPM6_NODE_MAX;
+        }
+        if (b->num >= num) {
+            return -1;
+        }
+        node = realloc(b->node, num * sizeof(struct lpm6_bnode));
+        if (!node) {
+            return -1;
+        }
+        b->node = node;
+        b->alloc = num;
+    }
+
+    node = &b->node[b->num++];
+    for (i = 0; i < LPM6_FANOUT; i++) {
+        node->slot[i] = init;
+    }
+    return 0;
+}
+
+/*
+    @brief 圧縮後のノード数と葉の数を数える
+    (上書きで参照されなくなった作成用ノードは数えない)
+*/
+static void
+count_bnode(struct lpm6_build *b, uint32_t bi, uint32_t *nodes,
+    uint32_t *leaves)
+{
+    uint32_t i, slot, prev = 0;
+    int first = 1;
+
+    for (i = 0; i < LPM6_FANOUT; i++) {
+        slot = b->node[bi].slot[i];
+        if (slot & LPM6_CHILD) {
+            (*nodes)++;
+            count_bnode(b, slot & ~LPM6_CHILD, nodes, leaves);
+        } else if (first || (slot != prev)) {
+            (*leaves)++;
+            prev = slot;
+            first = 0;
+        }
+    }
+}
+
+/*
+    @brief 作成用ノード bi を圧縮して node[ni] に格納
+    子ノードは連続した位置に置き、葉は値が変わる位置だけ持つ
+*/
+static void
+compile_bnode(struct lb_pol_lpm6 *t, struct lpm6_build *b, uint32_t bi,
+    uint32_t ni)
+{
+    struct lpm6_node *n = &t->node[ni];
+    uint32_t i, slot, prev = 0, child;
+    int first = 1;
+
+    n->base0 = t->node_num;
+    n->base1 = t->leaf_num;
+
+    for (i = 0; i < LPM6_FANOUT; i++) {
+        slot = b->node[bi].slot[i];
+        if (slot & LPM6_CHILD) {
+            n->vector |= 1ULL << i;
+            t->node_num++;
+        } else if (first || (slot != prev)) {
+            n->leafvec |= 1ULL << i;
+            t->leaf[t->leaf_num++] = slot;
+            prev = slot;
+            first = 0;
+        }
+    }
+
+    child = n->base0;
+    for (i = 0; i < LPM6_FANOUT; i++) {
+        slot = b->node[bi].slot[i];
+        if (slot & LPM6_CHILD) {
+            compile_bnode(t, b, slot & ~LPM6_CHILD, child++);
+        }
+    }
+}
+
+/*
+    @brief IPv6 アドレスをホストバイトオーダの 64bit x 2 にする
+*/
+static void
+get_addr6(const struct in6_addr *in, uint64_t *a)
+{
+    a[0] = ((uint64_t)ntohl(in->s6_addr32[0]) << 32) | ntohl(in->s6_addr32[1]);
+    a[1] = ((uint64_t)ntohl(in->s6_addr32[2]) << 32) | ntohl(in->s6_addr32[3]);
+}
+
+/* end */
@@ -20,29 +20,63 @@
 #include "server.h"
 #include "util_inline.h"
 #include "val.h"
+#include "front_properties.h"
+#include "init.h"
+#include "hugemem.h"
+#include "xdp_fwd.h"
 
 static FILE *open_prop_file(void);
-static void parse_policy(FILE *file);
-static void parse_policy_line(char *buff);
-static void create_policy_table(server_tbl_t *svr_tbl, char *saddr, char *netmask, char*buff);
+static void parse_policy(FILE *file, struct lb_pol_set *set);
+static void parse_policy_line(char *buff, struct lb_pol_set *set);
+static void create_policy_table(struct lb_pol_set *set, server_tbl_t *svr_tbl, char *saddr, char *netmask, char*buff);
 static sa_family_t get_family(char *p);
+static void init_policy_cache(struct lb_pol_cache *);
+static void init_flow_table(struct flow_table *, const char *);
 
 /*
     振り分けテーブルファイル読み込み処理
+    振り分けスレッドが使用中のテーブルとは別に作成する
+    @return 振り分けテーブル一式(メモリ不足時はNULL)
 */
-void get_policy(void)
+struct lb_pol_set *get_policy(void)
 {
-    FILE *file = open_prop_file();
-
-    /* ファイルが無い場合、記録だけ行なう */
-    if (file == NULL) {
+    struct lb_pol_set *set;
+    FILE *file;
+
+    set = calloc(sizeof(struct lb_pol_set), 1);
+    if (!set) {
+        mlog("create policy set malloc error %d",
+            (int)sizeof(struct lb_pol_set));
+        return NULL;
+    }
+    set->pol_no = ++lb_policy_info.pol_no;
+    set->vip4 = if_ingress->vip4;
+    load_vip6(if_ingress, &set->vip6);
+    TAILQ_INIT(&set->lb_pol_head4);
+    TAILQ_INIT(&set->lb_pol_head6);
+    init_svr_mng_table(&set->svr);
+
+    /* ファイルが無い場合、記録だけ行なう(空のテーブル) */
+    if ((file = open_prop_file()) == NULL) {
         mlog("can not open policy file");
-        return;
+        return set;
     }
 
-    parse_policy(file);
+    parse_policy(file, set);
 
     fclose(file);
+
+    /* 検索用テーブルを作成 */
+    build_lpm4(set);
+    build_lpm6(set);
+
+    /* 切り替え前にサーバのMACアドレスを解決しておく */
+    resolve_svr_tbl(&set->svr);
+
+    /* XDP振り分け(io_mode=2) */
+    set->xdp = xdp_fwd_build(set);
+
+    return set;
 }
 
 /*
@@ -64,7 +98,7 @@ static FILE *open_prop_file(void)
     ファイル読み出し
 */
 static void
-parse_policy(FILE *file)
+parse_policy(FILE *file, struct lb_pol_set *set)
 {
     for ( ;; ) {
         char buff[256];
@@ -79,7 +113,7 @@ parse_policy(FILE *file)
         if ((buff[0] == '#') || (buff[0] == '[')) {
             continue;
         }
-        parse_policy_line(buff);
+        parse_policy_line(buff, set);
     }
 }
 
@@ -93,7 +127,7 @@ parse_policy(FILE *file)
 #define PART_SIZE 64
 #define POL_DELIMITER ','
 static void
-parse_policy_line(char *buff)
+parse_policy_line(char *buff, struct lb_pol_set *set)
 {
     char *dp, *sp;
     int i, l;
@@ -147,9 +181,9 @@ parse_policy_line(char *buff)
     }
 
     /* サーバ管理テーブルの検索（なかったら作成） */
-    svr_tbl = get_svr_table(ip[2], family[0]);
+    svr_tbl = get_svr_table(&set->svr, ip[2], family[0]);
     /* 振り分けテーブルの作成 */
-    create_policy_table(svr_tbl, ip[0], ip[1], ip[2]);
+    create_policy_table(set, svr_tbl, ip[0], ip[1], ip[2]);
 }
 
 /*
@@ -160,7 +194,7 @@ parse_policy_line(char *buff)
     @param mask
 */
 static void
-create_policy_table(server_tbl_t *svr_tbl, char *saddr, 
+create_policy_table(struct lb_pol_set *set, server_tbl_t *svr_tbl, char *saddr, 
     char *netmask, char *svr)
 {
     if (svr_tbl->family == AF_INET) {
@@ -187,7 +221,7 @@ create_policy_table(server_tbl_t *svr_tbl, char *saddr,
 
         mlog("create v4 policy table (%s)", pol_v4->line);
 
-        TAILQ_INSERT_TAIL(&lb_policy_info.lb_pol_head4, pol_v4, lb_list);
+        TAILQ_INSERT_TAIL(&set->lb_pol_head4, pol_v4, lb_list);
 
     } else /* svr_tbl->family == AF_INET6) */ {
         lb_pol_v6_t *pol_v6;
@@ -214,40 +248,46 @@ create_policy_table(server_tbl_t *svr_tbl, char *saddr,
 
         mlog("create v6 policy table (%s)", pol_v6->line);
 
-        TAILQ_INSERT_TAIL(&lb_policy_info.lb_pol_head6, pol_v6, lb_list);
+        TAILQ_INSERT_TAIL(&set->lb_pol_head6, pol_v6, lb_list);
     }
 }
 
 /*
-    @brief 更新前に古いものを削除する
+    @brief 切り替え後に古いものを削除する
+    (全振り分けスレッドが新しいテーブルへ切り替えた後に呼ぶこと)
 */
 void
-destroy_policy_table(void)
+destroy_policy_table(struct lb_pol_set *set)
 {
     lb_pol_v4_t *entry4, *entry4_next;
 
-    lb_policy_info.pol_no++;
+    free_lpm4(&set->lpm4);
+    free_lpm6(&set->lpm6);
 
-    for (entry4 = TAILQ_FIRST(&lb_policy_info.lb_pol_head4);
+    for (entry4 = TAILQ_FIRST(&set->lb_pol_head4);
          entry4 != NULL;
          entry4 = entry4_next) {
 
         entry4_next = TAILQ_NEXT(entry4, lb_list);
-        TAILQ_REMOVE(&lb_policy_info.lb_pol_head4, entry4, lb_list);
+        TAILQ_REMOVE(&set->lb_pol_head4, entry4, lb_list);
 
         free(entry4);
     }
 
     lb_pol_v6_t *entry6, *entry6_next;
-    for (entry6 = TAILQ_FIRST(&lb_policy_info.lb_pol_head6);
+    for (entry6 = TAILQ_FIRST(&set->lb_pol_head6);
          entry6 != NULL;
          entry6 = entry6_next) {
 
         entry6_next = TAILQ_NEXT(entry6, lb_list);
-        TAILQ_REMOVE(&lb_policy_info.lb_pol_head6, entry6, lb_list);
+        TAILQ_REMOVE(&set->lb_pol_head6, entry6, lb_list);
         
         free(entry6);
     }
+
+    destroy_svr_tbl(&set->svr);
+    xdp_fwd_free(set);
+    free(set);
 }
 
 /*
@@ -282,72 +322,107 @@ get_family(char *p)
 
 /*
     @brief 振り分けテーブル初期化
-    @param reset 再読み込み時は１
+    振り分けキャッシュは振り分けスレッド(nt_info.count)毎に作成する
+    振り分けテーブル本体は get_policy() で作成する
 */
 void
-init_policy_table(int reset)
+init_policy_table(void)
 {
-    int i;
-    lb_pol_cache_v4_t *pol_cache4;
-    lb_pol_cache_v6_t *pol_cache6;
+    int n;
     struct timespec time;
 
     lb_policy_info.pol_no = 0;
+    lb_policy_info.set = NULL;
 
-    TAILQ_INIT(&lb_policy_info.lb_pol_head4);
-    TAILQ_INIT(&lb_policy_info.lb_pol_head6);
-
-    for( i = 0; i < LB_POL_DIVISOR; i++) {
-        TAILQ_INIT(&lb_policy_info.lb_pol_hash_v4[i]);
-        TAILQ_INIT(&lb_policy_info.lb_pol_hash_v6[i]);
-    }
-
-    TAILQ_INIT(&lb_policy_info.lb_pol_free4);
-    TAILQ_INIT(&lb_policy_info.lb_pol_free6);
-
-    if (reset) {
-        pol_cache4 = lb_policy_info.init4;
-    } else {
-        pol_cache4 = malloc(sizeof(lb_pol_cache_v4_t) * LB_MAX_CACHE);
-        if (!pol_cache4) {
+    for (n = 0; n < nt_info.count; n++) {
+        lb_policy_info.cache[n] = calloc(sizeof(struct lb_pol_cache), 1);
+        if (!lb_policy_info.cache[n]) {
             syslog(LOG_ERR, "init policy table malloc error %d",
-                (sizeof(lb_pol_cache_v4_t) * LB_MAX_CACHE));
+                (int)sizeof(struct lb_pol_cache));
             exit(1);
         }
-        lb_policy_info.init4 = pol_cache4;
+        init_policy_cache(lb_policy_info.cache[n]);
+    }
+
+    clock_gettime(CLOCK_REALTIME, &time);
+    lb_policy_info.starttime = time.tv_sec;
+    lb_policy_info.tsc = rdtsc(); 
+}
+
+/*
+    @brief 振り分けキャッシュを振り分けスレッドのNUMAノードへ移動
+    (init_policy_table()はメインスレッドで確保するため)
+    @param node thread_placement()の戻り値
+*/
+void
+move_policy_cache(struct lb_pol_cache *pc, int node)
+{
+    numa_move(pc->ft4.bucket, (pc->ft4.mask + 1) * sizeof(struct flow_bucket),
+        node);
+    numa_move(pc->ft6.bucket, (pc->ft6.mask + 1) * sizeof(struct flow_bucket),
+        node);
+    numa_move(pc->init4, pc->ft4.size * sizeof(lb_pol_cache_v4_t), node);
+    numa_move(pc->init6, pc->ft6.size * sizeof(lb_pol_cache_v6_t), node);
+}
+
+/*
+    @brief 振り分けキャッシュ初期化
+    エントリ数は flow.size4, flow.size6 (バケット単位に切り上げ)
+    再読み込み時はクリアせず、振り分けスレッドが切り替え時に再検索する
+    @param pc    振り分けスレッドのキャッシュ
+*/
+static void
+init_policy_cache(struct lb_pol_cache *pc)
+{
+    init_flow_table(&pc->ft4, KEY_FLOW_SIZE4);
+    init_flow_table(&pc->ft6, KEY_FLOW_SIZE6);
+
+    pc->init4 = huge_alloc(pc->ft4.size * sizeof(lb_pol_cache_v4_t),
+        "flow entry v4");
+    pc->init6 = huge_alloc(pc->ft6.size * sizeof(lb_pol_cache_v6_t),
+        "flow entry v6");
+    if (!pc->init4 || !pc->init6) {
+        syslog(LOG_ERR, "init policy table malloc error %u/%u",
+            pc->ft4.size, pc->ft6.size);
+        exit(1);
     }
+}
 
-    for (i = 0; i < LB_MAX_CACHE; i++) {
-        pol_cache4->lb_cache_type = 0;
-        pol_cache4->lb_stat = 0;
-        TAILQ_INSERT_TAIL(&lb_policy_info.lb_pol_free4, pol_cache4, lb_list);
-        pol_cache4++;
+/*
+    @brief フローテーブル作成
+    バケット数は2のべき乗
+    (エントリ数がFLOW_SIZE_MAXを超える設定は起動しない)
+    @param key エントリ数のプロパティ
+*/
+static void
+init_flow_table(struct flow_table *ft, const char *key)
+{
+    long size;
+    size_t num;
+
+    size = anycast_get_properties_int(key);
+    if (size < FLOW_WAYS) {
+        size = FLOW_WAYS;
+    } else if (size > FLOW_SIZE_MAX) {
+        syslog(LOG_ERR, "%s %ld exceeds %d", key, size, FLOW_SIZE_MAX);
+        exit(1);
     }
 
-    if (reset) {
-        pol_cache6 = lb_policy_info.init6;
-    } else {
-        pol_cache6 = malloc(sizeof(lb_pol_cache_v6_t) * LB_MAX_CACHE);
-        if (!pol_cache6) {
-            syslog(LOG_ERR, "init policy table malloc error %d",
-                (sizeof(lb_pol_cache_v6_t) * LB_MAX_CACHE));
-            exit(1);
-        }
-        lb_policy_info.init6 = pol_cache6;
+    for (num = 1; (num * FLOW_WAYS) < (size_t)size; num <<= 1) {
+        ;
     }
-    for (i = 0; i < LB_MAX_CACHE; i++) {
-        pol_cache6->lb_cache_type = 0;
-        pol_cache6->lb_stat = 0;
-        TAILQ_INSERT_TAIL(&lb_policy_info.lb_pol_free6, pol_cache6, lb_list);
-        pol_cache6++;
+
+    /* ページ境界(バケット境界)から確保、0クリア済み */
+    ft->bucket = huge_alloc(num * sizeof(struct flow_bucket), key);
+    if (ft->bucket == NULL) {
+        syslog(LOG_ERR, "init flow table malloc error %zu", num);
+        exit(1);
     }
 
-    lb_policy_info.fix4.lb_cache_type = 1;
-    lb_policy_info.fix6.lb_cache_type = 1;
+    ft->mask = num - 1;
+    ft->size = num * FLOW_WAYS;
 
-    clock_gettime(CLOCK_REALTIME, &time);
-    lb_policy_info.starttime = time.tv_sec;
-    lb_policy_info.tsc = rdtsc(); 
+    mlog("flow table %s %u entries (%zu buckets)", key, ft->size, num);
 }
 
 /* end */
@@ -12,11 +12,15 @@
 #define _POLICY_H_
 
 #include <sys/queue.h>
+#include "anycast.h"
 #include "server.h"
 
-#define LB_POL_DIVISOR  4096
-#define LB_POL_MASK     (LB_POL_DIVISOR - 1)
-#define LB_MAX_CACHE    1024
+/*
+    フローテーブル(振り分けキャッシュ)
+    1バケットを1キャッシュラインとし、2つの候補バケットのどちらかに格納する
+*/
+#define FLOW_WAYS       15      /* 1バケットのエントリ数 */
+#define FLOW_SIZE_MAX   (1 << 24)
 
 #define POL_DIRNAME     "/var/opt/sasat/etc"
 #define POL_FILENAME    "sasat.policy"
@@ -26,30 +30,25 @@
 */
 typedef struct lb_pol_cache_v4_s
 {
-    TAILQ_ENTRY(lb_pol_cache_v4_s) lb_list;
-    
     struct in_addr lb_src_ip;       /* src ip */
     struct in_addr lb_dst_ip;       /* 変換ip */
 
-#if 0
-    uint    pol_no;
-#endif
+    uint    pol_no;                 /* 作成時の振り分けテーブル番号 */
 
-    uint8_t lb_dst_mac[ETH_ALEN];   /* 変換宛先MAC */
-    uint8_t lb_cache_type;          /* type 0 -- normal, 1 -- fix */
-    uint8_t lb_stat;                /* 状態 0 使用していない, 1 使用中(通常), 2 破棄 */
+    uint8_t lb_stat;                /* 状態 0 使用していない, 1 使用中(通常), 2 破棄, 3 MAC解決待ち */
+    uint8_t _rsv;
     
     uint16_t chksum_delta;          /* IPチェックサム差分 */
-    uint8_t _rsv[2];
 
     /* 統計情報 */
     uint32_t hit;                   /* このテーブルを使用した回数 */
     uint32_t *pol_hit;              /* 振り分けヒット数 */
-    uint32_t *svr_hit;              /* サーバヒット数 */
+    uint32_t *pol_use;              /* 振り分けテーブルの参照キャッシュ数 */
+    server_tbl_t *svr;              /* 振り分け先サーバ(宛先MAC、ヒット数) */
 
     struct lb_pol_cache_v4_s *op;   /* 自分のアドレス */
 
-    uint64_t timestamp;             /* tsc value */
+    uint64_t timestamp;             /* tsc value (作成時刻、追い出しに使用) */
 } lb_pol_cache_v4_t;
 
 /*
@@ -57,27 +56,23 @@ typedef struct lb_pol_cache_v4_s
 */
 typedef struct lb_pol_cache_v6_s
 {
-    TAILQ_ENTRY(lb_pol_cache_v6_s) lb_list;
-    
     struct in6_addr lb_src_ip;      /* src ip */
     struct in6_addr lb_dst_ip;      /* server ip */
 
-#if 0
-    uint    pol_no;
-#endif
+    uint    pol_no;                 /* 作成時の振り分けテーブル番号 */
 
-    uint8_t lb_dst_mac[ETH_ALEN];   /* backend MAC */
-    uint8_t lb_cache_type;          /* type 0 -- normal, 1 -- fix */
     uint8_t lb_stat;
+    uint8_t _rsv[3];
 
     /* 統計情報 */
     uint32_t hit;                   /* このテーブルを使用した回数 */
     uint32_t *pol_hit;              /* 振り分けヒット数 */
-    uint32_t *svr_hit;              /* サーバヒット数 */
+    uint32_t *pol_use;              /* 振り分けテーブルの参照キャッシュ数 */
+    server_tbl_t *svr;              /* 振り分け先サーバ(宛先MAC、ヒット数) */
 
     struct lb_pol_cache_v6_s *op;   /* 自分のアドレス */
 
-    uint64_t timestamp;             /* tsc value */
+    uint64_t timestamp;             /* tsc value (作成時刻、追い出しに使用) */
 } lb_pol_cache_v6_t;
 
 
@@ -115,53 +110,216 @@ typedef struct lb_pol_v6_s
 } lb_pol_v6_t;
 
 /*
-    振り分けテーブルの管理
+    フローテーブルのバケット
+    エントリ番号は バケット番号 * FLOW_WAYS + way
 */
-struct lb_pol_info {
+struct flow_bucket {
+    uint32_t sig[FLOW_WAYS];    /* v4 送信元アドレス, v6 ハッシュ値 */
+    uint16_t used;              /* 使用中の way */
+    uint16_t ref;               /* 参照ビット(CLOCK) */
+} __attribute__((aligned(64)));
+
+struct flow_table {
+    struct flow_bucket *bucket;
+    uint32_t mask;              /* バケット数 - 1 */
+    uint32_t size;              /* エントリ数 */
+};
+
+/*
+    振り分けキャッシュ(振り分けスレッド毎に持ち、スレッド間で共有しない)
+*/
+struct lb_pol_cache {
+    /* 使用中の振り分けテーブル(切り替え時に更新) */
+    struct lb_pol_set *set;
+    volatile uint pol_no;
+
+    uint32_t miss;              /* 振り分けテーブルを検索した回数(prof用) */
+
+    struct flow_table ft4;
+    struct flow_table ft6;
+
+    /* エントリ(フローテーブルのエントリ数分) */
+    lb_pol_cache_v4_t *init4;   
+    lb_pol_cache_v6_t *init6;
+};
+
+/*
+    IPv4 振り分けテーブル検索用 DIR-24-8 テーブル
+    エントリは振り分けテーブルの番号(0は該当なし)
+    上位24bitで tbl24 を引き、LPM4_EXT が立っていれば下位8bitで tbl8 を引く
+*/
+#define LPM4_TBL24_NUM  (1 << 24)
+#define LPM4_TBL8_SIZE  256
+#define LPM4_TBL8_MAX   8192            /* tbl8 グループ数の上限 */
+#define LPM4_EXT        0x80000000
+
+struct lb_pol_lpm4 {
+    uint32_t *tbl24;            /* NULLのときは線形検索 */
+    uint32_t *tbl8;
+    uint32_t tbl8_num;          /* 使用中のグループ数 */
+    uint32_t tbl8_alloc;        /* 確保済みのグループ数 */
+    lb_pol_v4_t **pol;          /* 番号 -> 振り分けテーブル */
+    uint32_t pol_num;
+};
+
+/*
+    IPv6 振り分けテーブル検索用 multibit trie (poptrie 方式)
+    アドレスを先頭から6bitずつ区切り、ノード毎に 64bit のビットマップで
+    子ノードと葉(振り分けテーブルの番号)の位置を圧縮して持つ
+*/
+#define LPM6_STRIDE     6
+#define LPM6_FANOUT     (1 << LPM6_STRIDE)
+#define LPM6_NODE_MAX   (1 << 18)       /* 作成時のノード数の上限 */
+
+struct lpm6_node {
+    uint64_t vector;            /* 子ノードのある位置 */
+    uint64_t leafvec;           /* 葉の値が変わる位置 */
+    uint32_t base0;             /* 先頭の子ノード */
+    uint32_t base1;             /* 先頭の葉 */
+};
+
+struct lb_pol_lpm6 {
+    struct lpm6_node *node;     /* NULLのときは線形検索 */
+    uint32_t *leaf;
+    uint32_t node_num;
+    uint32_t leaf_num;
+    lb_pol_v6_t **pol;          /* 番号 -> 振り分けテーブル */
+    uint32_t pol_num;
+};
+
+/*
+    振り分けテーブル一式
+    再読み込み時は新しく作成し、ポインタの入れ替えで切り替える
+*/
+struct lb_pol_set {
     uint pol_no;                /* 番号（更新されるとインクリメント) */
 
     /* 振り分けテーブルのリスト */
     TAILQ_HEAD(, lb_pol_v4_s)   lb_pol_head4;
     TAILQ_HEAD(, lb_pol_v6_s)   lb_pol_head6;
 
-    /* 振り分けキャッシュテーブルのフリーリスト */
-    TAILQ_HEAD(,lb_pol_cache_v4_s) lb_pol_free4;
-    TAILQ_HEAD(,lb_pol_cache_v6_s) lb_pol_free6;
+    /* 振り分けテーブルの検索用 */
+    struct lb_pol_lpm4 lpm4;
+    struct lb_pol_lpm6 lpm6;
 
-    /* 先頭アドレス（ダンプ用) */
-    lb_pol_cache_v4_t *init4;   
-    lb_pol_cache_v6_t *init6;
-    
-    /* 使用中の振り分けキャッシュテーブルのハッシュ */
-    TAILQ_HEAD(lb_hash_head4, lb_pol_cache_v4_s) lb_pol_hash_v4[LB_POL_DIVISOR];
-    TAILQ_HEAD(lb_hash_head6, lb_pol_cache_v6_s) lb_pol_hash_v6[LB_POL_DIVISOR];
+    /* サーバ管理テーブル */
+    server_manage_t svr;
+
+    /* XDP振り分け(io_mode=2の場合、作成できなければNULL) */
+    struct xdp_fwd *xdp;
+
+    /* タグ無しフレームの宛先(作成時のVIP、テーブルと共に切り替える) */
+    struct in_addr  vip4;
+    struct in6_addr vip6;
+};
+
+/*
+    振り分けテーブルの管理
+*/
+struct lb_pol_info {
+    struct lb_pol_set *set;     /* 使用中の振り分けテーブル */
+    uint pol_no;                /* 最後に作成した番号 */
 
-    /* 空きがなくなったときのため */
-    lb_pol_cache_v4_t fix4;
-    lb_pol_cache_v6_t fix6;
+    /* 振り分けキャッシュ(振り分けスレッド数分) */
+    struct lb_pol_cache *cache[MAX_NET_THREAD];
 
     time_t starttime;
     uint64_t tsc;
 };
 
 /*
-    定期処理種別
+    振り分けキャッシュの使用状況(pol_cache_collect()で集計)
 */
-enum  {
-    DEL_CACHE  = 1,
-    DEL_CACHE4 = (1 << 0),
-    DEL_CACHE6 = (1 << 1)
+struct pol_cache_count {
+    uint32_t size4;             /* テーブルサイズ */
+    uint32_t size6;
+    uint32_t up4;               /* 使用中のエントリ数 */
+    uint32_t up6;
 };
 
-
 /* prototype */
-void init_policy_table(int);
-void get_policy(void);
-void destroy_policy_table(void);
-void start_patrol(int);
-lb_pol_cache_v4_t *get_pol_v4(struct in_addr saddr);
-lb_pol_cache_v6_t *get_pol_v6(struct in6_addr *saddr);
-int clear_v4_cache(int);
-int clear_v6_cache(int);
+void init_policy_table(void);
+void move_policy_cache(struct lb_pol_cache *, int);
+struct lb_pol_set *get_policy(void);
+void destroy_policy_table(struct lb_pol_set *);
+void switch_policy(struct lb_pol_cache *, struct lb_pol_set *);
+lb_pol_cache_v4_t *get_pol_v4(struct lb_pol_cache *, struct in_addr saddr);
+lb_pol_cache_v6_t *get_pol_v6(struct lb_pol_cache *, struct in6_addr *saddr);
+int check_wait_v4(lb_pol_cache_v4_t *);
+int check_wait_v6(lb_pol_cache_v6_t *);
+void pol_cache_collect(struct lb_pol_set *, struct pol_cache_count *);
+uint32_t pol_cache_hit(const uint32_t *);
+void build_lpm4(struct lb_pol_set *);
+void free_lpm4(struct lb_pol_lpm4 *);
+void build_lpm6(struct lb_pol_set *);
+void free_lpm6(struct lb_pol_lpm6 *);
+
+/*
+    @brief DIR-24-8 テーブルの検索
+    @param saddr 送信元アドレス
+    @return 振り分けテーブル(該当なしはNULL)
+*/
+static inline lb_pol_v4_t *
+lpm4_lookup(const struct lb_pol_lpm4 *t, struct in_addr saddr)
+{
+    uint32_t addr = ntohl(saddr.s_addr);
+    uint32_t e = t->tbl24[addr >> 8];
+
+    if (e & LPM4_EXT) {
+        e = t->tbl8[((e & ~LPM4_EXT) * LPM4_TBL8_SIZE) + (addr & 0xff)];
+    }
+    return t->pol[e];
+}
+
+/*
+    @brief アドレスの off ビット目から6bitを取り出す(128bit以降は0)
+    @param a アドレス(ホストバイトオーダの上位64bit、下位64bit)
+*/
+static inline uint32_t
+lpm6_index(const uint64_t *a, int off)
+{
+    if (off + LPM6_STRIDE <= 64) {
+        return (a[0] >> (64 - LPM6_STRIDE - off)) & (LPM6_FANOUT - 1);
+    }
+    if (off >= 64) {
+        off -= 64;
+        if (off + LPM6_STRIDE <= 64) {
+            return (a[1] >> (64 - LPM6_STRIDE - off)) & (LPM6_FANOUT - 1);
+        }
+        return (a[1] << (off + LPM6_STRIDE - 64)) & (LPM6_FANOUT - 1);
+    }
+    return ((a[0] << (off + LPM6_STRIDE - 64)) |
+            (a[1] >> (128 - LPM6_STRIDE - off))) & (LPM6_FANOUT - 1);
+}
+
+/*
+    @brief multibit trie の検索
+    @param saddr 送信元アドレス
+    @return 振り分けテーブル(該当なしはNULL)
+*/
+static inline lb_pol_v6_t *
+lpm6_lookup(const struct lb_pol_lpm6 *t, const struct in6_addr *saddr)
+{
+    const struct lpm6_node *n = t->node;
+    uint64_t a[2], bits;
+    uint32_t idx;
+    int off = 0;
+
+    a[0] = ((uint64_t)ntohl(saddr->s6_addr32[0]) << 32) |
+        ntohl(saddr->s6_addr32[1]);
+    a[1] = ((uint64_t)ntohl(saddr->s6_addr32[2]) << 32) |
+        ntohl(saddr->s6_addr32[3]);
+
+    for (;;) {
+        idx = lpm6_index(a, off);
+        bits = (2ULL << idx) - 1;
+        if (!(n->vector & (1ULL << idx))) {
+            break;
+        }
+        n = &t->node[n->base0 + __builtin_popcountll(n->vector & bits) - 1];
+        off += LPM6_STRIDE;
+    }
+    return t->pol[t->leaf[n->base1 + __builtin_popcountll(n->leafvec & bits) - 1]];
+}
 
 #endif
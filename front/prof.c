@@ -0,0 +1,24 @@
+/**
+ * file    prof.c
+ * brief   振り分け処理の段階毎のサイクル数計測(prof=1の場合)
+ * note    COPYRIGHT FUJITSU LIMITED 2010
+ *
+ * 改版履歴(出荷後記入)
+ * 版数   日付    変更者    リリースノート
+ * ---- -------- --------- --------------------------------------------------
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "option.h"
+#include "log.h"
+#include "prop_common.h"
+#include "stat.h"
+#include "prof.h"
+
+/* 共通処理 */
+#include "prof_body.c"
+
+/* end */
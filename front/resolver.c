@@ -0,0 +1,31 @@
+/**
+ * file    resolver.c
+ * brief   MACアドレス解決スレッド(front)
+ * note    COPYRIGHT FUJITSU LIMITED 2010
+ *
+ * 改版履歴(出荷後記入)
+ * 版数   日付    変更者    リリースノート
+ * ---- -------- --------- --------------------------------------------------
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <netinet/if_ether.h>
+
+#include "option.h"
+#include "anycast.h"
+#include "val.h"
+#include "util_inline.h"
+#include "stat.h"
+#include "resolver.h"
+#include "init.h"
+#include "prop_common.h"
+
+/* 共通処理 */
+#include "resolver_body.c"
+
+/* end */
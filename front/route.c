@@ -20,6 +20,9 @@
 #include "option.h"
 #include "log.h"
 #include "val.h"
+#include "init.h"
+#include "stat.h"
+#include "prop_common.h"
 
 /* 共通処理 */
 #include "rt_body.c"
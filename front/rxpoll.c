@@ -0,0 +1,30 @@
+/**
+ * file    rxpoll.c
+ * brief   受信待ち受け(割り込み待ち、busy poll、適応型)
+ * note    COPYRIGHT FUJITSU LIMITED 2010
+ *
+ * 改版履歴(出荷後記入)
+ * 版数   日付    変更者    リリースノート
+ * ---- -------- --------- --------------------------------------------------
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <linux/if_packet.h>
+
+#include "option.h"
+#include "log.h"
+#include "prop_common.h"
+#include "stat.h"
+#include "rxpoll.h"
+
+/* 共通処理 */
+#include "rxpoll_body.c"
+
+/* end */
@@ -14,11 +14,14 @@
 #include <sys/queue.h>
 #include <netinet/if_ether.h>
 
+#include "resolver.h"
+
 /* サーバテーブルの状態 */
 enum {
     SVR_INIT = 0,   /* MACが不明    */
     SVR_OK,         /* MAC解決済み  */
     SVR_DROP,       /* 破棄         */
+    SVR_WAIT,       /* MAC解決待ち(振り分けキャッシュのみ) */
 };
 
 /*
@@ -44,7 +47,7 @@ typedef struct server_tbl_s
     struct sockaddr_storage  svr_ip;    /* server(backend) IP */
     struct sockaddr_storage  gw_ip;     /* gateway IP */
 
-    uint8_t dst_mac[ETH_ALEN];          /* gateway mac */          
+    uint8_t dst_mac[MAC_STORE_LEN] __attribute__((aligned(8)));  /* gateway mac(load_mac) */
 #if 0
     uint8_t bytelen;
     uint8_t bitlen;
@@ -56,8 +59,26 @@ typedef struct server_tbl_s
     
     struct server_stat srv_stat;
 
+    struct nh_entry nh;                 /* MAC解決要求、保留キュー */
+
+    /* XDP振り分けのサーバmap(io_mode=2の場合) */
+    int xdp_fd;                         /* 0:未使用 */
+    uint32_t xdp_idx;
+
 } server_tbl_t;
 
+/*
+    @brief 振り分けキャッシュの宛先MACが未解決か
+    キャッシュ作成後にネイバーが削除され、サーバテーブルがSVR_INITへ
+    戻った(再解決中の)場合も未解決とする
+*/
+static inline int
+svr_unresolved(uint8_t lb_stat, server_tbl_t *svr)
+{
+    return (lb_stat == SVR_WAIT) ||
+        (__atomic_load_n(&svr->status, __ATOMIC_ACQUIRE) != SVR_OK);
+}
+
 /*
     管理テーブル
 */
@@ -74,9 +95,10 @@ typedef struct server_manage_s
 
 inline void
 resolve_target_mac(server_tbl_t *svr);
-server_tbl_t *get_svr_table(char *, sa_family_t);
-void destroy_svr_tbl(void);
-void init_svr_mng_table(void);
+server_tbl_t *get_svr_table(server_manage_t *, char *, sa_family_t);
+void destroy_svr_tbl(server_manage_t *);
+void init_svr_mng_table(server_manage_t *);
+void resolve_svr_tbl(server_manage_t *);
 
 
 #endif /*__FRONT_SRV_H__*/
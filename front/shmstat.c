@@ -0,0 +1,39 @@
+/**
+ * file    shmstat.c
+ * brief   共有メモリの統計
+ * note    COPYRIGHT FUJITSU LIMITED 2010
+ *
+ * 改版履歴(出荷後記入)
+ * 版数   日付    変更者    リリースノート
+ * ---- -------- --------- --------------------------------------------------
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "option.h"
+#include "log.h"
+#include "prop_common.h"
+#include "stat.h"
+#include "anycast.h"
+#include "policy.h"
+#include "server.h"
+#include "val.h"
+#include "xdp_fwd.h"
+#include "shmstat.h"
+#include "latency.h"
+#include "rxpoll.h"
+
+/* 共通処理 */
+#include "shmstat_body.c"
+
+/* end */
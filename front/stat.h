@@ -12,6 +12,7 @@
 #define __ANC_STAT__
 
 #include "../common/stat_common.h"
+#include "anycast.h"
 /*
     @brief 統計種別 
 */
@@ -20,6 +21,8 @@ enum {
     tx_packet_v6,
     rx_packet_v4,
     tx_packet_v4,
+    rx_bytes,
+    tx_bytes,
     
     rx_packet_mc, 
     tx_arp_reply,
@@ -30,12 +33,49 @@ enum {
     rx_drop_noip,
     rx_drop_vlan,
     rx_drop_short,
+    rx_drop_oversize,
 
     rx_drop_policy,
     rx_drop,
 
+    tx_queue_full,
+    tx_drop_full,
+    tx_flush_num,
+    tx_flush_frames,
+
     select_to,
-    clr_policy_cache,
+    rx_spin,
+    rx_sleep,
+    rx_gro,
+    rx_packet_vlan,
+    rx_kernel,
+    rx_kernel_drop,
+    rx_kernel_freeze,
+    rx_loss_int,
+    rx_loss_last,
+    rx_loss_max,
+    flow_evict_v4,
+    flow_evict_v6,
+    tx_xdp_v4,
+    tx_xdp_v6,
+    nh_held,
+    nh_held_drop,
+    nh_held_tx,
+    nh_resolved,
+
+    nh_resolve_fail,
+    nh_updated,
+    lat_samples,
+    lat_p50,
+    lat_p99,
+    lat_p999,
+    mem_hugetlb,
+    mem_thp,
+    mem_normal,
+    mem_static,
+    mem_resident,
+    mem_locked,
+    mem_fallback,
     cmd_upd_policy,
 
     cmd_dump_req,
@@ -51,6 +91,8 @@ struct stat_member sstat[STAT_MAX] = {
     {0, ":tx packets v6\n"},
     {0, ":rx packets v4\n"},
     {0, ":tx packets v4\n"},
+    {0, ":rx bytes\n"},
+    {0, ":tx bytes\n"},
 
     {0, ":rx packets multicast\n"},
 
@@ -62,11 +104,49 @@ struct stat_member sstat[STAT_MAX] = {
     {0, ":rx drop (not ip)\n"},
     {0, ":rx drop (vlan)\n"},
     {0, ":rx drop (short)\n"},
+    {0, ":rx drop (oversize)\n"},
     {0, ":rx drop (policy)\n"},
 
     {0, ":rx drop (other)\n"},
+
+    {0, ":tx queue full\n"},
+    {0, ":tx drop (queue full)\n"},
+    {0, ":tx flush\n"},
+    {0, ":tx flush frames\n"},
+
     {0, ":select\n"},
-    {0, ":clear policy cache\n"},
+    {0, ":rx busy poll (empty)\n"},
+    {0, ":rx poll sleep\n"},
+    {0, ":rx gro frames\n"},
+    {0, ":rx packets vlan\n"},
+    {0, ":rx kernel packets\n"},
+    {0, ":rx kernel drop\n"},
+    {0, ":rx kernel ring freeze\n"},
+    {0, ":rx loss intervals\n"},
+    {0, ":rx loss rate last (ppm)\n"},
+    {0, ":rx loss rate max (ppm)\n"},
+    {0, ":flow evict v4\n"},
+    {0, ":flow evict v6\n"},
+    {0, ":tx packets v4 (xdp)\n"},
+    {0, ":tx packets v6 (xdp)\n"},
+    {0, ":hold (mac unresolved)\n"},
+    {0, ":drop (hold queue full)\n"},
+    {0, ":tx held frames\n"},
+    {0, ":mac resolved\n"},
+
+    {0, ":mac resolve failed\n"},
+    {0, ":mac updated (neighbor)\n"},
+    {0, ":latency samples\n"},
+    {0, ":latency p50 (ns)\n"},
+    {0, ":latency p99 (ns)\n"},
+    {0, ":latency p99.9 (ns)\n"},
+    {0, ":memory hugetlb (bytes)\n"},
+    {0, ":memory thp (bytes)\n"},
+    {0, ":memory normal (bytes)\n"},
+    {0, ":memory static (bytes)\n"},
+    {0, ":memory resident (bytes)\n"},
+    {0, ":memory locked (bytes)\n"},
+    {0, ":memory fallback (hugepage/mlock)\n"},
     {0, ":command update policy\n"},
 
     {0, ":command dump req\n"},
@@ -74,10 +154,37 @@ struct stat_member sstat[STAT_MAX] = {
     {0, ":command illegal req\n"}
 };
 
+#endif
+
+/*
+    @brief スレッド毎の統計
+    network処理スレッドはスレッド番号の領域、resolverスレッドとnetlink通知
+    受信スレッドはそれぞれ専用の領域、その他のスレッド(コマンドスレッド)は
+    最後の領域を更新する。sstatへは書き出し時に合算する
+    領域はページ単位とし、更新するスレッドのNUMAノードに置く
+    (振り分けスレッドは共有するキャッシュラインへ書き込まない)
+*/
+#define STAT_BLOCK_RESOLVER (MAX_NET_THREAD)
+#define STAT_BLOCK_NETLINK  (MAX_NET_THREAD + 1)
+#define STAT_BLOCK_NUM  (MAX_NET_THREAD + 3)
+
+struct stat_block {
+    ssz_t stat[STAT_MAX];
+} __attribute__((aligned(4096)));
+
+#ifdef VAL_SUBS
+struct stat_block sstat_blk[STAT_BLOCK_NUM];
+__thread struct stat_block *sstat_self = &sstat_blk[STAT_BLOCK_NUM - 1];
 #else
 extern struct stat_member sstat[STAT_MAX];
+extern struct stat_block sstat_blk[STAT_BLOCK_NUM];
+extern __thread struct stat_block *sstat_self;
 #endif
 
-#define SASAT_STAT(member)  (sstat[member].stat++)
+#define SASAT_STAT(member)  (sstat_self->stat[member]++)
+#define SASAT_STAT_ADD(member, n)  (sstat_self->stat[member] += (n))
+
+/* 統計の領域をスレッド番号に切り替える */
+#define SASAT_STAT_THREAD(no)   (sstat_self = &sstat_blk[no])
 
 #endif
@@ -17,31 +17,26 @@
 #include "server.h"
 #include "util_inline.h"
 #include "val.h"
-
-int get_target_mac(struct sockaddr *target_addr,
-                   char *ifname,
-                   struct sockaddr *nexthop,
-                   unsigned char *dstmac,
-                   int gw);
-void send_ping(struct sockaddr *, struct ifdata*);
+#include "xdp_fwd.h"
 
 static server_tbl_t *
-find_svr_tbl(uint32_t *addr, sa_family_t family);
+find_svr_tbl(server_manage_t *mng, uint32_t *addr, sa_family_t family);
 
 /*
     @brief サーバ管理テーブル検索
+    @param mng 管理テーブル
     @param name ipアドレス（文字列)
     @param family 
 */
 server_tbl_t *
-get_svr_table(char *name, sa_family_t family)
+get_svr_table(server_manage_t *mng, char *name, sa_family_t family)
 {
     server_tbl_t *svr;
     uint32_t addr[4];
     int ret;    
 
     ret = inet_pton(family, name, addr);
-    svr = find_svr_tbl(addr, family);
+    svr = find_svr_tbl(mng, addr, family);
     
     if ((svr != NULL) && (svr->status == SVR_INIT)) {
         /* サーバ管理テーブルが存在かつMACアドレス不明な場合 */
@@ -52,33 +47,12 @@ get_svr_table(char *name, sa_family_t family)
 
 /*
     @brief backendトランスレータへ送信する場合のMACアドレスを解決
+    (コマンドスレッド用、振り分けスレッドは nh_request で要求する)
 */
 inline void
 resolve_target_mac(server_tbl_t *svr)
 {
-    int i, ret;
-
-    for (i = 0; i < 3; i++)  {
-        /* routing socket検索 */
-        ret = get_target_mac((struct sockaddr*)&svr->svr_ip, 
-                             if_egress->ifname, 
-                             (struct sockaddr*)&svr->gw_ip, 
-                             svr->dst_mac,
-                             0); 
-        if (ret < 0) {
-            /* エラー */
-            continue;
-        }
-        /* 正常終了 */
-        if (cmp_mac(zerodata, svr->dst_mac) == 0) {
-            /* MACが不明の場合、pingを打つ */
-            send_ping((struct sockaddr*)&svr->gw_ip, if_egress);
-            anycast_sleep(10);
-        } else {
-            svr->status = SVR_OK;
-            break;
-        }
-    }
+    (void)nh_resolve(&svr->nh);
 }
 
 /*
@@ -86,13 +60,13 @@ resolve_target_mac(server_tbl_t *svr)
     無かったら作る
 */
 static server_tbl_t *
-find_svr_tbl(uint32_t *addr, sa_family_t family)
+find_svr_tbl(server_manage_t *mng, uint32_t *addr, sa_family_t family)
 {
     server_tbl_t *svr_tbl = NULL;
 
     if (family == AF_INET) {
         struct sockaddr_in *sa;
-        SLIST_FOREACH(svr_tbl, &svr_mng_tbl.head4, list) {
+        SLIST_FOREACH(svr_tbl, &mng->head4, list) {
             sa = (struct sockaddr_in*)&svr_tbl->svr_ip;
             if (sa->sin_addr.s_addr == *addr) {
                 return svr_tbl;
@@ -116,8 +90,8 @@ find_svr_tbl(uint32_t *addr, sa_family_t family)
 
         // svr_tbl->time = rdtsc();    /* 作成時間 */
 
-        SLIST_INSERT_HEAD(&svr_mng_tbl.head4, svr_tbl, list);
-        svr_mng_tbl.server_num++;
+        SLIST_INSERT_HEAD(&mng->head4, svr_tbl, list);
+        mng->server_num++;
 
         if (is_zero_ip((struct sockaddr*)&svr_tbl->svr_ip) == 0) {
             /* 宛先IPが0の場合、破棄設定 */
@@ -125,7 +99,7 @@ find_svr_tbl(uint32_t *addr, sa_family_t family)
         }
     } else /* if (family == AF_INET6)*/ {
         struct sockaddr_in6 *sa;
-        SLIST_FOREACH(svr_tbl, &svr_mng_tbl.head6, list) {
+        SLIST_FOREACH(svr_tbl, &mng->head6, list) {
             sa = (struct sockaddr_in6*)&svr_tbl->svr_ip;
             if (cmp_ipv6(&sa->sin6_addr, (struct in6_addr*)addr) == 0) {
                 return svr_tbl;
@@ -148,51 +122,83 @@ find_svr_tbl(uint32_t *addr, sa_family_t family)
 
         // svr_tbl->time = rdtsc();
 
-        SLIST_INSERT_HEAD(&svr_mng_tbl.head6, svr_tbl, list);
-        svr_mng_tbl.server_num++;
+        SLIST_INSERT_HEAD(&mng->head6, svr_tbl, list);
+        mng->server_num++;
 
         if (is_zero_ip((struct sockaddr*)&svr_tbl->svr_ip) == 0) {
             svr_tbl->status = SVR_DROP;
         } 
     }
+
+    if (svr_tbl->status == SVR_INIT) {
+        /* MAC解決の要求先 */
+        (void)nh_init(&svr_tbl->nh, (struct sockaddr*)&svr_tbl->svr_ip,
+            (struct sockaddr*)&svr_tbl->gw_ip, svr_tbl->dst_mac,
+            &svr_tbl->status, if_egress, 0);
+        svr_tbl->nh.notify = xdp_fwd_svr_update;
+    }
     return svr_tbl; 
 }
 
+/*
+    @brief MACアドレス未解決のサーバを解決する
+    振り分けテーブルの切り替え前に行ない、振り分けスレッドでの解決を減らす
+*/
+void
+resolve_svr_tbl(server_manage_t *mng)
+{
+    server_tbl_t *svr_tbl;
+
+    SLIST_FOREACH(svr_tbl, &mng->head4, list) {
+        if (svr_tbl->status == SVR_INIT) {
+            resolve_target_mac(svr_tbl);
+        }
+    }
+    SLIST_FOREACH(svr_tbl, &mng->head6, list) {
+        if (svr_tbl->status == SVR_INIT) {
+            resolve_target_mac(svr_tbl);
+        }
+    }
+}
+
 /*
     サーバテーブルは振り分けテーブルから参照されているので
     参照が無くなってから削除する
+    (resolverスレッドの参照は resolver_sync で無くしておく)
 */
 void
-destroy_svr_tbl(void)
+destroy_svr_tbl(server_manage_t *mng)
 {
     server_tbl_t *svr_tbl, *svr_tbl_next;
 
-    for (svr_tbl = SLIST_FIRST(&svr_mng_tbl.head4);
+    for (svr_tbl = SLIST_FIRST(&mng->head4);
          svr_tbl;
          svr_tbl = svr_tbl_next) {
         svr_tbl_next = SLIST_NEXT(svr_tbl, list);
-        SLIST_REMOVE_HEAD(&svr_mng_tbl.head4, list);
+        SLIST_REMOVE_HEAD(&mng->head4, list);
 
+        nh_free(&svr_tbl->nh);
         free(svr_tbl);
     }
 
-    for (svr_tbl = SLIST_FIRST(&svr_mng_tbl.head6);
+    for (svr_tbl = SLIST_FIRST(&mng->head6);
          svr_tbl;
          svr_tbl = svr_tbl_next) {
         svr_tbl_next = SLIST_NEXT(svr_tbl, list);
-        SLIST_REMOVE_HEAD(&svr_mng_tbl.head6, list);
+        SLIST_REMOVE_HEAD(&mng->head6, list);
 
+        nh_free(&svr_tbl->nh);
         free(svr_tbl);
     }
 }
 
 void
-init_svr_mng_table(void)
+init_svr_mng_table(server_manage_t *mng)
 {
-    memset(&svr_mng_tbl, 0, sizeof(svr_mng_tbl));
+    memset(mng, 0, sizeof(*mng));
 
-    SLIST_INIT(&svr_mng_tbl.head4);
-    SLIST_INIT(&svr_mng_tbl.head6);
+    SLIST_INIT(&mng->head4);
+    SLIST_INIT(&mng->head6);
 }
 
 /* end */
@@ -14,6 +14,7 @@
 #include "server.h"
 #include "log.h"
 #include "anycast.h"
+#include "vlan.h"
 
 #ifndef VAL_SUBS
 #define SLOCAL  extern
@@ -24,13 +25,12 @@
 /* global valiables */
 SLOCAL struct ifdata *if_ingress;
 SLOCAL struct ifdata *if_egress;
+SLOCAL struct vlan_info *vlan_in;   /* クライアント側のVLAN(VLAN_INFO()で参照) */
 SLOCAL int vip_mode;
 SLOCAL const uint8_t zerodata[16];  /* all 0 ip */
-SLOCAL volatile int patrol_flag;
 
 SLOCAL struct lb_pol_info lb_policy_info;
 SLOCAL struct net_thread_info nt_info;
-SLOCAL server_manage_t svr_mng_tbl;
 
 SLOCAL struct log_ctl mlog_ctl;
 SLOCAL struct mlogdata mlog_data[MAX_MLOG];
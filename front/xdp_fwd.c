@@ -0,0 +1,893 @@
+/**
+ * file    xdp_fwd.c
+ * brief   XDPによる振り分け(書き換えてXDP_TXで送信する)
+ * note    COPYRIGHT FUJITSU LIMITED 2010
+ *
+ * 改版履歴(出荷後記入)
+ * 版数   日付    変更者    リリースノート
+ * ---- -------- --------- --------------------------------------------------
+ */
+
+/*
+    io_mode=2の場合、proc_v4()/proc_v6()と同じ書き換え(VIPの確認、送信元
+    による振り分け、宛先IP/MACの書き換え、チェックサム補正)をXDPで行ない、
+    受信したインターフェースへXDP_TXで送り返す(送信インターフェースが
+    異なる場合はXDP_REDIRECT)。
+    振り分けテーブルに無い、MAC未解決、ARP/ND等のフレームはXDP_PASSで
+    従来のAF_PACKETソケットの処理へ渡す。
+
+    振り分けテーブルは先に書かれたものが優先されるが、LPM_TRIEは最長一致
+    のため、各プレフィックスにはそれを含む最初の振り分けのサーバを登録する
+    (プレフィックス同士は包含か排他のどちらかのため、最長一致の結果が
+    先勝ちの結果と一致する)。マスクが連続していない振り分けがある場合、
+    そのアドレスファミリはXDPで処理しない。
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <linux/if_ether.h>
+#include <linux/if_link.h>
+
+#include "option.h"
+#include "policy.h"
+#include "val.h"
+#include "util_inline.h"
+#include "stat.h"
+#include "log.h"
+#include "prop_common.h"
+#include "checksum.h"
+#include "bpf_insn.h"
+#include "xsk.h"
+#include "xdp_fwd.h"
+
+#define XDP_INSN_MAX    192
+
+/* ジャンプ先 */
+enum {
+    XL_NONE = 0,
+    XL_V4,
+    XL_V6,
+    XL_TX,
+    XL_HIT,
+    XL_TX_END,
+    XL_PASS,
+    XL_NUM
+};
+
+struct xdp_prog {
+    struct bpf_insn insn[XDP_INSN_MAX];
+    uint8_t jmp[XDP_INSN_MAX];      /* ジャンプ先ラベル */
+    int label[XL_NUM];
+    int num;
+};
+
+/* 作成用のプレフィックス */
+struct xdp_pfx {
+    uint32_t len;
+    uint8_t addr[16];
+    uint32_t order;             /* 最初に書かれた振り分けの位置 */
+    uint32_t svr;               /* サーバ番号 */
+};
+
+struct xdp_pfx_tbl {
+    struct xdp_pfx *pfx;        /* 出現順 */
+    uint32_t *hash;             /* pfxの番号+1(0は空き) */
+    uint32_t num;
+    uint32_t mask;
+    int alen;
+};
+
+static int xdp_link_fd = -1;
+static int xdp_stat_fd = -1;
+static int xdp_ifindex;
+static int xdp_egress_ifindex;    /* 受信と異なる場合XDP_REDIRECT */
+
+static int xdp_svr_write(server_tbl_t *);
+static void xdp_pfx_add(struct xdp_pfx_tbl *, const uint8_t *, uint32_t,
+    uint32_t, uint32_t);
+static int xdp_pol_fill(int, struct xdp_pfx_tbl *);
+static int xdp_load_prog(struct xdp_fwd *);
+
+/*
+    @brief 振り分けテーブル一式からXDPプログラムとmapを作成
+    (切り替え前のコマンドスレッドから呼ぶ)
+    @return XDP振り分け(io_mode=2でない、作成できない場合はNULL)
+*/
+struct xdp_fwd *
+xdp_fwd_build(struct lb_pol_set *set)
+{
+    struct xdp_fwd *xf;
+    struct xdp_pfx_tbl t4, t6;
+    server_tbl_t *svr;
+    lb_pol_v4_t *p4;
+    lb_pol_v6_t *p6;
+    uint32_t idx, n4, n6, m;
+    uint8_t addr[16];
+    int i, len;
+    char buf[32];
+
+    if (anycast_get_properties_int(KEY_IO_MODE) != IO_MODE_XDP_FWD) {
+        return NULL;
+    }
+    if ((xdp_ifindex = if_nametoindex(if_ingress->ifname)) == 0) {
+        mlog("xdp(%s) interface not found", if_ingress->ifname);
+        return NULL;
+    }
+    xdp_egress_ifindex = 0;
+    if (strcmp(if_ingress->ifname, if_egress->ifname) != 0) {
+        xdp_egress_ifindex = if_nametoindex(if_egress->ifname);
+    }
+    if (xdp_stat_fd < 0) {
+        xdp_stat_fd = bpf_map_create(BPF_MAP_TYPE_PERCPU_ARRAY,
+            sizeof(uint32_t), sizeof(uint64_t), XDP_STAT_NUM, 0);
+        if (xdp_stat_fd < 0) {
+            mlog("xdp stat map error (%s)",
+                strerror_r(errno, buf, sizeof(buf)));
+            return NULL;
+        }
+    }
+    if ((xf = malloc(sizeof(*xf))) == NULL) {
+        return NULL;
+    }
+    xf->pol4_fd = xf->pol6_fd = xf->svr_fd = xf->hit_fd = xf->prog_fd = -1;
+
+    memset(&t4, 0, sizeof(t4));
+    memset(&t6, 0, sizeof(t6));
+
+    /* サーバmap(番号は振り分けテーブル一式の中で振る) */
+    xf->svr_fd = bpf_map_create(BPF_MAP_TYPE_HASH, sizeof(uint32_t),
+        sizeof(struct xdp_svr_val),
+        (set->svr.server_num > 0) ? set->svr.server_num : 1, 0);
+    if (xf->svr_fd < 0) {
+        goto xdp_err;
+    }
+    idx = 0;
+    SLIST_FOREACH(svr, &set->svr.head4, list) {
+        svr->xdp_idx = idx++;
+        __atomic_store_n(&svr->xdp_fd, xf->svr_fd, __ATOMIC_RELEASE);
+        if (xdp_svr_write(svr) < 0) {
+            goto xdp_err;
+        }
+    }
+    SLIST_FOREACH(svr, &set->svr.head6, list) {
+        svr->xdp_idx = idx++;
+        __atomic_store_n(&svr->xdp_fd, xf->svr_fd, __ATOMIC_RELEASE);
+        if (xdp_svr_write(svr) < 0) {
+            goto xdp_err;
+        }
+    }
+
+    /* 振り分けテーブルをプレフィックスへ変換 */
+    n4 = n6 = 0;
+    TAILQ_FOREACH(p4, &set->lb_pol_head4, lb_list) {
+        n4++;
+    }
+    TAILQ_FOREACH(p6, &set->lb_pol_head6, lb_list) {
+        n6++;
+    }
+    t4.alen = 4;
+    t6.alen = 16;
+    for (m = 1; m < (n4 * 2); m <<= 1)
+        ;
+    t4.mask = m - 1;
+    for (m = 1; m < (n6 * 2); m <<= 1)
+        ;
+    t6.mask = m - 1;
+    t4.pfx = calloc(n4 + 1, sizeof(struct xdp_pfx));
+    t4.hash = calloc(t4.mask + 1, sizeof(uint32_t));
+    t6.pfx = calloc(n6 + 1, sizeof(struct xdp_pfx));
+    t6.hash = calloc(t6.mask + 1, sizeof(uint32_t));
+    if (!t4.pfx || !t4.hash || !t6.pfx || !t6.hash) {
+        goto xdp_err;
+    }
+
+    /* 振り分け毎のヒット数(ダンプ時にpol_cache_collect()で加える) */
+    xf->hit_num = n4 + n6;
+    xf->hit_fd = bpf_map_create(BPF_MAP_TYPE_PERCPU_ARRAY, sizeof(uint32_t),
+        sizeof(uint64_t), (xf->hit_num > 0) ? xf->hit_num : 1, 0);
+    if (xf->hit_fd < 0) {
+        goto xdp_err;
+    }
+
+    idx = 0;
+    TAILQ_FOREACH(p4, &set->lb_pol_head4, lb_list) {
+        m = ntohl(p4->mask_v4.s_addr);
+        if ((~m & (~m + 1)) != 0) {
+            /* マスクが連続していない */
+            mlog("xdp v4 disabled, mask not contiguous (%s)", p4->line);
+            t4.alen = 0;
+            break;
+        }
+        memcpy(addr, &p4->addr_v4, 4);
+        if (p4->svr != NULL) {
+            xdp_pfx_add(&t4, addr, __builtin_popcount(m), idx,
+                p4->svr->xdp_idx);
+        }
+        idx++;
+    }
+
+    idx = n4;
+    TAILQ_FOREACH(p6, &set->lb_pol_head6, lb_list) {
+        for (len = 0; len < 128; len++) {
+            if (!(p6->mask_v6.s6_addr[len / 8] & (0x80 >> (len % 8)))) {
+                break;
+            }
+        }
+        for (i = len; i < 128; i++) {
+            if (p6->mask_v6.s6_addr[i / 8] & (0x80 >> (i % 8))) {
+                break;
+            }
+        }
+        if (i < 128) {
+            mlog("xdp v6 disabled, mask not contiguous (%s)", p6->line);
+            t6.alen = 0;
+            break;
+        }
+        if (p6->svr != NULL) {
+            xdp_pfx_add(&t6, p6->addr_v6.s6_addr, len, idx,
+                p6->svr->xdp_idx);
+        }
+        idx++;
+    }
+
+    if (t4.alen && if_ingress->v4_enable &&
+            ((xf->pol4_fd = xdp_pol_fill(sizeof(struct xdp_pol_key4),
+                &t4)) < 0)) {
+        goto xdp_err;
+    }
+    if (t6.alen && if_ingress->v6_enable &&
+            ((xf->pol6_fd = xdp_pol_fill(sizeof(struct xdp_pol_key6),
+                &t6)) < 0)) {
+        goto xdp_err;
+    }
+
+    if (xdp_load_prog(xf) < 0) {
+        goto xdp_err;
+    }
+
+    mlog("xdp(%s) built: policy v4 %u/%u v6 %u/%u server %u",
+        if_ingress->ifname, (xf->pol4_fd >= 0) ? t4.num : 0, n4,
+        (xf->pol6_fd >= 0) ? t6.num : 0, n6, set->svr.server_num);
+
+    free(t4.pfx);
+    free(t4.hash);
+    free(t6.pfx);
+    free(t6.hash);
+    return xf;
+
+xdp_err:
+    mlog("xdp(%s) build error (%s)", if_ingress->ifname,
+        strerror_r(errno, buf, sizeof(buf)));
+    free(t4.pfx);
+    free(t4.hash);
+    free(t6.pfx);
+    free(t6.hash);
+    /* 通知からの書き込みを止めてから閉じる */
+    SLIST_FOREACH(svr, &set->svr.head4, list) {
+        __atomic_store_n(&svr->xdp_fd, 0, __ATOMIC_RELEASE);
+    }
+    SLIST_FOREACH(svr, &set->svr.head6, list) {
+        __atomic_store_n(&svr->xdp_fd, 0, __ATOMIC_RELEASE);
+    }
+    resolver_sync(1000);
+    set->xdp = xf;
+    xdp_fwd_free(set);
+    return NULL;
+}
+
+/*
+    @brief 振り分けテーブル一式のXDPプログラムを接続する
+    接続済みの場合はプログラムを入れ替える。作成できなかった場合は
+    切り離し、全てユーザ空間で処理する
+*/
+void
+xdp_fwd_attach(struct lb_pol_set *set)
+{
+    char buf[32];
+
+    if (set->xdp == NULL) {
+        if (xdp_link_fd >= 0) {
+            close(xdp_link_fd);
+            xdp_link_fd = -1;
+            mlog("xdp(%s) detached", if_ingress->ifname);
+        }
+        return;
+    }
+
+    if (xdp_link_fd >= 0) {
+        if (bpf_link_update(xdp_link_fd, set->xdp->prog_fd) < 0) {
+            mlog("xdp(%s) update error (%s), detached", if_ingress->ifname,
+                strerror_r(errno, buf, sizeof(buf)));
+            close(xdp_link_fd);
+            xdp_link_fd = -1;
+        }
+        return;
+    }
+
+    /* ドライバが対応していない場合はgeneric(skb)モード */
+    xdp_link_fd = bpf_xdp_link(set->xdp->prog_fd, xdp_ifindex,
+        XDP_FLAGS_DRV_MODE);
+    if (xdp_link_fd >= 0) {
+        mlog("xdp(%s) attached drv mode", if_ingress->ifname);
+        return;
+    }
+    xdp_link_fd = bpf_xdp_link(set->xdp->prog_fd, xdp_ifindex,
+        XDP_FLAGS_SKB_MODE);
+    if (xdp_link_fd >= 0) {
+        mlog("xdp(%s) attached skb mode", if_ingress->ifname);
+        return;
+    }
+    mlog("xdp(%s) attach error (%s)", if_ingress->ifname,
+        strerror_r(errno, buf, sizeof(buf)));
+}
+
+/*
+    @brief XDPプログラムとmapを解放
+    (サーバテーブルの解放後に呼ぶ、接続中のプログラムは参照を持っている)
+*/
+void
+xdp_fwd_free(struct lb_pol_set *set)
+{
+    struct xdp_fwd *xf = set->xdp;
+
+    if (xf == NULL) {
+        return;
+    }
+    if (xf->prog_fd >= 0) {
+        close(xf->prog_fd);
+    }
+    if (xf->pol4_fd >= 0) {
+        close(xf->pol4_fd);
+    }
+    if (xf->pol6_fd >= 0) {
+        close(xf->pol6_fd);
+    }
+    if (xf->svr_fd >= 0) {
+        close(xf->svr_fd);
+    }
+    if (xf->hit_fd >= 0) {
+        close(xf->hit_fd);
+    }
+    free(xf);
+    set->xdp = NULL;
+}
+
+/*
+    @brief サーバのMAC解決、変更をサーバmapへ反映する
+    (nh_entryの通知としてresolverスレッド等から呼ばれる)
+*/
+void
+xdp_fwd_svr_update(struct nh_entry *nh)
+{
+    server_tbl_t *svr = (server_tbl_t *)((char *)nh -
+        offsetof(server_tbl_t, nh));
+
+    if (__atomic_load_n(&svr->xdp_fd, __ATOMIC_ACQUIRE) > 0) {
+        (void)xdp_svr_write(svr);
+    }
+}
+
+/*
+    @brief CPU毎のmapの値の数(possibleのCPU数)
+*/
+static int
+xdp_possible_cpus(void)
+{
+    FILE *fp;
+    char buf[128], *p;
+    int n = 0;
+
+    if ((fp = fopen("/sys/devices/system/cpu/possible", "r")) != NULL) {
+        if (fgets(buf, sizeof(buf), fp) != NULL) {
+            /* "0-N" または "0" の最後の番号 + 1 */
+            for (p = buf + strlen(buf); p > buf; p--) {
+                if ((p[-1] == '-') || (p[-1] == ',')) {
+                    break;
+                }
+            }
+            n = atoi(p) + 1;
+        }
+        fclose(fp);
+    }
+    if (n <= 0) {
+        n = sysconf(_SC_NPROCESSORS_CONF);
+    }
+    return n;
+}
+
+/*
+    @brief XDPで送信したパケット数を統計へ反映する(書き出し前に呼ぶ)
+*/
+void
+xdp_fwd_stat(void)
+{
+    static const int member[XDP_STAT_NUM] = { tx_xdp_v4, tx_xdp_v6 };
+    uint64_t *val, sum;
+    uint32_t key;
+    int i, cpu;
+
+    if (xdp_stat_fd < 0) {
+        return;
+    }
+    cpu = xdp_possible_cpus();
+    if ((val = calloc(cpu, sizeof(uint64_t))) == NULL) {
+        return;
+    }
+    for (key = 0; key < XDP_STAT_NUM; key++) {
+        if (bpf_map_lookup(xdp_stat_fd, &key, val) < 0) {
+            continue;
+        }
+        for (i = 0, sum = 0; i < cpu; i++) {
+            sum += val[i];
+        }
+        /* 統計の最後の領域はコマンドスレッドのみが更新する */
+        sstat_blk[STAT_BLOCK_NUM - 1].stat[member[key]] = sum;
+    }
+    free(val);
+}
+
+/*
+    @brief XDPで送信したパケット数を振り分け毎に集計する
+    (コマンドスレッドから呼ぶ)
+    @param num 振り分け数の格納先
+    @return 振り分けの位置毎のパケット数(呼び出し元で解放する、
+    XDPで処理していない場合はNULL)
+*/
+uint32_t *
+xdp_fwd_hit(struct lb_pol_set *set, uint32_t *num)
+{
+    struct xdp_fwd *xf = set->xdp;
+    uint64_t *val;
+    uint32_t *hit, key;
+    int i, cpu;
+
+    if ((xf == NULL) || (xf->hit_num == 0)) {
+        return NULL;
+    }
+    cpu = xdp_possible_cpus();
+    if ((val = calloc(cpu, sizeof(uint64_t))) == NULL) {
+        return NULL;
+    }
+    if ((hit = calloc(xf->hit_num, sizeof(uint32_t))) == NULL) {
+        free(val);
+        return NULL;
+    }
+    for (key = 0; key < xf->hit_num; key++) {
+        if (bpf_map_lookup(xf->hit_fd, &key, val) < 0) {
+            continue;
+        }
+        for (i = 0; i < cpu; i++) {
+            hit[key] += (uint32_t)val[i];
+        }
+    }
+    free(val);
+    *num = xf->hit_num;
+    return hit;
+}
+
+/*
+    @brief サーバmapへ書き込む
+    解決後の書き込みと作成時の書き込みが前後しないよう、書き込み後に
+    状態が変わっていれば書き直す
+*/
+static int
+xdp_svr_write(server_tbl_t *svr)
+{
+    struct xdp_svr_val v;
+    uint8_t status;
+    int ret;
+
+    do {
+        status = __atomic_load_n(&svr->status, __ATOMIC_ACQUIRE);
+
+        memset(&v, 0, sizeof(v));
+        if (svr->family == AF_INET) {
+            struct sockaddr_in *sa = (struct sockaddr_in *)&svr->svr_ip;
+            memcpy(v.ip, &sa->sin_addr, sizeof(struct in_addr));
+            v.csum = htons(calc_chksum_delta(&if_ingress->vip4,
+                &sa->sin_addr));
+        } else {
+            struct sockaddr_in6 *sa = (struct sockaddr_in6 *)&svr->svr_ip;
+            memcpy(v.ip, &sa->sin6_addr, sizeof(struct in6_addr));
+        }
+        load_mac(v.mac, svr->dst_mac);
+        v.ready = (status == SVR_OK);
+
+        ret = bpf_map_update(svr->xdp_fd, &svr->xdp_idx, &v, BPF_ANY);
+    } while ((ret == 0) &&
+             (status != __atomic_load_n(&svr->status, __ATOMIC_ACQUIRE)));
+
+    return ret;
+}
+
+/*
+    @brief プレフィックスのハッシュ
+*/
+static inline uint32_t
+xdp_pfx_hash(const uint8_t *addr, uint32_t len)
+{
+    uint32_t a[4];
+
+    memset(a, 0, sizeof(a));
+    memcpy(a, addr, (len + 7) / 8);
+    return flow_hash6(a) ^ flow_hash4(len);
+}
+
+/*
+    @brief プレフィックス長でマスクする
+*/
+static inline void
+xdp_pfx_mask(uint8_t *dst, const uint8_t *src, uint32_t len, int alen)
+{
+    int i;
+
+    for (i = 0; i < alen; i++) {
+        if (len >= 8) {
+            dst[i] = src[i];
+            len -= 8;
+        } else {
+            dst[i] = src[i] & (uint8_t)(0xff00 >> len);
+            len = 0;
+        }
+    }
+}
+
+/*
+    @brief プレフィックスを検索
+    @return 該当なしはNULL
+*/
+static struct xdp_pfx *
+xdp_pfx_find(struct xdp_pfx_tbl *t, const uint8_t *addr, uint32_t len)
+{
+    struct xdp_pfx *p;
+    uint32_t h = xdp_pfx_hash(addr, len);
+
+    for (;; h++) {
+        if (t->hash[h & t->mask] == 0) {
+            return NULL;
+        }
+        p = &t->pfx[t->hash[h & t->mask] - 1];
+        if ((p->len == len) && (memcmp(p->addr, addr, t->alen) == 0)) {
+            return p;
+        }
+    }
+}
+
+/*
+    @brief プレフィックスを登録(同じプレフィックスは最初のものを残す)
+*/
+static void
+xdp_pfx_add(struct xdp_pfx_tbl *t, const uint8_t *addr, uint32_t len,
+    uint32_t order, uint32_t svr)
+{
+    struct xdp_pfx *p;
+    uint8_t a[16];
+    uint32_t h;
+
+    memset(a, 0, sizeof(a));
+    xdp_pfx_mask(a, addr, len, t->alen);
+    if (xdp_pfx_find(t, a, len) != NULL) {
+        return;
+    }
+
+    p = &t->pfx[t->num++];
+    p->len = len;
+    memcpy(p->addr, a, sizeof(p->addr));
+    p->order = order;
+    p->svr = svr;
+
+    for (h = xdp_pfx_hash(a, len); t->hash[h & t->mask] != 0; h++)
+        ;
+    t->hash[h & t->mask] = t->num;
+}
+
+/*
+    @brief LPM_TRIEを作成し、プレフィックスを登録する
+    各プレフィックスには、それを含むプレフィックスのうち最初に書かれた
+    振り分けのサーバと位置を登録する
+    @return map(エラーの場合-1)
+*/
+static int
+xdp_pol_fill(int key_size, struct xdp_pfx_tbl *t)
+{
+    struct xdp_pol_key6 key;
+    struct xdp_pol_val val;
+    struct xdp_pfx *p, *q;
+    uint8_t a[16];
+    uint32_t i, l, svr, order;
+    int fd;
+
+    fd = bpf_map_create(BPF_MAP_TYPE_LPM_TRIE, key_size, sizeof(val),
+        (t->num > 0) ? t->num : 1, BPF_F_NO_PREALLOC);
+    if (fd < 0) {
+        return -1;
+    }
+
+    for (i = 0; i < t->num; i++) {
+        p = &t->pfx[i];
+        svr = p->svr;
+        order = p->order;
+        for (l = 0; l < p->len; l++) {
+            memset(a, 0, sizeof(a));
+            xdp_pfx_mask(a, p->addr, l, t->alen);
+            if (((q = xdp_pfx_find(t, a, l)) != NULL) && (q->order < order)) {
+                svr = q->svr;
+                order = q->order;
+            }
+        }
+
+        memset(&key, 0, sizeof(key));
+        key.prefixlen = p->len;
+        memcpy(key.addr, p->addr, t->alen);
+        val.svr = svr;
+        val.pol = order;
+        if (bpf_map_update(fd, &key, &val, BPF_ANY) < 0) {
+            close(fd);
+            return -1;
+        }
+    }
+    return fd;
+}
+
+/*
+    @brief 命令の追加
+    @param jmp ジャンプ先のラベル(XL_NONEはジャンプ命令以外)
+*/
+static inline void
+xp_emit(struct xdp_prog *p, struct bpf_insn insn, int jmp)
+{
+    if (p->num < XDP_INSN_MAX) {
+        p->insn[p->num] = insn;
+        p->jmp[p->num] = jmp;
+    }
+    p->num++;
+}
+
+/*
+    @brief map fdのロード(2命令)
+*/
+static inline void
+xp_map(struct xdp_prog *p, int reg, int fd)
+{
+    struct bpf_insn insn[] = { BPF_LD_MAP_FD(reg, fd) };
+
+    xp_emit(p, insn[0], XL_NONE);
+    xp_emit(p, insn[1], XL_NONE);
+}
+
+static inline void
+xp_label(struct xdp_prog *p, int l)
+{
+    p->label[l] = p->num;
+}
+
+/*
+    @brief map参照(r0に値、該当なしはXL_PASSへ)
+    @param key スタック上のキーの位置(r10からのオフセット)
+*/
+static void
+xp_lookup(struct xdp_prog *p, int fd, int key)
+{
+    xp_map(p, BPF_REG_1, fd);
+    xp_emit(p, BPF_MOV64_REG(BPF_REG_2, BPF_REG_10), XL_NONE);
+    xp_emit(p, BPF_ALU64_IMM(BPF_ADD, BPF_REG_2, key), XL_NONE);
+    xp_emit(p, BPF_CALL_FUNC(BPF_FUNC_map_lookup_elem), XL_NONE);
+    xp_emit(p, BPF_JMP_IMM(BPF_JEQ, BPF_REG_0, 0, 0), XL_PASS);
+}
+
+/*
+    @brief XDPプログラム生成、ロード
+    r7:フレーム先頭 r8:フレーム末尾 r9:サーバmapの値
+    VIP、送信元MACは即値としてプログラムに埋め込む
+*/
+static int
+xdp_load_prog(struct xdp_fwd *xf)
+{
+    struct xdp_prog p;
+    uint32_t w;
+    uint16_t h;
+    char log[2048];
+    int i, off;
+
+    memset(&p, 0, sizeof(p));
+
+    xp_emit(&p, BPF_LDX_MEM(BPF_W, BPF_REG_7, BPF_REG_1,
+        offsetof(struct xdp_md, data)), XL_NONE);
+    xp_emit(&p, BPF_LDX_MEM(BPF_W, BPF_REG_8, BPF_REG_1,
+        offsetof(struct xdp_md, data_end)), XL_NONE);
+    xp_emit(&p, BPF_MOV64_REG(BPF_REG_2, BPF_REG_7), XL_NONE);
+    xp_emit(&p, BPF_ALU64_IMM(BPF_ADD, BPF_REG_2, ETH_HLEN), XL_NONE);
+    xp_emit(&p, BPF_JMP_REG(BPF_JGT, BPF_REG_2, BPF_REG_8, 0), XL_PASS);
+    /* multicastはユーザ空間(ARP, NS) */
+    xp_emit(&p, BPF_LDX_MEM(BPF_B, BPF_REG_2, BPF_REG_7, 0), XL_NONE);
+    xp_emit(&p, BPF_JMP_IMM(BPF_JSET, BPF_REG_2, 1, 0), XL_PASS);
+    xp_emit(&p, BPF_LDX_MEM(BPF_H, BPF_REG_2, BPF_REG_7,
+        offsetof(struct ethhdr, h_proto)), XL_NONE);
+    xp_emit(&p, BPF_JMP_IMM(BPF_JEQ, BPF_REG_2, htons(ETH_P_IP), 0), XL_V4);
+    xp_emit(&p, BPF_JMP_IMM(BPF_JEQ, BPF_REG_2, htons(ETH_P_IPV6), 0), XL_V6);
+    xp_emit(&p, BPF_JMP_A(0), XL_PASS);
+
+    /*
+        IPv4: 宛先がVIPなら送信元で振り分け、宛先IPとチェックサムを書き換える
+        キー: r10-8 prefixlen, r10-4 送信元IP / サーバ番号: r10-12
+        振り分けの位置: r10-32
+    */
+    xp_label(&p, XL_V4);
+    if (xf->pol4_fd >= 0) {
+        xp_emit(&p, BPF_MOV64_REG(BPF_REG_2, BPF_REG_7), XL_NONE);
+        xp_emit(&p, BPF_ALU64_IMM(BPF_ADD, BPF_REG_2, ETH_HLEN + 20), XL_NONE);
+        xp_emit(&p, BPF_JMP_REG(BPF_JGT, BPF_REG_2, BPF_REG_8, 0), XL_PASS);
+        xp_emit(&p, BPF_LDX_MEM(BPF_W, BPF_REG_2, BPF_REG_7, ETH_HLEN + 16),
+            XL_NONE);
+        xp_emit(&p, BPF_JMP32_IMM(BPF_JNE, BPF_REG_2,
+            if_ingress->vip4.s_addr, 0), XL_PASS);
+
+        xp_emit(&p, BPF_ST_MEM(BPF_W, BPF_REG_10, -8, 32), XL_NONE);
+        xp_emit(&p, BPF_LDX_MEM(BPF_W, BPF_REG_2, BPF_REG_7, ETH_HLEN + 12),
+            XL_NONE);
+        xp_emit(&p, BPF_STX_MEM(BPF_W, BPF_REG_10, BPF_REG_2, -4), XL_NONE);
+        xp_lookup(&p, xf->pol4_fd, -8);
+        xp_emit(&p, BPF_LDX_MEM(BPF_W, BPF_REG_2, BPF_REG_0,
+            offsetof(struct xdp_pol_val, svr)), XL_NONE);
+        xp_emit(&p, BPF_STX_MEM(BPF_W, BPF_REG_10, BPF_REG_2, -12), XL_NONE);
+        xp_emit(&p, BPF_LDX_MEM(BPF_W, BPF_REG_2, BPF_REG_0,
+            offsetof(struct xdp_pol_val, pol)), XL_NONE);
+        xp_emit(&p, BPF_STX_MEM(BPF_W, BPF_REG_10, BPF_REG_2, -32), XL_NONE);
+        xp_lookup(&p, xf->svr_fd, -12);
+        xp_emit(&p, BPF_MOV64_REG(BPF_REG_9, BPF_REG_0), XL_NONE);
+        xp_emit(&p, BPF_LDX_MEM(BPF_B, BPF_REG_2, BPF_REG_9,
+            offsetof(struct xdp_svr_val, ready)), XL_NONE);
+        xp_emit(&p, BPF_JMP_IMM(BPF_JEQ, BPF_REG_2, 0, 0), XL_PASS);
+
+        xp_emit(&p, BPF_LDX_MEM(BPF_W, BPF_REG_2, BPF_REG_9, 0), XL_NONE);
+        xp_emit(&p, BPF_STX_MEM(BPF_W, BPF_REG_7, BPF_REG_2, ETH_HLEN + 16),
+            XL_NONE);
+        /* チェックサム(16bit補数和、バイトオーダに依存しない) */
+        xp_emit(&p, BPF_LDX_MEM(BPF_H, BPF_REG_2, BPF_REG_7, ETH_HLEN + 10),
+            XL_NONE);
+        xp_emit(&p, BPF_LDX_MEM(BPF_H, BPF_REG_3, BPF_REG_9,
+            offsetof(struct xdp_svr_val, csum)), XL_NONE);
+        xp_emit(&p, BPF_ALU64_REG(BPF_ADD, BPF_REG_2, BPF_REG_3), XL_NONE);
+        xp_emit(&p, BPF_MOV64_REG(BPF_REG_3, BPF_REG_2), XL_NONE);
+        xp_emit(&p, BPF_ALU64_IMM(BPF_RSH, BPF_REG_3, 16), XL_NONE);
+        xp_emit(&p, BPF_ALU64_IMM(BPF_AND, BPF_REG_2, 0xffff), XL_NONE);
+        xp_emit(&p, BPF_ALU64_REG(BPF_ADD, BPF_REG_2, BPF_REG_3), XL_NONE);
+        xp_emit(&p, BPF_STX_MEM(BPF_H, BPF_REG_7, BPF_REG_2, ETH_HLEN + 10),
+            XL_NONE);
+        xp_emit(&p, BPF_ST_MEM(BPF_W, BPF_REG_10, -16, XDP_STAT_TX4), XL_NONE);
+        xp_emit(&p, BPF_JMP_A(0), XL_TX);
+    } else {
+        xp_emit(&p, BPF_JMP_A(0), XL_PASS);
+    }
+
+    /*
+        IPv6: ICMPv6(ND)はユーザ空間で処理する
+        キー: r10-24 prefixlen, r10-20 送信元IP / サーバ番号: r10-28
+        振り分けの位置: r10-32
+    */
+    xp_label(&p, XL_V6);
+    if (xf->pol6_fd >= 0) {
+        xp_emit(&p, BPF_MOV64_REG(BPF_REG_2, BPF_REG_7), XL_NONE);
+        xp_emit(&p, BPF_ALU64_IMM(BPF_ADD, BPF_REG_2, ETH_HLEN + 40), XL_NONE);
+        xp_emit(&p, BPF_JMP_REG(BPF_JGT, BPF_REG_2, BPF_REG_8, 0), XL_PASS);
+        xp_emit(&p, BPF_LDX_MEM(BPF_B, BPF_REG_2, BPF_REG_7, ETH_HLEN + 6),
+            XL_NONE);
+        xp_emit(&p, BPF_JMP_IMM(BPF_JEQ, BPF_REG_2, IPPROTO_ICMPV6, 0),
+            XL_PASS);
+        for (i = 0; i < 4; i++) {
+            xp_emit(&p, BPF_LDX_MEM(BPF_W, BPF_REG_2, BPF_REG_7,
+                ETH_HLEN + 24 + (i * 4)), XL_NONE);
+            xp_emit(&p, BPF_JMP32_IMM(BPF_JNE, BPF_REG_2,
+                if_ingress->vip6.s6_addr32[i], 0), XL_PASS);
+        }
+
+        xp_emit(&p, BPF_ST_MEM(BPF_W, BPF_REG_10, -24, 128), XL_NONE);
+        for (i = 0; i < 4; i++) {
+            xp_emit(&p, BPF_LDX_MEM(BPF_W, BPF_REG_2, BPF_REG_7,
+                ETH_HLEN + 8 + (i * 4)), XL_NONE);
+            xp_emit(&p, BPF_STX_MEM(BPF_W, BPF_REG_10, BPF_REG_2,
+                -20 + (i * 4)), XL_NONE);
+        }
+        xp_lookup(&p, xf->pol6_fd, -24);
+        xp_emit(&p, BPF_LDX_MEM(BPF_W, BPF_REG_2, BPF_REG_0,
+            offsetof(struct xdp_pol_val, svr)), XL_NONE);
+        xp_emit(&p, BPF_STX_MEM(BPF_W, BPF_REG_10, BPF_REG_2, -28), XL_NONE);
+        xp_emit(&p, BPF_LDX_MEM(BPF_W, BPF_REG_2, BPF_REG_0,
+            offsetof(struct xdp_pol_val, pol)), XL_NONE);
+        xp_emit(&p, BPF_STX_MEM(BPF_W, BPF_REG_10, BPF_REG_2, -32), XL_NONE);
+        xp_lookup(&p, xf->svr_fd, -28);
+        xp_emit(&p, BPF_MOV64_REG(BPF_REG_9, BPF_REG_0), XL_NONE);
+        xp_emit(&p, BPF_LDX_MEM(BPF_B, BPF_REG_2, BPF_REG_9,
+            offsetof(struct xdp_svr_val, ready)), XL_NONE);
+        xp_emit(&p, BPF_JMP_IMM(BPF_JEQ, BPF_REG_2, 0, 0), XL_PASS);
+
+        for (i = 0; i < 4; i++) {
+            xp_emit(&p, BPF_LDX_MEM(BPF_W, BPF_REG_2, BPF_REG_9, i * 4),
+                XL_NONE);
+            xp_emit(&p, BPF_STX_MEM(BPF_W, BPF_REG_7, BPF_REG_2,
+                ETH_HLEN + 24 + (i * 4)), XL_NONE);
+        }
+        xp_emit(&p, BPF_ST_MEM(BPF_W, BPF_REG_10, -16, XDP_STAT_TX6), XL_NONE);
+    } else {
+        xp_emit(&p, BPF_JMP_A(0), XL_PASS);
+    }
+
+    /* MACの書き換え、統計、送信 */
+    xp_label(&p, XL_TX);
+    xp_emit(&p, BPF_LDX_MEM(BPF_W, BPF_REG_2, BPF_REG_9,
+        offsetof(struct xdp_svr_val, mac)), XL_NONE);
+    xp_emit(&p, BPF_STX_MEM(BPF_W, BPF_REG_7, BPF_REG_2, 0), XL_NONE);
+    xp_emit(&p, BPF_LDX_MEM(BPF_H, BPF_REG_2, BPF_REG_9,
+        offsetof(struct xdp_svr_val, mac) + 4), XL_NONE);
+    xp_emit(&p, BPF_STX_MEM(BPF_H, BPF_REG_7, BPF_REG_2, 4), XL_NONE);
+    memcpy(&w, if_egress->mac, sizeof(w));
+    memcpy(&h, if_egress->mac + 4, sizeof(h));
+    xp_emit(&p, BPF_MOV32_IMM(BPF_REG_2, w), XL_NONE);
+    xp_emit(&p, BPF_STX_MEM(BPF_W, BPF_REG_7, BPF_REG_2, ETH_ALEN), XL_NONE);
+    xp_emit(&p, BPF_MOV32_IMM(BPF_REG_2, h), XL_NONE);
+    xp_emit(&p, BPF_STX_MEM(BPF_H, BPF_REG_7, BPF_REG_2, ETH_ALEN + 4),
+        XL_NONE);
+
+    xp_map(&p, BPF_REG_1, xdp_stat_fd);
+    xp_emit(&p, BPF_MOV64_REG(BPF_REG_2, BPF_REG_10), XL_NONE);
+    xp_emit(&p, BPF_ALU64_IMM(BPF_ADD, BPF_REG_2, -16), XL_NONE);
+    xp_emit(&p, BPF_CALL_FUNC(BPF_FUNC_map_lookup_elem), XL_NONE);
+    xp_emit(&p, BPF_JMP_IMM(BPF_JEQ, BPF_REG_0, 0, 0), XL_HIT);
+    xp_emit(&p, BPF_LDX_MEM(BPF_DW, BPF_REG_2, BPF_REG_0, 0), XL_NONE);
+    xp_emit(&p, BPF_ALU64_IMM(BPF_ADD, BPF_REG_2, 1), XL_NONE);
+    xp_emit(&p, BPF_STX_MEM(BPF_DW, BPF_REG_0, BPF_REG_2, 0), XL_NONE);
+    /* 振り分け毎のヒット数 */
+    xp_label(&p, XL_HIT);
+    xp_map(&p, BPF_REG_1, xf->hit_fd);
+    xp_emit(&p, BPF_MOV64_REG(BPF_REG_2, BPF_REG_10), XL_NONE);
+    xp_emit(&p, BPF_ALU64_IMM(BPF_ADD, BPF_REG_2, -32), XL_NONE);
+    xp_emit(&p, BPF_CALL_FUNC(BPF_FUNC_map_lookup_elem), XL_NONE);
+    xp_emit(&p, BPF_JMP_IMM(BPF_JEQ, BPF_REG_0, 0, 0), XL_TX_END);
+    xp_emit(&p, BPF_LDX_MEM(BPF_DW, BPF_REG_2, BPF_REG_0, 0), XL_NONE);
+    xp_emit(&p, BPF_ALU64_IMM(BPF_ADD, BPF_REG_2, 1), XL_NONE);
+    xp_emit(&p, BPF_STX_MEM(BPF_DW, BPF_REG_0, BPF_REG_2, 0), XL_NONE);
+    xp_label(&p, XL_TX_END);
+    if (xdp_egress_ifindex > 0) {
+        /* 送信インターフェースが異なる */
+        xp_emit(&p, BPF_MOV64_IMM(BPF_REG_1, xdp_egress_ifindex), XL_NONE);
+        xp_emit(&p, BPF_MOV64_IMM(BPF_REG_2, 0), XL_NONE);
+        xp_emit(&p, BPF_CALL_FUNC(BPF_FUNC_redirect), XL_NONE);
+    } else {
+        xp_emit(&p, BPF_MOV64_IMM(BPF_REG_0, XDP_TX), XL_NONE);
+    }
+    xp_emit(&p, BPF_EXIT_INSN(), XL_NONE);
+
+    xp_label(&p, XL_PASS);
+    xp_emit(&p, BPF_MOV64_IMM(BPF_REG_0, XDP_PASS), XL_NONE);
+    xp_emit(&p, BPF_EXIT_INSN(), XL_NONE);
+
+    if (p.num > XDP_INSN_MAX) {
+        mlog("xdp prog too large %d", p.num);
+        return -1;
+    }
+    /* ラベルをオフセットへ */
+    for (i = 0; i < p.num; i++) {
+        if (p.jmp[i] != XL_NONE) {
+            off = p.label[p.jmp[i]] - i - 1;
+            p.insn[i].off = off;
+        }
+    }
+
+    xf->prog_fd = bpf_prog_load(BPF_PROG_TYPE_XDP, p.insn, p.num, NULL, 0);
+    if (xf->prog_fd < 0) {
+        /* verifierのログを取得するため再ロード */
+        bpf_prog_load(BPF_PROG_TYPE_XDP, p.insn, p.num, log, sizeof(log));
+        mlog("xdp(%s) prog load error %s", if_ingress->ifname, log);
+        return -1;
+    }
+    return 0;
+}
+
+/* end */
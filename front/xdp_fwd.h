@@ -0,0 +1,75 @@
+/**
+ * file    xdp_fwd.h
+ * brief   XDPによる振り分け(書き換えてXDP_TXで送信する)
+ * note    COPYRIGHT FUJITSU LIMITED 2010
+ *
+ * 改版履歴(出荷後記入)
+ * 版数   日付    変更者    リリースノート
+ * ---- -------- --------- --------------------------------------------------
+ */
+#ifndef __XDP_FWD_H__
+#define __XDP_FWD_H__
+
+#include <stdint.h>
+
+#include "policy.h"
+#include "resolver.h"
+
+/*
+    XDPプログラムが参照するmap
+    振り分けテーブル(送信元プレフィックス -> サーバ番号、振り分けの位置)、
+    サーバmap(サーバ番号 -> 変換IP、宛先MAC)、ヒット数map(CPU毎、振り分けの
+    位置 -> パケット数)を振り分けテーブル一式毎に作る
+    振り分けの位置はv4が0から、v6はv4の振り分け数から数える
+*/
+struct xdp_pol_key4 {
+    uint32_t prefixlen;
+    uint8_t addr[4];
+};
+
+struct xdp_pol_key6 {
+    uint32_t prefixlen;
+    uint8_t addr[16];
+};
+
+struct xdp_pol_val {
+    uint32_t svr;               /* サーバ番号 */
+    uint32_t pol;               /* 振り分けの位置 */
+};
+
+struct xdp_svr_val {
+    uint8_t ip[16];             /* 変換IP(v4は先頭4byte) */
+    uint8_t mac[ETH_ALEN];      /* 宛先MAC */
+    uint8_t ready;              /* 1:MAC解決済み(0の場合はユーザ空間で処理) */
+    uint8_t _rsv;
+    uint16_t csum;              /* IPチェックサム差分(ネットワークバイトオーダ) */
+    uint16_t _rsv2;
+};
+
+/* 統計map(CPU毎)の番号 */
+enum {
+    XDP_STAT_TX4 = 0,
+    XDP_STAT_TX6,
+    XDP_STAT_NUM
+};
+
+/*
+    @brief 振り分けテーブル一式毎のXDPプログラムとmap
+*/
+struct xdp_fwd {
+    int pol4_fd;                /* LPM_TRIE(無効の場合-1) */
+    int pol6_fd;
+    int svr_fd;                 /* HASH */
+    int hit_fd;                 /* PERCPU_ARRAY */
+    uint32_t hit_num;           /* 振り分け数(v4 + v6) */
+    int prog_fd;
+};
+
+struct xdp_fwd *xdp_fwd_build(struct lb_pol_set *);
+void xdp_fwd_attach(struct lb_pol_set *);
+void xdp_fwd_free(struct lb_pol_set *);
+void xdp_fwd_svr_update(struct nh_entry *);
+void xdp_fwd_stat(void);
+uint32_t *xdp_fwd_hit(struct lb_pol_set *, uint32_t *);
+
+#endif
@@ -0,0 +1,35 @@
+/**
+ * file    xsk.c
+ * brief   AF_XDPソケット(XSK)による送受信
+ * note    COPYRIGHT FUJITSU LIMITED 2010
+ *
+ * 改版履歴(出荷後記入)
+ * 版数   日付    変更者    リリースノート
+ * ---- -------- --------- --------------------------------------------------
+ */
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/ip6.h>
+#include <linux/if_ether.h>
+#include <linux/if_link.h>
+
+#include "option.h"
+#include "log.h"
+#include "prop_common.h"
+#include "anycast.h"
+#include "bpf_insn.h"
+#include "xsk.h"
+#include "hugemem.h"
+
+/* 共通処理 */
+#include "xsk_body.c"
+
+/* end */
@@ -0,0 +1,103 @@
+/**
+ * file    vlan_csum.c
+ * brief   VLAN毎のVIP宛てフレームのIPチェックサム書き換えのテスト
+ * note    COPYRIGHT FUJITSU LIMITED 2010
+ *
+ * 改版履歴(出荷後記入)
+ * 版数   日付    変更者    リリースノート
+ * ---- -------- --------- --------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <netinet/ip.h>
+
+#include "checksum.h"
+
+/*
+    @brief IPヘッダのチェックサム(正しい場合は0)
+*/
+static uint16_t
+ip_sum(const struct ip *ip)
+{
+    uint16_t w[sizeof(*ip) / 2];
+    uint32_t sum = 0;
+    int i;
+
+    memcpy(w, ip, sizeof(w));
+    for (i = 0; i < (int)(sizeof(*ip) / 2); i++) {
+        sum += w[i];
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return ~sum & 0xffff;
+}
+
+/*
+    @brief segのVIP宛てのフレームをサーバへ書き換え、チェックサムを確認
+    @return 0:正しい -1:誤り
+*/
+static int
+check(const char *name, struct ifdata *seg, struct in_addr *svr,
+    uint16_t delta)
+{
+    struct ip ip;
+
+    memset(&ip, 0, sizeof(ip));
+    ip.ip_v = 4;
+    ip.ip_hl = 5;
+    ip.ip_len = htons(60);
+    ip.ip_id = htons(0x1234);
+    ip.ip_ttl = 64;
+    ip.ip_p = IPPROTO_TCP;
+    inet_pton(AF_INET, "198.18.7.9", &ip.ip_src);
+    ip.ip_dst = seg->vip4;
+    ip.ip_sum = ip_sum(&ip);
+
+    ip.ip_dst = *svr;
+    ip.ip_sum = htons(rewrite_ip_sum(seg, ntohs(ip.ip_sum), delta));
+
+    if (ip_sum(&ip) != 0) {
+        printf("NG %s: checksum 0x%04x\n", name, ntohs(ip.ip_sum));
+        return -1;
+    }
+    printf("OK %s\n", name);
+    return 0;
+}
+
+int
+main(void)
+{
+    struct ifdata base, seg1, seg2;
+    struct in_addr svr;
+    uint16_t delta;
+    int ng = 0;
+
+    memset(&base, 0, sizeof(base));
+    memset(&seg1, 0, sizeof(seg1));
+    memset(&seg2, 0, sizeof(seg2));
+    inet_pton(AF_INET, "192.0.2.1", &base.vip4);
+    inet_pton(AF_INET, "198.51.100.10", &seg1.vip4);
+    inet_pton(AF_INET, "203.0.113.254", &seg2.vip4);
+    inet_pton(AF_INET, "10.1.2.3", &svr);
+
+    /* 振り分けの差分はタグ無しのVIPから求める */
+    delta = calc_chksum_delta(&base.vip4, &svr);
+    set_vip4_delta(&seg1, &base);
+    set_vip4_delta(&seg2, &base);
+
+    ng |= check("untagged", &base, &svr, delta);
+    ng |= check("vlan seg1", &seg1, &svr, delta);
+    ng |= check("vlan seg2", &seg2, &svr, delta);
+
+    /* VLANのVIPがタグ無しと同じ場合 */
+    seg1.vip4 = base.vip4;
+    set_vip4_delta(&seg1, &base);
+    ng |= check("vlan same vip", &seg1, &svr, delta);
+
+    return ng ? 1 : 0;
+}
+
+/* end */
@@ -0,0 +1,297 @@
+/**
+ * file    xdp_fwd_run.c
+ * brief   XDP振り分けプログラム(front/xdp_fwd.c)のテスト
+ * note    COPYRIGHT FUJITSU LIMITED 2010
+ *
+ * 改版履歴(出荷後記入)
+ * 版数   日付    変更者    リリースノート
+ * ---- -------- --------- --------------------------------------------------
+ */
+
+/*
+    振り分けテーブル一式からプログラムとmapを作成し、BPF_PROG_TEST_RUNで
+    作成したフレームを通して結果(XDP_TX/XDP_PASS)、書き換え後のフレーム、
+    統計とヒット数を確認する
+    (bpf()を使用できない環境では確認せずに終了する)
+*/
+#define VAL_SUBS
+#include <stdarg.h>
+#include <sys/syscall.h>
+
+#include "xdp_fwd.c"
+
+#define FRAME_LEN   (ETH_HLEN + 40 + 8)
+
+static struct ifdata if_in;
+static struct lb_pol_set set;
+static server_tbl_t svr4, svr6;
+static lb_pol_v4_t pol4;
+static lb_pol_v6_t pol6;
+
+static const uint8_t svr_mac[ETH_ALEN] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x09};
+static const uint8_t own_mac[ETH_ALEN] = {0x02, 0x00, 0x00, 0x00, 0x00, 0x01};
+
+/* xdp_fwd.cが参照する関数 */
+const char *
+anycast_get_properties(const char *key)
+{
+    return NULL;
+}
+
+long int
+anycast_get_properties_int(const char *key)
+{
+    return (strcmp(key, KEY_IO_MODE) == 0) ? IO_MODE_XDP_FWD : 0;
+}
+
+int
+resolver_sync(int msec)
+{
+    return 0;
+}
+
+void
+mlog(const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    printf("\n");
+}
+
+/*
+    @brief IPヘッダのチェックサム(正しい場合は0)
+*/
+static uint16_t
+ip_sum(const uint8_t *hdr)
+{
+    uint16_t w[10];
+    uint32_t sum = 0;
+    int i;
+
+    memcpy(w, hdr, sizeof(w));
+    for (i = 0; i < 10; i++) {
+        sum += w[i];
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return ~sum & 0xffff;
+}
+
+/*
+    @brief VIP宛てのIPv4フレームを作成
+*/
+static void
+frame_v4(uint8_t *f, const char *src, const char *dst)
+{
+    uint8_t *ip = f + ETH_HLEN;
+    uint16_t sum;
+
+    memset(f, 0, FRAME_LEN);
+    memcpy(f, own_mac, ETH_ALEN);
+    f[6] = 0x02;
+    f[11] = 0x77;
+    f[12] = 0x08;
+    ip[0] = 0x45;
+    ip[3] = 28;
+    ip[8] = 64;
+    ip[9] = IPPROTO_UDP;
+    inet_pton(AF_INET, src, ip + 12);
+    inet_pton(AF_INET, dst, ip + 16);
+    sum = ip_sum(ip);
+    memcpy(ip + 10, &sum, sizeof(sum));
+}
+
+/*
+    @brief IPv6フレームを作成
+*/
+static void
+frame_v6(uint8_t *f, const char *src, const char *dst)
+{
+    uint8_t *ip = f + ETH_HLEN;
+
+    memset(f, 0, FRAME_LEN);
+    memcpy(f, own_mac, ETH_ALEN);
+    f[6] = 0x02;
+    f[11] = 0x77;
+    f[12] = 0x86;
+    f[13] = 0xdd;
+    ip[0] = 0x60;
+    ip[5] = 8;
+    ip[6] = IPPROTO_UDP;
+    ip[7] = 64;
+    inet_pton(AF_INET6, src, ip + 8);
+    inet_pton(AF_INET6, dst, ip + 24);
+}
+
+/*
+    @brief フレームをプログラムに通す
+    @return XDPの結果(-1:実行できない)
+*/
+static int
+run(int prog_fd, uint8_t *f)
+{
+    union bpf_attr attr;
+    uint8_t out[FRAME_LEN];
+
+    memset(&attr, 0, sizeof(attr));
+    attr.test.prog_fd = prog_fd;
+    attr.test.data_in = (uintptr_t)f;
+    attr.test.data_size_in = FRAME_LEN;
+    attr.test.data_out = (uintptr_t)out;
+    attr.test.data_size_out = sizeof(out);
+    attr.test.repeat = 1;
+    if (syscall(__NR_bpf, BPF_PROG_TEST_RUN, &attr, sizeof(attr)) < 0) {
+        return -1;
+    }
+    memcpy(f, out, FRAME_LEN);
+    return attr.test.retval;
+}
+
+static int ng;
+
+static void
+expect(const char *name, int cond)
+{
+    printf("%s %s\n", cond ? "OK" : "NG", name);
+    if (!cond) {
+        ng = 1;
+    }
+}
+
+/*
+    @brief 統計map(CPU毎)の合計
+*/
+static uint64_t
+stat_sum(uint32_t key)
+{
+    uint64_t *val, sum = 0;
+    int i, cpu = xdp_possible_cpus();
+
+    if ((val = calloc(cpu, sizeof(uint64_t))) == NULL) {
+        return 0;
+    }
+    if (bpf_map_lookup(xdp_stat_fd, &key, val) == 0) {
+        for (i = 0; i < cpu; i++) {
+            sum += val[i];
+        }
+    }
+    free(val);
+    return sum;
+}
+
+/*
+    @brief 振り分けテーブル一式を作成
+    v4: 192.168.0.0/16 -> 10.1.2.3, v6: 2001:db8:1::/48 -> 2001:db8:ff::9
+*/
+static void
+build_set(void)
+{
+    struct sockaddr_in *sa4 = (struct sockaddr_in *)&svr4.svr_ip;
+    struct sockaddr_in6 *sa6 = (struct sockaddr_in6 *)&svr6.svr_ip;
+
+    strcpy(if_in.ifname, "lo");
+    memcpy(if_in.mac, own_mac, ETH_ALEN);
+    if_in.v4_enable = if_in.v6_enable = 1;
+    inet_pton(AF_INET, "192.0.2.1", &if_in.vip4);
+    inet_pton(AF_INET6, "2001:db8::1", &if_in.vip6);
+    if_ingress = if_egress = &if_in;
+
+    TAILQ_INIT(&set.lb_pol_head4);
+    TAILQ_INIT(&set.lb_pol_head6);
+    SLIST_INIT(&set.svr.head4);
+    SLIST_INIT(&set.svr.head6);
+
+    svr4.family = sa4->sin_family = AF_INET;
+    inet_pton(AF_INET, "10.1.2.3", &sa4->sin_addr);
+    svr4.status = SVR_OK;
+    store_mac(svr4.dst_mac, svr_mac);
+    SLIST_INSERT_HEAD(&set.svr.head4, &svr4, list);
+
+    svr6.family = sa6->sin6_family = AF_INET6;
+    inet_pton(AF_INET6, "2001:db8:ff::9", &sa6->sin6_addr);
+    svr6.status = SVR_OK;
+    store_mac(svr6.dst_mac, svr_mac);
+    SLIST_INSERT_HEAD(&set.svr.head6, &svr6, list);
+    set.svr.server_num = 2;
+
+    inet_pton(AF_INET, "192.168.0.0", &pol4.addr_v4);
+    inet_pton(AF_INET, "255.255.0.0", &pol4.mask_v4);
+    pol4.svr = &svr4;
+    TAILQ_INSERT_TAIL(&set.lb_pol_head4, &pol4, lb_list);
+
+    inet_pton(AF_INET6, "2001:db8:1::", &pol6.addr_v6);
+    inet_pton(AF_INET6, "ffff:ffff:ffff::", &pol6.mask_v6);
+    pol6.svr = &svr6;
+    TAILQ_INSERT_TAIL(&set.lb_pol_head6, &pol6, lb_list);
+}
+
+int
+main(void)
+{
+    uint8_t f[FRAME_LEN];
+    struct in_addr a4;
+    struct in6_addr a6;
+    uint32_t *hit, num = 0;
+    int fd, ret;
+
+    /* bpf()を使用できるか */
+    if ((fd = bpf_map_create(BPF_MAP_TYPE_ARRAY, sizeof(uint32_t),
+            sizeof(uint32_t), 1, 0)) < 0) {
+        printf("SKIP xdp_fwd (bpf not available: %s)\n", strerror(errno));
+        return 0;
+    }
+    close(fd);
+
+    build_set();
+    if ((set.xdp = xdp_fwd_build(&set)) == NULL) {
+        printf("NG xdp_fwd_build\n");
+        return 1;
+    }
+
+    /* v4 ヒット: 宛先IP、チェックサム、MACを書き換えて送信 */
+    frame_v4(f, "192.168.1.5", "192.0.2.1");
+    if ((ret = run(set.xdp->prog_fd, f)) < 0) {
+        printf("SKIP xdp_fwd (BPF_PROG_TEST_RUN: %s)\n", strerror(errno));
+        return 0;
+    }
+    inet_pton(AF_INET, "10.1.2.3", &a4);
+    expect("v4 hit: XDP_TX", ret == XDP_TX);
+    expect("v4 hit: dst ip", memcmp(f + ETH_HLEN + 16, &a4, 4) == 0);
+    expect("v4 hit: checksum", ip_sum(f + ETH_HLEN) == 0);
+    expect("v4 hit: dst mac", memcmp(f, svr_mac, ETH_ALEN) == 0);
+    expect("v4 hit: src mac", memcmp(f + ETH_ALEN, own_mac, ETH_ALEN) == 0);
+
+    /* v4 ミス(振り分け対象外)、VIP以外宛てはユーザ空間へ */
+    frame_v4(f, "172.16.0.1", "192.0.2.1");
+    expect("v4 miss: XDP_PASS", run(set.xdp->prog_fd, f) == XDP_PASS);
+    frame_v4(f, "192.168.1.5", "192.0.2.99");
+    expect("v4 non-VIP: XDP_PASS", run(set.xdp->prog_fd, f) == XDP_PASS);
+
+    /* v6 */
+    frame_v6(f, "2001:db8:1::5", "2001:db8::1");
+    inet_pton(AF_INET6, "2001:db8:ff::9", &a6);
+    expect("v6 hit: XDP_TX", run(set.xdp->prog_fd, f) == XDP_TX);
+    expect("v6 hit: dst ip", memcmp(f + ETH_HLEN + 24, &a6, 16) == 0);
+    expect("v6 hit: dst mac", memcmp(f, svr_mac, ETH_ALEN) == 0);
+    frame_v6(f, "2001:db8:2::5", "2001:db8::1");
+    expect("v6 miss: XDP_PASS", run(set.xdp->prog_fd, f) == XDP_PASS);
+    frame_v6(f, "2001:db8:1::5", "2001:db8::2");
+    expect("v6 non-VIP: XDP_PASS", run(set.xdp->prog_fd, f) == XDP_PASS);
+
+    /* 送信したパケットだけを数える */
+    expect("stat tx v4", stat_sum(XDP_STAT_TX4) == 1);
+    expect("stat tx v6", stat_sum(XDP_STAT_TX6) == 1);
+    hit = xdp_fwd_hit(&set, &num);
+    expect("policy hit", (hit != NULL) && (num == 2) &&
+        (hit[0] == 1) && (hit[1] == 1));
+    free(hit);
+
+    xdp_fwd_free(&set);
+    return ng;
+}
+
+/* end */